@@ -29,6 +29,7 @@
 #include <ctype.h>
 #include <fcntl.h>
 #include <sys/mman.h>
+#include <sys/ioctl.h>
 #include <unistd.h>
 #include <err.h>
 
@@ -213,13 +214,24 @@ enum {
 typedef struct {
 	const char *name;
 	const uint32_t base;
+	const uint32_t core_clock;  // highest core clock (Hz) of any board using it
 } chip_version;
 
 const char *cpu_info_file = "/proc/cpuinfo";
 const char *cpu_info_key = "\nHardware";  // note '\n' for start of line match
 const chip_version chips[] = {
-	{"BCM2708", V1_BCM_PERIPHERALS_ADDRESS},
-	{"BCM2709", V2_BCM_PERIPHERALS_ADDRESS}
+	{"BCM2708", V1_BCM_PERIPHERALS_ADDRESS, 250000000},
+	{"BCM2709", V2_BCM_PERIPHERALS_ADDRESS, 400000000}  // Pi 2 250 MHz, Pi 3 400 MHz
+};
+
+// firmware property mailbox, for the core clock
+const char *mailbox_file = "/dev/vcio";
+#define MAILBOX_PROPERTY _IOWR(100, 0, char *)
+enum {
+	MAILBOX_REQUEST       = 0x00000000,
+	MAILBOX_SUCCESS       = 0x80000000,
+	MAILBOX_GET_MAX_CLOCK = 0x00030004,  // clock id -> clock id, Hz
+	MAILBOX_CLOCK_CORE    = 4
 };
 
 #define SIZE_OF_ARRAY(a) (sizeof(a)/ sizeof((a)[0]))
@@ -233,7 +245,9 @@ volatile uint32_t *clock_map;
 
 
 // local function prototypes;
+static const chip_version *get_chip(void);
 static bool get_cpu_io_base_address(uint32_t *base);
+static bool get_firmware_core_clock(uint32_t *hz);
 static bool create_rw_map(volatile uint32_t **map, int fd, uint32_t base_address, uint32_t offset);
 static bool delete_map(volatile uint32_t *address);
 
@@ -390,19 +404,36 @@ void GPIO_pwm_write(GPIO_pin_type pin, uint32_t value) {
 }
 
 
+bool GPIO_peripheral_base(uint32_t *base) {
+	return get_cpu_io_base_address(base);
+}
+
+
+bool GPIO_core_clock(uint32_t *hz) {
+	const chip_version *chip = get_chip();
+	if (NULL == chip) {
+		return false;
+	}
+	if (!get_firmware_core_clock(hz)) {
+		*hz = chip->core_clock;
+	}
+	return true;
+}
+
+
 // private functions
 // =================
 
 // map page size
 #define MAP_SIZE 4096
 
-bool get_cpu_io_base_address(uint32_t *base) {
+static const chip_version *get_chip(void) {
 
 	int info_fd = open(cpu_info_file, O_RDONLY);
 
 	if (info_fd < 0) {
 		warn("cannot open: %s", cpu_info_file);
-		return false;
+		return NULL;
 	}
 
 	char buffer[8192];  // cpuinfo is not very big (on Rpi B2: "cat /proc/cpuinfo | wc -c" -> 1112 bytes)
@@ -412,13 +443,13 @@ bool get_cpu_io_base_address(uint32_t *base) {
 	close(info_fd);
 
 	if (n < 0) {
-		return false;
+		return NULL;
 	}
 
 	// locate the key
 	char *p = strstr(buffer, cpu_info_key);
 	if (NULL == p) {
-		return false;
+		return NULL;
 	}
 
 	p += strlen(cpu_info_key);
@@ -434,13 +465,47 @@ bool get_cpu_io_base_address(uint32_t *base) {
 	for (int i = 0; i < SIZE_OF_ARRAY(chips); ++i) {
 		size_t l = p1 - p;
 		if (strlen(chips[i].name) == l && 0 == strncmp(chips[i].name, p, l)) {
-			*base = chips[i].base;
-			return true;
+			return &chips[i];
 		}
 	}
 
 	// failed
-	return false;
+	return NULL;
+}
+
+
+bool get_cpu_io_base_address(uint32_t *base) {
+	const chip_version *chip = get_chip();
+	if (NULL == chip) {
+		return false;
+	}
+	*base = chip->base;
+	return true;
+}
+
+
+// the core clock can be lowered when idle, so ask for its maximum
+bool get_firmware_core_clock(uint32_t *hz) {
+
+	int fd = open(mailbox_file, O_RDONLY);
+	if (fd < 0) {
+		return false;
+	}
+
+	// size, code, tag, value size, request size, clock id, rate, end tag
+	uint32_t message[8] = {
+		sizeof(message), MAILBOX_REQUEST,
+		MAILBOX_GET_MAX_CLOCK, 8, 4, MAILBOX_CLOCK_CORE, 0,
+		0
+	};
+	int r = ioctl(fd, MAILBOX_PROPERTY, message);
+	close(fd);
+
+	if (r < 0 || MAILBOX_SUCCESS != message[1] || 0 == message[6]) {
+		return false;
+	}
+	*hz = message[6];
+	return true;
 }
 
 // setup a map to a peripheral offset
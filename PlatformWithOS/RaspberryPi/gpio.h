@@ -81,5 +81,14 @@ void GPIO_write(GPIO_pin_type pin, int value);
 // set the PWM ration 0..1023 for hardware PWM pin (GPIO_P1_12)
 void GPIO_pwm_write(GPIO_pin_type pin, uint32_t value);
 
+// physical base address of the BCM peripherals (for spi_bcm.c)
+// return false if the SoC is not recognised
+bool GPIO_peripheral_base(uint32_t *base);
+
+// core clock (Hz) feeding the SPI divider: the firmware's maximum, or
+// the highest any board with this SoC runs at so SPI is never faster
+// than asked; return false if the SoC is not recognised
+bool GPIO_core_clock(uint32_t *hz);
+
 
 #endif
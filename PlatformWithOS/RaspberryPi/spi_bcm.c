@@ -0,0 +1,365 @@
+// Copyright 2013-2015 Pervasive Displays, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at:
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+// express or implied.  See the License for the specific language
+// governing permissions and limitations under the License.
+
+
+// SPI0 driven directly through its registers instead of spidev
+// (BCM2835 ARM Peripherals manual chapter 10), build with: make SPI=bcm
+//
+// each SPI_send is one polled transfer with CS held for its whole
+// length however many FIFO refills that takes, and SPI_on/SPI_off
+// change the clock mode with a register write, so the line loop makes
+// no system calls at all
+//
+// the spi-bcm2835 kernel driver must not be using SPI0 at the same time
+//
+// the SPI clock is the core clock divided down: the core clock is the
+// firmware's maximum for it or, failing that, the highest any board
+// with the SoC runs at, and an unknown SoC is refused
+//
+// $EPD_SPI_BCM_MAP names a file to map instead of /dev/mem; it is
+// taken as the peripheral window starting at the GPIO registers
+// (SPI0 at offset 0x4000) so the code can run against a fake register
+// file with another process playing the controller (see spi_bcm_test);
+// the core clock is then $EPD_SPI_BCM_CLOCK (Hz), default 250 MHz
+
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <err.h>
+#include <sys/mman.h>
+
+#include "gpio.h"
+#include "spi.h"
+#include "epd_stats.h"
+
+
+// core clock (Hz) assumed for a fake register window
+#define SPI_BCM_MAP_CLOCK 250000000
+
+// give up on a transfer that makes no progress for this long (ns)
+#define SPI_BCM_TIMEOUT_NS 100000000
+
+// mapped window: GPIO registers followed by SPI0
+enum {
+	GPIO_REGISTERS = 0x00200000,
+	SPI0_OFFSET    = 0x00004000,  // SPI0 at 0x00204000
+	WINDOW_SIZE    = 0x00005000
+};
+
+// GPIO function select for the SPI0 pins
+// (Manual Chapter 6)
+enum {
+	GPFSEL0      = 0x00,  // pins 0..9
+	GPFSEL1      = 0x01,  // pins 10..19
+	GPFSEL_ALT_0 = 0x04,
+
+	SPI0_CE1  = 7,
+	SPI0_CE0  = 8,
+	SPI0_MISO = 9,
+	SPI0_MOSI = 10,
+	SPI0_SCLK = 11
+};
+
+// SPI0 registers (all 32 bit)
+// (Manual Chapter 10.5)
+enum {                     // byte offset     function
+	SPI_CS   = 0x00,   // 0x00  Control and Status
+	SPI_FIFO = 0x01,   // 0x04  TX and RX FIFOs
+	SPI_CLK  = 0x02,   // 0x08  Clock Divider
+	SPI_DLEN = 0x03,   // 0x0c  Data Length (DMA only)
+	SPI_LTOH = 0x04,   // 0x10  LoSSI mode Control
+	SPI_DC   = 0x05    // 0x14  DMA DREQ Controls
+};
+
+// SPI_CS register bits
+enum {
+	CS_CS       = 0x03,     //  1..0  Chip Select
+	CS_CPHA     = 1 <<  2,  //  2     Clock Phase
+	CS_CPOL     = 1 <<  3,  //  3     Clock Polarity
+	CS_CLEAR_TX = 1 <<  4,  //  4     Clear TX FIFO (one shot)
+	CS_CLEAR_RX = 1 <<  5,  //  5     Clear RX FIFO (one shot)
+	CS_TA       = 1 <<  7,  //  7     Transfer Active (asserts CS)
+	CS_DONE     = 1 << 16,  // 16     Transfer Done
+	CS_RXD      = 1 << 17,  // 17     RX FIFO contains Data
+	CS_TXD      = 1 << 18   // 18     TX FIFO can accept Data
+};
+
+
+// spi information
+struct SPI_struct {
+	volatile uint32_t *window;
+	volatile uint32_t *registers;  // SPI0 inside the window
+	uint32_t control;              // chip select and mode bits for SPI_CS
+	uint32_t core_clock;           // Hz, divided down to bps
+	uint32_t bps;
+	uint64_t bytes;
+};
+
+
+// prototypes
+static void set_alt_0(volatile uint32_t *gpio, int pin);
+static void set_divider(SPI_type *spi);
+static bool transfer(SPI_type *spi, const uint8_t *tx, uint8_t *rx, size_t length);
+static bool timed_out(uint64_t *deadline);
+
+
+// map SPI0, spi_path only selects the chip select: "...0.1" uses CE1
+SPI_type *SPI_create(const char *spi_path, uint32_t bps) {
+
+	// allocate memory
+	SPI_type *spi = malloc(sizeof(SPI_type));
+	if (NULL == spi) {
+		warn("falled to allocate SPI structure");
+		return NULL;
+	}
+
+	const char *map_path = getenv("EPD_SPI_BCM_MAP");
+	off_t map_offset = 0;
+	uint32_t core_clock = SPI_BCM_MAP_CLOCK;
+	if (NULL == map_path || '\0' == *map_path) {
+		uint32_t base = 0;
+		if (!GPIO_peripheral_base(&base) || !GPIO_core_clock(&core_clock)) {
+			free(spi);
+			warnx("unknown SoC: cannot get the SPI base address and core clock");
+			return NULL;
+		}
+		map_path = "/dev/mem";
+		map_offset = base + GPIO_REGISTERS;
+	} else {
+		const char *clock = getenv("EPD_SPI_BCM_CLOCK");
+		if (NULL != clock && '\0' != *clock) {
+			core_clock = strtoul(clock, NULL, 0);
+		}
+	}
+
+	int fd = open(map_path, O_RDWR | O_SYNC | O_CLOEXEC);
+	if (fd < 0) {
+		free(spi);
+		warn("cannot open: %s", map_path);
+		return NULL;
+	}
+	void *m = mmap(0, WINDOW_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, map_offset);
+	close(fd);
+	if (MAP_FAILED == m) {
+		free(spi);
+		warn("failed to mmap SPI0");
+		return NULL;
+	}
+
+	size_t n = strlen(spi_path);
+	int chip_select = (n > 0 && '1' == spi_path[n - 1]) ? 1 : 0;
+
+	spi->window = (volatile uint32_t *)m;
+	spi->registers = spi->window + SPI0_OFFSET / sizeof(uint32_t);
+	spi->control = chip_select;
+	spi->core_clock = core_clock;
+	spi->bps = bps;
+	spi->bytes = 0;
+
+	// route the pins to SPI0 in case spidev never did
+	set_alt_0(spi->window, 0 == chip_select ? SPI0_CE0 : SPI0_CE1);
+	set_alt_0(spi->window, SPI0_MISO);
+	set_alt_0(spi->window, SPI0_MOSI);
+	set_alt_0(spi->window, SPI0_SCLK);
+
+	set_divider(spi);
+	spi->registers[SPI_CS] = spi->control | CS_CLEAR_TX | CS_CLEAR_RX;
+
+	return spi;
+}
+
+
+// release the register map
+bool SPI_destroy(SPI_type *spi) {
+	if (NULL == spi) {
+		return false;
+	}
+	spi->registers[SPI_CS] = spi->control | CS_CLEAR_TX | CS_CLEAR_RX;
+	munmap((void *)spi->window, WINDOW_SIZE);
+	free(spi);
+	return true;
+}
+
+
+// enable SPI, ensures a zero byte was sent (MOSI=0)
+// using SPI MODE 2 and that CS and clock remain high
+void SPI_on(SPI_type *spi) {
+	const uint8_t buffer[1] = {0};
+
+#if EPD_COG_VERSION == 1
+	spi->control = (spi->control & CS_CS) | CS_CPOL;
+#else
+	spi->control = (spi->control & CS_CS);
+#endif
+	SPI_send(spi, buffer, sizeof(buffer));
+}
+
+
+// disable SPI, ensures a zero byte was sent (MOSI=0)
+// using SPI MODE 0 and that CS and clock remain low
+void SPI_off(SPI_type *spi) {
+	const uint8_t buffer[1] = {0};
+
+	spi->control = (spi->control & CS_CS);
+	SPI_send(spi, buffer, sizeof(buffer));
+}
+
+
+// send a data block to SPI
+// CS is asserted for the whole block
+void SPI_send(SPI_type *spi, const void *buffer, size_t length) {
+	if (!transfer(spi, buffer, NULL, length)) {
+		warnx("SPI: send timeout");
+		EPD_STATS_ADD(spi_errors, 1);
+	}
+	spi->bytes += length;
+	EPD_STATS_ADD(spi_bytes, length);
+	EPD_STATS_ADD(spi_transfers, 1);
+}
+
+
+// send a data block to SPI and return last bytes returned by slave
+// CS is asserted for the whole block
+void SPI_read(SPI_type *spi, const void *buffer, void *received, size_t length) {
+	if (!transfer(spi, buffer, received, length)) {
+		warnx("SPI: read timeout");
+		EPD_STATS_ADD(spi_errors, 1);
+	}
+	spi->bytes += length;
+	EPD_STATS_ADD(spi_bytes, length);
+	EPD_STATS_ADD(spi_transfers, 1);
+}
+
+
+// sends cost no system calls here so there is nothing to batch
+void SPI_batch_begin(SPI_type *spi) {
+	(void)spi;
+}
+
+
+void SPI_batch_group(SPI_type *spi) {
+	(void)spi;
+}
+
+
+void SPI_batch_end(SPI_type *spi) {
+	(void)spi;
+}
+
+
+// total bytes transferred since SPI_create
+uint64_t SPI_bytes(const SPI_type *spi) {
+	return spi->bytes;
+}
+
+
+void SPI_set_speed(SPI_type *spi, uint32_t bps) {
+	spi->bps = bps;
+	set_divider(spi);
+}
+
+
+uint32_t SPI_get_speed(const SPI_type *spi) {
+	return spi->bps;
+}
+
+
+// internal functions
+// ==================
+
+static void set_alt_0(volatile uint32_t *gpio, int pin) {
+	uint32_t offset = GPFSEL0 + pin / 10;
+	uint32_t shift = (pin % 10) * 3;
+	gpio[offset] = (gpio[offset] & ~(0x07 << shift)) | (GPFSEL_ALT_0 << shift);
+}
+
+
+// divider must be even, round up so the clock never exceeds bps
+static void set_divider(SPI_type *spi) {
+	uint32_t divider = ((uint64_t)spi->core_clock + spi->bps - 1) / spi->bps;
+	divider = (divider + 1) & ~1;
+	if (divider < 2) {
+		divider = 2;
+	} else if (divider >= 65536) {
+		divider = 0;  // 0 => 65536, the slowest clock
+	}
+	spi->registers[SPI_CLK] = divider;
+}
+
+
+// polled full duplex transfer, rx may be NULL
+// the controller stalls when the RX FIFO is full so nothing is lost
+// while the TX FIFO is kept topped up
+static bool transfer(SPI_type *spi, const uint8_t *tx, uint8_t *rx, size_t length) {
+	volatile uint32_t *r = spi->registers;
+	size_t sent = 0;
+	size_t received = 0;
+	uint64_t deadline = 0;
+	bool ok = true;
+
+	__sync_synchronize();
+	r[SPI_CS] = spi->control | CS_CLEAR_TX | CS_CLEAR_RX | CS_TA;
+
+	while (received < length) {
+		size_t moved = sent + received;
+		while (sent < length && 0 != (r[SPI_CS] & CS_TXD)) {
+			r[SPI_FIFO] = tx[sent++];
+		}
+		while (received < length && 0 != (r[SPI_CS] & CS_RXD)) {
+			uint32_t data = r[SPI_FIFO];
+			if (NULL != rx) {
+				rx[received] = data;
+			}
+			++received;
+		}
+		if (sent + received != moved) {
+			deadline = 0;  // progress, start the timeout again
+		} else if (timed_out(&deadline)) {
+			ok = false;
+			break;
+		}
+	}
+
+	deadline = 0;
+	while (ok && 0 == (r[SPI_CS] & CS_DONE)) {
+		if (timed_out(&deadline)) {
+			ok = false;
+		}
+	}
+
+	// clearing TA releases CS
+	r[SPI_CS] = spi->control;
+	__sync_synchronize();
+	return ok;
+}
+
+
+// first call (deadline 0) starts the clock, true once
+// SPI_BCM_TIMEOUT_NS has passed
+static bool timed_out(uint64_t *deadline) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	uint64_t now = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+	if (0 == *deadline) {
+		*deadline = now + SPI_BCM_TIMEOUT_NS;
+		return false;
+	}
+	return now > *deadline;
+}
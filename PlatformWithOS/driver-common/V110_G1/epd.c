@@ -25,6 +25,8 @@
 #include "gpio.h"
 #include "spi.h"
 #include "epd.h"
+#include "epd_trace.h"
+#include "epd_stats.h"
 
 // delays - more consistent naming
 #define Delay_ms(ms) usleep(1000 * (ms))
@@ -226,10 +228,14 @@ EPD_error EPD_status(EPD_type *epd) {
 // starts an EPD sequence
 void EPD_begin(EPD_type *epd) {
 
+	EPD_TRACE_BEGIN(begin, epd->size);
+	uint64_t begin_us = EPD_stats_now_us();
+
 	// assume OK
 	epd->status = EPD_OK;
 
 	// power up sequence
+	EPD_TRACE_BEGIN(power_on, 0);
 	digitalWrite(epd->EPD_Pin_RESET, LOW);
 	digitalWrite(epd->EPD_Pin_PANEL_ON, LOW);
 	digitalWrite(epd->EPD_Pin_DISCHARGE, LOW);
@@ -252,10 +258,19 @@ void EPD_begin(EPD_type *epd) {
 	digitalWrite(epd->EPD_Pin_RESET, HIGH);
 	Delay_ms(5);
 
+	EPD_TRACE_END(power_on, 0);
+
 	// wait for COG to become ready
+	EPD_TRACE_BEGIN(busy_wait, 0);
+	uint64_t busy_us = EPD_stats_now_us();
+	int polls = 0;
 	while (HIGH == digitalRead(epd->EPD_Pin_BUSY)) {
 		Delay_us(10);
+		++polls;
 	}
+	EPD_STATS_ADD(busy_waits, 1);
+	EPD_STATS_ADD(busy_wait_us, EPD_stats_now_us() - busy_us);
+	EPD_TRACE_END(busy_wait, polls);
 
 	// channel select
 	Delay_us(10);
@@ -310,6 +325,9 @@ void EPD_begin(EPD_type *epd) {
 
 	Delay_ms(5);
 
+	// single charge pump start, G1 has no DC/DC check
+	EPD_TRACE_BEGIN(dc_dc, 0);
+
 	// charge pump positive voltage on
 	Delay_us(10);
 	SPI_send(epd->spi, CU8(0x70, 0x05), 2);
@@ -335,6 +353,7 @@ void EPD_begin(EPD_type *epd) {
 	SPI_send(epd->spi, CU8(0x72, 0x0f), 2);
 
 	Delay_ms(30);
+	EPD_TRACE_END(dc_dc, 0);
 
 	// output enable to disable
 	Delay_us(10);
@@ -343,11 +362,17 @@ void EPD_begin(EPD_type *epd) {
 	SPI_send(epd->spi, CU8(0x72, 0x24), 2);
 
 	SPI_off(epd->spi);
+
+	EPD_stats_latency(EPD_STATS_PHASE_BEGIN, EPD_stats_now_us() - begin_us);
+	EPD_TRACE_END(begin, epd->status);
 }
 
 
 void EPD_end(EPD_type *epd) {
 
+	EPD_TRACE_BEGIN(end, epd->size);
+	uint64_t end_us = EPD_stats_now_us();
+
 	// dummy frame
 	frame_fixed(epd, 0x55, EPD_normal);
 
@@ -439,11 +464,15 @@ void EPD_end(EPD_type *epd) {
 	Delay_us(10);
 
 	power_off(epd);
+	EPD_stats_latency(EPD_STATS_PHASE_END, EPD_stats_now_us() - end_us);
+	EPD_TRACE_END(end, 0);
 }
 
 
 static void power_off(EPD_type *epd) {
 
+	EPD_TRACE_BEGIN(power_off, 0);
+
 	// turn of power and all signals
 	digitalWrite(epd->EPD_Pin_RESET, LOW);
 	digitalWrite(epd->EPD_Pin_PANEL_ON, LOW);
@@ -456,6 +485,8 @@ static void power_off(EPD_type *epd) {
 	digitalWrite(epd->EPD_Pin_DISCHARGE, HIGH);
 	Delay_ms(150);
 	digitalWrite(epd->EPD_Pin_DISCHARGE, LOW);
+
+	EPD_TRACE_END(power_off, 0);
 }
 
 
@@ -558,16 +589,24 @@ static void frame_fixed_repeat(EPD_type *epd, uint8_t fixed_value, EPD_stage sta
 	its.it_interval.tv_sec = 0;
 	its.it_interval.tv_nsec = 0;
 
+	EPD_TRACE_BEGIN(stage, stage);
+	uint64_t start_us = EPD_stats_now_us();
+	int frames = 0;
 	if (-1 == timer_settime(epd->timer, 0, &its, NULL)) {
 		err(1, "timer_settime failed");
 	}
 	do {
+		uint64_t bytes = SPI_bytes(epd->spi);
 		frame_fixed(epd, fixed_value, stage);
+		EPD_TRACE_COUNTER(frame_bytes, SPI_bytes(epd->spi) - bytes);
+		++frames;
 
 		if (-1 == timer_gettime(epd->timer, &its)) {
 			err(1, "timer_gettime failed");
 		}
 	} while (its.it_value.tv_sec > 0 || its.it_value.tv_nsec > 0);
+	EPD_stats_stage(stage, frames, EPD_stats_now_us() - start_us, (uint64_t)epd->factored_stage_time * 1000);
+	EPD_TRACE_END(stage, frames);
 }
 
 
@@ -578,15 +617,23 @@ static void frame_data_repeat(EPD_type *epd, const uint8_t *image, const uint8_t
 	its.it_interval.tv_sec = 0;
 	its.it_interval.tv_nsec = 0;
 
+	EPD_TRACE_BEGIN(stage, stage);
+	uint64_t start_us = EPD_stats_now_us();
+	int frames = 0;
 	if (-1 == timer_settime(epd->timer, 0, &its, NULL)) {
 		err(1, "timer_settime failed");
 	}
 	do {
+		uint64_t bytes = SPI_bytes(epd->spi);
 		frame_data(epd, image, mask, stage);
+		EPD_TRACE_COUNTER(frame_bytes, SPI_bytes(epd->spi) - bytes);
+		++frames;
 		if (-1 == timer_gettime(epd->timer, &its)) {
 			err(1, "timer_gettime failed");
 		}
 	} while (its.it_value.tv_sec > 0 || its.it_value.tv_nsec > 0);
+	EPD_stats_stage(stage, frames, EPD_stats_now_us() - start_us, (uint64_t)epd->factored_stage_time * 1000);
+	EPD_TRACE_END(stage, frames);
 }
 
 
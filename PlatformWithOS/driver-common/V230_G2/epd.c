@@ -26,6 +26,8 @@
 #include "gpio.h"
 #include "spi.h"
 #include "epd.h"
+#include "epd_trace.h"
+#include "epd_stats.h"
 
 // delays - more consistent naming
 #define Delay_ms(ms) usleep(1000 * (ms))
@@ -56,7 +58,7 @@ typedef enum {           // Image pixel -> Display pixel
 
 static void power_off(EPD_type *epd);
 
-static void frame_fixed_timed(EPD_type *epd, uint8_t fixed_value, long stage_time);
+static int frame_fixed_timed(EPD_type *epd, uint8_t fixed_value, long stage_time);
 static void frame_fixed_13(EPD_type *epd, uint8_t value, EPD_stage stage);
 static void frame_data_13(EPD_type *epd, const uint8_t *image, EPD_stage stage);
 static void frame_stage2(EPD_type *epd);
@@ -235,10 +237,14 @@ EPD_error EPD_status(EPD_type *epd) {
 // starts an EPD sequence
 void EPD_begin(EPD_type *epd) {
 
+	EPD_TRACE_BEGIN(begin, epd->size);
+	uint64_t begin_us = EPD_stats_now_us();
+
 	// assume OK
 	epd->status = EPD_OK;
 
 	// power up sequence
+	EPD_TRACE_BEGIN(power_on, 0);
 	digitalWrite(epd->EPD_Pin_RESET, LOW);
 	digitalWrite(epd->EPD_Pin_PANEL_ON, LOW);
 	digitalWrite(epd->EPD_Pin_DISCHARGE, LOW);
@@ -260,20 +266,32 @@ void EPD_begin(EPD_type *epd) {
 	digitalWrite(epd->EPD_Pin_RESET, HIGH);
 	Delay_ms(5);
 
+	EPD_TRACE_END(power_on, 0);
+
 	// wait for COG to become ready
+	EPD_TRACE_BEGIN(busy_wait, 0);
+	uint64_t busy_us = EPD_stats_now_us();
+	int polls = 0;
 	while (HIGH == digitalRead(epd->EPD_Pin_BUSY)) {
 		Delay_us(10);
+		++polls;
 	}
+	EPD_STATS_ADD(busy_waits, 1);
+	EPD_STATS_ADD(busy_wait_us, EPD_stats_now_us() - busy_us);
+	EPD_TRACE_END(busy_wait, polls);
 
 	// read the COG ID
 	uint8_t receive_buffer[2];
 	SPI_read(epd->spi, CU8(0x71, 0x00), receive_buffer, sizeof(receive_buffer));
 	SPI_read(epd->spi, CU8(0x71, 0x00), receive_buffer, sizeof(receive_buffer));
 	int cog_id = receive_buffer[1];
+	EPD_TRACE_INSTANT(cog_id, cog_id);
 	if (0x02 != (0x0f & cog_id)) {
 		printf("cog_id: %x\n", cog_id);
 		epd->status = EPD_UNSUPPORTED_COG;
 		power_off(epd);
+		EPD_stats_latency(EPD_STATS_PHASE_BEGIN, EPD_stats_now_us() - begin_us);
+		EPD_TRACE_END(begin, epd->status);
 		return;
 	}
 
@@ -285,9 +303,12 @@ void EPD_begin(EPD_type *epd) {
 	SPI_send(epd->spi, CU8(0x70, 0x0f), 2);
 	SPI_read(epd->spi, CU8(0x73, 0x00), receive_buffer, sizeof(receive_buffer));
 	int broken_panel = receive_buffer[1];
+	EPD_TRACE_INSTANT(panel_check, broken_panel);
 	if (0x00 == (0x80 & broken_panel)) {
 		epd->status = EPD_PANEL_BROKEN;
 		power_off(epd);
+		EPD_stats_latency(EPD_STATS_PHASE_BEGIN, EPD_stats_now_us() - begin_us);
+		EPD_TRACE_END(begin, epd->status);
 		return;
 	}
 
@@ -328,6 +349,8 @@ void EPD_begin(EPD_type *epd) {
 	bool dc_ok = false;
 
 	for (int i = 0; i < 4; ++i) {
+		EPD_TRACE_BEGIN(dc_dc, i);
+
 		// charge pump positive voltage on - VGH/VDL on
 		SPI_send(epd->spi, CU8(0x70, 0x05), 2);
 		SPI_send(epd->spi, CU8(0x72, 0x01), 2);
@@ -350,6 +373,7 @@ void EPD_begin(EPD_type *epd) {
 		SPI_send(epd->spi, CU8(0x70, 0x0f), 2);
 		SPI_read(epd->spi, CU8(0x73, 0x00), receive_buffer, sizeof(receive_buffer));
 		int dc_state = receive_buffer[1];
+		EPD_TRACE_END(dc_dc, dc_state);
 		if (0x40 == (0x40 & dc_state)) {
 			dc_ok = true;
 			break;
@@ -358,17 +382,25 @@ void EPD_begin(EPD_type *epd) {
 	if (!dc_ok) {
 		epd->status = EPD_DC_FAILED;
 		power_off(epd);
+		EPD_stats_latency(EPD_STATS_PHASE_BEGIN, EPD_stats_now_us() - begin_us);
+		EPD_TRACE_END(begin, epd->status);
 		return;
 	}
 
 	// output enable to disable
 	SPI_send(epd->spi, CU8(0x70, 0x02), 2);
 	SPI_send(epd->spi, CU8(0x72, 0x40), 2);
+
+	EPD_stats_latency(EPD_STATS_PHASE_BEGIN, EPD_stats_now_us() - begin_us);
+	EPD_TRACE_END(begin, epd->status);
 }
 
 
 void EPD_end(EPD_type *epd) {
 
+	EPD_TRACE_BEGIN(end, epd->size);
+	uint64_t end_us = EPD_stats_now_us();
+
 	nothing_frame(epd);
 
 	if (EPD_1_44 == epd->size || EPD_2_0 == epd->size) {
@@ -391,6 +423,8 @@ void EPD_end(EPD_type *epd) {
 	if (0x40 != (0x40 & dc_state)) {
 		epd->status = EPD_DC_FAILED;
 		power_off(epd);
+		EPD_stats_latency(EPD_STATS_PHASE_END, EPD_stats_now_us() - end_us);
+		EPD_TRACE_END(end, epd->status);
 		return;
 	}
 
@@ -431,11 +465,15 @@ void EPD_end(EPD_type *epd) {
 	//SPI_send(epd->spi, CU8(0x72, 0x00), 2);
 
 	power_off(epd);
+	EPD_stats_latency(EPD_STATS_PHASE_END, EPD_stats_now_us() - end_us);
+	EPD_TRACE_END(end, epd->status);
 }
 
 
 static void power_off(EPD_type *epd) {
 
+	EPD_TRACE_BEGIN(power_off, 0);
+
 	// turn of power and all signals
 	digitalWrite(epd->EPD_Pin_RESET, LOW);
 	digitalWrite(epd->EPD_Pin_PANEL_ON, LOW);
@@ -447,6 +485,8 @@ static void power_off(EPD_type *epd) {
 	digitalWrite(epd->EPD_Pin_DISCHARGE, HIGH);
 	Delay_ms(150);
 	digitalWrite(epd->EPD_Pin_DISCHARGE, LOW);
+
+	EPD_TRACE_END(power_off, 0);
 }
 
 
@@ -525,7 +565,10 @@ void EPD_image(EPD_type *epd, const uint8_t *image) {
 // the image is arranged by line which matches the display size
 // so smallest would have 96 * 32 bytes
 
-static void frame_fixed_timed(EPD_type *epd, uint8_t fixed_value, long stage_time) {
+// each frame is batched so its lines go out in as few ioctls as the
+// spidev buffer allows
+
+static int frame_fixed_timed(EPD_type *epd, uint8_t fixed_value, long stage_time) {
 	struct itimerspec its;
 	its.it_value.tv_sec = stage_time / 1000;
 	its.it_value.tv_nsec = (stage_time % 1000) * 1000000;
@@ -536,15 +579,22 @@ static void frame_fixed_timed(EPD_type *epd, uint8_t fixed_value, long stage_tim
 		err(1, "timer_settime failed");
 	}
 
+	int frames = 0;
 	do {
+		uint64_t bytes = SPI_bytes(epd->spi);
+		SPI_batch_begin(epd->spi);
 		for (uint8_t line = 0; line < epd->lines_per_display ; ++line) {
 			one_line(epd, epd->lines_per_display - line - 1, 0, fixed_value, EPD_normal, BORDER_BYTE_NULL);
 		}
+		SPI_batch_end(epd->spi);
+		EPD_TRACE_COUNTER(frame_bytes, SPI_bytes(epd->spi) - bytes);
+		++frames;
 
 		if (-1 == timer_gettime(epd->timer, &its)) {
 			err(1, "timer_gettime failed");
 		}
 	} while ((its.it_value.tv_sec > 0) || (its.it_value.tv_nsec > 0));
+	return frames;
 }
 
 
@@ -565,7 +615,11 @@ static void frame_fixed_13(EPD_type *epd, uint8_t value, EPD_stage stage) {
 
 	int total_lines = epd->lines_per_display;
 
+	EPD_TRACE_BEGIN(stage, EPD_inverse == stage ? 1 : 3);
+	uint64_t start_us = EPD_stats_now_us();
 	for (int n = 0; n < repeat; ++n) {
+		uint64_t bytes = SPI_bytes(epd->spi);
+		SPI_batch_begin(epd->spi);
 
 		int block_begin = 0;
 		int block_end = 0;
@@ -593,7 +647,11 @@ static void frame_fixed_13(EPD_type *epd, uint8_t value, EPD_stage stage) {
 				}
 			}
 		}
+		SPI_batch_end(epd->spi);
+		EPD_TRACE_COUNTER(frame_bytes, SPI_bytes(epd->spi) - bytes);
 	}
+	EPD_stats_stage(EPD_inverse == stage ? 1 : 3, repeat, EPD_stats_now_us() - start_us, 0);
+	EPD_TRACE_END(stage, repeat);
 }
 
 
@@ -614,7 +672,11 @@ static void frame_data_13(EPD_type *epd, const uint8_t *image, EPD_stage stage)
 
 	int total_lines = epd->lines_per_display;
 
+	EPD_TRACE_BEGIN(stage, EPD_inverse == stage ? 1 : 3);
+	uint64_t start_us = EPD_stats_now_us();
 	for (int n = 0; n < repeat; ++n) {
+		uint64_t bytes = SPI_bytes(epd->spi);
+		SPI_batch_begin(epd->spi);
 
 		int block_begin = 0;
 		int block_end = 0;
@@ -642,19 +704,31 @@ static void frame_data_13(EPD_type *epd, const uint8_t *image, EPD_stage stage)
 				}
 			}
 		}
+		SPI_batch_end(epd->spi);
+		EPD_TRACE_COUNTER(frame_bytes, SPI_bytes(epd->spi) - bytes);
 	}
+	EPD_stats_stage(EPD_inverse == stage ? 1 : 3, repeat, EPD_stats_now_us() - start_us, 0);
+	EPD_TRACE_END(stage, repeat);
 }
 
 
 static void frame_stage2(EPD_type *epd) {
+	EPD_TRACE_BEGIN(stage, 2);
+	uint64_t start_us = EPD_stats_now_us();
+	int frames = 0;
 	for (int i = 0; i < epd->compensation->stage2_repeat; ++i) {
-		frame_fixed_timed(epd, 0xff, epd->compensation->stage2_t1);
-		frame_fixed_timed(epd, 0xaa, epd->compensation->stage2_t2);
+		frames += frame_fixed_timed(epd, 0xff, epd->compensation->stage2_t1);
+		frames += frame_fixed_timed(epd, 0xaa, epd->compensation->stage2_t2);
 	}
+	EPD_stats_stage(2, frames, EPD_stats_now_us() - start_us,
+			(uint64_t)epd->compensation->stage2_repeat *
+			(epd->compensation->stage2_t1 + epd->compensation->stage2_t2) * 1000);
+	EPD_TRACE_END(stage, epd->compensation->stage2_repeat);
 }
 
 
 static void nothing_frame(EPD_type *epd) {
+	SPI_batch_begin(epd->spi);
 	for (int line = 0; line < epd->lines_per_display; ++line) {
 
 		// charge pump voltage level reduce voltage shift
@@ -663,6 +737,7 @@ static void nothing_frame(EPD_type *epd) {
 
 		one_line(epd, line, 0, 0x00, EPD_normal, BORDER_BYTE_NULL);
 	}
+	SPI_batch_end(epd->spi);
 }
 
 
@@ -733,6 +808,8 @@ static void one_line(EPD_type *epd, uint16_t line, const uint8_t *data, uint8_t
 	}
 
 	// send the accumulated line buffer
+	// (kept in one ioctl when batching)
+	SPI_batch_group(epd->spi);
 	SPI_send(epd->spi, CU8(0x70, 0x0a), 2);
 	SPI_send(epd->spi, epd->line_buffer, epd->line_buffer_size);
 
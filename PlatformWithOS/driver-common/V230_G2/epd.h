@@ -24,6 +24,7 @@
 #define EPD_IMAGE_ONE_ARG     1
 #define EPD_IMAGE_TWO_ARG     0
 #define EPD_PARTIAL_AVAILABLE 0
+#define EPD_PARTIAL_LINES_AVAILABLE 0
 
 // display panels supported
 #define EPD_1_44_SUPPORT      1
@@ -26,6 +26,9 @@
 #include "gpio.h"
 #include "spi.h"
 #include "epd.h"
+#include "epd_trace.h"
+#include "epd_stats.h"
+#include "EPD_ENCODE.h"
 
 // delays - more consistent naming
 #define Delay_ms(ms) usleep(1000 * (ms))
@@ -41,6 +44,9 @@
 #define BORDER_BYTE_NULL  0x00
 
 
+// force inlining so constant geometry reaches the loops
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+
 // inline arrays
 #define ARRAY(type, ...) ((type[]){__VA_ARGS__})
 #define CU8(...) (ARRAY(const uint8_t, __VA_ARGS__))
@@ -59,16 +65,29 @@ typedef enum {
 	EPD_BORDER_BYTE_SET,   // border byte needs to be set
 } EPD_border_byte;
 
+// fill the line buffer for one line, returns the end pointer
+typedef uint8_t *EPD_line_encoder(uint8_t *p, uint16_t line, const uint8_t *data, uint8_t fixed_value, const uint8_t *change, EPD_stage stage);
+
 // function prototypes
 
 static void power_off(EPD_type *epd);
 
 static int temperature_to_factor_10x(int temperature);
 static void frame_fixed(EPD_type *epd, uint8_t fixed_value, EPD_stage stage);
-static void frame_data(EPD_type *epd, const uint8_t *image, const uint8_t *mask, EPD_stage stage);
+static void frame_data(EPD_type *epd, const uint8_t *image, const uint8_t *change, EPD_stage stage);
+static void frame_lines(EPD_type *epd, const uint8_t *image, const uint8_t *changes, const uint16_t *lines, int line_count, EPD_stage stage);
 static void frame_fixed_repeat(EPD_type *epd, uint8_t fixed_value, EPD_stage stage);
-static void frame_data_repeat(EPD_type *epd, const uint8_t *image, const uint8_t *mask, EPD_stage stage);
-static void one_line(EPD_type *epd, uint16_t line, const uint8_t *data, uint8_t fixed_value, const uint8_t *mask, EPD_stage stage);
+static void frame_data_repeat(EPD_type *epd, const uint8_t *image, const uint8_t *change, EPD_stage stage);
+static void frame_lines_repeat(EPD_type *epd, const uint8_t *image, const uint8_t *changes, const uint16_t *lines, int line_count, EPD_stage stage);
+static void stage_timer_start(EPD_type *epd, EPD_stage stage);
+static bool stage_timer_running(EPD_type *epd);
+static uint64_t stage_planned_us(EPD_type *epd, EPD_stage stage);
+static void one_line(EPD_type *epd, uint16_t line, const uint8_t *data, uint8_t fixed_value, const uint8_t *change, EPD_stage stage);
+static EPD_line_encoder encode_line_1_44;
+static EPD_line_encoder encode_line_1_9;
+static EPD_line_encoder encode_line_2_0;
+static EPD_line_encoder encode_line_2_6;
+static EPD_line_encoder encode_line_2_7;
 static void nothing_frame(EPD_type *epd);
 static void dummy_line(EPD_type *epd);
 static void border_dummy_line(EPD_type *epd);
@@ -101,6 +120,9 @@ struct EPD_struct {
 
 	uint8_t *line_buffer;
 	size_t line_buffer_size;
+	EPD_line_encoder *encode_line;  // specialised for the panel size
+
+	uint8_t *change_buffer;  // old ^ new for partial update
 
 	timer_t timer;
 	SPI_type *spi;
@@ -152,6 +174,7 @@ EPD_type *EPD_create(EPD_size size,
 	epd->middle_scan = true; // => data-scan-data ELSE: scan-data-scan
 	epd->pre_border_byte = false;
 	epd->border_byte = EPD_BORDER_BYTE_ZERO;
+	epd->encode_line = encode_line_1_44;
 
 	// display size dependent items
 	{
@@ -167,6 +190,7 @@ EPD_type *EPD_create(EPD_size size,
 		break;
 
 	case EPD_1_9: {
+		epd->encode_line = encode_line_1_9;
 		epd->lines_per_display = 128;
 		epd->dots_per_line = 144;
 		epd->bytes_per_line = 144 / 8;
@@ -181,6 +205,7 @@ EPD_type *EPD_create(EPD_size size,
 	}
 
 	case EPD_2_0: {
+		epd->encode_line = encode_line_2_0;
 		epd->lines_per_display = 96;
 		epd->dots_per_line = 200;
 		epd->bytes_per_line = 200 / 8;
@@ -194,6 +219,7 @@ EPD_type *EPD_create(EPD_size size,
 	}
 
 	case EPD_2_6: {
+		epd->encode_line = encode_line_2_6;
 		epd->base_stage_time = 630; // milliseconds
 		epd->lines_per_display = 128;
 		epd->dots_per_line = 232;
@@ -209,6 +235,7 @@ EPD_type *EPD_create(EPD_size size,
 	}
 
 	case EPD_2_7: {
+		epd->encode_line = encode_line_2_7;
 		epd->base_stage_time = 630; // milliseconds
 		epd->lines_per_display = 176;
 		epd->dots_per_line = 264;
@@ -248,6 +275,15 @@ EPD_type *EPD_create(EPD_size size,
 	// ensure zero
 	memset(epd->line_buffer, 0x00, epd->line_buffer_size);
 
+	// buffer for partial update change mask
+	epd->change_buffer = malloc(epd->lines_per_display * epd->bytes_per_line);
+	if (NULL == epd->change_buffer) {
+		free(epd->line_buffer);
+		free(epd);
+		warn("falled to allocate EPD change buffer");
+		return NULL;
+	}
+
 	// ensure I/O is all set to ZERO
 	power_off(epd);
 
@@ -266,6 +302,9 @@ void EPD_destroy(EPD_type *epd) {
 	if (NULL != epd->line_buffer) {
 		free(epd->line_buffer);
 	}
+	if (NULL != epd->change_buffer) {
+		free(epd->change_buffer);
+	}
 	free(epd);
 }
 
@@ -284,10 +323,14 @@ void EPD_begin(EPD_type *epd) {
 		return;
 	}
 
+	EPD_TRACE_BEGIN(begin, epd->size);
+	uint64_t begin_us = EPD_stats_now_us();
+
 	// assume OK
 	epd->status = EPD_OK;
 
 	// power up sequence
+	EPD_TRACE_BEGIN(power_on, 0);
 	digitalWrite(epd->EPD_Pin_RESET, LOW);
 	digitalWrite(epd->EPD_Pin_PANEL_ON, LOW);
 	digitalWrite(epd->EPD_Pin_DISCHARGE, LOW);
@@ -308,21 +351,32 @@ void EPD_begin(EPD_type *epd) {
 
 	digitalWrite(epd->EPD_Pin_RESET, HIGH);
 	Delay_ms(5);
+	EPD_TRACE_END(power_on, 0);
 
 	// wait for COG to become ready
+	EPD_TRACE_BEGIN(busy_wait, 0);
+	uint64_t busy_us = EPD_stats_now_us();
+	int polls = 0;
 	while (HIGH == digitalRead(epd->EPD_Pin_BUSY)) {
 		Delay_us(10);
+		++polls;
 	}
+	EPD_STATS_ADD(busy_waits, 1);
+	EPD_STATS_ADD(busy_wait_us, EPD_stats_now_us() - busy_us);
+	EPD_TRACE_END(busy_wait, polls);
 
 	// read the COG ID
 	uint8_t receive_buffer[2];
 	SPI_read(epd->spi, CU8(0x71, 0x00), receive_buffer, sizeof(receive_buffer));
 	SPI_read(epd->spi, CU8(0x71, 0x00), receive_buffer, sizeof(receive_buffer));
 	int cog_id = receive_buffer[1];
+	EPD_TRACE_INSTANT(cog_id, cog_id);
 	if (0x02 != (0x0f & cog_id)) {
 		printf("cog_id = %x\n", cog_id);
 		epd->status = EPD_UNSUPPORTED_COG;
 		power_off(epd);
+		EPD_stats_latency(EPD_STATS_PHASE_BEGIN, EPD_stats_now_us() - begin_us);
+		EPD_TRACE_END(begin, epd->status);
 		return;
 	}
 
@@ -334,9 +388,12 @@ void EPD_begin(EPD_type *epd) {
 	SPI_send(epd->spi, CU8(0x70, 0x0f), 2);
 	SPI_read(epd->spi, CU8(0x73, 0x00), receive_buffer, sizeof(receive_buffer));
 	int broken_panel = receive_buffer[1];
+	EPD_TRACE_INSTANT(panel_check, broken_panel);
 	if (0x00 == (0x80 & broken_panel)) {
 		epd->status = EPD_PANEL_BROKEN;
 		power_off(epd);
+		EPD_stats_latency(EPD_STATS_PHASE_BEGIN, EPD_stats_now_us() - begin_us);
+		EPD_TRACE_END(begin, epd->status);
 		return;
 	}
 
@@ -377,6 +434,8 @@ void EPD_begin(EPD_type *epd) {
 	bool dc_ok = false;
 
 	for (int i = 0; i < 4; ++i) {
+		EPD_TRACE_BEGIN(dc_dc, i);
+
 		// charge pump positive voltage on - VGH/VDL on
 		SPI_send(epd->spi, CU8(0x70, 0x05), 2);
 		SPI_send(epd->spi, CU8(0x72, 0x01), 2);
@@ -399,6 +458,7 @@ void EPD_begin(EPD_type *epd) {
 		SPI_send(epd->spi, CU8(0x70, 0x0f), 2);
 		SPI_read(epd->spi, CU8(0x73, 0x00), receive_buffer, sizeof(receive_buffer));
 		int dc_state = receive_buffer[1];
+		EPD_TRACE_END(dc_dc, dc_state);
 		if (0x40 == (0x40 & dc_state)) {
 			dc_ok = true;
 			break;
@@ -407,6 +467,8 @@ void EPD_begin(EPD_type *epd) {
 	if (!dc_ok) {
 		epd->status = EPD_DC_FAILED;
 		power_off(epd);
+		EPD_stats_latency(EPD_STATS_PHASE_BEGIN, EPD_stats_now_us() - begin_us);
+		EPD_TRACE_END(begin, epd->status);
 		return;
 	}
 
@@ -415,11 +477,16 @@ void EPD_begin(EPD_type *epd) {
 	SPI_send(epd->spi, CU8(0x72, 0x04), 2);
 
 	epd->COG_on = true;
+	EPD_stats_latency(EPD_STATS_PHASE_BEGIN, EPD_stats_now_us() - begin_us);
+	EPD_TRACE_END(begin, epd->status);
 }
 
 
 void EPD_end(EPD_type *epd) {
 
+	EPD_TRACE_BEGIN(end, epd->size);
+	uint64_t end_us = EPD_stats_now_us();
+
 	nothing_frame(epd);
 
 	if (EPD_2_7 == epd->size) {
@@ -469,11 +536,15 @@ void EPD_end(EPD_type *epd) {
 	power_off(epd);
 
 	epd->COG_on = false;
+	EPD_stats_latency(EPD_STATS_PHASE_END, EPD_stats_now_us() - end_us);
+	EPD_TRACE_END(end, 0);
 }
 
 
 static void power_off(EPD_type *epd) {
 
+	EPD_TRACE_BEGIN(power_off, 0);
+
 	// turn of power and all signals
 	digitalWrite(epd->EPD_Pin_RESET, LOW);
 	digitalWrite(epd->EPD_Pin_PANEL_ON, LOW);
@@ -485,6 +556,8 @@ static void power_off(EPD_type *epd) {
 	digitalWrite(epd->EPD_Pin_DISCHARGE, HIGH);
 	Delay_ms(150);
 	digitalWrite(epd->EPD_Pin_DISCHARGE, LOW);
+
+	EPD_TRACE_END(power_off, 0);
 }
 
 
@@ -519,10 +592,26 @@ void EPD_image(EPD_type *epd, const uint8_t *old_image, const uint8_t *new_image
 
 // change from old image to new image
 void EPD_partial_image(EPD_type *epd, const uint8_t *old_image, const uint8_t *new_image) {
+	// compute the changed pixels once rather than on every frame
+	size_t length = epd->lines_per_display * epd->bytes_per_line;
+	for (size_t i = 0; i < length; ++i) {
+		epd->change_buffer[i] = old_image[i] ^ new_image[i];
+	}
+
 	// Only need last stage for partial update
 	// See discussion on issue #19 in the repaper/gratis repository on github
-        frame_data_repeat(epd, new_image, old_image, EPD_inverse);
-	frame_data_repeat(epd, new_image, old_image, EPD_normal);
+	frame_data_repeat(epd, new_image, epd->change_buffer, EPD_inverse);
+	frame_data_repeat(epd, new_image, epd->change_buffer, EPD_normal);
+}
+
+// change only the listed lines to the new image
+void EPD_partial_lines(EPD_type *epd, const uint8_t *new_image,
+		       const uint8_t *changes, const uint16_t *lines, int line_count) {
+	if (line_count <= 0) {
+		return;
+	}
+	frame_lines_repeat(epd, new_image, changes, lines, line_count, EPD_inverse);
+	frame_lines_repeat(epd, new_image, changes, lines, line_count, EPD_normal);
 }
 
 void EPD_blink(EPD_type *epd, const uint8_t *new_image) {
@@ -563,24 +652,42 @@ static int temperature_to_factor_10x(int temperature) {
 // the image is arranged by line which matches the display size
 // so smallest would have 96 * 32 bytes
 
+// each frame is batched so its lines go out in as few ioctls as the
+// spidev buffer allows
+
 static void frame_fixed(EPD_type *epd, uint8_t fixed_value, EPD_stage stage) {
+	SPI_batch_begin(epd->spi);
 	for (uint8_t l = 0; l < epd->lines_per_display ; ++l) {
 		one_line(epd, l, NULL, fixed_value, NULL, stage);
 	}
+	SPI_batch_end(epd->spi);
 }
 
 
-static void frame_data(EPD_type *epd, const uint8_t *image, const uint8_t *mask, EPD_stage stage) {
-	if (NULL == mask) {
+static void frame_data(EPD_type *epd, const uint8_t *image, const uint8_t *change, EPD_stage stage) {
+	SPI_batch_begin(epd->spi);
+	if (NULL == change) {
 		for (uint8_t l = 0; l < epd->lines_per_display ; ++l) {
 			one_line(epd, l, &image[l * epd->bytes_per_line], 0, NULL, stage);
 		}
 	} else {
 		for (uint8_t l = 0; l < epd->lines_per_display ; ++l) {
 			size_t n = l * epd->bytes_per_line;
-			one_line(epd, l, &image[n], 0, &mask[n], stage);
+			one_line(epd, l, &image[n], 0, &change[n], stage);
 		}
 	}
+	SPI_batch_end(epd->spi);
+}
+
+
+// changes holds one packed line of change bits for each entry of lines
+static void frame_lines(EPD_type *epd, const uint8_t *image, const uint8_t *changes, const uint16_t *lines, int line_count, EPD_stage stage) {
+	SPI_batch_begin(epd->spi);
+	for (int i = 0; i < line_count; ++i) {
+		uint16_t l = lines[i];
+		one_line(epd, l, &image[l * epd->bytes_per_line], 0, &changes[i * epd->bytes_per_line], stage);
+	}
+	SPI_batch_end(epd->spi);
 }
 
 
@@ -591,54 +698,103 @@ static void frame_fixed_repeat(EPD_type *epd, uint8_t fixed_value, EPD_stage sta
 	its.it_interval.tv_sec = 0;
 	its.it_interval.tv_nsec = 0;
 
+	EPD_TRACE_BEGIN(stage, stage);
+	uint64_t start_us = EPD_stats_now_us();
+	int frames = 0;
 	if (-1 == timer_settime(epd->timer, 0, &its, NULL)) {
 		err(1, "timer_settime failed");
 	}
 	do {
+		uint64_t bytes = SPI_bytes(epd->spi);
 		frame_fixed(epd, fixed_value, stage);
+		EPD_TRACE_COUNTER(frame_bytes, SPI_bytes(epd->spi) - bytes);
+		++frames;
 
 		if (-1 == timer_gettime(epd->timer, &its)) {
 			err(1, "timer_gettime failed");
 		}
 	} while (its.it_value.tv_sec > 0 || its.it_value.tv_nsec > 0);
+	EPD_stats_stage(stage, frames, EPD_stats_now_us() - start_us, (uint64_t)epd->factored_stage_time * 1000);
+	EPD_TRACE_END(stage, frames);
+}
+
+
+static void frame_data_repeat(EPD_type *epd, const uint8_t *image, const uint8_t *change, EPD_stage stage) {
+	EPD_TRACE_BEGIN(stage, stage);
+	uint64_t start_us = EPD_stats_now_us();
+	int frames = 0;
+	stage_timer_start(epd, stage);
+	do {
+		uint64_t bytes = SPI_bytes(epd->spi);
+		frame_data(epd, image, change, stage);
+		EPD_TRACE_COUNTER(frame_bytes, SPI_bytes(epd->spi) - bytes);
+		++frames;
+	} while (stage_timer_running(epd));
+	EPD_stats_stage(stage, frames, EPD_stats_now_us() - start_us, stage_planned_us(epd, stage));
+	EPD_TRACE_END(stage, frames);
+}
+
+
+static void frame_lines_repeat(EPD_type *epd, const uint8_t *image, const uint8_t *changes, const uint16_t *lines, int line_count, EPD_stage stage) {
+	EPD_TRACE_BEGIN(stage, stage);
+	uint64_t start_us = EPD_stats_now_us();
+	int frames = 0;
+	stage_timer_start(epd, stage);
+	do {
+		uint64_t bytes = SPI_bytes(epd->spi);
+		frame_lines(epd, image, changes, lines, line_count, stage);
+		EPD_TRACE_COUNTER(frame_bytes, SPI_bytes(epd->spi) - bytes);
+		++frames;
+	} while (stage_timer_running(epd));
+	EPD_stats_stage(stage, frames, EPD_stats_now_us() - start_us, stage_planned_us(epd, stage));
+	EPD_TRACE_END(stage, frames);
 }
 
 
-static void frame_data_repeat(EPD_type *epd, const uint8_t *image, const uint8_t *mask, EPD_stage stage) {
+// start the stage timer for an image stage
+static void stage_timer_start(EPD_type *epd, EPD_stage stage) {
 	struct itimerspec its;
 	its.it_value.tv_sec = epd->factored_stage_time / 1000;
 	its.it_value.tv_nsec = (epd->factored_stage_time % 1000) * 1000000;
 	its.it_interval.tv_sec = 0;
 	its.it_interval.tv_nsec = 0;
 
-//        if (stage == EPD_white) {
-	if (stage == EPD_compensate || stage == EPD_inverse) {
-            its.it_value.tv_sec >>= 1;
-            its.it_value.tv_nsec >>= 1;
-        } else if (stage != EPD_normal) {
-            its.it_value.tv_sec >>= 1;
-            its.it_value.tv_nsec >>= 1;
-        }
+	// only the final stage needs the full time
+	if (stage != EPD_normal) {
+		its.it_value.tv_sec >>= 1;
+		its.it_value.tv_nsec >>= 1;
+	}
 
-	int n = 0;
 	if (-1 == timer_settime(epd->timer, 0, &its, NULL)) {
 		err(1, "timer_settime failed");
 	}
-	do {
-		frame_data(epd, image, mask, stage);
-		if (-1 == timer_gettime(epd->timer, &its)) {
-			err(1, "timer_gettime failed");
-		}
-		++n;
-	} while (its.it_value.tv_sec > 0 || its.it_value.tv_nsec > 0);
+}
+
+
+// true until the stage time has expired
+static bool stage_timer_running(EPD_type *epd) {
+	struct itimerspec its;
+	if (-1 == timer_gettime(epd->timer, &its)) {
+		err(1, "timer_gettime failed");
+	}
+	return its.it_value.tv_sec > 0 || its.it_value.tv_nsec > 0;
+}
+
+
+// the time stage_timer_start allows for a stage
+static uint64_t stage_planned_us(EPD_type *epd, EPD_stage stage) {
+	uint64_t us = (uint64_t)epd->factored_stage_time * 1000;
+	return stage != EPD_normal ? us / 2 : us;
 }
 
 
 
 static void nothing_frame(EPD_type *epd) {
+	SPI_batch_begin(epd->spi);
 	for (int line = 0; line < epd->lines_per_display; ++line) {
 		one_line(epd, 0x7fffu, NULL, 0x00, NULL, EPD_compensate);
 	}
+	SPI_batch_end(epd->spi);
 }
 
 
@@ -652,143 +808,29 @@ static void border_dummy_line(EPD_type *epd) {
 }
 
 
-// pixels on display are numbered from 1 so even is actually bits 1,3,5,...
-static void even_pixels(EPD_type *epd, uint8_t **pp, const uint8_t *data, uint8_t fixed_value, const uint8_t *mask, EPD_stage stage) {
-
-	for (uint16_t b = 0; b < epd->bytes_per_line; ++b) {
-		if (NULL != data) {
-			uint8_t pixels = data[b] & 0xaa;
-			uint8_t pixel_mask = 0xff;
-			if (NULL != mask) {
-				pixel_mask = (mask[b] ^ pixels) & 0xaa;
-				pixel_mask |= pixel_mask >> 1;
-			}
-			switch(stage) {
-			case EPD_compensate:  // B -> W, W -> B (Current Image)
-				pixels = 0xaa | ((pixels ^ 0xaa) >> 1);
-				break;
-			case EPD_white:       // B -> N, W -> W (Current Image)
-				pixels = 0x55 + ((pixels ^ 0xaa) >> 1);
-				break;
-			case EPD_inverse:     // B -> N, W -> B (New Image)
-				pixels = 0x55 | (pixels ^ 0xaa);
-				break;
-			case EPD_normal:       // B -> B, W -> W (New Image)
-				pixels = 0xaa | (pixels >> 1);
-				break;
-			}
-			pixels = (pixels & pixel_mask) | (~pixel_mask & 0x55);
-			uint8_t p1 = (pixels >> 6) & 0x03;
-			uint8_t p2 = (pixels >> 4) & 0x03;
-			uint8_t p3 = (pixels >> 2) & 0x03;
-			uint8_t p4 = (pixels >> 0) & 0x03;
-			pixels = (p1 << 0) | (p2 << 2) | (p3 << 4) | (p4 << 6);
-			*(*pp)++ = pixels;
-		} else {
-			*(*pp)++ = fixed_value;
-		}
-	}
-}
-
-// pixels on display are numbered from 1 so odd is actually bits 0,2,4,...
-static void odd_pixels(EPD_type *epd, uint8_t **pp, const uint8_t *data, uint8_t fixed_value, const uint8_t *mask, EPD_stage stage) {
-	for (uint16_t b = epd->bytes_per_line; b > 0; --b) {
-		if (NULL != data) {
-			uint8_t pixels = data[b - 1] & 0x55;
-			uint8_t pixel_mask = 0xff;
-			if (NULL != mask) {
-				pixel_mask = (mask[b - 1] ^ pixels) & 0x55;
-				pixel_mask |= pixel_mask << 1;
-			}
-			switch(stage) {
-			case EPD_compensate:  // B -> W, W -> B (Current Image)
-				pixels = 0xaa | (pixels ^ 0x55);
-				break;
-			case EPD_white:       // B -> N, W -> W (Current Image)
-				pixels = 0x55 + (pixels ^ 0x55);
-				break;
-			case EPD_inverse:     // B -> N, W -> B (New Image)
-				pixels = 0x55 | ((pixels ^ 0x55) << 1);
-				break;
-			case EPD_normal:       // B -> B, W -> W (New Image)
-				pixels = 0xaa | pixels;
-				break;
-			}
-			pixels = (pixels & pixel_mask) | (~pixel_mask & 0x55);
-			*(*pp)++ = pixels;
-		} else {
-			*(*pp)++ = fixed_value;
-		}
-	}
-}
-
-// interleave bits: (byte)76543210 -> (16 bit).7.6.5.4.3.2.1
-static inline uint16_t interleave_bits(uint16_t value) {
-	value = (value | (value << 4)) & 0x0f0f;
-	value = (value | (value << 2)) & 0x3333;
-	value = (value | (value << 1)) & 0x5555;
-	return value;
-}
-
-// pixels on display are numbered from 1
-static void all_pixels(EPD_type *epd, uint8_t **pp, const uint8_t *data, uint8_t fixed_value, const uint8_t *mask, EPD_stage stage) {
-	for (uint16_t b = epd->bytes_per_line; b > 0; --b) {
-		if (NULL != data) {
-			uint16_t pixels = interleave_bits(data[b - 1]);
-
-			uint16_t pixel_mask = 0xffff;
-			if (NULL != mask) {
-				uint16_t pixel_mask = interleave_bits(mask[b - 1]);
-				pixel_mask = (pixel_mask ^ pixels) & 0x5555;
-				pixel_mask |= pixel_mask << 1;
-			}
-			switch(stage) {
-			case EPD_compensate:  // B -> W, W -> B (Current Image)
-				pixels = 0xaaaa | (pixels ^ 0x5555);
-				break;
-			case EPD_white:       // B -> N, W -> W (Current Image)
-				pixels = 0x5555 + (pixels ^ 0x5555);
-				break;
-			case EPD_inverse:     // B -> N, W -> B (New Image)
-				pixels = 0x5555 | ((pixels ^ 0x5555) << 1);
-				break;
-			case EPD_normal:       // B -> B, W -> W (New Image)
-				pixels = 0xaaaa | pixels;
-				break;
-			}
-			pixels = (pixels & pixel_mask) | (~pixel_mask & 0x5555);
-			*(*pp)++ = pixels >> 8;
-			*(*pp)++ = pixels;
-		} else {
-			*(*pp)++ = fixed_value;
-			*(*pp)++ = fixed_value;
-		}
-	}
-}
-
-// output one line of scan and data bytes to the display
-static void one_line(EPD_type *epd, uint16_t line, const uint8_t *data, uint8_t fixed_value, const uint8_t *mask, EPD_stage stage) {
-
-	SPI_on(epd->spi);
-
-	// send data
-	SPI_send(epd->spi, CU8(0x70, 0x0a), 2);
-
-	// CS low
-	uint8_t *p = epd->line_buffer;
+// build one line of scan and data bytes in the line buffer
+// every geometry argument is a constant at each call site (see
+// LINE_ENCODER below) so the loops have fixed trip counts and the
+// layout branches are resolved at compile time
+static ALWAYS_INLINE uint8_t *encode_line(uint8_t *p, uint16_t line, const uint8_t *data, uint8_t fixed_value, const uint8_t *change, EPD_stage stage,
+					  const uint16_t bytes_per_line,
+					  const uint16_t bytes_per_scan,
+					  const bool middle_scan,
+					  const bool pre_border_byte,
+					  const EPD_border_byte border_byte) {
 
 	*p++ = 0x72;
 
-	if (epd->pre_border_byte) {
+	if (pre_border_byte) {
 		*p++ = 0x00;
 	}
 
-	if (epd->middle_scan) {
+	if (middle_scan) {
 		// data bytes
-		odd_pixels(epd, &p, data, fixed_value, mask, stage);
+		p = EPD_encode_odd_line(p, data, change, fixed_value, false, bytes_per_line, stage);
 
 		// scan line
-		for (uint16_t b = epd->bytes_per_scan; b > 0; --b) {
+		for (uint16_t b = bytes_per_scan; b > 0; --b) {
 			if (line / 4 == b - 1) {
 				*p++ = 0x03 << (2 * (line & 0x03));
 			} else {
@@ -797,11 +839,11 @@ static void one_line(EPD_type *epd, uint16_t line, const uint8_t *data, uint8_t
 		}
 
 		// data bytes
-		even_pixels(epd, &p, data, fixed_value, mask, stage);
+		p = EPD_encode_even_line(p, data, change, fixed_value, false, bytes_per_line, stage);
 
 	} else {
 		// even scan line, but as lines on display are numbered from 1, line: 1,3,5,...
-		for (uint16_t b = 0; b < epd->bytes_per_scan; ++b) {
+		for (uint16_t b = 0; b < bytes_per_scan; ++b) {
 			if (0 != (line & 0x01) && line / 8 == b) {
 				*p++ = 0xc0 >> (line & 0x06);
 			} else {
@@ -810,10 +852,10 @@ static void one_line(EPD_type *epd, uint16_t line, const uint8_t *data, uint8_t
 		}
 
 		// data bytes
-		all_pixels(epd, &p, data, fixed_value, mask, stage);
+		p = EPD_encode_all_line(p, data, change, fixed_value, false, bytes_per_line, stage);
 
 		// odd scan line, but as lines on display are numbered from 1, line: 0,2,4,6,...
-		for (uint16_t b = epd->bytes_per_scan; b > 0; --b) {
+		for (uint16_t b = bytes_per_scan; b > 0; --b) {
 			if (0 == (line & 0x01) && line / 8 == b - 1) {
 				*p++ = 0x03 << (line & 0x06);
 			} else {
@@ -823,7 +865,7 @@ static void one_line(EPD_type *epd, uint16_t line, const uint8_t *data, uint8_t
 	}
 
 	// post data border byte
-	switch (epd->border_byte) {
+	switch (border_byte) {
 	case EPD_BORDER_BYTE_NONE:  // no border byte requred
 		break;
 
@@ -844,6 +886,39 @@ static void one_line(EPD_type *epd, uint16_t line, const uint8_t *data, uint8_t
 		}
 		break;
 	}
+	return p;
+}
+
+
+// one specialised encoder per panel size
+// arguments must match the values set in EPD_create
+#define LINE_ENCODER(name, bytes_per_line, bytes_per_scan, middle_scan, pre_border_byte, border_byte) \
+	static uint8_t *name(uint8_t *p, uint16_t line, const uint8_t *data, uint8_t fixed_value, const uint8_t *change, EPD_stage stage) { \
+		return encode_line(p, line, data, fixed_value, change, stage, \
+				   bytes_per_line, bytes_per_scan, middle_scan, pre_border_byte, border_byte); \
+	}
+
+LINE_ENCODER(encode_line_1_44, 128 / 8, 96 / 4, true, false, EPD_BORDER_BYTE_ZERO)
+LINE_ENCODER(encode_line_1_9, 144 / 8, 128 / 4 / 2, false, false, EPD_BORDER_BYTE_SET)
+LINE_ENCODER(encode_line_2_0, 200 / 8, 96 / 4, true, true, EPD_BORDER_BYTE_NONE)
+LINE_ENCODER(encode_line_2_6, 232 / 8, 128 / 4 / 2, false, false, EPD_BORDER_BYTE_SET)
+LINE_ENCODER(encode_line_2_7, 264 / 8, 176 / 4, true, true, EPD_BORDER_BYTE_NONE)
+
+
+// output one line of scan and data bytes to the display
+static void one_line(EPD_type *epd, uint16_t line, const uint8_t *data, uint8_t fixed_value, const uint8_t *change, EPD_stage stage) {
+
+	// keep the whole line in one ioctl when batching
+	SPI_batch_group(epd->spi);
+
+	SPI_on(epd->spi);
+
+	// send data
+	SPI_send(epd->spi, CU8(0x70, 0x0a), 2);
+
+	// CS low
+	uint8_t *p = epd->encode_line(epd->line_buffer, line, data, fixed_value, change, stage);
+
 	// send the accumulated line buffer
 	SPI_send(epd->spi, epd->line_buffer, p - epd->line_buffer);
 
@@ -24,6 +24,7 @@
 #define EPD_IMAGE_ONE_ARG     0
 #define EPD_IMAGE_TWO_ARG     1
 #define EPD_PARTIAL_AVAILABLE 1
+#define EPD_PARTIAL_LINES_AVAILABLE 1
 
 // display panels supported
 #define EPD_1_44_SUPPORT      1
@@ -93,5 +94,11 @@ void EPD_image(EPD_type *epd, const uint8_t *old_image, const uint8_t *new_image
 // only updating changed pixels
 void EPD_partial_image(EPD_type *epd, const uint8_t *old_image, const uint8_t *new_image);
 
+// update only the listed lines of new image
+// changes holds line_count lines of (old ^ new) bits in the same
+// order as lines, e.g. an animation frame record
+void EPD_partial_lines(EPD_type *epd, const uint8_t *new_image,
+		       const uint8_t *changes, const uint16_t *lines, int line_count);
+
 void EPD_blink(EPD_type *epd, const uint8_t *new_image);
 #endif
@@ -0,0 +1,316 @@
+// Copyright 2013-2015 Pervasive Displays, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at:
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+// express or implied.  See the License for the specific language
+// governing permissions and limitations under the License.
+
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdio.h>
+#include <err.h>
+
+#include "epd_anim.h"
+
+
+struct ANIM_struct {
+	int width;
+	int height;
+	int bytes_per_line;
+	int frame_count;
+	uint8_t *data;            // whole file
+	size_t size;
+	const uint8_t *keyframe;  // points into data
+	uint16_t *lines;          // all line numbers converted to host order
+	ANIM_frame *frames;
+};
+
+
+// little endian access - records are not aligned
+static uint16_t get16(const uint8_t *p) {
+	return p[0] | (p[1] << 8);
+}
+
+static uint32_t get32(const uint8_t *p) {
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void put16(uint8_t *p, uint16_t value) {
+	p[0] = value;
+	p[1] = value >> 8;
+}
+
+static void put32(uint8_t *p, uint32_t value) {
+	p[0] = value;
+	p[1] = value >> 8;
+	p[2] = value >> 16;
+	p[3] = value >> 24;
+}
+
+
+// read the whole file in one go
+static uint8_t *read_file(const char *path, size_t *size) {
+	FILE *f = fopen(path, "rb");
+	if (NULL == f) {
+		warn("cannot open: %s", path);
+		return NULL;
+	}
+	uint8_t *data = NULL;
+	if (0 != fseek(f, 0, SEEK_END)) {
+		goto done;
+	}
+	long length = ftell(f);
+	if (length < ANIM_HEADER_SIZE || 0 != fseek(f, 0, SEEK_SET)) {
+		warnx("%s: too short", path);
+		goto done;
+	}
+	data = malloc(length);
+	if (NULL == data) {
+		warn("%s: malloc", path);
+		goto done;
+	}
+	if (1 != fread(data, length, 1, f)) {
+		warn("%s: read", path);
+		free(data);
+		data = NULL;
+		goto done;
+	}
+	*size = length;
+done:
+	fclose(f);
+	return data;
+}
+
+
+ANIM_type *ANIM_load(const char *path) {
+	size_t size = 0;
+	uint8_t *data = read_file(path, &size);
+	if (NULL == data) {
+		return NULL;
+	}
+
+	if (0 != memcmp(data, ANIM_MAGIC, sizeof(ANIM_MAGIC))) {
+		warnx("%s: not an animation file", path);
+		goto fail_data;
+	}
+	if (ANIM_VERSION != get16(&data[8])) {
+		warnx("%s: unsupported version: %d", path, get16(&data[8]));
+		goto fail_data;
+	}
+
+	ANIM_type *anim = calloc(1, sizeof(ANIM_type));
+	if (NULL == anim) {
+		warn("%s: calloc", path);
+		goto fail_data;
+	}
+	anim->data = data;
+	anim->size = size;
+	anim->width = get16(&data[10]);
+	anim->height = get16(&data[12]);
+	anim->bytes_per_line = get16(&data[14]);
+	uint32_t frame_count = get32(&data[16]);
+
+	if (0 == anim->width || 0 == anim->height
+	    || anim->bytes_per_line != anim->width / 8
+	    || 0 == frame_count || frame_count > 65535) {
+		warnx("%s: invalid header", path);
+		goto fail_anim;
+	}
+	anim->frame_count = frame_count;
+
+	size_t frame_size = anim->height * anim->bytes_per_line;
+	size_t offset = ANIM_HEADER_SIZE;
+	if (size - offset < frame_size) {
+		warnx("%s: truncated keyframe", path);
+		goto fail_anim;
+	}
+	anim->keyframe = &data[offset];
+	offset += frame_size;
+
+	// first pass: validate records and count the lines
+	size_t total_lines = 0;
+	size_t scan = offset;
+	for (uint32_t i = 0; i < frame_count; ++i) {
+		if (size - scan < 4) {
+			warnx("%s: truncated frame: %u", path, i);
+			goto fail_anim;
+		}
+		size_t count = get16(&data[scan + 2]);
+		size_t length = 4 + count * (2 + anim->bytes_per_line);
+		if (count > (size_t)anim->height || size - scan < length) {
+			warnx("%s: invalid frame: %u", path, i);
+			goto fail_anim;
+		}
+		total_lines += count;
+		scan += length;
+	}
+
+	anim->frames = calloc(frame_count, sizeof(ANIM_frame));
+	anim->lines = malloc((total_lines > 0 ? total_lines : 1) * sizeof(uint16_t));
+	if (NULL == anim->frames || NULL == anim->lines) {
+		warn("%s: malloc", path);
+		goto fail_anim;
+	}
+
+	// second pass: build the frame index
+	uint16_t *lines = anim->lines;
+	for (uint32_t i = 0; i < frame_count; ++i) {
+		ANIM_frame *frame = &anim->frames[i];
+		frame->duration = get16(&data[offset]);
+		frame->line_count = get16(&data[offset + 2]);
+		frame->lines = lines;
+		offset += 4;
+		for (int l = 0; l < frame->line_count; ++l) {
+			uint16_t n = get16(&data[offset]);
+			if (n >= anim->height || (l > 0 && n <= lines[-1])) {
+				warnx("%s: frame: %u has bad line: %u", path, i, n);
+				goto fail_anim;
+			}
+			*lines++ = n;
+			offset += 2;
+		}
+		frame->changes = &data[offset];
+		offset += frame->line_count * anim->bytes_per_line;
+	}
+
+	return anim;
+
+fail_anim:
+	free(anim->frames);
+	free(anim->lines);
+	free(anim);
+fail_data:
+	free(data);
+	return NULL;
+}
+
+
+void ANIM_destroy(ANIM_type *anim) {
+	if (NULL == anim) {
+		return;
+	}
+	free(anim->frames);
+	free(anim->lines);
+	free(anim->data);
+	free(anim);
+}
+
+
+int ANIM_width(const ANIM_type *anim) {
+	return anim->width;
+}
+
+int ANIM_height(const ANIM_type *anim) {
+	return anim->height;
+}
+
+int ANIM_bytes_per_line(const ANIM_type *anim) {
+	return anim->bytes_per_line;
+}
+
+int ANIM_frame_count(const ANIM_type *anim) {
+	return anim->frame_count;
+}
+
+const uint8_t *ANIM_keyframe(const ANIM_type *anim) {
+	return anim->keyframe;
+}
+
+const ANIM_frame *ANIM_frame_get(const ANIM_type *anim, int n) {
+	return &anim->frames[n];
+}
+
+
+void ANIM_apply(const ANIM_type *anim, const ANIM_frame *frame, uint8_t *image) {
+	const uint8_t *change = frame->changes;
+	for (int l = 0; l < frame->line_count; ++l) {
+		uint8_t *p = &image[frame->lines[l] * anim->bytes_per_line];
+		for (int b = 0; b < anim->bytes_per_line; ++b) {
+			*p++ ^= *change++;
+		}
+	}
+}
+
+
+// write the record that changes image from into image to
+static bool write_frame(FILE *out, int height, int bytes_per_line,
+			const uint8_t *from, const uint8_t *to, uint16_t duration) {
+
+	uint16_t line_count = 0;
+	uint8_t *record = malloc(4 + height * (2 + bytes_per_line));
+	if (NULL == record) {
+		warn("malloc");
+		return false;
+	}
+
+	// collect the changed line numbers first then their masks
+	uint8_t *p = &record[4];
+	for (int l = 0; l < height; ++l) {
+		size_t offset = l * bytes_per_line;
+		if (0 != memcmp(&from[offset], &to[offset], bytes_per_line)) {
+			put16(p, l);
+			p += 2;
+			++line_count;
+		}
+	}
+	for (int i = 0; i < line_count; ++i) {
+		size_t offset = get16(&record[4 + 2 * i]) * bytes_per_line;
+		for (int b = 0; b < bytes_per_line; ++b) {
+			*p++ = from[offset + b] ^ to[offset + b];
+		}
+	}
+	put16(&record[0], duration);
+	put16(&record[2], line_count);
+
+	bool ok = 1 == fwrite(record, p - record, 1, out);
+	if (!ok) {
+		warn("write frame");
+	}
+	free(record);
+	return ok;
+}
+
+
+bool ANIM_build(FILE *out, int width, int height,
+		const uint8_t *const *frames, const uint16_t *durations, int count) {
+
+	if (width <= 0 || 0 != width % 8 || height <= 0 || count <= 0) {
+		warnx("invalid animation geometry");
+		return false;
+	}
+	int bytes_per_line = width / 8;
+
+	uint8_t header[ANIM_HEADER_SIZE];
+	memset(header, 0, sizeof(header));
+	memcpy(header, ANIM_MAGIC, sizeof(ANIM_MAGIC));
+	put16(&header[8], ANIM_VERSION);
+	put16(&header[10], width);
+	put16(&header[12], height);
+	put16(&header[14], bytes_per_line);
+	put32(&header[16], count);
+
+	if (1 != fwrite(header, sizeof(header), 1, out)
+	    || 1 != fwrite(frames[0], height * bytes_per_line, 1, out)) {
+		warn("write header");
+		return false;
+	}
+
+	// record 0 closes the loop: last frame back to the keyframe
+	for (int i = 0; i < count; ++i) {
+		const uint8_t *from = frames[0 == i ? count - 1 : i - 1];
+		if (!write_frame(out, height, bytes_per_line, from, frames[i], durations[i])) {
+			return false;
+		}
+	}
+	return true;
+}
@@ -0,0 +1,98 @@
+// Copyright 2013-2015 Pervasive Displays, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at:
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+// express or implied.  See the License for the specific language
+// governing permissions and limitations under the License.
+
+
+#if !defined(EPD_ANIM_H)
+#define EPD_ANIM_H 1
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+// precompiled animation (.epdanim) file layout
+// all multi-byte values are little endian
+//
+//   offset  size  item
+//        0     8  magic: "EPDANIM\0"
+//        8     2  format version (ANIM_VERSION)
+//       10     2  width in pixels
+//       12     2  height in lines
+//       14     2  bytes per line
+//       16     4  frame count
+//       20     4  reserved (zero)
+//       24     *  keyframe: height * bytes per line
+//        *     *  frame count frame records
+//
+// frame record:
+//
+//        0     2  duration in milliseconds
+//        2     2  changed line count: n
+//        4   2*n  changed line numbers in ascending order
+//        *   n*b  XOR mask for each changed line (b = bytes per line)
+//
+// record i (i > 0) changes frame i - 1 into frame i, record 0
+// changes the last frame back into the keyframe so that a repeated
+// animation never has to compute a difference
+
+#define ANIM_MAGIC        "EPDANIM"
+#define ANIM_VERSION      1
+#define ANIM_HEADER_SIZE  24
+
+// one decoded frame record
+typedef struct {
+	uint16_t duration;         // milliseconds to show this frame
+	uint16_t line_count;       // number of changed lines
+	const uint16_t *lines;     // changed line numbers
+	const uint8_t *changes;    // line_count * bytes_per_line XOR bytes
+} ANIM_frame;
+
+// type to hold a loaded animation
+typedef struct ANIM_struct ANIM_type;
+
+
+// functions
+// =========
+
+// load and validate an animation file
+// returns NULL on error
+ANIM_type *ANIM_load(const char *path);
+
+// release memory
+void ANIM_destroy(ANIM_type *anim);
+
+// geometry
+int ANIM_width(const ANIM_type *anim);
+int ANIM_height(const ANIM_type *anim);
+int ANIM_bytes_per_line(const ANIM_type *anim);
+
+// number of frames (always at least one)
+int ANIM_frame_count(const ANIM_type *anim);
+
+// the full first image
+const uint8_t *ANIM_keyframe(const ANIM_type *anim);
+
+// the n'th frame record (0 <= n < frame count)
+const ANIM_frame *ANIM_frame_get(const ANIM_type *anim, int n);
+
+// apply a frame record's XOR masks to an image in place
+void ANIM_apply(const ANIM_type *anim, const ANIM_frame *frame, uint8_t *image);
+
+// offline builder: write an animation of count full frames
+// each frame is height * (width / 8) bytes in panel order
+// returns false on error
+bool ANIM_build(FILE *out, int width, int height,
+		const uint8_t *const *frames, const uint16_t *durations, int count);
+
+#endif
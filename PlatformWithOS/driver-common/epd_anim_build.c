@@ -0,0 +1,153 @@
+// Copyright 2013-2015 Pervasive Displays, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at:
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+// express or implied.  See the License for the specific language
+// governing permissions and limitations under the License.
+
+// build a .epdanim file from a sequence of panel images
+// images are raw binary as produced by: ./xbm2bin < image.xbm > image.bin
+// this runs offline (no panel required) so all frame differences are
+// computed once here rather than on the device
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <err.h>
+
+#include "epd_anim.h"
+
+
+static const struct {
+	const char *key;
+	int width;
+	int height;
+} panels[] = {
+	{"1.44", 128, 96},
+	{"1.9",  144, 128},
+	{"2.0",  200, 96},
+	{"2.6",  232, 128},
+	{"2.7",  264, 176},
+	{NULL, 0, 0}  // must be last entry
+};
+
+
+static void usage(const char *program) {
+	fprintf(stderr,
+		"usage: %s [options] output.epdanim frame.bin[@ms] ...\n"
+		"\n"
+		"options:\n"
+		"    -p SIZE   panel size: 1.44 1.9 2.0 2.6 2.7 (default 2.0)\n"
+		"    -d MS     default frame duration in milliseconds (default 500)\n"
+		"    -h        print help\n",
+		program);
+	exit(1);
+}
+
+
+int main(int argc, char *argv[]) {
+	const char *panel_key = "2.0";
+	long default_duration = 500;
+
+	int c;
+	while (-1 != (c = getopt(argc, argv, "hp:d:"))) {
+		switch (c) {
+		case 'p':
+			panel_key = optarg;
+			break;
+		case 'd':
+			default_duration = strtol(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (argc - optind < 2) {
+		usage(argv[0]);
+	}
+
+	int p = 0;
+	for (; NULL != panels[p].key; ++p) {
+		if (0 == strcmp(panels[p].key, panel_key)) {
+			break;
+		}
+	}
+	if (NULL == panels[p].key) {
+		errx(1, "unsupported panel: %s", panel_key);
+	}
+
+	const char *output = argv[optind++];
+	int count = argc - optind;
+	size_t frame_size = panels[p].height * panels[p].width / 8;
+
+	uint8_t **frames = calloc(count, sizeof(uint8_t *));
+	uint16_t *durations = calloc(count, sizeof(uint16_t));
+	if (NULL == frames || NULL == durations) {
+		err(1, "calloc");
+	}
+
+	for (int i = 0; i < count; ++i) {
+		char *name = strdup(argv[optind + i]);
+		if (NULL == name) {
+			err(1, "strdup");
+		}
+
+		// optional per frame duration suffix: name@ms
+		long duration = default_duration;
+		char *at = strrchr(name, '@');
+		if (NULL != at) {
+			char *end = NULL;
+			long ms = strtol(at + 1, &end, 10);
+			if ('\0' != at[1] && '\0' == *end) {
+				duration = ms;
+				*at = '\0';
+			}
+		}
+		if (duration < 0 || duration > 65535) {
+			errx(1, "%s: duration out of range: %ld", name, duration);
+		}
+		durations[i] = duration;
+
+		frames[i] = malloc(frame_size);
+		if (NULL == frames[i]) {
+			err(1, "malloc");
+		}
+		FILE *f = fopen(name, "rb");
+		if (NULL == f) {
+			err(1, "cannot open: %s", name);
+		}
+		if (1 != fread(frames[i], frame_size, 1, f)) {
+			errx(1, "%s: expected %zu bytes for panel %s", name, frame_size, panel_key);
+		}
+		fclose(f);
+		free(name);
+	}
+
+	FILE *out = fopen(output, "wb");
+	if (NULL == out) {
+		err(1, "cannot create: %s", output);
+	}
+	bool ok = ANIM_build(out, panels[p].width, panels[p].height,
+			     (const uint8_t *const *)frames, durations, count);
+	if (0 != fclose(out) || !ok) {
+		unlink(output);
+		errx(1, "failed to write: %s", output);
+	}
+
+	for (int i = 0; i < count; ++i) {
+		free(frames[i]);
+	}
+	free(frames);
+	free(durations);
+	return 0;
+}
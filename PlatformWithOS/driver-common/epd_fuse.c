@@ -33,6 +33,8 @@
 #include "gpio.h"
 #include "spi.h"
 #include "epd.h"
+#include "epd_trace.h"
+#include "epd_stats.h"
 #include EPD_IO
 
 
@@ -49,6 +51,7 @@ static const char *display_path          = "/display";          // the next imag
 static const char *display_inverted_path = "/display_inverse";  // the next image to display
 static const char *command_path          = "/command";          // any write transfers display -> EPD and updates current
 static const char *temperature_path      = "/temperature";      // read/write temperature compensation setting
+static const char *stats_path            = "/stats";            // performance counters as JSON
 
 static const char *spi_device = SPI_DEVICE;        // default SPI device path
 static const uint32_t spi_bps = SPI_BPS;           // default SPI device speed
@@ -177,6 +180,13 @@ static int display_getattr(const char *path, struct stat *stbuf) {
 		stbuf->st_nlink = 1;
 		stbuf->st_size = 4;
 
+	} else if (strcmp(path, stats_path) == 0) {
+		EPD_stats stats;
+		EPD_stats_get(&stats);
+		stbuf->st_mode = S_IFREG | 0444;
+		stbuf->st_nlink = 1;
+		stbuf->st_size = EPD_stats_format(&stats, NULL, 0);
+
 	} else {
 		return display_subdir_getattr(path, stbuf);
 	}
@@ -200,6 +210,7 @@ static int display_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
 		filler(buf, panel_path + 1, NULL, 0);
 		filler(buf, command_path + 1, NULL, 0);
 		filler(buf, temperature_path + 1, NULL, 0);
+		filler(buf, stats_path + 1, NULL, 0);
 		filler(buf, version_path + 1, NULL, 0);
 		return 0;
 	} else if (strcmp(path, "/BE") == 0 ||
@@ -225,6 +236,10 @@ static int display_open(const char *path, struct fuse_file_info *fi) {
 	} else if (strcmp(path, panel_path) == 0 ||
 		   strcmp(path, version_path) == 0) {
 		write_allowed = false;
+	} else if (strcmp(path, stats_path) == 0) {
+		// changes on every update so bypass the page cache
+		fi->direct_io = 1;
+		write_allowed = false;
 	} else {
 		if (strncmp(path, "/BE/", 4) == 0) {
 			path += 3;
@@ -348,6 +363,12 @@ static int display_read(const char *path, char *buffer, size_t size, off_t offse
 		char t_buffer[16];
 		int length = snprintf(t_buffer, sizeof(t_buffer), "%3d\n", t);
 		return buffer_read(buffer, size, offset, t_buffer, length, false, false);
+	} else if (strcmp(path, stats_path) == 0) {
+		EPD_stats stats;
+		char stats_buffer[EPD_STATS_FORMAT_SIZE];
+		EPD_stats_get(&stats);
+		int length = EPD_stats_format(&stats, stats_buffer, sizeof(stats_buffer));
+		return buffer_read(buffer, size, offset, stats_buffer, length, false, false);
 	}
 
 	// test big/little endian
@@ -425,6 +446,9 @@ static int display_write(const char *path, const char *buffer, size_t size, off_
 
 static void *display_init(struct fuse_conn_info *conn) {
 
+	// after fuse has daemonised so the trace has the right pid
+	EPD_trace_setup_env();
+
 	if (!GPIO_setup()) {
 		warn("GPIO_setup failed");
 		goto done;
@@ -558,6 +582,8 @@ static void special_memcpy(char *d, const char *s, size_t size, bool bit_reverse
 
 // run a command
 static void run_command(const char c) {
+	EPD_TRACE_BEGIN(fuse_command, c);
+	uint64_t start_us = EPD_stats_now_us();
 	switch(c) {
 	case 'C':  // clear the display
 		EPD_set_temperature(epd, temperature);
@@ -567,6 +593,7 @@ static void run_command(const char c) {
 		}
 		EPD_clear(epd);
 		EPD_end(epd);
+		EPD_stats_update_done(EPD_STATS_CLEAR, EPD_OK == EPD_status(epd), EPD_stats_now_us() - start_us);
 
 		memset(current_buffer, 0, sizeof(current_buffer));
 		break;
@@ -585,6 +612,7 @@ static void run_command(const char c) {
 #error "unsupported EPD_image() function"
 #endif
 		EPD_end(epd);
+		EPD_stats_update_done(EPD_STATS_FULL, EPD_OK == EPD_status(epd), EPD_stats_now_us() - start_us);
 
 		memcpy(current_buffer, display_buffer, sizeof(display_buffer));
 		break;
@@ -612,13 +640,22 @@ static void run_command(const char c) {
 		// Do not switch off COG when doing a partial update.
 		EPD_end(epd);
 #endif
+		EPD_stats_update_done(EPD_STATS_PARTIAL, EPD_OK == EPD_status(epd), EPD_stats_now_us() - start_us);
 
 		memcpy(current_buffer, display_buffer, sizeof(display_buffer));
 		break;
 
+	case 'T':  // save the trace ring to $EPD_TRACE_FILE
+		if (NULL != getenv("EPD_TRACE_FILE")) {
+			EPD_trace_save(getenv("EPD_TRACE_FILE"));
+			EPD_trace_reset();
+		}
+		break;
+
 	default:
 		break;
 	}
+	EPD_TRACE_END(fuse_command, c);
 }
 
 
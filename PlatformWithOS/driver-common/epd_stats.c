@@ -0,0 +1,231 @@
+// Copyright 2013-2015 Pervasive Displays, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at:
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+// express or implied.  See the License for the specific language
+// governing permissions and limitations under the License.
+
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <err.h>
+#include <pthread.h>
+
+#include "epd_stats.h"
+
+
+// per thread counters, linked so a reader can find them all
+typedef struct stats_block {
+	EPD_stats counters;
+	struct stats_block *next;
+} stats_block;
+
+#define COUNTER_COUNT (sizeof(EPD_stats) / sizeof(uint64_t))
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t key;
+
+static stats_block *blocks = NULL;         // live threads
+static EPD_stats retired;                  // threads that have exited
+static EPD_stats fallback;                 // used if a block cannot be allocated
+
+static __thread stats_block *local_block = NULL;
+
+static const char *const update_names[EPD_STATS_UPDATE_KINDS] = {
+	[EPD_STATS_CLEAR] = "clear",
+	[EPD_STATS_FULL] = "full",
+	[EPD_STATS_PARTIAL] = "partial",
+	[EPD_STATS_BLINK] = "blink",
+	[EPD_STATS_ANIMATE] = "animate",
+};
+
+static const char *const phase_names[EPD_STATS_PHASES] = {
+	[EPD_STATS_PHASE_BEGIN] = "begin",
+	[EPD_STATS_PHASE_STAGE] = "stage",
+	[EPD_STATS_PHASE_END] = "end",
+	[EPD_STATS_PHASE_UPDATE] = "update",
+};
+
+
+// add every counter of one block into a total
+static void add_counters(EPD_stats *total, const EPD_stats *counters) {
+	uint64_t *t = (uint64_t *)total;
+	const uint64_t *c = (const uint64_t *)counters;
+	for (size_t i = 0; i < COUNTER_COUNT; ++i) {
+		t[i] += __atomic_load_n(&c[i], __ATOMIC_RELAXED);
+	}
+}
+
+
+// thread exit: keep its counts and release the block
+static void retire_block(void *p) {
+	stats_block *block = p;
+
+	pthread_mutex_lock(&lock);
+	for (stats_block **b = &blocks; NULL != *b; b = &(*b)->next) {
+		if (*b == block) {
+			*b = block->next;
+			break;
+		}
+	}
+	add_counters(&retired, &block->counters);
+	pthread_mutex_unlock(&lock);
+
+	free(block);
+}
+
+
+static void make_key(void) {
+	if (0 != pthread_key_create(&key, retire_block)) {
+		warn("stats: cannot create thread key");
+	}
+}
+
+
+EPD_stats *EPD_stats_local(void) {
+	if (__builtin_expect(NULL != local_block, 1)) {
+		return &local_block->counters;
+	}
+
+	pthread_once(&key_once, make_key);
+
+	stats_block *block = calloc(1, sizeof(stats_block));
+	if (NULL == block) {
+		// still counted, just shared between threads
+		return &fallback;
+	}
+
+	pthread_mutex_lock(&lock);
+	block->next = blocks;
+	blocks = block;
+	pthread_mutex_unlock(&lock);
+
+	pthread_setspecific(key, block);
+	local_block = block;
+	return &block->counters;
+}
+
+
+void EPD_stats_get(EPD_stats *stats) {
+	memset(stats, 0, sizeof(*stats));
+
+	pthread_mutex_lock(&lock);
+	add_counters(stats, &retired);
+	add_counters(stats, &fallback);
+	for (const stats_block *b = blocks; NULL != b; b = b->next) {
+		add_counters(stats, &b->counters);
+	}
+	pthread_mutex_unlock(&lock);
+}
+
+
+uint64_t EPD_stats_now_us(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+void EPD_stats_latency(EPD_stats_phase phase, uint64_t us) {
+	uint64_t ms = us / 1000;
+	int bucket = 0 == ms ? 0 : 64 - __builtin_clzll(ms);
+	if (bucket >= EPD_STATS_BUCKETS) {
+		bucket = EPD_STATS_BUCKETS - 1;
+	}
+	EPD_STATS_ADD(latency[phase][bucket], 1);
+	EPD_STATS_ADD(latency_us[phase], us);
+}
+
+
+void EPD_stats_update_done(EPD_stats_update kind, bool ok, uint64_t us) {
+	EPD_STATS_ADD(updates[kind], 1);
+	if (!ok) {
+		EPD_STATS_ADD(failures, 1);
+	}
+	EPD_stats_latency(EPD_STATS_PHASE_UPDATE, us);
+}
+
+
+void EPD_stats_stage(int stage, int frames, uint64_t us, uint64_t planned_us) {
+	if (stage < 0 || stage >= EPD_STATS_STAGES) {
+		return;
+	}
+	EPD_STATS_ADD(stages[stage], 1);
+	EPD_STATS_ADD(stage_frames[stage], frames);
+	EPD_STATS_ADD(stage_us[stage], us);
+	EPD_STATS_ADD(stage_planned_us[stage], planned_us);
+	EPD_stats_latency(EPD_STATS_PHASE_STAGE, us);
+}
+
+
+// append to the buffer, counting the length even when it is full
+#define APPEND(...)							\
+	do {								\
+		int n = snprintf(size > (size_t)length ? buffer + length : NULL, \
+				 size > (size_t)length ? size - length : 0, __VA_ARGS__); \
+		if (n > 0) {						\
+			length += n;					\
+		}							\
+	} while (0)
+
+int EPD_stats_format(const EPD_stats *stats, char *buffer, size_t size) {
+	int length = 0;
+
+	APPEND("{\n  \"updates\": {");
+	for (int k = 0; k < EPD_STATS_UPDATE_KINDS; ++k) {
+		APPEND("\"%s\": %llu, ", update_names[k], (unsigned long long)stats->updates[k]);
+	}
+	APPEND("\"failures\": %llu},\n", (unsigned long long)stats->failures);
+
+	APPEND("  \"latency\": {\n");
+	for (int p = 0; p < EPD_STATS_PHASES; ++p) {
+		uint64_t count = 0;
+		for (int b = 0; b < EPD_STATS_BUCKETS; ++b) {
+			count += stats->latency[p][b];
+		}
+		APPEND("    \"%s\": {\"count\": %llu, \"total_us\": %llu, \"ms_log2\": [",
+		       phase_names[p], (unsigned long long)count,
+		       (unsigned long long)stats->latency_us[p]);
+		for (int b = 0; b < EPD_STATS_BUCKETS; ++b) {
+			APPEND("%s%llu", 0 == b ? "" : ", ", (unsigned long long)stats->latency[p][b]);
+		}
+		APPEND("]}%s\n", p < EPD_STATS_PHASES - 1 ? "," : "");
+	}
+	APPEND("  },\n");
+
+	APPEND("  \"stages\": [\n");
+	for (int s = 0; s < EPD_STATS_STAGES; ++s) {
+		APPEND("    {\"stage\": %d, \"count\": %llu, \"frames\": %llu, \"us\": %llu, \"planned_us\": %llu}%s\n",
+		       s, (unsigned long long)stats->stages[s],
+		       (unsigned long long)stats->stage_frames[s],
+		       (unsigned long long)stats->stage_us[s],
+		       (unsigned long long)stats->stage_planned_us[s],
+		       s < EPD_STATS_STAGES - 1 ? "," : "");
+	}
+	APPEND("  ],\n");
+
+	APPEND("  \"spi\": {\"bytes\": %llu, \"transfers\": %llu, \"errors\": %llu},\n",
+	       (unsigned long long)stats->spi_bytes,
+	       (unsigned long long)stats->spi_transfers,
+	       (unsigned long long)stats->spi_errors);
+	APPEND("  \"busy_wait\": {\"count\": %llu, \"us\": %llu},\n",
+	       (unsigned long long)stats->busy_waits,
+	       (unsigned long long)stats->busy_wait_us);
+	APPEND("  \"animation\": {\"frames\": %llu, \"late\": %llu}\n}\n",
+	       (unsigned long long)stats->animation_frames,
+	       (unsigned long long)stats->animation_late);
+
+	return length;
+}
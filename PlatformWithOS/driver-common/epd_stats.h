@@ -0,0 +1,107 @@
+// Copyright 2013-2015 Pervasive Displays, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at:
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+// express or implied.  See the License for the specific language
+// governing permissions and limitations under the License.
+
+// performance counters shared by the drivers and daemons
+//
+// each thread counts into its own block (no locking, no shared cache
+// lines); EPD_stats_get() adds up all the blocks for a reader, and
+// blocks of finished threads are folded into a total
+
+#if !defined(EPD_STATS_H)
+#define EPD_STATS_H 1
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef enum {
+	EPD_STATS_CLEAR,
+	EPD_STATS_FULL,
+	EPD_STATS_PARTIAL,
+	EPD_STATS_BLINK,
+	EPD_STATS_ANIMATE,
+	EPD_STATS_UPDATE_KINDS       // must be last
+} EPD_stats_update;
+
+typedef enum {
+	EPD_STATS_PHASE_BEGIN,       // EPD_begin: power up and DC/DC
+	EPD_STATS_PHASE_STAGE,       // one stage of frames
+	EPD_STATS_PHASE_END,         // EPD_end: power down
+	EPD_STATS_PHASE_UPDATE,      // whole update request
+	EPD_STATS_PHASES             // must be last
+} EPD_stats_phase;
+
+// latency histogram: bucket 0 is < 1 ms, bucket n is [2^(n-1), 2^n) ms
+// and the last bucket collects everything longer
+#define EPD_STATS_BUCKETS 16
+
+// stage numbers as used by the drivers (V230 uses 1..3)
+#define EPD_STATS_STAGES 4
+
+typedef struct {
+	uint64_t updates[EPD_STATS_UPDATE_KINDS];
+	uint64_t failures;                          // COG did not start or stop cleanly
+
+	uint64_t latency[EPD_STATS_PHASES][EPD_STATS_BUCKETS];
+	uint64_t latency_us[EPD_STATS_PHASES];      // sum for the mean
+
+	uint64_t stages[EPD_STATS_STAGES];
+	uint64_t stage_frames[EPD_STATS_STAGES];
+	uint64_t stage_us[EPD_STATS_STAGES];        // time taken
+	uint64_t stage_planned_us[EPD_STATS_STAGES];// time from temperature compensation
+
+	uint64_t spi_bytes;
+	uint64_t spi_transfers;
+	uint64_t spi_errors;                        // failed ioctl
+
+	uint64_t busy_waits;
+	uint64_t busy_wait_us;
+
+	uint64_t animation_frames;
+	uint64_t animation_late;                    // frames shown after their deadline
+} EPD_stats;
+
+
+// functions
+// =========
+
+// the calling thread's counters (registered on first use)
+EPD_stats *EPD_stats_local(void);
+
+// add up the counters of all threads
+void EPD_stats_get(EPD_stats *stats);
+
+// write stats as JSON, returns the length like snprintf
+#define EPD_STATS_FORMAT_SIZE 4096   // always enough
+int EPD_stats_format(const EPD_stats *stats, char *buffer, size_t size);
+
+// monotonic time for the intervals below
+uint64_t EPD_stats_now_us(void);
+
+// record an interval in a latency histogram
+void EPD_stats_latency(EPD_stats_phase phase, uint64_t us);
+
+// record a completed update request
+void EPD_stats_update_done(EPD_stats_update kind, bool ok, uint64_t us);
+
+// record one stage: frames sent against the planned stage time
+// (planned_us is 0 for stages with a fixed frame count)
+void EPD_stats_stage(int stage, int frames, uint64_t us, uint64_t planned_us);
+
+
+// hot path counters: one relaxed atomic add on the thread's own block
+#define EPD_STATS_ADD(field, n) \
+	((void)__atomic_fetch_add(&EPD_stats_local()->field, (n), __ATOMIC_RELAXED))
+
+#endif
@@ -25,6 +25,7 @@
 #include "gpio.h"
 #include "spi.h"
 #include "epd.h"
+#include "epd_trace.h"
 #include EPD_IO
 
 // 1.44" test images
@@ -204,6 +205,8 @@ int main(int argc, char *argv[]) {
 		image_count = n;
 	}
 
+	EPD_trace_setup_env();
+
 	if (!GPIO_setup()) {
 		rc = 1;
 		warn("GPIO_setup failed");
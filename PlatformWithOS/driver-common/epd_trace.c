@@ -0,0 +1,240 @@
+// Copyright 2013-2015 Pervasive Displays, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at:
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+// express or implied.  See the License for the specific language
+// governing permissions and limitations under the License.
+
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <err.h>
+#include <sys/syscall.h>
+
+#include "epd_trace.h"
+
+
+// one recorded event
+typedef struct {
+	uint64_t ns;        // CLOCK_MONOTONIC
+	const char *name;   // string literal from the trace point
+	int64_t arg;
+	int32_t tid;
+	char phase;
+} trace_event;
+
+int EPD_trace_sinks = EPD_TRACE_OFF;
+
+static trace_event *ring = NULL;
+static uint32_t ring_mask = 0;      // ring size - 1 (size is a power of 2)
+static uint32_t ring_next = 0;      // total events written (wraps)
+static int marker_fd = -1;
+static int32_t pid = 0;
+static __thread int32_t tid = 0;
+
+static const char *const marker_paths[] = {
+	"/sys/kernel/tracing/trace_marker",
+	"/sys/kernel/debug/tracing/trace_marker",
+};
+
+static const char *save_path = NULL;
+
+
+static void save_at_exit(void) {
+	if (NULL != save_path) {
+		EPD_trace_save(save_path);
+	}
+}
+
+
+bool EPD_trace_setup(int sinks, unsigned int ring_events) {
+	bool ok = true;
+
+	EPD_trace_teardown();
+	pid = getpid();
+
+	if (0 != (sinks & EPD_TRACE_RING)) {
+		if (0 == ring_events) {
+			ring_events = EPD_TRACE_RING_EVENTS;
+		}
+		uint32_t size = 1;
+		while (size < ring_events) {
+			size <<= 1;
+		}
+		ring = calloc(size, sizeof(trace_event));
+		if (NULL == ring) {
+			warn("trace: cannot allocate %u events", size);
+			sinks &= ~EPD_TRACE_RING;
+			ok = false;
+		} else {
+			ring_mask = size - 1;
+			ring_next = 0;
+		}
+	}
+
+	if (0 != (sinks & EPD_TRACE_MARKER)) {
+		for (size_t i = 0; marker_fd < 0 && i < sizeof(marker_paths) / sizeof(marker_paths[0]); ++i) {
+			marker_fd = open(marker_paths[i], O_WRONLY | O_CLOEXEC);
+		}
+		if (marker_fd < 0) {
+			warn("trace: cannot open trace_marker");
+			sinks &= ~EPD_TRACE_MARKER;
+			ok = false;
+		}
+	}
+
+	EPD_trace_sinks = sinks;
+	return ok;
+}
+
+
+void EPD_trace_setup_env(void) {
+	const char *value = getenv("EPD_TRACE");
+	if (NULL == value || '\0' == *value) {
+		return;
+	}
+
+	int sinks = EPD_TRACE_OFF;
+	if (NULL != strstr(value, "ring")) {
+		sinks |= EPD_TRACE_RING;
+	}
+	if (NULL != strstr(value, "marker")) {
+		sinks |= EPD_TRACE_MARKER;
+	}
+	EPD_trace_setup(sinks, 0);
+
+	const char *path = getenv("EPD_TRACE_FILE");
+	if (NULL != path && '\0' != *path && NULL != ring) {
+		if (NULL == save_path) {
+			atexit(save_at_exit);
+		}
+		save_path = path;
+	}
+}
+
+
+void EPD_trace_teardown(void) {
+	EPD_trace_sinks = EPD_TRACE_OFF;
+	free(ring);
+	ring = NULL;
+	ring_mask = 0;
+	ring_next = 0;
+	if (marker_fd >= 0) {
+		close(marker_fd);
+		marker_fd = -1;
+	}
+}
+
+
+void EPD_trace_reset(void) {
+	__atomic_store_n(&ring_next, 0, __ATOMIC_RELEASE);
+}
+
+
+void EPD_trace_event(char phase, const char *name, int64_t arg) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	if (0 == tid) {
+		tid = syscall(SYS_gettid);
+	}
+
+	if (NULL != ring) {
+		uint32_t n = __atomic_fetch_add(&ring_next, 1, __ATOMIC_RELAXED);
+		trace_event *e = &ring[n & ring_mask];
+		e->ns = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+		e->name = name;
+		e->arg = arg;
+		e->tid = tid;
+		e->phase = phase;
+	}
+
+	if (marker_fd >= 0) {
+		// systrace format: B|pid|name, E|pid, C|pid|name|value, I|pid|name
+		char buffer[128];
+		int length;
+		switch (phase) {
+		case EPD_TRACE_PHASE_BEGIN:
+			length = snprintf(buffer, sizeof(buffer), "B|%d|%s %lld", pid, name, (long long)arg);
+			break;
+		case EPD_TRACE_PHASE_END:
+			length = snprintf(buffer, sizeof(buffer), "E|%d", pid);
+			break;
+		case EPD_TRACE_PHASE_COUNTER:
+			length = snprintf(buffer, sizeof(buffer), "C|%d|%s|%lld", pid, name, (long long)arg);
+			break;
+		default:
+			length = snprintf(buffer, sizeof(buffer), "I|%d|%s %lld", pid, name, (long long)arg);
+			break;
+		}
+		if (write(marker_fd, buffer, length) < 0) {
+			// tracing may have been switched off, nothing to do
+		}
+	}
+}
+
+
+bool EPD_trace_export(FILE *out) {
+	uint32_t next = __atomic_load_n(&ring_next, __ATOMIC_ACQUIRE);
+	uint32_t count = 0;
+	uint32_t first = 0;
+	if (NULL != ring) {
+		count = next > ring_mask + 1 ? ring_mask + 1 : next;
+		first = next - count;
+	}
+
+	fprintf(out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	for (uint32_t i = 0; i < count; ++i) {
+		const trace_event *e = &ring[(first + i) & ring_mask];
+		fprintf(out, "%s{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%llu.%03u,\"pid\":%d,\"tid\":%d",
+			0 == i ? "" : ",\n",
+			e->name, e->phase,
+			(unsigned long long)(e->ns / 1000), (unsigned int)(e->ns % 1000),
+			pid, e->tid);
+		switch (e->phase) {
+		case EPD_TRACE_PHASE_COUNTER:
+			fprintf(out, ",\"args\":{\"%s\":%lld}}", e->name, (long long)e->arg);
+			break;
+		case EPD_TRACE_PHASE_INSTANT:
+			fprintf(out, ",\"s\":\"t\",\"args\":{\"arg\":%lld}}", (long long)e->arg);
+			break;
+		default:
+			fprintf(out, ",\"args\":{\"%s\":%lld}}",
+				EPD_TRACE_PHASE_END == e->phase ? "result" : "arg", (long long)e->arg);
+			break;
+		}
+	}
+	fprintf(out, "\n]}\n");
+
+	return !ferror(out);
+}
+
+
+bool EPD_trace_save(const char *path) {
+	FILE *out = fopen(path, "w");
+	if (NULL == out) {
+		warn("trace: cannot create: %s", path);
+		return false;
+	}
+	bool ok = EPD_trace_export(out);
+	if (0 != fclose(out)) {
+		ok = false;
+	}
+	if (!ok) {
+		warn("trace: write failed: %s", path);
+	}
+	return ok;
+}
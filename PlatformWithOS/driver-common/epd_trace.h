@@ -0,0 +1,121 @@
+// Copyright 2013-2015 Pervasive Displays, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at:
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+// express or implied.  See the License for the specific language
+// governing permissions and limitations under the License.
+
+// trace points for the update pipeline
+//
+// the EPD_TRACE_* macros compile to nothing unless EPD_TRACE is
+// non-zero (make TRACE=1, the default); EPD_TRACE_USDT adds a
+// systemtap/bpftrace probe "epd:<name>" at every trace point
+//
+// at run time nothing is recorded until EPD_trace_setup() selects
+// where the events go, so a disabled trace point costs one test:
+//   EPD_TRACE_RING    in memory ring, dump with EPD_trace_export()
+//   EPD_TRACE_MARKER  write to the ftrace trace_marker in the
+//                     systrace format understood by perfetto
+// EPD_trace_setup_env() does the same from $EPD_TRACE ("ring",
+// "marker" or "ring,marker") and saves the ring to $EPD_TRACE_FILE
+// at exit
+
+#if !defined(EPD_TRACE_H)
+#define EPD_TRACE_H 1
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#if !defined(EPD_TRACE)
+#define EPD_TRACE 0
+#endif
+
+typedef enum {
+	EPD_TRACE_OFF = 0,
+	EPD_TRACE_RING = 0x01,
+	EPD_TRACE_MARKER = 0x02
+} EPD_trace_sink;
+
+// event phases (Chrome trace "ph" values)
+#define EPD_TRACE_PHASE_BEGIN   'B'
+#define EPD_TRACE_PHASE_END     'E'
+#define EPD_TRACE_PHASE_INSTANT 'i'
+#define EPD_TRACE_PHASE_COUNTER 'C'
+
+// default ring size in events
+#define EPD_TRACE_RING_EVENTS 16384
+
+// currently selected sinks, tested by every trace point
+extern int EPD_trace_sinks;
+
+
+// functions
+// =========
+
+// select sinks, ring_events = 0 for the default size
+// returns false if a sink could not be set up (the others still work)
+bool EPD_trace_setup(int sinks, unsigned int ring_events);
+
+// configure from the environment (see above)
+void EPD_trace_setup_env(void);
+
+// stop tracing and release the ring and trace_marker
+void EPD_trace_teardown(void);
+
+// discard the events in the ring
+void EPD_trace_reset(void);
+
+// write the ring as Chrome trace JSON (chrome://tracing, perfetto)
+// oldest events first; call when no update is running
+bool EPD_trace_export(FILE *out);
+
+// EPD_trace_export to a file
+bool EPD_trace_save(const char *path);
+
+// record one event; name must be a string literal
+void EPD_trace_event(char phase, const char *name, int64_t arg);
+
+
+// trace points
+// ============
+// name is a bare identifier (it is also the USDT probe name)
+// arg is only evaluated when the event is recorded
+
+#if EPD_TRACE_USDT
+#include <sys/sdt.h>
+#define EPD_TRACE_PROBE(phase, name, arg) DTRACE_PROBE2(epd, name, phase, (int64_t)(arg))
+#else
+#define EPD_TRACE_PROBE(phase, name, arg) do {} while (0)
+#endif
+
+#if EPD_TRACE
+#define EPD_TRACE_POINT(phase, name, arg)				\
+	do {								\
+		EPD_TRACE_PROBE(phase, name, arg);			\
+		if (__builtin_expect(0 != EPD_trace_sinks, 0)) {	\
+			EPD_trace_event(phase, #name, (arg));		\
+		}							\
+	} while (0)
+#else
+#define EPD_TRACE_POINT(phase, name, arg) do { (void)sizeof(arg); } while (0)
+#endif
+
+// a duration, the end arg is added to the begin arg in the trace
+#define EPD_TRACE_BEGIN(name, arg) EPD_TRACE_POINT(EPD_TRACE_PHASE_BEGIN, name, arg)
+#define EPD_TRACE_END(name, arg) EPD_TRACE_POINT(EPD_TRACE_PHASE_END, name, arg)
+
+// a single point in time
+#define EPD_TRACE_INSTANT(name, arg) EPD_TRACE_POINT(EPD_TRACE_PHASE_INSTANT, name, arg)
+
+// a value plotted over time
+#define EPD_TRACE_COUNTER(name, value) EPD_TRACE_POINT(EPD_TRACE_PHASE_COUNTER, name, value)
+
+#endif
@@ -35,8 +35,13 @@
 #include <sys/stat.h>
 #include <errno.h>
 #include <inttypes.h>
+#include <time.h>
 #include <json-c/json.h>
 #include "b64.h"
+#include "epd_anim.h"
+#include "epd_trace.h"
+#include "epd_stats.h"
+#include "spi_tune.h"
 #include "gpio.h"
 #include "spi.h"
 #include "epd.h"
@@ -52,7 +57,9 @@ static const char version_buffer[] = {STR(VERSION)};
 #define VERSION_SIZE (sizeof(version_buffer) - sizeof((char)'\0'))
 
 static const char *spi_device = SPI_DEVICE;        // default SPI device path
-static const uint32_t spi_bps = SPI_BPS;           // default SPI device speed
+static uint32_t spi_bps = SPI_BPS;                 // default SPI device speed
+static const char *spi_speed_file = NULL;          // saved speed for this unit
+static bool spi_calibrate = false;                 // find the speed at startup
 
 // expect that external process changes this just before update command
 // by sending text string e.g. shell:  echo 19 > /dev/epd/temperature
@@ -143,6 +150,13 @@ process_get_command(struct json_object *json_obj, int fd)
 		snprintf(t_buffer, sizeof(t_buffer), "%3d\n", t);
 		json_object_object_add(json_obj, "value",
 				       json_object_new_string(t_buffer));
+	} else if (strcmp("stats", param) == 0) {
+		EPD_stats stats;
+		char stats_buffer[EPD_STATS_FORMAT_SIZE];
+		EPD_stats_get(&stats);
+		EPD_stats_format(&stats, stats_buffer, sizeof(stats_buffer));
+		json_object_object_add(json_obj, "value",
+				       json_tokener_parse(stats_buffer));
 	} else {
                 json_object_object_add(json_obj, "result",
                                        json_object_new_string("failure"));
@@ -254,6 +268,25 @@ process_image_command(struct json_object *json_obj, int fd)
 	return 0;
 }
 
+// step the SPI clock up to 4 x the default while the COG still reads
+// back correctly, optionally saving the result for the next start
+static void spi_calibration(void)
+{
+	EPD_set_temperature(epd, temperature);
+	EPD_begin(epd);
+	if (EPD_OK != EPD_status(epd)) {
+		warn("EPD_begin failed, SPI speed not calibrated");
+		return;
+	}
+	uint32_t bps = SPI_tune(spi, 4 * SPI_BPS, SPI_tune_probe_cog, NULL);
+	EPD_end(epd);
+
+	fprintf(stderr, "SPI speed: %u Hz\n", bps);
+	if (NULL != spi_speed_file) {
+		SPI_tune_save(spi_speed_file, bps);
+	}
+}
+
 static void *display_init(void) {
 
 	if (!GPIO_setup()) {
@@ -292,6 +325,10 @@ static void *display_init(void) {
 		goto done_spi;
 	}
 
+	if (spi_calibrate) {
+		spi_calibration();
+	}
+
 	return (void *)epd;
 
 	// release resources
@@ -373,6 +410,7 @@ static void special_memcpy(char *d, const char *s, size_t size, bool bit_reverse
 static int
 process_clear_command(struct json_object *json_obj, int fd)
 {
+	uint64_t start_us = EPD_stats_now_us();
 	EPD_set_temperature(epd, temperature);
 	EPD_begin(epd);
 	if (EPD_OK != EPD_status(epd)) {
@@ -380,6 +418,7 @@ process_clear_command(struct json_object *json_obj, int fd)
 	}
 	EPD_clear(epd);
 	EPD_end(epd);
+	EPD_stats_update_done(EPD_STATS_CLEAR, EPD_OK == EPD_status(epd), EPD_stats_now_us() - start_us);
 
 	memset(current_buffer, 0, sizeof(current_buffer));
 
@@ -392,6 +431,7 @@ process_clear_command(struct json_object *json_obj, int fd)
 static int
 process_update_command(struct json_object *json_obj, int fd)
 {
+	uint64_t start_us = EPD_stats_now_us();
 	EPD_set_temperature(epd, temperature);
 	EPD_begin(epd);
 	if (EPD_OK != EPD_status(epd)) {
@@ -405,6 +445,7 @@ process_update_command(struct json_object *json_obj, int fd)
 #error "unsupported EPD_image() function"
 #endif
 	EPD_end(epd);
+	EPD_stats_update_done(EPD_STATS_FULL, EPD_OK == EPD_status(epd), EPD_stats_now_us() - start_us);
 
 	memcpy(current_buffer, display_buffer, sizeof(display_buffer));
 
@@ -417,6 +458,7 @@ process_update_command(struct json_object *json_obj, int fd)
 static int
 process_blink_command(struct json_object *json_obj, int fd)
 {
+	uint64_t start_us = EPD_stats_now_us();
 	EPD_set_temperature(epd, 29);
 	EPD_begin(epd);
 	if (EPD_OK != EPD_status(epd)) {
@@ -424,6 +466,7 @@ process_blink_command(struct json_object *json_obj, int fd)
 	}
 	EPD_blink(epd, (const uint8_t *)display_buffer);
 	EPD_end(epd);
+	EPD_stats_update_done(EPD_STATS_BLINK, EPD_OK == EPD_status(epd), EPD_stats_now_us() - start_us);
 
 	memcpy(current_buffer, display_buffer, sizeof(display_buffer));
 
@@ -436,6 +479,7 @@ process_blink_command(struct json_object *json_obj, int fd)
 static int
 process_partial_command(struct json_object *json_obj, int fd)
 {
+	uint64_t start_us = EPD_stats_now_us();
 	EPD_set_temperature(epd, temperature);
 	EPD_begin(epd);
 	if (EPD_OK != EPD_status(epd)) {
@@ -455,6 +499,7 @@ process_partial_command(struct json_object *json_obj, int fd)
 #endif
 
 	EPD_end(epd);
+	EPD_stats_update_done(EPD_STATS_PARTIAL, EPD_OK == EPD_status(epd), EPD_stats_now_us() - start_us);
 
 	memcpy(current_buffer, display_buffer, sizeof(display_buffer));
 	
@@ -465,6 +510,196 @@ process_partial_command(struct json_object *json_obj, int fd)
 	return 0;
 }
 
+// show one animation frame: current_buffer becomes the frame
+static void animation_frame(const ANIM_type *anim, const ANIM_frame *frame)
+{
+#if EPD_PARTIAL_LINES_AVAILABLE
+	// record already holds the change mask, so only send changed lines
+	ANIM_apply(anim, frame, (uint8_t *)current_buffer);
+	EPD_partial_lines(epd, (const uint8_t *)current_buffer,
+			  frame->changes, frame->lines, frame->line_count);
+#else
+	static char next_buffer[sizeof(current_buffer)];
+
+	memcpy(next_buffer, current_buffer, sizeof(next_buffer));
+	ANIM_apply(anim, frame, (uint8_t *)next_buffer);
+#if EPD_PARTIAL_AVAILABLE
+	EPD_partial_image(epd, (const uint8_t *)current_buffer, (const uint8_t *)next_buffer);
+#elif EPD_IMAGE_ONE_ARG
+	EPD_image(epd, (const uint8_t *)next_buffer);
+#elif EPD_IMAGE_TWO_ARG
+	EPD_image(epd, (const uint8_t *)current_buffer, (const uint8_t *)next_buffer);
+#else
+#error "unsupported EPD_image() function"
+#endif
+	memcpy(current_buffer, next_buffer, sizeof(current_buffer));
+#endif
+}
+
+// wait until duration milliseconds after *deadline and advance it
+// a frame that took longer than its duration is not delayed further
+// and is counted as late
+static void animation_wait(struct timespec *deadline, int duration)
+{
+	deadline->tv_sec += duration / 1000;
+	deadline->tv_nsec += (duration % 1000) * 1000000;
+	if (deadline->tv_nsec >= 1000000000) {
+		deadline->tv_nsec -= 1000000000;
+		++deadline->tv_sec;
+	}
+
+	// checked before sleeping: after the sleep now is always a little
+	// past the deadline, and restarting from it would add the wakeup
+	// latency to every frame
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (now.tv_sec > deadline->tv_sec
+	    || (now.tv_sec == deadline->tv_sec && now.tv_nsec > deadline->tv_nsec)) {
+		*deadline = now;
+		EPD_STATS_ADD(animation_late, 1);
+		return;
+	}
+	while (EINTR == clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, deadline, NULL)) {
+	}
+}
+
+static int
+process_animate_command(struct json_object *json_obj, int fd)
+{
+	json_object *file_obj = NULL;
+	json_object *repeat_obj = NULL;
+	int repeat = 1;
+
+	if (!json_object_object_get_ex(json_obj, "file", &file_obj)) {
+		json_object_object_add(json_obj, "result",
+		                       json_object_new_string("failure"));
+		json_object_object_add(json_obj, "reason",
+		                       json_object_new_string("Missing 'file'"));
+		return -ENOENT;
+	}
+	if (json_object_object_get_ex(json_obj, "repeat", &repeat_obj)) {
+		repeat = json_object_get_int(repeat_obj);
+		if (repeat < 1) {
+			repeat = 1;
+		}
+	}
+
+	ANIM_type *anim = ANIM_load(json_object_get_string(file_obj));
+	if (NULL == anim) {
+		json_object_object_add(json_obj, "result",
+		                       json_object_new_string("failure"));
+		json_object_object_add(json_obj, "reason",
+		                       json_object_new_string("Invalid animation file"));
+		return -EINVAL;
+	}
+	if (ANIM_width(anim) != panel->width || ANIM_height(anim) != panel->height) {
+		ANIM_destroy(anim);
+		json_object_object_add(json_obj, "result",
+		                       json_object_new_string("failure"));
+		json_object_object_add(json_obj, "reason",
+		                       json_object_new_string("Animation does not match panel"));
+		return -EINVAL;
+	}
+
+	uint64_t start_us = EPD_stats_now_us();
+	EPD_set_temperature(epd, temperature);
+	EPD_begin(epd);
+	if (EPD_OK != EPD_status(epd)) {
+		warn("EPD_begin failed");
+	}
+
+	// keyframe is the only full image, everything after it is a
+	// precomputed change so no frame is compared at run time
+	size_t frame_size = ANIM_height(anim) * ANIM_bytes_per_line(anim);
+	memcpy(display_buffer, ANIM_keyframe(anim), frame_size);
+#if EPD_PARTIAL_AVAILABLE
+	EPD_partial_image(epd, (const uint8_t *)current_buffer, (const uint8_t *)display_buffer);
+#elif EPD_IMAGE_ONE_ARG
+	EPD_image(epd, (const uint8_t *)display_buffer);
+#elif EPD_IMAGE_TWO_ARG
+	EPD_image(epd, (const uint8_t *)current_buffer, (const uint8_t *)display_buffer);
+#else
+#error "unsupported EPD_image() function"
+#endif
+	memcpy(current_buffer, display_buffer, frame_size);
+
+	struct timespec deadline;
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	animation_wait(&deadline, ANIM_frame_get(anim, 0)->duration);
+
+	int frame_count = ANIM_frame_count(anim);
+	for (int r = 0; r < repeat; ++r) {
+		for (int n = 1; n <= frame_count; ++n) {
+			// record 0 wraps the last frame back to the keyframe
+			// which is not needed after the final repeat
+			if (n == frame_count && r == repeat - 1) {
+				break;
+			}
+			const ANIM_frame *frame = ANIM_frame_get(anim, n % frame_count);
+			EPD_TRACE_BEGIN(anim_frame, n);
+			animation_frame(anim, frame);
+			EPD_TRACE_END(anim_frame, frame->line_count);
+			EPD_STATS_ADD(animation_frames, 1);
+			animation_wait(&deadline, frame->duration);
+		}
+	}
+
+	EPD_end(epd);
+	EPD_stats_update_done(EPD_STATS_ANIMATE, EPD_OK == EPD_status(epd), EPD_stats_now_us() - start_us);
+
+	// leave the last frame as the next image as well
+	memcpy(display_buffer, current_buffer, sizeof(display_buffer));
+	ANIM_destroy(anim);
+
+	json_object_object_add(json_obj, "result",
+	                       json_object_new_string("success"));
+
+	return 0;
+}
+
+// select trace sinks and/or save the trace ring
+// {"command":"trace", "sinks":"ring,marker"|"off", "file":"/tmp/epd.json"}
+static int
+process_trace_command(struct json_object *json_obj, int fd)
+{
+	json_object *sinks_obj = NULL;
+	json_object *file_obj = NULL;
+
+	if (json_object_object_get_ex(json_obj, "sinks", &sinks_obj)) {
+		const char *value = json_object_get_string(sinks_obj);
+		int sinks = EPD_TRACE_OFF;
+		if (NULL != strstr(value, "ring")) {
+			sinks |= EPD_TRACE_RING;
+		}
+		if (NULL != strstr(value, "marker")) {
+			sinks |= EPD_TRACE_MARKER;
+		}
+		if (!EPD_trace_setup(sinks, 0)) {
+			json_object_object_add(json_obj, "result",
+			                       json_object_new_string("failure"));
+			json_object_object_add(json_obj, "reason",
+			                       json_object_new_string("Trace sink unavailable"));
+			return -EIO;
+		}
+	}
+
+	if (json_object_object_get_ex(json_obj, "file", &file_obj)) {
+		if (!EPD_trace_save(json_object_get_string(file_obj))) {
+			json_object_object_add(json_obj, "result",
+			                       json_object_new_string("failure"));
+			json_object_object_add(json_obj, "reason",
+			                       json_object_new_string("Cannot write trace file"));
+			return -EIO;
+		}
+		EPD_trace_reset();
+	}
+
+	json_object_object_add(json_obj, "result",
+	                       json_object_new_string("success"));
+
+	return 0;
+}
+
 typedef struct json_command {
     const char *cmdStr;
     int (*command)(struct json_object *, int);
@@ -477,6 +712,8 @@ json_command commands[] = {
     { "blink", process_blink_command },
     { "image", process_image_command },
     { "get", process_get_command },
+    { "animate", process_animate_command },
+    { "trace", process_trace_command },
     { NULL, NULL }
 };
 
@@ -500,7 +737,9 @@ process_json_command(struct json_object *json_obj, int fd)
 
         for (unsigned i = 0; commands[i].cmdStr; i++) {
             if (ISTREQ(commands[i].cmdStr, cmdStr )) {
-                commands[i].command(json_obj, fd);
+                EPD_TRACE_BEGIN(ipc_command, i);
+                int rc = commands[i].command(json_obj, fd);
+                EPD_TRACE_END(ipc_command, rc);
                 return;
             }
         }
@@ -521,11 +760,14 @@ static int option_processor(int argc, char **argv)
         static struct option long_options[] = {
             {"panel",      required_argument, 0, 'p'  },
             {"spi",        required_argument, 0, 's'  },
+            {"spi-speed-file", required_argument, 0, 'f'  },
+            {"calibrate",  no_argument,       0, 'c'  },
             {"version",    no_argument,       0, 'V'},
             {"help",       no_argument,       0, 'h'},
+            {0,            0,                 0, 0  }
         };
 
-        c = getopt_long(argc, argv, "Vhp:s:", long_options, &option_index);
+        c = getopt_long(argc, argv, "Vhp:s:f:c", long_options, &option_index);
         if (c == -1) {
             break;
         }
@@ -541,7 +783,9 @@ static int option_processor(int argc, char **argv)
 		     "\n"
 		     "Panel options:\n"
 		     "    --panel=NUM       same as '-opanel=SIZE'\n"
-		     "    --spi=DEVICE      same as '-ospi=DEVICE'\n",
+		     "    --spi=DEVICE      same as '-ospi=DEVICE'\n"
+		     "    -f FILE --spi-speed-file=FILE  SPI speed saved for this unit\n"
+		     "    -c   --calibrate  find the fastest reliable SPI speed (saved to FILE)\n",
 		     argv[0]);
 	     exit(1);
 
@@ -560,8 +804,21 @@ static int option_processor(int argc, char **argv)
         case 's':
 	     spi_device = strdup(optarg);
              break;
+
+        case 'f':
+	     spi_speed_file = strdup(optarg);
+             break;
+
+        case 'c':
+	     spi_calibrate = true;
+             break;
         }
     }
+
+    // a calibrated speed replaces the default
+    if (NULL != spi_speed_file && !spi_calibrate) {
+	    SPI_tune_load(spi_speed_file, &spi_bps);
+    }
     return 0;
 }
 
@@ -576,6 +833,7 @@ int main(int argc, char *argv[])
     struct json_object *json_obj;
 
     option_processor(argc, argv);
+    EPD_trace_setup_env();
 
     memset(current_buffer, 0, sizeof(current_buffer));
     memset(display_buffer, 0, sizeof(display_buffer));
@@ -618,11 +876,16 @@ int main(int argc, char *argv[])
 
         size_t offset = 0, len = 0;
         do {
+            EPD_TRACE_BEGIN(ipc_receive, offset);
             len = read(remoteFd, buffer + offset, BUFFER_SIZE - offset);
+            EPD_TRACE_END(ipc_receive, len);
             if (len > 0) {
                 offset += len;
             }
-        } while (!(json_obj = json_tokener_parse(buffer)) && (offset < BUFFER_SIZE));
+            EPD_TRACE_BEGIN(ipc_decode, offset);
+            json_obj = json_tokener_parse(buffer);
+            EPD_TRACE_END(ipc_decode, NULL != json_obj);
+        } while (!json_obj && (offset < BUFFER_SIZE));
 
         if (json_obj && json_object_get_type(json_obj) == json_type_object) {
             process_json_command(json_obj, remoteFd);
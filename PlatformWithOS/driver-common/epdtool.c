@@ -0,0 +1,1065 @@
+// Copyright 2013-2015 Pervasive Displays, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at:
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+// express or implied.  See the License for the specific language
+// governing permissions and limitations under the License.
+
+// offline image conversion for the drivers and sketches
+//
+// each input (XBM, PBM/PGM/PPM or PNG) is scaled to fit the panel,
+// dithered to one bit and written in any of:
+//
+//   bin     panel binary, the XBM bytes (xbm2bin, amslide, epd_fuse)
+//   xbm     XBM for the Images library (NAME_SIZE_bits)
+//   pk      EPD_PACKBITS line packed binary (xbm2packbits --binary)
+//   pk.h    EPD_PACKBITS C array (xbm2packbits)
+//   stages  binary followed by the four V231_G2 stage frames as
+//           line_encode() makes them (EPD_FLASH_ENCODING_STAGES)
+//
+// and all of the inputs can also go into one .epdanim animation and
+// one EPD_FLASH chip image with the catalog already filled in.  The
+// inputs are converted in parallel, one thread per CPU by default
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <err.h>
+
+#if EPDTOOL_PNG
+#include <png.h>
+#endif
+
+#include "epd_anim.h"
+#include "EPD_ENCODE.h"
+
+
+// V231_G2 line layout (must match EPD_create in V231_G2/epd.c)
+typedef enum {
+	BORDER_BYTE_NONE,
+	BORDER_BYTE_ZERO,
+	BORDER_BYTE_SET
+} border_byte_type;
+
+static const struct panel_struct {
+	const char *key;
+	const char *suffix;        // of the Images library names
+	int width;
+	int height;
+	int bytes_per_scan;
+	bool middle_scan;
+	bool pre_border_byte;
+	border_byte_type border_byte;
+} panels[] = {
+	{"1.44", "1_44", 128, 96, 96 / 4, true, false, BORDER_BYTE_ZERO},
+	{"1.9",  "1_9",  144, 128, 128 / 4 / 2, false, false, BORDER_BYTE_SET},
+	{"2.0",  "2_0",  200, 96, 96 / 4, true, true, BORDER_BYTE_NONE},
+	{"2.6",  "2_6",  232, 128, 128 / 4 / 2, false, false, BORDER_BYTE_SET},
+	{"2.7",  "2_7",  264, 176, 176 / 4, true, true, BORDER_BYTE_NONE},
+	{NULL, NULL, 0, 0, 0, false, false, BORDER_BYTE_NONE}  // must be last entry
+};
+
+typedef const struct panel_struct panel_type;
+
+// output formats
+enum {
+	FORMAT_BIN = 0x01,
+	FORMAT_XBM = 0x02,
+	FORMAT_PACKBITS = 0x04,
+	FORMAT_PACKBITS_XBM = 0x08,
+	FORMAT_STAGES = 0x10
+};
+
+static const struct {
+	const char *name;
+	int format;
+} format_names[] = {
+	{"bin", FORMAT_BIN},
+	{"xbm", FORMAT_XBM},
+	{"pk", FORMAT_PACKBITS},
+	{"pk.h", FORMAT_PACKBITS_XBM},
+	{"stages", FORMAT_STAGES},
+	{NULL, 0}  // must be last entry
+};
+
+typedef enum {
+	DITHER_THRESHOLD,
+	DITHER_BAYER,
+	DITHER_FLOYD_STEINBERG
+} dither_type;
+
+// EPD_FLASH catalog (see EPD_FLASH.h)
+#define FLASH_SECTOR_SIZE 4096
+#define FLASH_SECTOR_COUNT 256
+#define CATALOG_FIRST_IMAGE 2
+#define CATALOG_SLOT_SIZE 32
+#define CATALOG_SLOTS (FLASH_SECTOR_SIZE / CATALOG_SLOT_SIZE)
+#define CATALOG_NAME_SIZE 16
+#define CATALOG_ENTRY_VALID 0x3f
+
+enum {
+	ENCODING_RAW = 0,
+	ENCODING_PACKBITS = 1,
+	ENCODING_STAGES = 2
+};
+
+static const char *const encoding_names[] = {"raw", "packbits", "stages", NULL};
+
+// settings shared by all the threads
+static struct {
+	panel_type *panel;
+	int formats;
+	const char *directory;
+	dither_type dither;
+	int threshold;
+	bool invert;
+} options;
+
+// one input file
+typedef struct {
+	const char *path;
+	char name[256];            // file name without directory or extension
+	uint16_t duration;         // animation frame time
+	uint8_t *bits;             // panel binary
+	uint8_t *packed;           // PackBits, made when needed
+	size_t packed_size;
+	uint8_t *stages;           // four stage frames, made when needed
+	size_t stages_size;
+	bool ok;
+} job_type;
+
+static job_type *jobs;
+static int job_count;
+static int next_job;
+static pthread_mutex_t job_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+// grey image, 0 = black .. 255 = white
+typedef struct {
+	int width;
+	int height;
+	uint8_t *pixels;
+} grey_type;
+
+
+static void usage(const char *program) {
+	fprintf(stderr,
+		"usage: %s [options] image[@ms] ...\n"
+		"\n"
+		"options:\n"
+		"    -p SIZE      panel size: 1.44 1.9 2.0 2.6 2.7 (default 2.0)\n"
+		"    -f FORMATS   comma separated: bin xbm pk pk.h stages (default bin)\n"
+		"    -o DIR       output directory (default .)\n"
+		"    -m METHOD    dither: threshold bayer fs (default fs)\n"
+		"    -t LEVEL     black below this grey level 1..255 (default 128)\n"
+		"    -i           invert\n"
+		"    -a FILE      also write all the images as an .epdanim animation\n"
+		"    -d MS        default frame duration in milliseconds (default 500)\n"
+		"    -c FILE      also write an EPD_FLASH chip image with a catalog\n"
+		"    -e ENCODING  catalog image data: raw packbits stages (default raw)\n"
+		"    -n ID        catalog id of the first image (default 1)\n"
+		"    -j JOBS      parallel conversions (default number of CPUs)\n"
+		"    -h           print help\n"
+		"\n"
+		"outputs are named DIR/NAME_SIZE.EXT from the input NAME (XBM\n"
+		"array names follow) and are written only if the image converts\n",
+		program);
+	exit(1);
+}
+
+
+// image readers
+// -------------
+
+static bool grey_alloc(grey_type *grey, int width, int height) {
+	if (width <= 0 || height <= 0 || width > 16384 || height > 16384) {
+		return false;
+	}
+	grey->width = width;
+	grey->height = height;
+	grey->pixels = malloc((size_t)width * height);
+	return NULL != grey->pixels;
+}
+
+
+static uint8_t *read_file(const char *path, size_t *size) {
+	FILE *f = fopen(path, "rb");
+	if (NULL == f) {
+		return NULL;
+	}
+	size_t allocated = 65536;
+	uint8_t *data = malloc(allocated + 1);
+	*size = 0;
+	while (NULL != data) {
+		*size += fread(data + *size, 1, allocated - *size, f);
+		if (*size < allocated) {
+			break;
+		}
+		allocated *= 2;
+		uint8_t *more = realloc(data, allocated + 1);
+		if (NULL == more) {
+			free(data);
+		}
+		data = more;
+	}
+	if (NULL != data) {
+		data[*size] = '\0';  // text readers can use string functions
+	}
+	fclose(f);
+	return data;
+}
+
+
+// XBM: LSB is the leftmost pixel, a set bit is black
+static bool read_xbm(const char *text, grey_type *grey) {
+	const char *w = strstr(text, "_width");
+	const char *h = strstr(text, "_height");
+	const char *p = strchr(text, '{');
+	if (NULL == w || NULL == h || NULL == p) {
+		return false;
+	}
+	if (!grey_alloc(grey, atoi(w + 6), atoi(h + 7))) {
+		return false;
+	}
+	int row_bytes = (grey->width + 7) / 8;
+	for (int y = 0; y < grey->height; ++y) {
+		for (int b = 0; b < row_bytes; ++b) {
+			char *end = NULL;
+			p = strstr(p, "0x");
+			if (NULL == p) {
+				return false;
+			}
+			unsigned long byte = strtoul(p, &end, 16);
+			p = end;
+			for (int i = 0; i < 8 && 8 * b + i < grey->width; ++i) {
+				grey->pixels[y * grey->width + 8 * b + i] = (byte >> i) & 1 ? 0 : 255;
+			}
+		}
+	}
+	return true;
+}
+
+
+// next PNM header number, skipping white space and comments
+static const uint8_t *pnm_number(const uint8_t *p, const uint8_t *end, int *value) {
+	for (;;) {
+		while (p < end && isspace(*p)) {
+			++p;
+		}
+		if (p < end && '#' == *p) {
+			while (p < end && '\n' != *p) {
+				++p;
+			}
+			continue;
+		}
+		break;
+	}
+	if (p >= end || !isdigit(*p)) {
+		return NULL;
+	}
+	*value = 0;
+	while (p < end && isdigit(*p)) {
+		*value = *value * 10 + *p++ - '0';
+	}
+	return p;
+}
+
+
+// PBM, PGM and PPM, ASCII or binary (8 bit samples)
+static bool read_pnm(const uint8_t *data, size_t size, grey_type *grey) {
+	const uint8_t *end = data + size;
+	int kind = data[1] - '0';
+	int width, height, maxval = 1;
+	const uint8_t *p = data + 2;
+	if (NULL == (p = pnm_number(p, end, &width)) ||
+	    NULL == (p = pnm_number(p, end, &height))) {
+		return false;
+	}
+	if (1 != kind && 4 != kind && (NULL == (p = pnm_number(p, end, &maxval)) || maxval <= 0 || maxval > 255)) {
+		return false;
+	}
+	if (!grey_alloc(grey, width, height)) {
+		return false;
+	}
+	if (kind >= 4) {
+		++p;  // single white space before the raster
+	}
+	int channels = 3 == kind || 6 == kind ? 3 : 1;
+	int row_bytes = (width + 7) / 8;
+	for (int y = 0; y < height; ++y) {
+		for (int x = 0; x < width; ++x) {
+			int v[3];
+			if (4 == kind) {
+				if (p + y * row_bytes + x / 8 >= end) {
+					return false;
+				}
+				v[0] = (p[y * row_bytes + x / 8] >> (7 - x % 8)) & 1 ? 0 : 255;
+			} else if (kind >= 5) {
+				for (int c = 0; c < channels; ++c) {
+					if (p >= end) {
+						return false;
+					}
+					v[c] = *p++ * 255 / maxval;
+				}
+			} else {
+				for (int c = 0; c < channels; ++c) {
+					if (1 == kind) {
+						while (p < end && isspace(*p)) {
+							++p;
+						}
+						if (p >= end) {
+							return false;
+						}
+						v[c] = '1' == *p++ ? 0 : 255;
+					} else if (NULL == (p = pnm_number(p, end, &v[c]))) {
+						return false;
+					} else {
+						v[c] = v[c] * 255 / maxval;
+					}
+				}
+			}
+			grey->pixels[y * width + x] = 3 == channels ? (77 * v[0] + 150 * v[1] + 29 * v[2]) >> 8 : v[0];
+		}
+	}
+	return true;
+}
+
+
+#if EPDTOOL_PNG
+// any PNG, transparency is composed on white
+static bool read_png(const uint8_t *data, size_t size, grey_type *grey) {
+	png_image image;
+	memset(&image, 0, sizeof(image));
+	image.version = PNG_IMAGE_VERSION;
+	if (!png_image_begin_read_from_memory(&image, data, size)) {
+		return false;
+	}
+	image.format = PNG_FORMAT_GRAY;
+	if (!grey_alloc(grey, image.width, image.height)) {
+		png_image_free(&image);
+		return false;
+	}
+	png_color white = {255, 255, 255};
+	if (!png_image_finish_read(&image, &white, grey->pixels, 0, NULL)) {
+		png_image_free(&image);
+		return false;
+	}
+	return true;
+}
+#endif
+
+
+static bool read_image(const char *path, grey_type *grey) {
+	size_t size = 0;
+	uint8_t *data = read_file(path, &size);
+	if (NULL == data) {
+		warn("cannot read: %s", path);
+		return false;
+	}
+	bool ok = false;
+	grey->pixels = NULL;
+	if (size > 2 && 'P' == data[0] && data[1] >= '1' && data[1] <= '6') {
+		ok = read_pnm(data, size, grey);
+	} else if (size > 8 && 0 == memcmp(data, "\x89PNG", 4)) {
+#if EPDTOOL_PNG
+		ok = read_png(data, size, grey);
+#else
+		warnx("%s: built without PNG support", path);
+		free(data);
+		return false;
+#endif
+	} else if (NULL != strstr((const char *)data, "#define")) {
+		ok = read_xbm((const char *)data, grey);
+	}
+	free(data);
+	if (!ok) {
+		free(grey->pixels);
+		grey->pixels = NULL;
+		warnx("%s: not a readable XBM, PNM or PNG image", path);
+	}
+	return ok;
+}
+
+
+// conversion
+// ----------
+
+// fit inside the panel keeping the aspect ratio, centred on white; each
+// panel pixel is the average of the source pixels it covers
+static bool grey_fit(const grey_type *in, int width, int height, grey_type *out) {
+	if (!grey_alloc(out, width, height)) {
+		return false;
+	}
+	memset(out->pixels, 255, (size_t)width * height);
+
+	int w = width;
+	int h = height;
+	if ((long)in->width * height > (long)in->height * width) {
+		h = ((long)in->height * width + in->width / 2) / in->width;
+	} else {
+		w = ((long)in->width * height + in->height / 2) / in->height;
+	}
+	if (w < 1) {
+		w = 1;
+	}
+	if (h < 1) {
+		h = 1;
+	}
+	int left = (width - w) / 2;
+	int top = (height - h) / 2;
+
+	for (int y = 0; y < h; ++y) {
+		int y0 = (long)y * in->height / h;
+		int y1 = (long)(y + 1) * in->height / h;
+		if (y1 <= y0) {
+			y1 = y0 + 1;
+		}
+		for (int x = 0; x < w; ++x) {
+			int x0 = (long)x * in->width / w;
+			int x1 = (long)(x + 1) * in->width / w;
+			if (x1 <= x0) {
+				x1 = x0 + 1;
+			}
+			uint32_t sum = 0;
+			for (int sy = y0; sy < y1; ++sy) {
+				const uint8_t *row = &in->pixels[(size_t)sy * in->width];
+				for (int sx = x0; sx < x1; ++sx) {
+					sum += row[sx];
+				}
+			}
+			out->pixels[(size_t)(top + y) * width + left + x] = sum / ((y1 - y0) * (x1 - x0));
+		}
+	}
+	return true;
+}
+
+
+// 8x8 ordered dither thresholds, 2..254 so black and white stay exact
+static uint8_t bayer_threshold(int x, int y) {
+	static const uint8_t matrix[8][8] = {
+		{ 0, 32,  8, 40,  2, 34, 10, 42},
+		{48, 16, 56, 24, 50, 18, 58, 26},
+		{12, 44,  4, 36, 14, 46,  6, 38},
+		{60, 28, 52, 20, 62, 30, 54, 22},
+		{ 3, 35, 11, 43,  1, 33,  9, 41},
+		{51, 19, 59, 27, 49, 17, 57, 25},
+		{15, 47,  7, 39, 13, 45,  5, 37},
+		{63, 31, 55, 23, 61, 29, 53, 21}
+	};
+	return 2 * (2 * matrix[y & 7][x & 7] + 1);
+}
+
+
+// one bit per pixel in panel (XBM) order, set bit = black
+static void dither(grey_type *grey, uint8_t *bits) {
+	int width = grey->width;
+	int bytes_per_line = width / 8;
+	memset(bits, 0, (size_t)bytes_per_line * grey->height);
+
+	// error for this and the next line, with a pixel of margin each side
+	int16_t *errors = calloc(2 * (width + 2), sizeof(int16_t));
+	int16_t *current = errors + 1;
+	int16_t *next = errors + width + 3;
+
+	for (int y = 0; y < grey->height; ++y) {
+		uint8_t *row = &grey->pixels[(size_t)y * width];
+		uint8_t *out = &bits[(size_t)y * bytes_per_line];
+		// serpentine so the error does not drift to one side
+		bool reverse = 0 != (y & 1);
+		int step = reverse ? -1 : 1;
+		for (int i = 0; i < width; ++i) {
+			int x = reverse ? width - 1 - i : i;
+			int value = options.invert ? 255 - row[x] : row[x];
+			bool black;
+			switch (options.dither) {
+			case DITHER_BAYER:
+				black = value < bayer_threshold(x, y);
+				break;
+			case DITHER_FLOYD_STEINBERG:
+				if (NULL != errors) {
+					value += current[x];
+					black = value < options.threshold;
+					int e = value - (black ? 0 : 255);
+					current[x + step] += e * 7 / 16;
+					next[x - step] += e * 3 / 16;
+					next[x] += e * 5 / 16;
+					next[x + step] += e / 16;
+					break;
+				}
+				// no memory for the errors: fall back to threshold
+				// fall through
+			default:
+				black = value < options.threshold;
+				break;
+			}
+			if (black) {
+				out[x / 8] |= 1 << (x % 8);
+			}
+		}
+		if (NULL != errors) {
+			int16_t *t = current;
+			current = next;
+			next = t;
+			memset(next - 1, 0, (width + 2) * sizeof(int16_t));
+		}
+	}
+	free(errors);
+}
+
+
+// output encoders
+// ---------------
+
+// same packing as the xbm2packbits script
+static size_t pack_run(const uint8_t *line, size_t length, size_t i) {
+	size_t n = 1;
+	while (i + n < length && line[i + n] == line[i] && n < 128) {
+		++n;
+	}
+	return n;
+}
+
+
+static uint8_t *pack_line(uint8_t *out, const uint8_t *line, size_t length) {
+	size_t i = 0;
+	while (i < length) {
+		size_t n = pack_run(line, length, i);
+		if (n >= 3) {
+			*out++ = (uint8_t)(1 - (int)n);
+			*out++ = line[i];
+			i += n;
+			continue;
+		}
+		// literal up to the next run worth encoding
+		size_t j = i;
+		while (j < length && j - i < 128 && pack_run(line, length, j) < 3) {
+			++j;
+		}
+		*out++ = j - i - 1;
+		memcpy(out, &line[i], j - i);
+		out += j - i;
+		i = j;
+	}
+	return out;
+}
+
+
+static inline void put16(uint8_t *p, uint16_t value) {
+	p[0] = value;
+	p[1] = value >> 8;
+}
+
+static inline void put32(uint8_t *p, uint32_t value) {
+	put16(p, value);
+	put16(p + 2, value >> 16);
+}
+
+
+// EPD_PACKBITS layout (see EPD_PACKBITS.h)
+static bool packbits(job_type *job) {
+	int bytes_per_line = options.panel->width / 8;
+	int height = options.panel->height;
+	size_t worst = 8 + 2 * (height + 1) + height * (bytes_per_line + bytes_per_line / 128 + 1);
+	uint8_t *packed = malloc(worst);
+	if (NULL == packed) {
+		return false;
+	}
+	uint8_t *p = packed + 8 + 2 * (height + 1);
+	for (int y = 0; y < height; ++y) {
+		put16(packed + 8 + 2 * y, p - packed);
+		p = pack_line(p, &job->bits[y * bytes_per_line], bytes_per_line);
+	}
+	size_t total = p - packed;
+	put16(packed + 8 + 2 * height, total);
+	if (total > 0xffff) {
+		warnx("%s: packed image too large: %zu bytes", job->path, total);
+		free(packed);
+		return false;
+	}
+	packed[0] = 'P';
+	packed[1] = 'K';
+	put16(packed + 2, bytes_per_line);
+	put16(packed + 4, height);
+	put16(packed + 6, total);
+	job->packed = packed;
+	job->packed_size = total;
+	return true;
+}
+
+
+// one line as EPD_V231_G2::line_encode() makes it
+static uint8_t *stage_line(uint8_t *p, int line, const uint8_t *data, int stage) {
+	panel_type *panel = options.panel;
+	int bytes_per_line = panel->width / 8;
+
+	*p++ = 0x72;
+	if (panel->pre_border_byte) {
+		*p++ = 0x00;
+	}
+	if (panel->middle_scan) {
+		p = EPD_encode_odd_line(p, data, NULL, 0x00, false, bytes_per_line, stage);
+		for (int b = panel->bytes_per_scan; b > 0; --b) {
+			*p++ = line / 4 == b - 1 ? 0x03 << (2 * (line & 0x03)) : 0x00;
+		}
+		p = EPD_encode_even_line(p, data, NULL, 0x00, false, bytes_per_line, stage);
+	} else {
+		for (int b = 0; b < panel->bytes_per_scan; ++b) {
+			*p++ = 0 != (line & 0x01) && line / 8 == b ? 0xc0 >> (line & 0x06) : 0x00;
+		}
+		p = EPD_encode_all_line(p, data, NULL, 0x00, false, bytes_per_line, stage);
+		for (int b = panel->bytes_per_scan; b > 0; --b) {
+			*p++ = 0 == (line & 0x01) && line / 8 == b - 1 ? 0x03 << (line & 0x06) : 0x00;
+		}
+	}
+	switch (panel->border_byte) {
+	case BORDER_BYTE_NONE:
+		break;
+	case BORDER_BYTE_ZERO:
+		*p++ = 0x00;
+		break;
+	case BORDER_BYTE_SET:
+		*p++ = 3 == stage ? 0xaa : 0x00;  // normal
+		break;
+	}
+	return p;
+}
+
+
+// the stages in EPD_stage order: compensate, white, inverse, normal
+static bool stages(job_type *job) {
+	panel_type *panel = options.panel;
+	int bytes_per_line = panel->width / 8;
+	size_t line_size = 1 + 2 * bytes_per_line + panel->bytes_per_scan * (panel->middle_scan ? 1 : 2) +
+		(panel->pre_border_byte ? 1 : 0) + (BORDER_BYTE_NONE != panel->border_byte ? 1 : 0);
+	job->stages_size = 4 * line_size * panel->height;
+	job->stages = malloc(job->stages_size);
+	if (NULL == job->stages) {
+		return false;
+	}
+	uint8_t *p = job->stages;
+	for (int stage = 0; stage < 4; ++stage) {
+		for (int line = 0; line < panel->height; ++line) {
+			p = stage_line(p, line, &job->bits[line * bytes_per_line], stage);
+		}
+	}
+	return true;
+}
+
+
+static bool write_file(const char *path, const void *data1, size_t size1, const void *data2, size_t size2) {
+	FILE *f = fopen(path, "wb");
+	if (NULL == f) {
+		warn("cannot create: %s", path);
+		return false;
+	}
+	bool ok = size1 == fwrite(data1, 1, size1, f) && (0 == size2 || size2 == fwrite(data2, 1, size2, f));
+	if (0 != fclose(f) || !ok) {
+		warnx("failed to write: %s", path);
+		unlink(path);
+		return false;
+	}
+	return true;
+}
+
+
+// XBM style C array, 12 bytes to a line like the Images library (and
+// xbm2packbits, which closes the brace without the space)
+static bool write_array(const char *path, const char *name, const char *kind, const char *array,
+			const char *close, int width, int height, const uint8_t *data, size_t size) {
+	FILE *f = fopen(path, "w");
+	if (NULL == f) {
+		warn("cannot create: %s", path);
+		return false;
+	}
+	fprintf(f, "#define %s%s_width %d\n", name, kind, width);
+	fprintf(f, "#define %s%s_height %d\n", name, kind, height);
+	fprintf(f, "static unsigned char %s%s[] = {\n", name, array);
+	for (size_t i = 0; i < size; ++i) {
+		fprintf(f, "%s0x%02x%s", 0 == i % 12 ? "   " : "", data[i],
+			i + 1 == size ? close : 11 == i % 12 ? ",\n" : ", ");
+	}
+	if (0 != fclose(f)) {
+		warnx("failed to write: %s", path);
+		unlink(path);
+		return false;
+	}
+	return true;
+}
+
+
+static bool convert(job_type *job) {
+	panel_type *panel = options.panel;
+	size_t image_size = (size_t)panel->width / 8 * panel->height;
+
+	grey_type in;
+	if (!read_image(job->path, &in)) {
+		return false;
+	}
+	grey_type fitted;
+	bool ok = grey_fit(&in, panel->width, panel->height, &fitted);
+	free(in.pixels);
+	job->bits = malloc(image_size);
+	if (!ok || NULL == job->bits) {
+		free(fitted.pixels);
+		warnx("%s: out of memory", job->path);
+		return false;
+	}
+	dither(&fitted, job->bits);
+	free(fitted.pixels);
+
+	// C identifier and file name: NAME_SIZE
+	char name[sizeof(job->name) + 8];
+	char path[4096];
+	size_t n = strlen(job->name);
+	size_t s = strlen(panel->suffix);
+	if (n > s + 1 && '_' == job->name[n - s - 1] && 0 == strcmp(&job->name[n - s], panel->suffix)) {
+		snprintf(name, sizeof(name), "%s", job->name);  // already has the size
+	} else {
+		snprintf(name, sizeof(name), "%s_%s", job->name, panel->suffix);
+	}
+	for (char *p = name; '\0' != *p; ++p) {
+		if (!isalnum((unsigned char)*p)) {
+			*p = '_';
+		}
+	}
+
+	if (0 != (options.formats & FORMAT_BIN)) {
+		snprintf(path, sizeof(path), "%s/%s.bin", options.directory, name);
+		ok = write_file(path, job->bits, image_size, NULL, 0) && ok;
+	}
+	if (0 != (options.formats & FORMAT_XBM)) {
+		snprintf(path, sizeof(path), "%s/%s.xbm", options.directory, name);
+		ok = write_array(path, name, "", "_bits", " };\n", panel->width, panel->height, job->bits, image_size) && ok;
+	}
+	if (0 != (options.formats & (FORMAT_PACKBITS | FORMAT_PACKBITS_XBM)) && NULL == job->packed) {
+		ok = packbits(job) && ok;
+	}
+	if (0 != (options.formats & FORMAT_PACKBITS) && NULL != job->packed) {
+		snprintf(path, sizeof(path), "%s/%s.pk", options.directory, name);
+		ok = write_file(path, job->packed, job->packed_size, NULL, 0) && ok;
+	}
+	if (0 != (options.formats & FORMAT_PACKBITS_XBM) && NULL != job->packed) {
+		snprintf(path, sizeof(path), "%s/%s.pk.h", options.directory, name);
+		ok = write_array(path, name, "_packed", "_packed", "};\n", panel->width, panel->height,
+				 job->packed, job->packed_size) && ok;
+	}
+	if (0 != (options.formats & FORMAT_STAGES) && NULL == job->stages) {
+		ok = stages(job) && ok;
+	}
+	if (0 != (options.formats & FORMAT_STAGES) && NULL != job->stages) {
+		snprintf(path, sizeof(path), "%s/%s.stages", options.directory, name);
+		ok = write_file(path, job->bits, image_size, job->stages, job->stages_size) && ok;
+	}
+	return ok;
+}
+
+
+static void *worker(void *arg) {
+	(void)arg;
+	for (;;) {
+		pthread_mutex_lock(&job_lock);
+		int i = next_job++;
+		pthread_mutex_unlock(&job_lock);
+		if (i >= job_count) {
+			break;
+		}
+		jobs[i].ok = convert(&jobs[i]);
+	}
+	return NULL;
+}
+
+
+// EPD_FLASH chip image
+// --------------------
+
+static uint16_t crc16(uint16_t crc, const uint8_t *data, size_t length) {
+	for (size_t i = 0; i < length; ++i) {
+		crc ^= (uint16_t)data[i] << 8;
+		for (int b = 0; b < 8; ++b) {
+			crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+		}
+	}
+	return crc;
+}
+
+
+// a freshly formatted catalog with every converted image added in order,
+// the same as the command sketch would leave it
+static bool write_flash(const char *path, int encoding, int first_id) {
+	panel_type *panel = options.panel;
+	size_t image_size = (size_t)panel->width / 8 * panel->height;
+	static uint8_t flash[FLASH_SECTOR_COUNT * FLASH_SECTOR_SIZE];
+	memset(flash, 0xff, sizeof(flash));
+	static const uint8_t magic[] = {'E', 'P', 'D', 'C', 1, CATALOG_SLOT_SIZE};
+	memcpy(flash, magic, sizeof(magic));
+
+	int slot = 1;
+	int sector = CATALOG_FIRST_IMAGE;
+	for (int i = 0; i < job_count; ++i) {
+		job_type *job = &jobs[i];
+		if (!job->ok) {
+			continue;
+		}
+		const uint8_t *data = job->bits;
+		size_t length = image_size;
+		if (ENCODING_PACKBITS == encoding) {
+			if (NULL == job->packed && !packbits(job)) {
+				return false;
+			}
+			data = job->packed;
+			length = job->packed_size;
+		} else if (ENCODING_STAGES == encoding && NULL == job->stages && !stages(job)) {
+			return false;
+		}
+		size_t total = ENCODING_STAGES == encoding ? length + job->stages_size : length;
+		int sectors = (total + FLASH_SECTOR_SIZE - 1) / FLASH_SECTOR_SIZE;
+		if (slot >= CATALOG_SLOTS || sector + sectors > FLASH_SECTOR_COUNT || first_id + i > 0xff) {
+			warnx("%s: does not fit in the FLASH catalog", job->path);
+			return false;
+		}
+
+		uint8_t *image = &flash[sector * FLASH_SECTOR_SIZE];
+		memcpy(image, data, length);
+		if (ENCODING_STAGES == encoding) {
+			memcpy(image + length, job->stages, job->stages_size);
+		}
+
+		uint8_t *entry = &flash[slot * CATALOG_SLOT_SIZE];
+		entry[0] = CATALOG_ENTRY_VALID;
+		entry[1] = first_id + i;
+		entry[2] = sector;
+		entry[3] = encoding;
+		put32(&entry[4], total);
+		put16(&entry[8], panel->width);
+		put16(&entry[10], panel->height);
+		put16(&entry[12], crc16(0xffff, image, total));
+		put16(&entry[14], 0xffff);
+		memset(&entry[16], 0, CATALOG_NAME_SIZE);
+		size_t n = strlen(job->name);
+		memcpy(&entry[16], job->name, n < CATALOG_NAME_SIZE ? n : CATALOG_NAME_SIZE - 1);
+
+		++slot;
+		sector += sectors;
+	}
+	return write_file(path, flash, sizeof(flash), NULL, 0);
+}
+
+
+int main(int argc, char *argv[]) {
+	const char *panel_key = "2.0";
+	const char *animation = NULL;
+	const char *flash = NULL;
+	int encoding = ENCODING_RAW;
+	long default_duration = 500;
+	long first_id = 1;
+	long threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+	options.formats = FORMAT_BIN;
+	options.directory = ".";
+	options.dither = DITHER_FLOYD_STEINBERG;
+	options.threshold = 128;
+
+	int c;
+	while (-1 != (c = getopt(argc, argv, "hp:f:o:m:t:ia:d:c:e:n:j:"))) {
+		switch (c) {
+		case 'p':
+			panel_key = optarg;
+			break;
+		case 'f':
+			options.formats = 0;
+			for (char *name = strtok(optarg, ","); NULL != name; name = strtok(NULL, ",")) {
+				int f = 0;
+				for (; NULL != format_names[f].name; ++f) {
+					if (0 == strcmp(format_names[f].name, name)) {
+						break;
+					}
+				}
+				if (NULL == format_names[f].name) {
+					errx(1, "unsupported format: %s", name);
+				}
+				options.formats |= format_names[f].format;
+			}
+			break;
+		case 'o':
+			options.directory = optarg;
+			break;
+		case 'm':
+			if (0 == strcmp("threshold", optarg)) {
+				options.dither = DITHER_THRESHOLD;
+			} else if (0 == strcmp("bayer", optarg)) {
+				options.dither = DITHER_BAYER;
+			} else if (0 == strcmp("fs", optarg)) {
+				options.dither = DITHER_FLOYD_STEINBERG;
+			} else {
+				errx(1, "unsupported dither: %s", optarg);
+			}
+			break;
+		case 't':
+			options.threshold = strtol(optarg, NULL, 0);
+			if (options.threshold < 1 || options.threshold > 255) {
+				errx(1, "threshold out of range: %s", optarg);
+			}
+			break;
+		case 'i':
+			options.invert = true;
+			break;
+		case 'a':
+			animation = optarg;
+			break;
+		case 'd':
+			default_duration = strtol(optarg, NULL, 0);
+			break;
+		case 'c':
+			flash = optarg;
+			break;
+		case 'e':
+			for (encoding = 0; NULL != encoding_names[encoding]; ++encoding) {
+				if (0 == strcmp(encoding_names[encoding], optarg)) {
+					break;
+				}
+			}
+			if (NULL == encoding_names[encoding]) {
+				errx(1, "unsupported encoding: %s", optarg);
+			}
+			break;
+		case 'n':
+			first_id = strtol(optarg, NULL, 0);
+			if (first_id < 1 || first_id > 0xff) {
+				errx(1, "catalog id out of range: %s", optarg);
+			}
+			break;
+		case 'j':
+			threads = strtol(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (argc - optind < 1) {
+		usage(argv[0]);
+	}
+
+	int p = 0;
+	for (; NULL != panels[p].key; ++p) {
+		if (0 == strcmp(panels[p].key, panel_key)) {
+			break;
+		}
+	}
+	if (NULL == panels[p].key) {
+		errx(1, "unsupported panel: %s", panel_key);
+	}
+	options.panel = &panels[p];
+
+	job_count = argc - optind;
+	jobs = calloc(job_count, sizeof(job_type));
+	if (NULL == jobs) {
+		err(1, "calloc");
+	}
+	for (int i = 0; i < job_count; ++i) {
+		job_type *job = &jobs[i];
+		job->path = argv[optind + i];
+
+		// optional animation frame duration suffix: name@ms
+		long duration = default_duration;
+		char *at = strrchr(job->path, '@');
+		if (NULL != at) {
+			char *end = NULL;
+			long ms = strtol(at + 1, &end, 10);
+			if ('\0' != at[1] && '\0' == *end) {
+				duration = ms;
+				*at = '\0';
+			}
+		}
+		if (duration < 0 || duration > 65535) {
+			errx(1, "%s: duration out of range: %ld", job->path, duration);
+		}
+		job->duration = duration;
+
+		const char *base = strrchr(job->path, '/');
+		snprintf(job->name, sizeof(job->name), "%s", NULL == base ? job->path : base + 1);
+		char *dot = strchr(job->name, '.');
+		if (NULL != dot && dot != job->name) {
+			*dot = '\0';
+		}
+	}
+
+	if (threads < 1) {
+		threads = 1;
+	}
+	if (threads > job_count) {
+		threads = job_count;
+	}
+	pthread_t *ids = calloc(threads, sizeof(pthread_t));
+	if (NULL == ids) {
+		err(1, "calloc");
+	}
+	for (long t = 1; t < threads; ++t) {
+		if (0 != pthread_create(&ids[t], NULL, worker, NULL)) {
+			errx(1, "pthread_create failed");
+		}
+	}
+	worker(NULL);
+	for (long t = 1; t < threads; ++t) {
+		pthread_join(ids[t], NULL);
+	}
+	free(ids);
+
+	int failed = 0;
+	for (int i = 0; i < job_count; ++i) {
+		if (!jobs[i].ok) {
+			++failed;
+		}
+	}
+
+	if (NULL != animation) {
+		const uint8_t **frames = calloc(job_count, sizeof(uint8_t *));
+		uint16_t *durations = calloc(job_count, sizeof(uint16_t));
+		if (NULL == frames || NULL == durations) {
+			err(1, "calloc");
+		}
+		int count = 0;
+		for (int i = 0; i < job_count; ++i) {
+			if (jobs[i].ok) {
+				frames[count] = jobs[i].bits;
+				durations[count++] = jobs[i].duration;
+			}
+		}
+		FILE *out = fopen(animation, "wb");
+		if (NULL == out) {
+			err(1, "cannot create: %s", animation);
+		}
+		bool ok = count > 0 && ANIM_build(out, options.panel->width, options.panel->height,
+						  (const uint8_t *const *)frames, durations, count);
+		if (0 != fclose(out) || !ok) {
+			unlink(animation);
+			warnx("failed to write: %s", animation);
+			++failed;
+		}
+		free(frames);
+		free(durations);
+	}
+
+	if (NULL != flash && !write_flash(flash, encoding, first_id)) {
+		++failed;
+	}
+
+	for (int i = 0; i < job_count; ++i) {
+		free(jobs[i].bits);
+		free(jobs[i].packed);
+		free(jobs[i].stages);
+	}
+	free(jobs);
+	return 0 == failed ? 0 : 1;
+}
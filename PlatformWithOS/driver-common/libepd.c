@@ -0,0 +1,280 @@
+// Copyright 2013-2015 Pervasive Displays, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at:
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+// express or implied.  See the License for the specific language
+// governing permissions and limitations under the License.
+
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <err.h>
+
+#include "gpio.h"
+#include "spi.h"
+#include "libepd.h"
+#include "libepd_cog.h"
+#include "epd_trace.h"
+#include EPD_IO
+
+
+// only exported symbols are the EPD_panel_* API
+#define LIBEPD_API __attribute__((visibility("default")))
+
+
+static const struct {
+	int width;
+	int height;
+} geometry[] = {
+	[EPD_PANEL_1_44] = {128, 96},
+	[EPD_PANEL_1_9]  = {144, 128},
+	[EPD_PANEL_2_0]  = {200, 96},
+	[EPD_PANEL_2_6]  = {232, 128},
+	[EPD_PANEL_2_7]  = {264, 176},
+};
+
+static const LIBEPD_driver *const drivers[] = {
+	[EPD_COG_V110_G1] = &v110_g1_driver,
+	[EPD_COG_V230_G2] = &v230_g2_driver,
+	[EPD_COG_V231_G2] = &v231_g2_driver,
+};
+
+#define SIZE_OF_ARRAY(a) (sizeof(a) / sizeof((a)[0]))
+
+
+struct EPD_panel_struct {
+	const LIBEPD_driver *driver;
+	void *epd;
+	SPI_type *spi;
+
+	int width;
+	int height;
+	size_t buffer_size;
+
+	uint8_t *next;      // application renders here
+	uint8_t *current;   // what the panel shows
+
+	int temperature;
+	EPD_panel_stats stats;
+};
+
+// GPIO is mapped once for all open panels
+static int gpio_users = 0;
+
+
+static uint64_t now_us(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void set_error(EPD_panel_error *error, EPD_panel_error value) {
+	if (NULL != error) {
+		*error = value;
+	}
+}
+
+
+LIBEPD_API uint32_t EPD_panel_version(void) {
+	return LIBEPD_VERSION;
+}
+
+
+LIBEPD_API void EPD_panel_config_default(EPD_panel_config *config) {
+	memset(config, 0, sizeof(*config));
+	config->cog = EPD_COG_V231_G2;
+	config->size = EPD_PANEL_2_0;
+	config->spi_device = SPI_DEVICE;
+	config->spi_bps = SPI_BPS;
+	config->EPD_Pin_PANEL_ON = panel_on_pin;
+	config->EPD_Pin_BORDER = border_pin;
+	config->EPD_Pin_DISCHARGE = discharge_pin;
+#if defined(pwm_pin)
+	config->EPD_Pin_PWM = pwm_pin;
+#endif
+	config->EPD_Pin_RESET = reset_pin;
+	config->EPD_Pin_BUSY = busy_pin;
+}
+
+
+LIBEPD_API EPD_panel_type *EPD_panel_open(const EPD_panel_config *config, EPD_panel_error *error) {
+
+	if ((unsigned)config->cog >= SIZE_OF_ARRAY(drivers)
+	    || (unsigned)config->size >= SIZE_OF_ARRAY(geometry)) {
+		set_error(error, EPD_PANEL_UNSUPPORTED);
+		return NULL;
+	}
+
+	EPD_panel_type *panel = calloc(1, sizeof(EPD_panel_type));
+	if (NULL == panel) {
+		set_error(error, EPD_PANEL_NO_MEMORY);
+		return NULL;
+	}
+
+	panel->driver = drivers[config->cog];
+	panel->width = geometry[config->size].width;
+	panel->height = geometry[config->size].height;
+	panel->buffer_size = panel->width * panel->height / 8;
+	panel->temperature = 25;
+
+	panel->next = calloc(2, panel->buffer_size);
+	if (NULL == panel->next) {
+		set_error(error, EPD_PANEL_NO_MEMORY);
+		goto done_panel;
+	}
+	panel->current = panel->next + panel->buffer_size;
+
+	if (0 == gpio_users) {
+		EPD_trace_setup_env();
+	}
+	if (0 == gpio_users && !GPIO_setup()) {
+		warn("GPIO_setup failed");
+		set_error(error, EPD_PANEL_IO_FAILED);
+		goto done_buffers;
+	}
+	++gpio_users;
+
+	panel->spi = SPI_create(NULL != config->spi_device ? config->spi_device : SPI_DEVICE,
+				0 != config->spi_bps ? config->spi_bps : SPI_BPS);
+	if (NULL == panel->spi) {
+		warn("SPI_setup failed");
+		set_error(error, EPD_PANEL_IO_FAILED);
+		goto done_gpio;
+	}
+
+	GPIO_mode(config->EPD_Pin_PANEL_ON, GPIO_OUTPUT);
+	GPIO_mode(config->EPD_Pin_BORDER, GPIO_OUTPUT);
+	GPIO_mode(config->EPD_Pin_DISCHARGE, GPIO_OUTPUT);
+	if (panel->driver->pwm_required) {
+		GPIO_mode(config->EPD_Pin_PWM, GPIO_PWM);
+	}
+	GPIO_mode(config->EPD_Pin_RESET, GPIO_OUTPUT);
+	GPIO_mode(config->EPD_Pin_BUSY, GPIO_INPUT);
+
+	panel->epd = panel->driver->create(config->size, config, panel->spi);
+	if (NULL == panel->epd) {
+		// size not supported by this COG or out of memory
+		set_error(error, EPD_PANEL_UNSUPPORTED);
+		goto done_spi;
+	}
+
+	set_error(error, EPD_PANEL_OK);
+	return panel;
+
+	// release resources
+done_spi:
+	SPI_destroy(panel->spi);
+done_gpio:
+	if (0 == --gpio_users) {
+		GPIO_teardown();
+	}
+done_buffers:
+	free(panel->next);
+done_panel:
+	free(panel);
+	return NULL;
+}
+
+
+LIBEPD_API void EPD_panel_close(EPD_panel_type *panel) {
+	if (NULL == panel) {
+		return;
+	}
+	panel->driver->destroy(panel->epd);
+	SPI_destroy(panel->spi);
+	if (0 == --gpio_users) {
+		GPIO_teardown();
+	}
+	free(panel->next);
+	free(panel);
+}
+
+
+LIBEPD_API int EPD_panel_width(const EPD_panel_type *panel) {
+	return panel->width;
+}
+
+LIBEPD_API int EPD_panel_height(const EPD_panel_type *panel) {
+	return panel->height;
+}
+
+LIBEPD_API size_t EPD_panel_buffer_size(const EPD_panel_type *panel) {
+	return panel->buffer_size;
+}
+
+LIBEPD_API uint8_t *EPD_panel_buffer(EPD_panel_type *panel) {
+	return panel->next;
+}
+
+LIBEPD_API const uint8_t *EPD_panel_current(const EPD_panel_type *panel) {
+	return panel->current;
+}
+
+LIBEPD_API void EPD_panel_set_temperature(EPD_panel_type *panel, int temperature) {
+	panel->temperature = temperature;
+}
+
+
+LIBEPD_API EPD_panel_error EPD_panel_show(EPD_panel_type *panel, const uint8_t *image, EPD_update_kind kind) {
+	const LIBEPD_driver *driver = panel->driver;
+	uint64_t start = now_us();
+
+	driver->set_temperature(panel->epd, panel->temperature);
+	if (!driver->begin(panel->epd)) {
+		++panel->stats.failures;
+		return EPD_PANEL_COG_FAILED;
+	}
+
+	switch (kind) {
+	case EPD_UPDATE_CLEAR:
+		driver->clear(panel->epd);
+		++panel->stats.clears;
+		break;
+
+	case EPD_UPDATE_PARTIAL:
+		driver->partial(panel->epd, panel->current, image);
+		++panel->stats.partial;
+		break;
+
+	case EPD_UPDATE_FULL:
+	default:
+		driver->image(panel->epd, panel->current, image);
+		++panel->stats.full;
+		break;
+	}
+	driver->end(panel->epd);
+
+	// the panel now shows this image
+	if (EPD_UPDATE_CLEAR == kind) {
+		memset(panel->current, 0, panel->buffer_size);
+	} else if (image != panel->current) {
+		memcpy(panel->current, image, panel->buffer_size);
+	}
+
+	uint64_t elapsed = now_us() - start;
+	++panel->stats.updates;
+	panel->stats.last_update_us = elapsed;
+	panel->stats.total_update_us += elapsed;
+
+	return EPD_PANEL_OK;
+}
+
+
+LIBEPD_API EPD_panel_error EPD_panel_update(EPD_panel_type *panel, EPD_update_kind kind) {
+	return EPD_panel_show(panel, panel->next, kind);
+}
+
+
+LIBEPD_API void EPD_panel_stats_get(const EPD_panel_type *panel, EPD_panel_stats *stats) {
+	*stats = panel->stats;
+}
@@ -0,0 +1,137 @@
+// Copyright 2013-2015 Pervasive Displays, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at:
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+// express or implied.  See the License for the specific language
+// governing permissions and limitations under the License.
+
+// libepd: in-process panel access for applications
+//
+// all COG drivers are built into the library and selected when a
+// panel is opened, so there is no compile-time PANEL_VERSION choice
+// a panel handle is not thread safe; use one thread per panel
+
+#if !defined(LIBEPD_H)
+#define LIBEPD_H 1
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+// API version: major changes break source or binary compatibility
+#define LIBEPD_VERSION_MAJOR 1
+#define LIBEPD_VERSION_MINOR 0
+#define LIBEPD_VERSION ((LIBEPD_VERSION_MAJOR << 16) | LIBEPD_VERSION_MINOR)
+
+// COG/film driver
+typedef enum {
+	EPD_COG_V110_G1,
+	EPD_COG_V230_G2,
+	EPD_COG_V231_G2
+} EPD_panel_cog;
+
+// panel sizes (not every COG supports every size)
+typedef enum {
+	EPD_PANEL_1_44,        // 128 x 96
+	EPD_PANEL_1_9,         // 144 x 128
+	EPD_PANEL_2_0,         // 200 x 96
+	EPD_PANEL_2_6,         // 232 x 128
+	EPD_PANEL_2_7          // 264 x 176
+} EPD_panel_size;
+
+typedef enum {
+	EPD_UPDATE_FULL,       // full four stage update
+	EPD_UPDATE_PARTIAL,    // changed pixels only (FULL if COG has no partial)
+	EPD_UPDATE_CLEAR       // clear to white, image is ignored
+} EPD_update_kind;
+
+typedef enum {
+	EPD_PANEL_OK,
+	EPD_PANEL_UNSUPPORTED,     // COG does not support this size
+	EPD_PANEL_IO_FAILED,       // GPIO or SPI could not be set up
+	EPD_PANEL_NO_MEMORY,
+	EPD_PANEL_COG_FAILED       // begin failed: bad COG ID, broken panel, DC/DC
+} EPD_panel_error;
+
+// open parameters, fill with EPD_panel_config_default() first
+typedef struct {
+	EPD_panel_cog cog;
+	EPD_panel_size size;
+	const char *spi_device;
+	uint32_t spi_bps;
+	int EPD_Pin_PANEL_ON;
+	int EPD_Pin_BORDER;
+	int EPD_Pin_DISCHARGE;
+	int EPD_Pin_PWM;           // only used by the V110 G1 COG
+	int EPD_Pin_RESET;
+	int EPD_Pin_BUSY;
+} EPD_panel_config;
+
+typedef struct {
+	uint32_t updates;          // successful updates of any kind
+	uint32_t full;
+	uint32_t partial;
+	uint32_t clears;
+	uint32_t failures;         // updates where the COG did not start
+	uint64_t last_update_us;   // time of the last update
+	uint64_t total_update_us;
+} EPD_panel_stats;
+
+typedef struct EPD_panel_struct EPD_panel_type;
+
+
+// functions
+// =========
+
+// library version, compare with LIBEPD_VERSION
+uint32_t EPD_panel_version(void);
+
+// platform defaults: V231 G2 2.0" with the pins from epd_io.h
+void EPD_panel_config_default(EPD_panel_config *config);
+
+// open a panel, sets *error (if not NULL) and returns NULL on failure
+EPD_panel_type *EPD_panel_open(const EPD_panel_config *config, EPD_panel_error *error);
+
+// power down and release everything
+void EPD_panel_close(EPD_panel_type *panel);
+
+// geometry
+int EPD_panel_width(const EPD_panel_type *panel);
+int EPD_panel_height(const EPD_panel_type *panel);
+size_t EPD_panel_buffer_size(const EPD_panel_type *panel);
+
+// the next image buffer: render into this then call EPD_panel_update
+uint8_t *EPD_panel_buffer(EPD_panel_type *panel);
+
+// the image currently on the panel (read only)
+const uint8_t *EPD_panel_current(const EPD_panel_type *panel);
+
+// set compensation temperature in Celsius for following updates
+void EPD_panel_set_temperature(EPD_panel_type *panel, int temperature);
+
+// display the next image buffer
+EPD_panel_error EPD_panel_update(EPD_panel_type *panel, EPD_update_kind kind);
+
+// display a caller owned image of EPD_panel_buffer_size() bytes
+// the image is sent directly, the next image buffer is not touched
+EPD_panel_error EPD_panel_show(EPD_panel_type *panel, const uint8_t *image, EPD_update_kind kind);
+
+// counters since open
+void EPD_panel_stats_get(const EPD_panel_type *panel, EPD_panel_stats *stats);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif
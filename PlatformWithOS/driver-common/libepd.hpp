@@ -0,0 +1,340 @@
+// Copyright 2013-2015 Pervasive Displays, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at:
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+// express or implied.  See the License for the specific language
+// governing permissions and limitations under the License.
+
+// header only C++17 interface to libepd
+//
+// epd::Panel owns an open panel (move only, closed by its destructor)
+// images are passed as views so nothing is copied unless the bit
+// order has to be changed, and canvas() gives a view of the driver's
+// own next image buffer to render into before commit()
+
+#if !defined(LIBEPD_HPP)
+#define LIBEPD_HPP 1
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+#if __has_include(<span>)
+#include <span>
+#endif
+
+#include "libepd.h"
+
+namespace epd {
+
+// span: the standard one when the library has it
+#if defined(__cpp_lib_span)
+template <typename T>
+using span = std::span<T>;
+#else
+template <typename T>
+class span {
+public:
+	constexpr span() noexcept = default;
+	constexpr span(T *data, std::size_t size) noexcept : data_(data), size_(size) {}
+	template <std::size_t N>
+	constexpr span(std::array<std::remove_const_t<T>, N> &a) noexcept : data_(a.data()), size_(N) {}
+	template <std::size_t N>
+	constexpr span(const std::array<std::remove_const_t<T>, N> &a) noexcept : data_(a.data()), size_(N) {}
+	template <typename U, typename = std::enable_if_t<std::is_convertible_v<U (*)[], T (*)[]>>>
+	constexpr span(const span<U> &s) noexcept : data_(s.data()), size_(s.size()) {}
+
+	constexpr T *data() const noexcept { return data_; }
+	constexpr std::size_t size() const noexcept { return size_; }
+	constexpr bool empty() const noexcept { return 0 == size_; }
+	constexpr T &operator[](std::size_t i) const noexcept { return data_[i]; }
+	constexpr T *begin() const noexcept { return data_; }
+	constexpr T *end() const noexcept { return data_ + size_; }
+
+private:
+	T *data_ = nullptr;
+	std::size_t size_ = 0;
+};
+#endif
+
+
+// which bit of a byte is the leftmost pixel
+enum class BitOrder {
+	msb_first,   // 0x80 is the left pixel (panel native, BE in epd_fuse)
+	lsb_first    // 0x01 is the left pixel (LE in epd_fuse)
+};
+
+enum class Update {
+	full = EPD_UPDATE_FULL,
+	partial = EPD_UPDATE_PARTIAL,
+	clear = EPD_UPDATE_CLEAR
+};
+
+enum class Cog {
+	v110_g1 = EPD_COG_V110_G1,
+	v230_g2 = EPD_COG_V230_G2,
+	v231_g2 = EPD_COG_V231_G2
+};
+
+
+// run time geometry
+struct Geometry {
+	int width;
+	int height;
+
+	constexpr std::size_t bytes_per_line() const noexcept { return width / 8; }
+	constexpr std::size_t bytes() const noexcept { return bytes_per_line() * height; }
+	constexpr bool operator==(const Geometry &other) const noexcept {
+		return width == other.width && height == other.height;
+	}
+	constexpr bool operator!=(const Geometry &other) const noexcept { return !(*this == other); }
+};
+
+// compile time geometry for each panel size
+template <EPD_panel_size Size, int Width, int Height>
+struct PanelGeometry {
+	static constexpr EPD_panel_size size = Size;
+	static constexpr int width = Width;
+	static constexpr int height = Height;
+	static constexpr std::size_t bytes_per_line = Width / 8;
+	static constexpr std::size_t bytes = bytes_per_line * Height;
+	static constexpr Geometry geometry() noexcept { return Geometry{Width, Height}; }
+};
+
+using Panel_1_44 = PanelGeometry<EPD_PANEL_1_44, 128, 96>;
+using Panel_1_9  = PanelGeometry<EPD_PANEL_1_9, 144, 128>;
+using Panel_2_0  = PanelGeometry<EPD_PANEL_2_0, 200, 96>;
+using Panel_2_6  = PanelGeometry<EPD_PANEL_2_6, 232, 128>;
+using Panel_2_7  = PanelGeometry<EPD_PANEL_2_7, 264, 176>;
+
+
+class Error : public std::runtime_error {
+public:
+	Error(const std::string &what, EPD_panel_error code)
+		: std::runtime_error(what), code_(code) {}
+	EPD_panel_error code() const noexcept { return code_; }
+private:
+	EPD_panel_error code_;
+};
+
+
+// read only image view: does not own the bytes
+class ImageView {
+public:
+	constexpr ImageView() noexcept = default;
+	ImageView(span<const std::uint8_t> data, Geometry geometry, BitOrder order = BitOrder::msb_first)
+		: data_(data), geometry_(geometry), order_(order) {
+		if (data.size() < geometry.bytes()) {
+			throw std::length_error("epd::ImageView: buffer smaller than geometry");
+		}
+	}
+
+	constexpr span<const std::uint8_t> data() const noexcept { return data_; }
+	constexpr Geometry geometry() const noexcept { return geometry_; }
+	constexpr BitOrder order() const noexcept { return order_; }
+
+	// true for a black pixel
+	bool pixel(int x, int y) const noexcept {
+		std::uint8_t byte = data_[y * geometry_.bytes_per_line() + x / 8];
+		return 0 != (byte & mask(order_, x));
+	}
+
+	static constexpr std::uint8_t mask(BitOrder order, int x) noexcept {
+		return BitOrder::msb_first == order ? 0x80 >> (x & 7) : 0x01 << (x & 7);
+	}
+
+private:
+	span<const std::uint8_t> data_;
+	Geometry geometry_{0, 0};
+	BitOrder order_ = BitOrder::msb_first;
+};
+
+
+// writable image view: does not own the bytes
+class MutableImageView {
+public:
+	constexpr MutableImageView() noexcept = default;
+	MutableImageView(span<std::uint8_t> data, Geometry geometry, BitOrder order = BitOrder::msb_first)
+		: data_(data), geometry_(geometry), order_(order) {
+		if (data.size() < geometry.bytes()) {
+			throw std::length_error("epd::MutableImageView: buffer smaller than geometry");
+		}
+	}
+
+	constexpr span<std::uint8_t> data() const noexcept { return data_; }
+	constexpr Geometry geometry() const noexcept { return geometry_; }
+	constexpr BitOrder order() const noexcept { return order_; }
+
+	operator ImageView() const {
+		return ImageView(span<const std::uint8_t>(data_.data(), data_.size()), geometry_, order_);
+	}
+
+	bool pixel(int x, int y) const noexcept {
+		return static_cast<ImageView>(*this).pixel(x, y);
+	}
+
+	void set(int x, int y, bool black) const noexcept {
+		std::uint8_t &byte = data_[y * geometry_.bytes_per_line() + x / 8];
+		std::uint8_t m = ImageView::mask(order_, x);
+		byte = black ? (byte | m) : (byte & ~m);
+	}
+
+	void fill(bool black) const noexcept {
+		for (std::size_t i = 0; i < geometry_.bytes(); ++i) {
+			data_[i] = black ? 0xff : 0x00;
+		}
+	}
+
+private:
+	span<std::uint8_t> data_;
+	Geometry geometry_{0, 0};
+	BitOrder order_ = BitOrder::msb_first;
+};
+
+
+// fixed size image storage for a compile time geometry
+template <typename G>
+class Image {
+public:
+	using geometry_type = G;
+
+	MutableImageView view() noexcept {
+		return MutableImageView(span<std::uint8_t>(bytes_.data(), bytes_.size()), G::geometry());
+	}
+	ImageView view() const noexcept {
+		return ImageView(span<const std::uint8_t>(bytes_.data(), bytes_.size()), G::geometry());
+	}
+	operator ImageView() const noexcept { return view(); }
+
+private:
+	std::array<std::uint8_t, G::bytes> bytes_{};
+};
+
+
+class Panel {
+public:
+	// open with an explicit configuration
+	explicit Panel(const EPD_panel_config &config) {
+		EPD_panel_error error = EPD_PANEL_OK;
+		panel_ = EPD_panel_open(&config, &error);
+		if (nullptr == panel_) {
+			throw Error("epd::Panel: open failed", error);
+		}
+	}
+
+	// open with the platform default pins
+	Panel(Cog cog, EPD_panel_size size) : Panel(default_config(cog, size)) {}
+
+	// open a compile time geometry
+	template <typename G>
+	static Panel open(Cog cog) {
+		return Panel(cog, G::size);
+	}
+
+	~Panel() { EPD_panel_close(panel_); }
+
+	Panel(const Panel &) = delete;
+	Panel &operator=(const Panel &) = delete;
+
+	Panel(Panel &&other) noexcept : panel_(std::exchange(other.panel_, nullptr)) {}
+	Panel &operator=(Panel &&other) noexcept {
+		if (this != &other) {
+			EPD_panel_close(panel_);
+			panel_ = std::exchange(other.panel_, nullptr);
+		}
+		return *this;
+	}
+
+	Geometry geometry() const noexcept {
+		return Geometry{EPD_panel_width(panel_), EPD_panel_height(panel_)};
+	}
+
+	// the driver owned next image: render here then commit()
+	MutableImageView canvas() noexcept {
+		return MutableImageView(span<std::uint8_t>(EPD_panel_buffer(panel_), EPD_panel_buffer_size(panel_)), geometry());
+	}
+
+	// the image on the panel now
+	ImageView current() const noexcept {
+		return ImageView(span<const std::uint8_t>(EPD_panel_current(panel_), EPD_panel_buffer_size(panel_)), geometry());
+	}
+
+	void set_temperature(int celsius) noexcept {
+		EPD_panel_set_temperature(panel_, celsius);
+	}
+
+	// display the canvas
+	void commit(Update kind = Update::partial) {
+		check(EPD_panel_update(panel_, static_cast<EPD_update_kind>(kind)));
+	}
+
+	// display an image; panel order images are sent without a copy,
+	// LSB first images are converted into the canvas first
+	void update(ImageView image, Update kind = Update::partial) {
+		if (image.geometry() != geometry()) {
+			throw std::invalid_argument("epd::Panel: image geometry does not match panel");
+		}
+		if (BitOrder::msb_first == image.order()) {
+			check(EPD_panel_show(panel_, image.data().data(), static_cast<EPD_update_kind>(kind)));
+			return;
+		}
+		span<std::uint8_t> out = canvas().data();
+		span<const std::uint8_t> in = image.data();
+		for (std::size_t i = 0; i < geometry().bytes(); ++i) {
+			out[i] = reverse(in[i]);
+		}
+		commit(kind);
+	}
+
+	void clear() {
+		check(EPD_panel_update(panel_, EPD_UPDATE_CLEAR));
+	}
+
+	EPD_panel_stats stats() const noexcept {
+		EPD_panel_stats s;
+		EPD_panel_stats_get(panel_, &s);
+		return s;
+	}
+
+	// escape hatch for the C API
+	EPD_panel_type *native() const noexcept { return panel_; }
+
+private:
+	static EPD_panel_config default_config(Cog cog, EPD_panel_size size) noexcept {
+		EPD_panel_config config;
+		EPD_panel_config_default(&config);
+		config.cog = static_cast<EPD_panel_cog>(cog);
+		config.size = size;
+		return config;
+	}
+
+	static void check(EPD_panel_error error) {
+		if (EPD_PANEL_OK != error) {
+			throw Error("epd::Panel: update failed", error);
+		}
+	}
+
+	static constexpr std::uint8_t reverse(std::uint8_t b) noexcept {
+		b = ((b & 0xf0) >> 4) | ((b & 0x0f) << 4);
+		b = ((b & 0xcc) >> 2) | ((b & 0x33) << 2);
+		b = ((b & 0xaa) >> 1) | ((b & 0x55) << 1);
+		return b;
+	}
+
+	EPD_panel_type *panel_ = nullptr;
+};
+
+} // namespace epd
+
+#endif
@@ -0,0 +1,148 @@
+// Copyright 2013-2015 Pervasive Displays, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at:
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+// express or implied.  See the License for the specific language
+// governing permissions and limitations under the License.
+
+// libepd: wrap one COG driver as a LIBEPD_driver table
+//
+// this file is compiled once per COG with that COG's directory first
+// on the include path and LIBEPD_COG set to its lower case name, e.g.
+//   cc -IV231_G2 -DLIBEPD_COG=v231_g2 -c libepd_cog.c
+// the driver's EPD_* functions are renamed so all COGs can be linked
+// into the same library
+
+#if !defined(LIBEPD_COG)
+#error "LIBEPD_COG must be set to the COG name"
+#endif
+
+#define LIBEPD_PASTE2(a, b) a ## _ ## b
+#define LIBEPD_PASTE(a, b) LIBEPD_PASTE2(a, b)
+#define LIBEPD_NAME(name) LIBEPD_PASTE(LIBEPD_COG, name)
+#define LIBEPD_STR1(x) #x
+#define LIBEPD_STR(x) LIBEPD_STR1(x)
+
+#define EPD_create          LIBEPD_NAME(EPD_create)
+#define EPD_destroy         LIBEPD_NAME(EPD_destroy)
+#define EPD_set_temperature LIBEPD_NAME(EPD_set_temperature)
+#define EPD_begin           LIBEPD_NAME(EPD_begin)
+#define EPD_end             LIBEPD_NAME(EPD_end)
+#define EPD_status          LIBEPD_NAME(EPD_status)
+#define EPD_clear           LIBEPD_NAME(EPD_clear)
+#define EPD_image_0         LIBEPD_NAME(EPD_image_0)
+#define EPD_image           LIBEPD_NAME(EPD_image)
+#define EPD_partial_image   LIBEPD_NAME(EPD_partial_image)
+#define EPD_partial_lines   LIBEPD_NAME(EPD_partial_lines)
+#define EPD_blink           LIBEPD_NAME(EPD_blink)
+
+#include "epd.c"
+
+#include "libepd_cog.h"
+
+
+static void *cog_create(EPD_panel_size size, const EPD_panel_config *config, SPI_type *spi) {
+	EPD_size epd_size;
+
+	switch (size) {
+#if EPD_1_44_SUPPORT
+	case EPD_PANEL_1_44:
+		epd_size = EPD_1_44;
+		break;
+#endif
+#if EPD_1_9_SUPPORT
+	case EPD_PANEL_1_9:
+		epd_size = EPD_1_9;
+		break;
+#endif
+#if EPD_2_0_SUPPORT
+	case EPD_PANEL_2_0:
+		epd_size = EPD_2_0;
+		break;
+#endif
+#if EPD_2_6_SUPPORT
+	case EPD_PANEL_2_6:
+		epd_size = EPD_2_6;
+		break;
+#endif
+#if EPD_2_7_SUPPORT
+	case EPD_PANEL_2_7:
+		epd_size = EPD_2_7;
+		break;
+#endif
+	default:
+		return NULL;
+	}
+
+	return EPD_create(epd_size,
+			  config->EPD_Pin_PANEL_ON,
+			  config->EPD_Pin_BORDER,
+			  config->EPD_Pin_DISCHARGE,
+#if EPD_PWM_REQUIRED
+			  config->EPD_Pin_PWM,
+#endif
+			  config->EPD_Pin_RESET,
+			  config->EPD_Pin_BUSY,
+			  spi);
+}
+
+static void cog_destroy(void *epd) {
+	EPD_destroy(epd);
+}
+
+static void cog_set_temperature(void *epd, int temperature) {
+	EPD_set_temperature(epd, temperature);
+}
+
+static bool cog_begin(void *epd) {
+	EPD_begin(epd);
+	return EPD_OK == EPD_status(epd);
+}
+
+static void cog_end(void *epd) {
+	EPD_end(epd);
+}
+
+static void cog_clear(void *epd) {
+	EPD_clear(epd);
+}
+
+static void cog_image(void *epd, const uint8_t *old_image, const uint8_t *new_image) {
+#if EPD_IMAGE_ONE_ARG
+	EPD_image(epd, new_image);
+#elif EPD_IMAGE_TWO_ARG
+	EPD_image(epd, old_image, new_image);
+#else
+#error "unsupported EPD_image() function"
+#endif
+}
+
+static void cog_partial(void *epd, const uint8_t *old_image, const uint8_t *new_image) {
+#if EPD_PARTIAL_AVAILABLE
+	EPD_partial_image(epd, old_image, new_image);
+#else
+	cog_image(epd, old_image, new_image);
+#endif
+}
+
+
+const LIBEPD_driver LIBEPD_NAME(driver) = {
+	.name = "COG " LIBEPD_STR(EPD_CHIP_VERSION) " FILM " LIBEPD_STR(EPD_FILM_VERSION),
+	.pwm_required = EPD_PWM_REQUIRED,
+	.partial_available = EPD_PARTIAL_AVAILABLE,
+	.create = cog_create,
+	.destroy = cog_destroy,
+	.set_temperature = cog_set_temperature,
+	.begin = cog_begin,
+	.end = cog_end,
+	.clear = cog_clear,
+	.image = cog_image,
+	.partial = cog_partial,
+};
@@ -0,0 +1,50 @@
+// Copyright 2013-2015 Pervasive Displays, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at:
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+// express or implied.  See the License for the specific language
+// governing permissions and limitations under the License.
+
+// libepd internal: one operations table per COG driver
+// (see libepd_cog.c for how each driver is built into the library)
+
+#if !defined(LIBEPD_COG_H)
+#define LIBEPD_COG_H 1
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "spi.h"
+#include "libepd.h"
+
+typedef struct {
+	const char *name;
+	bool pwm_required;
+	bool partial_available;
+
+	// returns NULL if the size is not supported by this COG
+	void *(*create)(EPD_panel_size size, const EPD_panel_config *config, SPI_type *spi);
+	void (*destroy)(void *epd);
+	void (*set_temperature)(void *epd, int temperature);
+
+	// true if the COG started
+	bool (*begin)(void *epd);
+	void (*end)(void *epd);
+
+	void (*clear)(void *epd);
+	void (*image)(void *epd, const uint8_t *old_image, const uint8_t *new_image);
+	void (*partial)(void *epd, const uint8_t *old_image, const uint8_t *new_image);
+} LIBEPD_driver;
+
+extern const LIBEPD_driver v110_g1_driver;
+extern const LIBEPD_driver v230_g2_driver;
+extern const LIBEPD_driver v231_g2_driver;
+
+#endif
@@ -17,6 +17,7 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <err.h>
@@ -24,17 +25,40 @@
 #include <linux/spi/spidev.h>
 
 #include "spi.h"
+#include "epd_stats.h"
 
 
+// spidev module parameter: largest message in bytes
+static const char *bufsiz_path = "/sys/module/spidev/parameters/bufsiz";
+#define SPI_DEFAULT_BUFSIZ 4096
+
+// most transfers in one ioctl (the message size must fit in 14 bits)
+#define SPI_BATCH_TRANSFERS 256
+
 // spi information
 struct SPI_struct {
 	int fd;
 	uint32_t bps;
+	uint64_t bytes;
+	int mode;                // last mode set, -1 => set it again
+
+	// batched sends, all allocated once in SPI_create
+	bool batching;
+	size_t buffer_size;      // spidev bufsiz
+	uint8_t *buffer;         // data of the batched transfers
+	size_t used;             // bytes in buffer
+	size_t count;            // transfers batched
+	size_t group_count;      // count at the start of the current group
+	struct spi_ioc_transfer transfers[SPI_BATCH_TRANSFERS];
 };
 
 
 // prototypes
 static void set_spi_mode(SPI_type *spi, uint8_t mode);
+static size_t read_bufsiz(void);
+static void batch_add(SPI_type *spi, const void *buffer, size_t length);
+static void batch_send(SPI_type *spi, size_t count);
+static void transfer(SPI_type *spi, const void *buffer, void *received, size_t length);
 
 
 // enable SPI access SPI fd
@@ -54,6 +78,21 @@ SPI_type *SPI_create(const char *spi_path, uint32_t bps) {
 	}
 
 	spi->bps = bps;
+	spi->bytes = 0;
+	spi->mode = -1;
+
+	spi->batching = false;
+	spi->buffer_size = read_bufsiz();
+	spi->buffer = malloc(spi->buffer_size);
+	spi->used = 0;
+	spi->count = 0;
+	spi->group_count = 0;
+	if (NULL == spi->buffer) {
+		close(spi->fd);
+		free(spi);
+		warn("falled to allocate SPI buffer");
+		return NULL;
+	}
 
 	return spi;
 }
@@ -64,7 +103,9 @@ bool SPI_destroy(SPI_type *spi) {
 	if (NULL == spi) {
 		return false;
 	}
+	SPI_batch_end(spi);
 	close(spi->fd);
+	free(spi->buffer);
 	free(spi);
 	return true;
 }
@@ -96,49 +137,81 @@ void SPI_off(SPI_type *spi) {
 // send a data block to SPI
 // will only change CS if the SPI_CS bits are set
 void SPI_send(SPI_type *spi, const void *buffer, size_t length) {
-	struct spi_ioc_transfer transfer_buffer[1] = {
-		{
-			.tx_buf = (unsigned long)(buffer),
-			.rx_buf = 0,  // nothing to receive
-			.len = length,
-			.delay_usecs = 2,
-			.speed_hz = spi->bps,
-			.bits_per_word = 8,
-			.cs_change = 0
-		}
-	};
-
-	if (-1 == ioctl(spi->fd, SPI_IOC_MESSAGE(1), transfer_buffer)) {
-		warn("SPI: send failure");
+	if (spi->batching) {
+		batch_add(spi, buffer, length);
+	} else {
+		transfer(spi, buffer, NULL, length);
 	}
+	spi->bytes += length;
+	EPD_STATS_ADD(spi_bytes, length);
+	EPD_STATS_ADD(spi_transfers, 1);
 }
 
 // send a data block to SPI and return last bytes returned by slave
 // will only change CS if the SPI_CS bits are set
 void SPI_read(SPI_type *spi, const void *buffer, void *received, size_t length) {
-	struct spi_ioc_transfer transfer_buffer[1] = {
-		{
-			.tx_buf = (unsigned long)(buffer),
-			.rx_buf = (unsigned long)(received),
-			.len = length,
-			.delay_usecs = 2,
-			.speed_hz = spi->bps,
-			.bits_per_word = 8,
-			.cs_change = 0
-		}
-	};
+	batch_send(spi, spi->count);
+	transfer(spi, buffer, received, length);
+	spi->bytes += length;
+	EPD_STATS_ADD(spi_bytes, length);
+	EPD_STATS_ADD(spi_transfers, 1);
+}
 
-	if (-1 == ioctl(spi->fd, SPI_IOC_MESSAGE(1), transfer_buffer)) {
-		warn("SPI: read failure");
-	}
+
+// start collecting sends
+void SPI_batch_begin(SPI_type *spi) {
+	spi->batching = true;
+	spi->group_count = spi->count;
+}
+
+
+// a group is only split between ioctls if it is larger than bufsiz
+void SPI_batch_group(SPI_type *spi) {
+	spi->group_count = spi->count;
+}
+
+
+// send everything collected and stop collecting
+void SPI_batch_end(SPI_type *spi) {
+	batch_send(spi, spi->count);
+	spi->batching = false;
+}
+
+
+// total bytes transferred since SPI_create
+uint64_t SPI_bytes(const SPI_type *spi) {
+	return spi->bytes;
+}
+
+
+// every transfer carries its own speed, the maximum is updated with
+// the mode on the next SPI_on/SPI_off
+void SPI_set_speed(SPI_type *spi, uint32_t bps) {
+	spi->bps = bps;
+	spi->mode = -1;
+}
+
+
+uint32_t SPI_get_speed(const SPI_type *spi) {
+	return spi->bps;
 }
 
 
 // internal functions
 // ==================
 
+// only changes are sent, so SPI_on/SPI_off around each line cost no
+// system calls once the mode is set
 static void set_spi_mode(SPI_type *spi, uint8_t in_mode) {
 
+	if (spi->mode == in_mode) {
+		return;
+	}
+
+	// the new mode must not apply to sends already batched
+	batch_send(spi, spi->count);
+	spi->mode = in_mode;
+
 	uint8_t mode = in_mode;
 	uint8_t bits = 8;
 	uint8_t lsb_first = 0;
@@ -161,3 +234,106 @@ static void set_spi_mode(SPI_type *spi, uint8_t in_mode) {
 		err(1,"SPI: cannot set SPI_IOC_WR_MAX_SPEED_HZ = %d", speed_hz);
 	}
 }
+
+
+// effective spidev buffer size, the default if it cannot be read
+static size_t read_bufsiz(void) {
+	size_t size = SPI_DEFAULT_BUFSIZ;
+	FILE *f = fopen(bufsiz_path, "r");
+	if (NULL != f) {
+		unsigned long value = 0;
+		if (1 == fscanf(f, "%lu", &value) && value > 0) {
+			size = value;
+		}
+		fclose(f);
+	}
+	return size;
+}
+
+
+// one CS framed transfer, outside of any batch
+static void transfer(SPI_type *spi, const void *buffer, void *received, size_t length) {
+	struct spi_ioc_transfer transfer_buffer[1] = {
+		{
+			.tx_buf = (unsigned long)(buffer),
+			.rx_buf = (unsigned long)(received),
+			.len = length,
+			.delay_usecs = 2,
+			.speed_hz = spi->bps,
+			.bits_per_word = 8,
+			.cs_change = 0
+		}
+	};
+
+	if (-1 == ioctl(spi->fd, SPI_IOC_MESSAGE(1), transfer_buffer)) {
+		warn(NULL == received ? "SPI: send failure" : "SPI: read failure");
+		EPD_STATS_ADD(spi_errors, 1);
+	}
+}
+
+
+// copy a send into the batch, first making room by sending the
+// complete groups before the current one
+static void batch_add(SPI_type *spi, const void *buffer, size_t length) {
+	if (length > spi->buffer_size) {
+		// can never be batched, keep the order and send it alone
+		batch_send(spi, spi->count);
+		transfer(spi, buffer, NULL, length);
+		return;
+	}
+
+	if (spi->used + length > spi->buffer_size || SPI_BATCH_TRANSFERS == spi->count) {
+		batch_send(spi, 0 != spi->group_count ? spi->group_count : spi->count);
+	}
+	if (spi->used + length > spi->buffer_size || SPI_BATCH_TRANSFERS == spi->count) {
+		// the current group alone is too large
+		batch_send(spi, spi->count);
+	}
+
+	// tx_buf holds the offset into the buffer until sent
+	struct spi_ioc_transfer *t = &spi->transfers[spi->count++];
+	memset(t, 0, sizeof(*t));
+	t->tx_buf = spi->used;
+	t->len = length;
+	t->delay_usecs = 2;
+	t->speed_hz = spi->bps;
+	t->bits_per_word = 8;
+	t->cs_change = 1;   // CS goes high between transfers as it would between ioctls
+
+	memcpy(spi->buffer + spi->used, buffer, length);
+	spi->used += length;
+}
+
+
+// send the first count batched transfers as one message and move the
+// rest to the front
+static void batch_send(SPI_type *spi, size_t count) {
+	if (0 == count) {
+		return;
+	}
+
+	size_t bytes = 0;
+	for (size_t i = 0; i < count; ++i) {
+		bytes += spi->transfers[i].len;
+		spi->transfers[i].tx_buf += (unsigned long)spi->buffer;
+	}
+	// CS is released at the end of the message anyway
+	spi->transfers[count - 1].cs_change = 0;
+
+	if (-1 == ioctl(spi->fd, SPI_IOC_MESSAGE(count), spi->transfers)) {
+		warn("SPI: send failure");
+		EPD_STATS_ADD(spi_errors, 1);
+	}
+
+	size_t remaining = spi->count - count;
+	if (0 != remaining) {
+		memmove(spi->buffer, spi->buffer + bytes, spi->used - bytes);
+		memmove(&spi->transfers[0], &spi->transfers[count], remaining * sizeof(spi->transfers[0]));
+		for (size_t i = 0; i < remaining; ++i) {
+			spi->transfers[i].tx_buf -= bytes;
+		}
+	}
+	spi->count = remaining;
+	spi->used -= bytes;
+	spi->group_count = spi->group_count > count ? spi->group_count - count : 0;
+}
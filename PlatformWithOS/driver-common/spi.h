@@ -51,4 +51,25 @@ void SPI_send(SPI_type *spi, const void *buffer, size_t length);
 // will only change CS if the SPI_CS bits are set
 void SPI_read(SPI_type *spi, const void *buffer, void *received, size_t length);
 
+// total bytes transferred since SPI_create
+uint64_t SPI_bytes(const SPI_type *spi);
+
+// batching: between SPI_batch_begin and SPI_batch_end sends are
+// collected and written with as few ioctls as the spidev buffer size
+// allows; CS still goes high between sends and SPI_read sends the
+// batch first, so the bytes on the wire are the same
+void SPI_batch_begin(SPI_type *spi);
+
+// start a group of sends (e.g. one line) that is kept in one ioctl
+void SPI_batch_group(SPI_type *spi);
+
+// send anything collected and go back to one ioctl per send
+void SPI_batch_end(SPI_type *spi);
+
+// change the clock used by the following transfers
+void SPI_set_speed(SPI_type *spi, uint32_t bps);
+
+// current clock setting
+uint32_t SPI_get_speed(const SPI_type *spi);
+
 #endif
@@ -0,0 +1,285 @@
+// Copyright 2013-2015 Pervasive Displays, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at:
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+// express or implied.  See the License for the specific language
+// governing permissions and limitations under the License.
+
+
+// test spi_bcm.c against a fake register window ($EPD_SPI_BCM_MAP)
+// with a thread playing the SPI0 controller, no Raspberry Pi needed:
+//
+//   make rpi-test-spi-bcm   (from the top directory)
+//
+// the FIFO is a single word in the file, so the controller can only
+// tell how far a transfer has got from the last byte written to it
+
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <err.h>
+#include <sys/mman.h>
+
+#include "spi.h"
+#include "epd_stats.h"
+
+
+// must match spi_bcm.c
+enum {
+	WINDOW_SIZE = 0x5000,
+	SPI0        = 0x4000 / sizeof(uint32_t),
+	SPI_CS      = SPI0 + 0,
+	SPI_FIFO    = SPI0 + 1,
+	SPI_CLK     = SPI0 + 2,
+
+	CS_CS   = 0x03,
+	CS_CPOL = 1 <<  3,
+	CS_TA   = 1 <<  7,
+	CS_DONE = 1 << 16,
+	CS_RXD  = 1 << 17,
+	CS_TXD  = 1 << 18,
+
+	LAST_BYTE = 0xff  // ends each test transfer, the others are 1..0x7f
+};
+
+// the controller's behaviour
+typedef enum {
+	CONTROLLER_READY,   // FIFOs always ready
+	CONTROLLER_STALLED, // never ready
+	CONTROLLER_SLOW     // TX after SLOW_GAP_MS, RX after another one
+} controller_mode;
+
+// each gap is under the 100 ms timeout, the two together are over it
+#define SLOW_GAP_MS 60
+
+
+static volatile uint32_t *window;
+static volatile controller_mode mode;
+static volatile bool stop;
+
+
+static uint64_t now_ms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+
+static void set_flags(uint32_t flags) {
+	window[SPI_CS] = (window[SPI_CS] & 0xffff) | flags;
+	__sync_synchronize();
+}
+
+
+// each transfer starts by writing SPI_CS, which clears the flags
+static void *controller(void *arg) {
+	(void)arg;
+	const uint32_t ready = CS_TXD | CS_RXD | CS_DONE;
+	controller_mode current = CONTROLLER_STALLED;
+	while (!stop) {
+		if (mode != current) {
+			current = mode;
+			set_flags(CONTROLLER_READY == current ? ready : 0);
+		}
+		if (CONTROLLER_READY == current) {
+			if (ready != (window[SPI_CS] & ready)) {
+				set_flags(ready);
+			}
+		} else if (CONTROLLER_SLOW == current) {
+			usleep(SLOW_GAP_MS * 1000);
+			set_flags(CS_TXD);
+			while (CONTROLLER_SLOW == mode && LAST_BYTE != window[SPI_FIFO]) {
+				usleep(1000);
+			}
+			set_flags(0);
+			usleep(SLOW_GAP_MS * 1000);
+			if (CONTROLLER_SLOW == mode) {
+				mode = CONTROLLER_READY;  // sets the RX flags next time round
+			}
+		} else {
+			usleep(1000);
+		}
+	}
+	return NULL;
+}
+
+
+static int failures;
+
+static void check(bool ok, const char *what) {
+	printf("%s: %s\n", ok ? "ok  " : "FAIL", what);
+	if (!ok) {
+		++failures;
+	}
+}
+
+
+static SPI_type *create(const char *path, const char *clock, uint32_t bps) {
+	setenv("EPD_SPI_BCM_CLOCK", clock, 1);
+	SPI_type *spi = SPI_create(path, bps);
+	if (NULL == spi) {
+		errx(1, "SPI_create failed");
+	}
+	return spi;
+}
+
+
+// divider: even, rounded up so the clock never exceeds bps
+static void test_divider(const char *clock, uint32_t bps, uint32_t expected) {
+	SPI_type *spi = create("/dev/spidev0.0", clock, bps);
+	char what[80];
+	snprintf(what, sizeof(what), "%s Hz core, %u bps -> divider %u", clock, bps, expected);
+	check(expected == window[SPI_CLK], what);
+	SPI_destroy(spi);
+}
+
+
+static uint32_t alt_function(int pin) {
+	return (window[pin / 10] >> ((pin % 10) * 3)) & 0x07;
+}
+
+
+static void test_pins(void) {
+	memset((void *)window, 0, WINDOW_SIZE);
+	SPI_type *spi = create("/dev/spidev0.1", "250000000", 8000000);
+	check(4 == alt_function(7) && 0 == alt_function(8) &&
+	      4 == alt_function(9) && 4 == alt_function(10) && 4 == alt_function(11),
+	      "CE1, MISO, MOSI and SCLK set to ALT0, CE0 untouched");
+	check(1 == (window[SPI_CS] & CS_CS), "CE1 selected");
+	SPI_destroy(spi);
+}
+
+
+static void fill(uint8_t *buffer, size_t length) {
+	for (size_t i = 0; i < length; ++i) {
+		buffer[i] = 1 + i % 0x7f;  // each differs from the one before
+	}
+	buffer[length - 1] = LAST_BYTE;
+}
+
+
+static void test_ready(void) {
+	SPI_type *spi = create("/dev/spidev0.0", "250000000", 8000000);
+	mode = CONTROLLER_READY;
+	usleep(10000);
+
+	uint8_t tx[300];
+	uint8_t rx[sizeof(tx)];
+	fill(tx, sizeof(tx));
+	uint64_t errors = EPD_stats_local()->spi_errors;
+	SPI_read(spi, tx, rx, sizeof(tx));
+	check(errors == EPD_stats_local()->spi_errors, "transfer longer than the FIFO completes");
+	check(LAST_BYTE == window[SPI_FIFO] && LAST_BYTE == rx[sizeof(rx) - 1],
+	      "all bytes written, the last one read back");
+	check(0 == (window[SPI_CS] & CS_TA), "TA (CS) released at the end");
+	check(sizeof(tx) == SPI_bytes(spi), "byte count");
+
+	SPI_on(spi);
+#if EPD_COG_VERSION == 1
+	check(0 != (window[SPI_CS] & CS_CPOL), "SPI_on: mode 2");
+#else
+	check(0 == (window[SPI_CS] & CS_CPOL), "SPI_on: mode 0");
+#endif
+	SPI_off(spi);
+	check(0 == (window[SPI_CS] & CS_CPOL), "SPI_off: mode 0");
+
+	mode = CONTROLLER_STALLED;
+	usleep(10000);
+	SPI_destroy(spi);
+}
+
+
+static void test_stalled(void) {
+	SPI_type *spi = create("/dev/spidev0.0", "250000000", 8000000);
+	mode = CONTROLLER_STALLED;
+	usleep(10000);
+
+	uint8_t tx[16];
+	fill(tx, sizeof(tx));
+	uint64_t errors = EPD_stats_local()->spi_errors;
+	uint64_t start = now_ms();
+	SPI_send(spi, tx, sizeof(tx));
+	uint64_t elapsed = now_ms() - start;
+	check(errors + 1 == EPD_stats_local()->spi_errors, "stalled transfer gives up");
+	check(elapsed >= 100 && elapsed < 1000, "after about 100 ms");
+	check(0 == (window[SPI_CS] & CS_TA), "TA (CS) released after the timeout");
+	SPI_destroy(spi);
+}
+
+
+// a transfer that keeps moving is not timed out however long it takes
+static void test_slow(void) {
+	SPI_type *spi = create("/dev/spidev0.0", "250000000", 8000000);
+	mode = CONTROLLER_STALLED;
+	usleep(10000);
+
+	uint8_t tx[512];
+	fill(tx, sizeof(tx));
+	window[SPI_FIFO] = 0;
+	uint64_t errors = EPD_stats_local()->spi_errors;
+	mode = CONTROLLER_SLOW;
+	uint64_t start = now_ms();
+	SPI_send(spi, tx, sizeof(tx));
+	uint64_t elapsed = now_ms() - start;
+	check(errors == EPD_stats_local()->spi_errors, "transfer with gaps completes");
+	check(elapsed >= 2 * SLOW_GAP_MS, "after more than 100 ms");
+
+	mode = CONTROLLER_STALLED;
+	usleep(10000);
+	SPI_destroy(spi);
+}
+
+
+int main(void) {
+
+	char path[] = "/tmp/spi_bcm_test.XXXXXX";
+	int fd = mkstemp(path);
+	if (fd < 0 || 0 != ftruncate(fd, WINDOW_SIZE)) {
+		err(1, "cannot create: %s", path);
+	}
+	window = mmap(0, WINDOW_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (MAP_FAILED == window) {
+		err(1, "cannot map: %s", path);
+	}
+	setenv("EPD_SPI_BCM_MAP", path, 1);
+
+	mode = CONTROLLER_STALLED;
+	pthread_t thread;
+	if (0 != pthread_create(&thread, NULL, controller, NULL)) {
+		errx(1, "cannot start the controller thread");
+	}
+
+	test_divider("250000000", 8000000, 32);
+	test_divider("400000000", 8000000, 50);
+	test_divider("500000000", 8000000, 64);
+	test_divider("250000000", 125000000, 2);
+	test_divider("400000000", 125000000, 4);
+	test_divider("500000000", 1000, 0);
+	test_pins();
+	test_ready();
+	test_stalled();
+	test_slow();
+
+	stop = true;
+	pthread_join(thread, NULL);
+	munmap((void *)window, WINDOW_SIZE);
+	unlink(path);
+
+	printf("%s\n", 0 == failures ? "PASS" : "FAIL");
+	return 0 == failures ? 0 : 1;
+}
@@ -0,0 +1,124 @@
+// Copyright 2013-2015 Pervasive Displays, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at:
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+// express or implied.  See the License for the specific language
+// governing permissions and limitations under the License.
+
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <err.h>
+
+#include "spi.h"
+#include "spi_tune.h"
+
+
+// each step is 5/4 of the previous speed
+static uint32_t next_speed(uint32_t bps) {
+	return bps + bps / 4;
+}
+
+
+bool SPI_tune_probe_cog(SPI_type *spi, uint32_t *signature, void *context) {
+	(void)context;
+	const uint8_t id_command[2] = {0x71, 0x00};
+	const uint8_t status_index[2] = {0x70, 0x0f};
+	const uint8_t status_read[2] = {0x73, 0x00};
+	uint8_t receive_buffer[2];
+
+	// first read after a speed change may be stale, as in EPD_begin
+	SPI_read(spi, id_command, receive_buffer, sizeof(receive_buffer));
+	SPI_read(spi, id_command, receive_buffer, sizeof(receive_buffer));
+	int cog_id = receive_buffer[1];
+
+	SPI_send(spi, status_index, sizeof(status_index));
+	SPI_read(spi, status_read, receive_buffer, sizeof(receive_buffer));
+	int status = receive_buffer[1];
+
+	*signature = (cog_id << 8) | status;
+
+	// a floating or missing MISO reads all zeros or all ones
+	return 0x00 != cog_id && 0xff != cog_id;
+}
+
+
+// true if every probe matches the reference
+static bool speed_ok(SPI_type *spi, uint32_t reference, SPI_tune_probe *probe, void *context) {
+	for (int i = 0; i < SPI_TUNE_READS; ++i) {
+		uint32_t signature = 0;
+		if (!probe(spi, &signature, context) || signature != reference) {
+			return false;
+		}
+	}
+	return true;
+}
+
+
+uint32_t SPI_tune(SPI_type *spi, uint32_t max_bps, SPI_tune_probe *probe, void *context) {
+	uint32_t base_bps = SPI_get_speed(spi);
+
+	// the reference must itself be stable at the starting speed
+	uint32_t reference = 0;
+	if (!probe(spi, &reference, context) || !speed_ok(spi, reference, probe, context)) {
+		warnx("SPI tune: no stable readback at %u Hz", base_bps);
+		return base_bps;
+	}
+
+	uint32_t previous = base_bps;
+	uint32_t good = base_bps;
+	for (uint32_t bps = next_speed(base_bps); bps <= max_bps; bps = next_speed(bps)) {
+		SPI_set_speed(spi, bps);
+		if (!speed_ok(spi, reference, probe, context)) {
+			break;
+		}
+		previous = good;
+		good = bps;
+	}
+
+	// one step below the fastest pass unless nothing faster passed
+	uint32_t chosen = good == base_bps ? base_bps : previous;
+	SPI_set_speed(spi, chosen);
+	return chosen;
+}
+
+
+bool SPI_tune_load(const char *path, uint32_t *bps) {
+	FILE *f = fopen(path, "r");
+	if (NULL == f) {
+		return false;
+	}
+	unsigned long value = 0;
+	bool ok = 1 == fscanf(f, "%lu", &value) && value > 0 && value <= UINT32_MAX;
+	fclose(f);
+	if (ok) {
+		*bps = value;
+	} else {
+		warnx("SPI tune: invalid speed in: %s", path);
+	}
+	return ok;
+}
+
+
+bool SPI_tune_save(const char *path, uint32_t bps) {
+	FILE *f = fopen(path, "w");
+	if (NULL == f) {
+		warn("SPI tune: cannot create: %s", path);
+		return false;
+	}
+	fprintf(f, "%u\n", bps);
+	if (0 != fclose(f)) {
+		warn("SPI tune: write failed: %s", path);
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,57 @@
+// Copyright 2013-2015 Pervasive Displays, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at:
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+// express or implied.  See the License for the specific language
+// governing permissions and limitations under the License.
+
+// SPI clock calibration
+//
+// SPI_tune() raises the clock a step at a time from the current speed
+// and keeps going while a probe keeps reading back exactly what it
+// read at the starting speed; it then backs off one step for margin
+//
+// the probe is a callback so it can be replaced by a test double;
+// SPI_tune_probe_cog() reads the G2 COG ID (0x71) and status register
+// (0x0f) and needs the COG powered up by EPD_begin()
+
+#if !defined(SPI_TUNE_H)
+#define SPI_TUNE_H 1
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "spi.h"
+
+// probes at each speed, all must match
+#define SPI_TUNE_READS 32
+
+// read something with a known answer from the slave,
+// return false if nothing sensible came back
+typedef bool SPI_tune_probe(SPI_type *spi, uint32_t *signature, void *context);
+
+
+// functions
+// =========
+
+// COG ID and status as the signature (context unused)
+bool SPI_tune_probe_cog(SPI_type *spi, uint32_t *signature, void *context);
+
+// find the fastest reliable clock up to max_bps and leave SPI set to it
+// returns the chosen speed, the current one if the probe fails
+uint32_t SPI_tune(SPI_type *spi, uint32_t max_bps, SPI_tune_probe *probe, void *context);
+
+// saved speed for this unit, false if there is none
+bool SPI_tune_load(const char *path, uint32_t *bps);
+
+// save the speed as a decimal number
+bool SPI_tune_save(const char *path, uint32_t bps);
+
+#endif
@@ -51,9 +51,12 @@
 #define EPD_SIZE EPD_2_0
 // #define EPD_SIZE EPD_2_7
 
+// only the last two stages when changing images (faster, more ghosting)
+// #define PARTIAL_UPDATE
+
 
 // current version number
-#define DEMO_VERSION "1"
+#define DEMO_VERSION "3"
 
 
 #if defined(__MSP430_CPU__)
@@ -113,15 +116,41 @@ File current_image;
 File next_image;
 
 
+// each image is read an aligned block at a time so the lines of a
+// frame pass come from RAM and the two files do not take turns
+// reloading the SD library's single block cache; the file is only
+// seeked when a pass goes back to the start
+#define SD_BLOCK_SIZE 512
+#if defined(__AVR__) && RAMEND < 0x1000
+#define PREFETCH_SIZE (SD_BLOCK_SIZE / 4)  // 2 kByte SRAM: part of a block
+#else
+#define PREFETCH_SIZE SD_BLOCK_SIZE
+#endif
+
+typedef struct {
+	uint32_t address;   // file offset of data[0]
+	uint16_t count;     // bytes in data
+	uint32_t position;  // file offset the next read() returns
+	uint8_t data[PREFETCH_SIZE];
+} image_block;
+
+image_block blocks[2];
+image_block *current_block = &blocks[0];
+image_block *next_block = &blocks[1];
+
+
 // EPD use of SPI totally disrupts SPI settings
-// this attempts to replicate the SPI settings for SD card
-// Check it against your particular SD interface
+// with SPI transactions the SD library sets its own mode and clock for
+// each card access, otherwise this attempts to replicate the SPI
+// settings for SD card, check it against your particular SD interface
 void set_spi_for_sdcard(void) {
 //	SPI.end();
 	SPI.begin();
+#if !defined(SPI_HAS_TRANSACTION)
 	SPI.setDataMode(SPI_MODE0);
 	SPI.setBitOrder(MSBFIRST);
 	SPI.setClockDivider(SPI_CLOCK_DIV128);
+#endif
 }
 
 
@@ -141,6 +170,9 @@ void open_index() {
 int get_image() {
 	current_image.close();
 	current_image = next_image;
+	image_block *b = current_block;
+	current_block = next_block;
+	next_block = b;
 
 	// get seconds, first non-digit ends number
 	int seconds = 0;
@@ -196,19 +228,57 @@ int get_image() {
 			delay(1000);
 		}
 	}
+	next_block->count = 0;
+	next_block->position = 0;
 	return seconds;
 }
 
-// read a block from the current image
-void next_image_reader(void *buffer, uint32_t address, uint16_t length) {
+
+// load the aligned block holding address
+void fill_block(File &file, image_block *block, uint32_t address) {
 	set_spi_for_sdcard();
-	next_image.seek(address);
-	next_image.read(buffer, length);
+	address &= ~(uint32_t)(PREFETCH_SIZE - 1);
+	if (address != block->position) {
+		file.seek(address);
+	}
+	int n = file.read(block->data, PREFETCH_SIZE);
+	if (n < 0) {
+		n = 0;
+	}
+	block->address = address;
+	block->count = n;
+	block->position = address + n;
+}
+
+// copy bytes from the block, refilling it as needed (white past the end)
+void read_block(File &file, image_block *block, void *buffer, uint32_t address, uint16_t length) {
+	uint8_t *p = (uint8_t *)buffer;
+	while (0 != length) {
+		if (address < block->address || address >= block->address + block->count) {
+			fill_block(file, block, address);
+			if (address >= block->address + block->count) {
+				memset(p, 0, length);
+				return;
+			}
+		}
+		uint16_t offset = address - block->address;
+		uint16_t n = block->count - offset;
+		if (n > length) {
+			n = length;
+		}
+		memcpy(p, &block->data[offset], n);
+		p += n;
+		address += n;
+		length -= n;
+	}
+}
+
+// read a line from an image
+void next_image_reader(void *buffer, uint32_t address, uint16_t length) {
+	read_block(next_image, next_block, buffer, address, length);
 }
 void current_image_reader(void *buffer, uint32_t address, uint16_t length){
-	set_spi_for_sdcard();
-	current_image.seek(address);
-	current_image.read(buffer, length);
+	read_block(current_image, current_block, buffer, address, length);
 }
 
 
@@ -306,11 +376,19 @@ void loop() {
 		EPD.frame_cb_repeat(0, next_image_reader, EPD_normal);
 		++state;
 		break;
-	case 1:        // swap images
+	case 1:        // swap images, only the pixels that differ are driven
+#if EPD_PARTIAL_AVAILABLE
+#if defined(PARTIAL_UPDATE)
+		EPD.partial_cb2(0, current_image_reader, 0, next_image_reader);
+#else
+		EPD.image_cb2(0, current_image_reader, 0, next_image_reader);
+#endif
+#else
 		EPD.frame_cb_repeat(0, current_image_reader, EPD_compensate);
 		EPD.frame_cb_repeat(0, current_image_reader, EPD_white);
 		EPD.frame_cb_repeat(0, next_image_reader, EPD_inverse);
 		EPD.frame_cb_repeat(0, next_image_reader, EPD_normal);
+#endif
 		break;
 	}
 	EPD.end();   // power down the EPD panel
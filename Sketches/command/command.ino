@@ -32,6 +32,8 @@
 // required libraries
 #include <SPI.h>
 #include <EPD_FLASH.h>
+#include <EPD_PACKBITS.h>
+#include <EPD_UPLOAD.h>
 #include <{% DRIVER:header %}>
 #define SCREEN_SIZE {% PANEL:size %}
 #include <EPD_PANELS.h>
@@ -40,7 +42,10 @@
 
 
 // version number
-#define COMMAND_VERSION "5"
+#define COMMAND_VERSION "6"
+
+// serial speed, it limits the binary upload (b) rate
+#define COMMAND_BAUD 115200
 
 
 // LED anode through resistor to I/O pin
@@ -56,6 +61,14 @@
 // function prototypes
 static void flash_info(void);
 static void flash_read(void *buffer, uint32_t address, uint16_t length);
+static void image_show(uint32_t address, EPD_reader *reader);
+#if EPD_IMAGE_TWO_ARG
+static void image_revert(uint32_t address, EPD_reader *reader);
+#endif
+#if EPD_ENCODED_AVAILABLE
+static void image_show_encoded(uint32_t stages);
+#endif
+static void catalog_print(int16_t slot, const EPD_FLASH_Entry *entry);
 
 static uint16_t xbm_count;
 static bool xbm_parser(uint8_t *b);
@@ -63,6 +76,7 @@ static bool xbm_parser(uint8_t *b);
 
 static uint8_t Serial_getc();
 static uint16_t Serial_gethex(bool echo);
+static void Serial_getname(char *name, uint16_t size);
 static void Serial_puthex(uint32_t n, int bits);
 static void Serial_puthex_byte(uint8_t n);
 static void Serial_puthex_word(uint16_t n);
@@ -110,7 +124,7 @@ void setup() {
 	digitalWrite(Pin_EPD_CS, LOW);
 	digitalWrite(Pin_EPD_FLASH_CS, HIGH);
 
-	Serial.begin(9600);
+	Serial.begin(COMMAND_BAUD);
 #if defined(__AVR__)
 	// indefinite wait for USB CDC serial port to connect.  Arduino Leonardo only
 	while (!Serial) {
@@ -133,6 +147,8 @@ void setup() {
 
 	// configure temperature sensor
 	S5813A.begin(Pin_TEMPERATURE);
+
+	EPD_UPLOAD.begin(Serial);
 }
 
 // main loop
@@ -152,12 +168,18 @@ void loop() {
 		Serial.println("h          - this command");
 		Serial.println("d<ss> <ll> - dump sector in hex, ll * 16 bytes");
 		Serial.println("e<ss>      - erase sector to 0xff");
-		Serial.println("u<ss>      - upload XBM to sector");
+		Serial.println("u<ss>      - upload XBM to sector (erases as needed)");
 		Serial.println("i<ss>      - display an image on white screen");
 #if EPD_IMAGE_TWO_ARG
 		Serial.println("r<ss>      - revert an image back to white");
 #endif
-		Serial.println("l          - search for non-empty sectors");
+		Serial.println("l          - list the image catalog");
+		Serial.println("a<id> name - upload XBM (or packed) as a new catalog image");
+		Serial.println("b          - binary catalog upload (epd_upload script)");
+		Serial.println("c<id>      - display a catalog image");
+		Serial.println("x<id>      - delete a catalog image");
+		Serial.println("z          - format the catalog (sectors 00, 01)");
+		Serial.println("s          - search for non-empty sectors");
 		Serial.println("w          - clear screen to white");
 		Serial.println("f          - dump EPD FLASH identification");
 		Serial.println("t          - show temperature");
@@ -202,25 +224,16 @@ void loop() {
 		Serial.println();
 		Serial.println("start upload...");
 
-		for (;;) {
-			uint8_t buffer[16];
-			uint16_t count = 0;
-			for (int i = 0; i < sizeof(buffer); ++i, ++count) {
-				if (!xbm_parser(&buffer[i])) {
-					break;
-				}
-			}
-			EPD_FLASH.write_enable();
-			EPD_FLASH.write(address, buffer, count);
-			address += count;
-			if (sizeof(buffer) != count) {
-				break;
-			}
+		EPD_FLASH_Writer writer(EPD_FLASH);
+		writer.begin(address);
+		uint8_t b;
+		while (xbm_parser(&b)) {
+			writer.write(b);
 		}
-
-		EPD_FLASH.write_disable();
+		bool verified = writer.end();
 
 		Serial.println();
+		Serial.print(verified ? " verify OK" : " verify FAILED");
 		Serial.print(" read = ");
 		Serial_puthex_word(xbm_count);
 		if (128 * 96 / 8 == xbm_count) {
@@ -236,58 +249,184 @@ void loop() {
 		break;
 	}
 
-#if EPD_IMAGE_ONE_ARG
 	case 'i':
 	{
 		uint32_t address = Serial_gethex(true);
 		address <<= 12;
-		EPD.begin();
-		if (!EPD) {
-			Serial.print("EPD error = ");
-			Serial.print(EPD.error());
-			Serial.println("");
-			break;
-		}
-		int t = S5813A.read();
-		EPD.setFactor(t);
-		EPD.frame_cb_13(address, flash_read, EPD_inverse);
-		EPD.frame_stage2();
-		EPD.frame_cb_13(address, flash_read, EPD_normal);
-		EPD.end();
+		image_show(address, flash_read);
 		break;
 	}
 
-#elif EPD_IMAGE_TWO_ARG
-	case 'i':
+#if EPD_IMAGE_TWO_ARG
+	case 'r':
 	{
 		uint32_t address = Serial_gethex(true);
 		address <<= 12;
-		EPD.begin();
-		int t = S5813A.read();
-		EPD.setFactor(t);
-		EPD.frame_cb_repeat(address, flash_read, EPD_inverse);
-		EPD.frame_cb_repeat(address, flash_read, EPD_normal);
-		EPD.end();
+		image_revert(address, flash_read);
 		break;
 	}
+#endif
 
-	case 'r':
+	case 'l':
 	{
-		uint32_t address = Serial_gethex(true);
-		address <<= 12;
-		EPD.begin();
-		int t = S5813A.read();
-		EPD.setFactor(t);
-		EPD.frame_cb_repeat(address, flash_read, EPD_compensate);
-		EPD.frame_cb_repeat(address, flash_read, EPD_white);
-		EPD.end();
+		Serial.println();
+		if (!EPD_FLASH.catalog_valid()) {
+			Serial.println("no catalog, use: z");
+			break;
+		}
+		EPD_FLASH_Entry entry;
+		for (int16_t slot = EPD_FLASH.catalog_next(0, &entry); slot > 0; slot = EPD_FLASH.catalog_next(slot, &entry)) {
+			catalog_print(slot, &entry);
+		}
 		break;
 	}
-#else
-#error "unsupported image function"
+
+	case 'a':
+	{
+		EPD_FLASH_Entry entry;
+		memset(&entry, 0, sizeof(entry));
+		entry.id = Serial_gethex(true);
+		Serial.print(' ');
+		Serial_getname(entry.name, sizeof(entry.name));
+		entry.width = EPD_PIXEL_WIDTH;
+		entry.height = EPD_PIXEL_HEIGHT;
+		Serial.println();
+
+		// the header tells packed data (from xbm2packbits) and its length
+		Serial.println("start upload...");
+		xbm_count = 0;
+		uint8_t header[EPD_PACKBITS_HEADER_SIZE];
+		uint16_t header_count = 0;
+		while (header_count < sizeof(header) && xbm_parser(&header[header_count])) {
+			++header_count;
+		}
+		if (sizeof(header) == header_count && 'P' == header[0] && 'K' == header[1]) {
+			if (EPD_PIXEL_WIDTH / 8 != (header[2] | header[3] << 8) ||
+			    EPD_PIXEL_HEIGHT != (header[4] | header[5] << 8)) {
+				while (xbm_parser(&header[0])) {  // skip the rest
+				}
+				Serial.println();
+				Serial.println("packed image does not suit this panel");
+				break;
+			}
+			entry.encoding = EPD_FLASH_ENCODING_PACKBITS;
+			entry.length = header[6] | header[7] << 8;
+		} else {
+			entry.encoding = EPD_FLASH_ENCODING_RAW;
+			entry.length = (uint32_t)EPD_PIXEL_WIDTH * EPD_PIXEL_HEIGHT / 8;
+		}
+
+		EPD_FLASH_Entry old_entry;
+		int16_t old_slot = EPD_FLASH.catalog_find(entry.id, &old_entry);
+		int16_t slot = EPD_FLASH.catalog_allocate(&entry);
+		if (slot < 0) {
+			while (xbm_parser(&header[0])) {  // skip the rest
+			}
+			Serial.println();
+			Serial.println("catalog full or missing");
+			break;
+		}
+		if (old_slot > 0) {
+			// allocating may have compacted the catalog
+			old_slot = EPD_FLASH.catalog_find(entry.id, &old_entry);
+		}
+
+		EPD_FLASH_Writer writer(EPD_FLASH);
+		writer.begin((uint32_t)entry.sector << EPD_FLASH_SECTOR_SHIFT);
+		writer.write(header, header_count);
+		uint8_t b;
+		while (header_count == sizeof(header) && xbm_parser(&b)) {
+			if (xbm_count <= entry.length) {
+				writer.write(b);
+			}
+		}
+		bool verified = writer.end();
+
+		Serial.println();
+		if (!verified || xbm_count != entry.length) {
+			EPD_FLASH.catalog_free(slot);
+			Serial.println(verified ? "invalid image" : "verify FAILED");
+			break;
+		}
+		EPD_FLASH.catalog_commit(slot, writer.written_crc());
+		if (old_slot > 0) {
+			EPD_FLASH.catalog_free(old_slot);
+		}
+		entry.crc = writer.written_crc();
+		catalog_print(slot, &entry);
+		break;
+	}
+
+	case 'b':
+	{
+		EPD_FLASH_Entry entry;
+		digitalWrite(Pin_RED_LED, LED_ON);
+		EPD_UPLOAD_status status = EPD_UPLOAD.catalog(EPD_PIXEL_WIDTH, EPD_PIXEL_HEIGHT, &entry);
+		digitalWrite(Pin_RED_LED, LED_OFF);
+		Serial.println();
+		if (EPD_UPLOAD_OK != status) {
+			Serial.print("upload failed = ");
+			Serial.println(status);
+			break;
+		}
+		catalog_print(EPD_FLASH.catalog_find(entry.id, &entry), &entry);
+		break;
+	}
+
+	case 'c':
+	{
+		uint8_t id = Serial_gethex(true);
+		EPD_FLASH_Entry entry;
+		if (EPD_FLASH.catalog_find(id, &entry) < 0) {
+			Serial.println();
+			Serial.println("no such image");
+			break;
+		}
+		if (EPD_PIXEL_WIDTH != entry.width || EPD_PIXEL_HEIGHT != entry.height) {
+			Serial.println();
+			Serial.println("image does not suit this panel");
+			break;
+		}
+		uint32_t address = (uint32_t)entry.sector << EPD_FLASH_SECTOR_SHIFT;
+		if (EPD_FLASH_ENCODING_PACKBITS == entry.encoding) {
+			// lines are unpacked as the frames are sent
+			if (!EPD_PACKBITS.begin(address, flash_read)) {
+				Serial.println();
+				Serial.println("bad packed image");
+				break;
+			}
+			image_show(0, EPD_PACKBITS_reader);
+			EPD_PACKBITS.end();
+#if EPD_ENCODED_AVAILABLE
+		} else if (EPD_FLASH_ENCODING_STAGES == entry.encoding) {
+			// inverse and normal stages follow the image and compensate, white
+			image_show_encoded(address + (uint32_t)EPD.lines() * EPD.line_bytes() +
+					   2 * EPD.encoded_frame_size());
 #endif
+		} else {
+			image_show(address, flash_read);
+		}
+		break;
+	}
 
-	case 'l':
+	case 'x':
+	{
+		uint8_t id = Serial_gethex(true);
+		EPD_FLASH_Entry entry;
+		int16_t slot = EPD_FLASH.catalog_find(id, &entry);
+		if (slot > 0) {
+			EPD_FLASH.catalog_free(slot);
+		}
+		break;
+	}
+
+	case 'z':
+	{
+		EPD_FLASH.catalog_format();
+		break;
+	}
+
+	case 's':
 	{
 		Serial.println();
 		uint16_t per_line = 0;
@@ -387,7 +526,81 @@ static void flash_info(void) {
 
 
 static void flash_read(void *buffer, uint32_t address, uint16_t length) {
-	EPD_FLASH.read(buffer, address, length);
+	EPD_FLASH.read_stream(buffer, address, length);
+}
+
+
+#if EPD_IMAGE_ONE_ARG
+static void image_show(uint32_t address, EPD_reader *reader) {
+	EPD.begin();
+	if (!EPD) {
+		Serial.print("EPD error = ");
+		Serial.print(EPD.error());
+		Serial.println("");
+		return;
+	}
+	int t = S5813A.read();
+	EPD.setFactor(t);
+	EPD.frame_cb_13(address, reader, EPD_inverse);
+	EPD.frame_stage2();
+	EPD.frame_cb_13(address, reader, EPD_normal);
+	EPD.end();
+}
+
+#elif EPD_IMAGE_TWO_ARG
+static void image_show(uint32_t address, EPD_reader *reader) {
+	EPD.begin();
+	int t = S5813A.read();
+	EPD.setFactor(t);
+	EPD.frame_cb_repeat(address, reader, EPD_inverse);
+	EPD.frame_cb_repeat(address, reader, EPD_normal);
+	EPD.end();
+}
+
+
+static void image_revert(uint32_t address, EPD_reader *reader) {
+	EPD.begin();
+	int t = S5813A.read();
+	EPD.setFactor(t);
+	EPD.frame_cb_repeat(address, reader, EPD_compensate);
+	EPD.frame_cb_repeat(address, reader, EPD_white);
+	EPD.end();
+}
+#else
+#error "unsupported image function"
+#endif
+
+
+#if EPD_ENCODED_AVAILABLE
+// the inverse frame at stages, then the normal frame
+static void image_show_encoded(uint32_t stages) {
+	EPD.begin();
+	int t = S5813A.read();
+	EPD.setFactor(t);
+	EPD.frame_encoded_repeat(stages, flash_read);
+	EPD.frame_encoded_repeat(stages + EPD.encoded_frame_size(), flash_read);
+	EPD.end();
+}
+#endif
+
+
+static void catalog_print(int16_t slot, const EPD_FLASH_Entry *entry) {
+	Serial.print("id = ");
+	Serial_puthex_byte(entry->id);
+	Serial.print(" sector = ");
+	Serial_puthex_byte(entry->sector);
+	Serial.print(" length = ");
+	Serial_puthex_double(entry->length);
+	Serial.print(' ');
+	Serial.print(entry->width);
+	Serial.print('x');
+	Serial.print(entry->height);
+	Serial.print(" crc = ");
+	Serial_puthex_word(entry->crc);
+	Serial.print(" slot = ");
+	Serial_puthex_byte(slot);
+	Serial.print(' ');
+	Serial.println(entry->name);
 }
 
 
@@ -443,6 +656,26 @@ static uint16_t Serial_gethex(bool echo) {
 }
 
 
+// read a name up to white space, silently truncated
+static void Serial_getname(char *name, uint16_t size) {
+	uint16_t i = 0;
+	for (;;) {
+		uint8_t c = Serial_getc();
+		if (isspace(c)) {
+			if (0 == i) {
+				continue;
+			}
+			break;
+		}
+		if (i < size - 1) {
+			name[i++] = c;
+			Serial.write(c);
+		}
+	}
+	name[i] = '\0';
+}
+
+
 static void Serial_puthex(uint32_t n, int bits) {
 	for (int i = bits - 4; i >= 0; i -= 4) {
 		char nibble = ((n >> i) & 0x0f) + '0';
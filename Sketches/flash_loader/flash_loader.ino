@@ -36,6 +36,7 @@
 // required libraries
 #include <SPI.h>
 #include <EPD_FLASH.h>
+#include <EPD_UPLOAD.h>
 #include <{% DRIVER:header %}>
 #define SCREEN_SIZE {% PANEL:size %}
 #include <EPD_PANELS.h>
@@ -48,19 +49,34 @@
 #define SCREEN_SIZE {% DRIVER:panelsize %}
 
 // select image from:  text_image text-hello cat aphrodite venus saturn
-// select a suitable sector, (size 260/270 will take two adjacent sectors)
+// and the catalog id to store it as (replaces any image with that id)
 #define IMAGE        cat
-#define FLASH_SECTOR 0
+#define IMAGE_ID     1
+
+// to use a raw sector instead of the catalog, select a suitable sector
+// (size 260/270 will take two adjacent sectors)
+// #define FLASH_SECTOR 2
 
 // if the display list is defined it will take priority over the flashing
 // (and FLASH code is disabled)
-// define a list of {sector, milliseconds}
-// #define DISPLAY_LIST {0, 5000}, {1, 5000}
+// define a list of {catalog id, milliseconds}
+// or {sector, milliseconds} if FLASH_SECTOR is defined
+// #define DISPLAY_LIST {1, 5000}, {2, 5000}
+
+// also store the four display stages pre-encoded after the image so
+// they are sent straight from FLASH (V231_G2 only, about 80k for 2.7")
+// #define IMAGE_ENCODED
+
+// wait this many milliseconds at start up for catalog images sent by
+// the epd_upload script (at UPLOAD_BAUD) before programming or
+// displaying, e.g. to provision a board with DISPLAY_LIST defined
+// #define SERIAL_UPLOAD 3000
+#define UPLOAD_BAUD 115200
 
 // no futher changed below this point
 
 // program version
-#define FLASH_LOADER_VERSION "5"
+#define FLASH_LOADER_VERSION "7"
 
 // pre-processor convert to string
 #define MAKE_STRING1(X) #X
@@ -106,8 +122,24 @@ PROGMEM const
 static void flash_info(void);
 static void flash_read(void *buffer, uint32_t address, uint16_t length);
 
-#if !defined(DISPLAY_LIST)
+static uint32_t image_address(int image, bool *encoded);
+#if defined(SERIAL_UPLOAD)
+static void serial_upload(unsigned long wait_ms);
+#endif
+#define NO_IMAGE 0xffffffff
+
+#if EPD_ENCODED_AVAILABLE
+static uint32_t stage_address(uint32_t address, EPD_stage stage);
+#if defined(IMAGE_ENCODED) && !defined(DISPLAY_LIST) && !defined(FLASH_SECTOR)
+static uint16_t stages_encode(PROGMEM const uint8_t *image, uint16_t crc, EPD_FLASH_Writer *writer);
+#endif
+#endif
+
+#if defined(DISPLAY_LIST)
+#elif defined(FLASH_SECTOR)
 static void flash_program(uint16_t sector, const void *buffer, uint16_t length);
+#else
+static void catalog_program(uint8_t id, const char *name, const void *buffer, uint16_t length);
 #endif
 
 // define the E-Ink display
@@ -150,7 +182,11 @@ void setup() {
 	digitalWrite(Pin_EPD_CS, LOW);
 	digitalWrite(Pin_EPD_FLASH_CS, HIGH);
 
+#if defined(SERIAL_UPLOAD)
+	Serial.begin(UPLOAD_BAUD);
+#else
 	Serial.begin(9600);
+#endif
 #if defined(__AVR__)
 	// // indefinite wait for USB CDC serial port to connect.  Arduino Leonardo only
 	// while (!Serial) {
@@ -174,25 +210,34 @@ void setup() {
 	// configure temperature sensor
 	S5813A.begin(Pin_TEMPERATURE);
 
+#if defined(SERIAL_UPLOAD)
+	serial_upload(SERIAL_UPLOAD);
+#endif
+
 	// if necessary program the flash
-#if !defined(DISPLAY_LIST)
+#if defined(DISPLAY_LIST)
+#elif defined(FLASH_SECTOR)
 	flash_program(FLASH_SECTOR, IMAGE_BITS, sizeof(IMAGE_BITS));
+#else
+	catalog_program(IMAGE_ID, MAKE_STRING(IMAGE), IMAGE_BITS, sizeof(IMAGE_BITS));
 #endif
 }
 
 
 typedef struct {
-	int sector;
+	int image;      // catalog id or FLASH sector
 	int delay_ms;
 } display_list_type[];
 
-// list of {FLASH sector, milliseconds} to display
-// if not defined then just display the current flash sector
+// list of {image, milliseconds} to display
+// if not defined then just display the image just programmed
 static const display_list_type display_list = {
 #if defined(DISPLAY_LIST)
 	DISPLAY_LIST
-#else
+#elif defined(FLASH_SECTOR)
 	{FLASH_SECTOR, 5000}
+#else
+	{IMAGE_ID, 5000}
 #endif
 };
 
@@ -204,6 +249,7 @@ static unsigned int display_index = 0;
 
 #if EPD_IMAGE_TWO_ARG
 static uint32_t old_address = 0xffffffff;
+static bool old_encoded = false;
 #endif
 
 // main loop
@@ -234,8 +280,8 @@ void loop() {
 		break;
 
 	case 1:         // next image
-		uint32_t address = display_list[display_index].sector;
-		address <<= 12;
+		bool encoded = false;
+		uint32_t address = image_address(display_list[display_index].image, &encoded);
 		delay_counts = display_list[display_index].delay_ms;
 
 		Serial.print("address[");
@@ -246,28 +292,49 @@ void loop() {
 		Serial.print(delay_counts);
 		Serial.println("ms");
 
+		if (NO_IMAGE == address) {
+			Serial.println("image not found");
+		} else {
 #if EPD_IMAGE_ONE_ARG
 
-		// V230_G2
-		EPD.frame_cb_13(address, flash_read, EPD_inverse);
-		EPD.frame_stage2();
-		EPD.frame_cb_13(address, flash_read, EPD_normal);
+			// V230_G2
+			EPD.frame_cb_13(address, flash_read, EPD_inverse);
+			EPD.frame_stage2();
+			EPD.frame_cb_13(address, flash_read, EPD_normal);
 
 #elif EPD_IMAGE_TWO_ARG
 
-		// V110_G1 and V231_G2
-		if (0xffffffff != old_address) {
-			EPD.frame_cb_repeat(old_address, flash_read, EPD_compensate);
-			EPD.frame_cb_repeat(old_address, flash_read, EPD_white);
-		}
-		EPD.frame_cb_repeat(address, flash_read, EPD_inverse);
-		EPD.frame_cb_repeat(address, flash_read, EPD_normal);
-		// preserve address for next cycle
-		old_address = address;
+			// V110_G1 and V231_G2
+			if (0xffffffff != old_address) {
+#if EPD_ENCODED_AVAILABLE
+				if (old_encoded) {
+					EPD.frame_encoded_repeat(stage_address(old_address, EPD_compensate), flash_read);
+					EPD.frame_encoded_repeat(stage_address(old_address, EPD_white), flash_read);
+				} else
+#endif
+				{
+					EPD.frame_cb_repeat(old_address, flash_read, EPD_compensate);
+					EPD.frame_cb_repeat(old_address, flash_read, EPD_white);
+				}
+			}
+#if EPD_ENCODED_AVAILABLE
+			if (encoded) {
+				EPD.frame_encoded_repeat(stage_address(address, EPD_inverse), flash_read);
+				EPD.frame_encoded_repeat(stage_address(address, EPD_normal), flash_read);
+			} else
+#endif
+			{
+				EPD.frame_cb_repeat(address, flash_read, EPD_inverse);
+				EPD.frame_cb_repeat(address, flash_read, EPD_normal);
+			}
+			// preserve address for next cycle
+			old_address = address;
+			old_encoded = encoded;
 
 #else
 #error "unsupported image function"
 #endif
+		}
 
 		// increment list index or reset to start on overflow
 		if (++display_index >= DISPLAY_ITEM_COUNT) {
@@ -303,10 +370,182 @@ static void flash_info(void) {
 
 // EPD display callback for reading the FLASH
 static void flash_read(void *buffer, uint32_t address, uint16_t length) {
-	EPD_FLASH.read(buffer, address, length);
+	EPD_FLASH.read_stream(buffer, address, length);
 }
 
-#if !defined(DISPLAY_LIST)
+#if defined(SERIAL_UPLOAD)
+// take 'b' uploads until none has started for wait_ms
+static void serial_upload(unsigned long wait_ms) {
+	if (!EPD_FLASH.catalog_valid()) {
+		Serial.println("FLASH: creating catalog");
+		EPD_FLASH.catalog_format();
+	}
+	Serial.println("UPLOAD: waiting");
+	EPD_UPLOAD.begin(Serial);
+	unsigned long start = millis();
+	while (millis() - start < wait_ms) {
+		if (0 == Serial.available()) {
+			continue;
+		}
+		if ('b' != Serial.read()) {
+			continue;
+		}
+		EPD_FLASH_Entry entry;
+		EPD_UPLOAD_status status = EPD_UPLOAD.catalog(EPD_PIXEL_WIDTH, EPD_PIXEL_HEIGHT, &entry);
+		Serial.println();
+		Serial.print("UPLOAD: ");
+		Serial.print(entry.name);
+		Serial.println(EPD_UPLOAD_OK == status ? " OK" : " FAILED");
+		start = millis();
+	}
+	EPD_UPLOAD.end();
+}
+#endif
+
+
+// FLASH address of a catalog image or a raw sector
+// encoded is set if the pre-encoded stages follow the image
+static uint32_t image_address(int image, bool *encoded) {
+	*encoded = false;
+#if defined(FLASH_SECTOR)
+	return (uint32_t)(image) << EPD_FLASH_SECTOR_SHIFT;
+#else
+	EPD_FLASH_Entry entry;
+	if (EPD_FLASH.catalog_find((uint8_t)image, &entry) < 0 ||
+	    EPD_PIXEL_WIDTH != entry.width || EPD_PIXEL_HEIGHT != entry.height) {
+		return NO_IMAGE;
+	}
+	switch (entry.encoding) {
+	case EPD_FLASH_ENCODING_RAW:
+		break;
+	case EPD_FLASH_ENCODING_STAGES:
+		// the raw image is still usable without them
+		*encoded = 0 != EPD_ENCODED_AVAILABLE;
+		break;
+	default:
+		return NO_IMAGE;
+	}
+	return (uint32_t)(entry.sector) << EPD_FLASH_SECTOR_SHIFT;
+#endif
+}
+
+
+#if EPD_ENCODED_AVAILABLE
+// stage frames are stored in EPD_stage order directly after the image
+static uint32_t stage_address(uint32_t address, EPD_stage stage) {
+	return address + (uint32_t)EPD.lines() * EPD.line_bytes() +
+		(uint32_t)stage * EPD.encoded_frame_size();
+}
+
+
+#if defined(IMAGE_ENCODED) && !defined(DISPLAY_LIST) && !defined(FLASH_SECTOR)
+// encode all four stages of a progmem image, either writing them to
+// FLASH or just adding them to the CRC (writer == NULL)
+static uint16_t stages_encode(PROGMEM const uint8_t *image, uint16_t crc, EPD_FLASH_Writer *writer) {
+	static uint8_t buffer[EPD_ENCODED_LINE_MAX];
+	static const EPD_stage stages[] = {EPD_compensate, EPD_white, EPD_inverse, EPD_normal};
+
+	for (uint8_t s = 0; s < sizeof(stages) / sizeof(stages[0]); ++s) {
+		for (uint16_t line = 0; line < EPD.lines(); ++line) {
+			uint16_t n = EPD.line_encode(buffer, line, &image[line * EPD.line_bytes()],
+						     0, true, stages[s]);
+			if (NULL != writer) {
+				writer->write(buffer, n);
+			} else {
+				for (uint16_t i = 0; i < n; ++i) {
+					crc = EPD_FLASH_Writer::crc16(crc, buffer[i]);
+				}
+			}
+		}
+	}
+	return crc;
+}
+#endif
+#endif
+
+
+#if defined(DISPLAY_LIST)
+#elif !defined(FLASH_SECTOR)
+// add the image to the catalog unless the same image is already there
+static void catalog_program(uint8_t id, const char *name, PROGMEM const void *buffer, uint16_t length) {
+	if (!EPD_FLASH.catalog_valid()) {
+		Serial.println("FLASH: creating catalog");
+		EPD_FLASH.catalog_format();
+	}
+
+	uint16_t crc = 0xffff;
+	PROGMEM const uint8_t *p = (PROGMEM const uint8_t *)buffer;
+	for (uint16_t i = 0; i < length; ++i) {
+#if defined(__AVR__)
+		crc = EPD_FLASH_Writer::crc16(crc, pgm_read_byte_near(p + i));
+#else
+		crc = EPD_FLASH_Writer::crc16(crc, p[i]);
+#endif
+	}
+
+	uint8_t encoding = EPD_FLASH_ENCODING_RAW;
+	uint32_t total = length;
+#if defined(IMAGE_ENCODED)
+#if EPD_ENCODED_AVAILABLE
+	encoding = EPD_FLASH_ENCODING_STAGES;
+	total += 4 * EPD.encoded_frame_size();
+	crc = stages_encode(p, crc, NULL);
+#else
+	Serial.println("FLASH: pre-encoded stages need the V231_G2 driver");
+#endif
+#endif
+
+	EPD_FLASH_Entry old_entry;
+	int16_t old_slot = EPD_FLASH.catalog_find(id, &old_entry);
+	if (old_slot > 0 && total == old_entry.length && crc == old_entry.crc &&
+	    encoding == old_entry.encoding &&
+	    0 == strncmp(name, old_entry.name, sizeof(old_entry.name))) {
+		Serial.print("FLASH: catalog already has: ");
+		Serial.println(name);
+		return;
+	}
+
+	EPD_FLASH_Entry entry;
+	memset(&entry, 0, sizeof(entry));
+	entry.id = id;
+	strncpy(entry.name, name, sizeof(entry.name) - 1);
+	entry.encoding = encoding;
+	entry.length = total;
+	entry.width = EPD_PIXEL_WIDTH;
+	entry.height = EPD_PIXEL_HEIGHT;
+	int16_t slot = EPD_FLASH.catalog_allocate(&entry);
+	if (slot < 0) {
+		Serial.println("FLASH: catalog full");
+		return;
+	}
+	if (old_slot > 0) {
+		old_slot = EPD_FLASH.catalog_find(id, &old_entry);  // allocate may compact
+	}
+
+	Serial.print("FLASH: program ");
+	Serial.print(name);
+	Serial.print(" to sector = ");
+	Serial.println(entry.sector, DEC);
+
+	EPD_FLASH_Writer writer(EPD_FLASH);
+	writer.begin((uint32_t)(entry.sector) << EPD_FLASH_SECTOR_SHIFT);
+	writer.write_from_progmem(buffer, length);
+#if defined(IMAGE_ENCODED) && EPD_ENCODED_AVAILABLE
+	stages_encode(p, 0, &writer);
+#endif
+	if (!writer.end()) {
+		EPD_FLASH.catalog_free(slot);
+		Serial.println("FLASH: verify FAILED");
+		return;
+	}
+	EPD_FLASH.catalog_commit(slot, writer.written_crc());
+	if (old_slot > 0) {
+		EPD_FLASH.catalog_free(old_slot);
+	}
+	Serial.println("FLASH: verify OK");
+}
+
+#else
 // program image into FLASH
 static void flash_program(uint16_t sector, PROGMEM const void *buffer, uint16_t length) {
 	Serial.print("FLASH: program sector = ");
@@ -318,40 +557,13 @@ static void flash_program(uint16_t sector, PROGMEM const void *buffer, uint16_t
 
 	uint32_t address = (uint32_t)(sector) << EPD_FLASH_SECTOR_SHIFT;
 
-	// erase required sectors
-	for (unsigned int i = 0; i < length; i += EPD_FLASH_SECTOR_SIZE, address += EPD_FLASH_SECTOR_SIZE) {
-		Serial.print("FLASH: erase = 0x");
-		Serial.println(address, HEX);
-		EPD_FLASH.write_enable();
-		EPD_FLASH.sector_erase(address);
-	}
-
-	// writable pages are EPD_FLASH_PAGE_SIZE bytes
-	PROGMEM const uint8_t *p = (PROGMEM const uint8_t *)buffer;
-	for (address = (uint32_t)(sector) << EPD_FLASH_SECTOR_SHIFT; length >= EPD_FLASH_PAGE_SIZE;
-	     length -= EPD_FLASH_PAGE_SIZE, address += EPD_FLASH_PAGE_SIZE, p += EPD_FLASH_PAGE_SIZE) {
-		Serial.print("FLASH: write @ 0x");
-		Serial.print(address, HEX);
-		Serial.print("  from: 0x");
-		Serial.print((uint32_t)p, HEX);
-		Serial.print("  bytes: 0x");
-		Serial.println(EPD_FLASH_PAGE_SIZE, HEX);
-		EPD_FLASH.write_enable();
-		EPD_FLASH.write_from_progmem(address, p, EPD_FLASH_PAGE_SIZE);
-	}
-	// write any remaining partial page
-	if (length > 0) {
-		Serial.print("FLASH: write @ 0x");
-		Serial.print(address, HEX);
-		Serial.print("  from: 0x");
-		Serial.print((uint32_t)p, HEX);
-		Serial.print("  bytes: 0x");
-		Serial.println(length, HEX);
-		EPD_FLASH.write_enable();
-		EPD_FLASH.write_from_progmem(address, p, length);
-	}
+	// whole pages are programmed and the sectors erased as they are reached
+	EPD_FLASH_Writer writer(EPD_FLASH);
+	writer.begin(address);
+	writer.write_from_progmem(buffer, length);
+	bool verified = writer.end();  // also turns off write
 
-	// turn off write - just to be safe
-	EPD_FLASH.write_disable();
+	Serial.print("FLASH: verify ");
+	Serial.println(verified ? "OK" : "FAILED");
 }
 #endif
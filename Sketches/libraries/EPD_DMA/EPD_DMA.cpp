@@ -0,0 +1,194 @@
+// Copyright 2013-2015 Pervasive Displays, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at:
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+// express or implied.  See the License for the specific language
+// governing permissions and limitations under the License.
+
+
+#if defined(ENERGIA)
+#include <Energia.h>
+#else
+#include <Arduino.h>
+#endif
+
+#include "EPD_DMA.h"
+
+
+#if defined(ARDUINO_ARCH_SAMD) && !defined(__SAMD51__)
+
+// SAMD21
+// ------
+
+#if !defined(EPD_DMA_SERCOM)
+#define EPD_DMA_SERCOM SERCOM4
+#define EPD_DMA_TRIGGER SERCOM4_DMAC_ID_TX
+#endif
+
+#if !defined(EPD_DMA_CHANNEL)
+#define EPD_DMA_CHANNEL 11
+#endif
+
+// used only if no other library has enabled the DMAC
+static DmacDescriptor descriptors[EPD_DMA_CHANNEL + 1] __attribute__((aligned(16)));
+static DmacDescriptor write_back[EPD_DMA_CHANNEL + 1] __attribute__((aligned(16)));
+
+static bool busy = false;
+
+
+// select the channel for the CHxxx registers (shared with interrupts
+// of other DMA users), returns its interrupt flags
+static uint8_t channel_flags(void) {
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	DMAC->CHID.reg = DMAC_CHID_ID(EPD_DMA_CHANNEL);
+	uint8_t flags = DMAC->CHINTFLAG.reg;
+	__set_PRIMASK(primask);
+	return flags;
+}
+
+
+void EPD_DMA_send(const uint8_t *buffer, uint16_t length) {
+	if (0 == length) {
+		return;
+	}
+
+	if (0 == (DMAC->CTRL.reg & DMAC_CTRL_DMAENABLE)) {
+		PM->AHBMASK.reg |= PM_AHBMASK_DMAC;
+		PM->APBBMASK.reg |= PM_APBBMASK_DMAC;
+		DMAC->CTRL.reg = DMAC_CTRL_SWRST;
+		while (0 != (DMAC->CTRL.reg & DMAC_CTRL_SWRST)) {
+		}
+		DMAC->BASEADDR.reg = (uint32_t)descriptors;
+		DMAC->WRBADDR.reg = (uint32_t)write_back;
+		DMAC->CTRL.reg = DMAC_CTRL_DMAENABLE | DMAC_CTRL_LVLEN(0x0f);
+	}
+
+	// one block of byte beats, the source address is its end
+	DmacDescriptor *d = &((DmacDescriptor *)DMAC->BASEADDR.reg)[EPD_DMA_CHANNEL];
+	d->BTCTRL.reg = DMAC_BTCTRL_VALID | DMAC_BTCTRL_BEATSIZE_BYTE |
+		DMAC_BTCTRL_SRCINC | DMAC_BTCTRL_BLOCKACT_NOACT;
+	d->BTCNT.reg = length;
+	d->SRCADDR.reg = (uint32_t)buffer + length;
+	d->DSTADDR.reg = (uint32_t)&EPD_DMA_SERCOM->SPI.DATA.reg;
+	d->DESCADDR.reg = 0;
+
+	// channel set up every time in case another library reset the DMAC
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	DMAC->CHID.reg = DMAC_CHID_ID(EPD_DMA_CHANNEL);
+	DMAC->CHCTRLA.reg = 0;
+	DMAC->CHCTRLB.reg = DMAC_CHCTRLB_LVL(0) | DMAC_CHCTRLB_TRIGSRC(EPD_DMA_TRIGGER) |
+		DMAC_CHCTRLB_TRIGACT_BEAT;
+	DMAC->CHINTFLAG.reg = DMAC_CHINTFLAG_MASK;
+	DMAC->CHCTRLA.reg = DMAC_CHCTRLA_ENABLE;
+	__set_PRIMASK(primask);
+
+	busy = true;
+}
+
+
+void EPD_DMA_wait(void) {
+	if (!busy) {
+		return;
+	}
+	while (0 == (channel_flags() & (DMAC_CHINTFLAG_TCMPL | DMAC_CHINTFLAG_TERR))) {
+	}
+
+	// last byte out of the shift register
+	while (0 == EPD_DMA_SERCOM->SPI.INTFLAG.bit.TXC) {
+	}
+
+	// otherwise SPI.transfer() would return a stale byte too early
+	while (0 != EPD_DMA_SERCOM->SPI.INTFLAG.bit.RXC) {
+		(void)EPD_DMA_SERCOM->SPI.DATA.reg;
+	}
+	EPD_DMA_SERCOM->SPI.STATUS.reg = SERCOM_SPI_STATUS_BUFOVF;
+
+	busy = false;
+}
+
+
+#elif defined(ARDUINO_ARCH_SAM)
+
+// SAM3X
+// -----
+
+#if !defined(EPD_DMA_CHANNEL)
+#define EPD_DMA_CHANNEL 2
+#endif
+
+// DMAC hardware handshake interface of SPI0 transmit
+#define SPI0_TX_INTERFACE 1
+
+// the SPI uses variable peripheral select so each transmit data word
+// carries the chip select number the SPI library set the transaction up for
+static uint32_t words[EPD_DMA_LENGTH_MAX];
+
+static bool busy = false;
+
+
+void EPD_DMA_send(const uint8_t *buffer, uint16_t length) {
+	if (0 == length) {
+		return;
+	}
+	if (length > EPD_DMA_LENGTH_MAX) {
+		length = EPD_DMA_LENGTH_MAX;
+	}
+
+	uint32_t pcs = SPI_PCS(BOARD_PIN_TO_SPI_CHANNEL(BOARD_SPI_DEFAULT_SS));
+	for (uint16_t i = 0; i < length; ++i) {
+		words[i] = buffer[i] | pcs;
+	}
+
+	if (0 == (DMAC->DMAC_EN & DMAC_EN_ENABLE)) {
+		pmc_enable_periph_clk(ID_DMAC);
+		DMAC->DMAC_GCFG = DMAC_GCFG_ARB_CFG_FIXED;
+		DMAC->DMAC_EN = DMAC_EN_ENABLE;
+	}
+
+	DMAC->DMAC_CHDR = DMAC_CHDR_DIS0 << EPD_DMA_CHANNEL;
+	DMAC->DMAC_CH_NUM[EPD_DMA_CHANNEL].DMAC_SADDR = (uint32_t)words;
+	DMAC->DMAC_CH_NUM[EPD_DMA_CHANNEL].DMAC_DADDR = (uint32_t)&SPI0->SPI_TDR;
+	DMAC->DMAC_CH_NUM[EPD_DMA_CHANNEL].DMAC_DSCR = 0;
+	DMAC->DMAC_CH_NUM[EPD_DMA_CHANNEL].DMAC_CTRLA = length |
+		DMAC_CTRLA_SRC_WIDTH_WORD | DMAC_CTRLA_DST_WIDTH_WORD;
+	DMAC->DMAC_CH_NUM[EPD_DMA_CHANNEL].DMAC_CTRLB = DMAC_CTRLB_SRC_DSCR |
+		DMAC_CTRLB_DST_DSCR | DMAC_CTRLB_FC_MEM2PER_DMA_FC |
+		DMAC_CTRLB_SRC_INCR_INCREMENTING | DMAC_CTRLB_DST_INCR_FIXED;
+	DMAC->DMAC_CH_NUM[EPD_DMA_CHANNEL].DMAC_CFG = DMAC_CFG_DST_PER(SPI0_TX_INTERFACE) |
+		DMAC_CFG_DST_H2SEL | DMAC_CFG_SOD | DMAC_CFG_FIFOCFG_ALAP_CFG;
+	DMAC->DMAC_CHER = DMAC_CHER_ENA0 << EPD_DMA_CHANNEL;
+
+	busy = true;
+}
+
+
+void EPD_DMA_wait(void) {
+	if (!busy) {
+		return;
+	}
+	// the channel disables itself when done
+	while (0 != (DMAC->DMAC_CHSR & (DMAC_CHSR_ENA0 << EPD_DMA_CHANNEL))) {
+	}
+
+	// last byte out of the shift register
+	while (0 == (SPI0->SPI_SR & SPI_SR_TXEMPTY)) {
+	}
+
+	// otherwise SPI.transfer() would return a stale byte too early
+	while (0 != (SPI0->SPI_SR & SPI_SR_RDRF)) {
+		(void)SPI0->SPI_RDR;
+	}
+
+	busy = false;
+}
+
+#endif
@@ -0,0 +1,57 @@
+// Copyright 2013-2015 Pervasive Displays, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at:
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+// express or implied.  See the License for the specific language
+// governing permissions and limitations under the License.
+
+#if !defined(EPD_DMA_H)
+#define EPD_DMA_H 1
+
+#if defined(ENERGIA)
+#include <Energia.h>
+#else
+#include <Arduino.h>
+#endif
+
+
+// SPI transmit by DMA for the panel drivers
+// -----------------------------------------
+//
+// EPD_DMA_send() starts sending a buffer on the SPI bus (already set up
+// by SPI.beginTransaction()) and returns at once.  The buffer must not
+// change until EPD_DMA_wait() returns, which is after the last bit has
+// left the SPI and the bytes received meanwhile have been dropped, so
+// SPI.transfer() works normally again.  Chip select is up to the caller
+//
+// SAMD21 (Zero, M0): DMAC channel EPD_DMA_CHANNEL (default 11) is
+//   triggered by EPD_DMA_SERCOM (default SERCOM4, the SPI on the Zero
+//   and most M0 boards); an existing descriptor table is shared
+// SAM3X (Due): DMAC channel EPD_DMA_CHANNEL (default 2, SdFat uses 0
+//   and 1) on the SPI0 transmit handshake
+
+
+#if defined(ARDUINO_ARCH_SAMD) && !defined(__SAMD51__)
+#define EPD_DMA_AVAILABLE 1
+#elif defined(ARDUINO_ARCH_SAM)
+#define EPD_DMA_AVAILABLE 1
+#else
+#define EPD_DMA_AVAILABLE 0
+#endif
+
+// longest buffer EPD_DMA_send() accepts
+#define EPD_DMA_LENGTH_MAX 128
+
+#if EPD_DMA_AVAILABLE
+void EPD_DMA_send(const uint8_t *buffer, uint16_t length);
+void EPD_DMA_wait(void);
+#endif
+
+#endif
@@ -0,0 +1,303 @@
+// Copyright 2013-2015 Pervasive Displays, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at:
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+// express or implied.  See the License for the specific language
+// governing permissions and limitations under the License.
+
+// G2 COG (film V231) pixel encoding shared by the Arduino library
+// (EPD_V231_G2) and the Linux driver (driver-common/V231_G2)
+//
+// header only, no allocation, usable from C and C++
+// all lookup tables are compile time constants, in PROGMEM on AVR
+//
+// stage numbers are the EPD_stage values of both drivers:
+//   0 = compensate, 1 = white, 2 = inverse, 3 = normal
+//
+// a change byte has a bit set for every pixel that must be updated
+// (old ^ new), pixels without the bit are sent as "nothing" (0b01)
+
+#if !defined(EPD_ENCODE_H)
+#define EPD_ENCODE_H 1
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#if defined(__AVR__)
+#include <avr/pgmspace.h>
+#define EPD_ENCODE_PROGMEM PROGMEM
+#define EPD_ENCODE_READ_TABLE(p) pgm_read_byte(p)
+#define EPD_ENCODE_READ_DATA(p, progmem) ((progmem) ? pgm_read_byte_near(p) : *(p))
+#else
+#define EPD_ENCODE_PROGMEM
+#define EPD_ENCODE_READ_TABLE(p) (*(p))
+#define EPD_ENCODE_READ_DATA(p, progmem) (*(p))
+#endif
+
+// the 2.3 kB of tables is too much for 16 kB AVRs
+// so compute instead (same results, see EPD_ENCODE_* macros below)
+#if !defined(EPD_ENCODE_TABLES)
+#if defined(__AVR__) && defined(FLASHEND) && FLASHEND <= 0x3fff
+#define EPD_ENCODE_TABLES 0
+#else
+#define EPD_ENCODE_TABLES 1
+#endif
+#endif
+
+#if defined(__cplusplus)
+#define EPD_ENCODE_CONST constexpr
+#else
+#define EPD_ENCODE_CONST const
+#endif
+
+#define EPD_ENCODE_INLINE static inline __attribute__((always_inline))
+
+
+// per byte formulas (also used to generate the tables)
+// ====================================================
+
+// swap the order of the four bit pairs in a byte
+#define EPD_ENCODE_REORDER(v) ((uint8_t)((((v) >> 6) & 0x03)	\
+					 | ((((v) >> 4) & 0x03) << 2)	\
+					 | ((((v) >> 2) & 0x03) << 4)	\
+					 | (((v) & 0x03) << 6)))
+
+// even pixels: bits 7,5,3,1 of the image byte, output pair order reversed
+#define EPD_ENCODE_EVEN_0(x) EPD_ENCODE_REORDER(0xaa | ((((x) & 0xaa) ^ 0xaa) >> 1))
+#define EPD_ENCODE_EVEN_1(x) EPD_ENCODE_REORDER(0x55 + ((((x) & 0xaa) ^ 0xaa) >> 1))
+#define EPD_ENCODE_EVEN_2(x) EPD_ENCODE_REORDER(0x55 | (((x) & 0xaa) ^ 0xaa))
+#define EPD_ENCODE_EVEN_3(x) EPD_ENCODE_REORDER(0xaa | (((x) & 0xaa) >> 1))
+
+// odd pixels: bits 6,4,2,0 of the image byte
+#define EPD_ENCODE_ODD_0(x) ((uint8_t)(0xaa | (((x) & 0x55) ^ 0x55)))
+#define EPD_ENCODE_ODD_1(x) ((uint8_t)(0x55 + (((x) & 0x55) ^ 0x55)))
+#define EPD_ENCODE_ODD_2(x) ((uint8_t)(0x55 | ((((x) & 0x55) ^ 0x55) << 1)))
+#define EPD_ENCODE_ODD_3(x) ((uint8_t)(0xaa | ((x) & 0x55)))
+
+// change bits to a two bit per pixel mask
+#define EPD_ENCODE_EVEN_MASK(c) EPD_ENCODE_REORDER(((c) & 0xaa) | (((c) & 0xaa) >> 1))
+#define EPD_ENCODE_ODD_MASK(c) ((uint8_t)(((c) & 0x55) | (((c) & 0x55) << 1)))
+
+// spread a nibble to bits 6,4,2,0: 3210 -> .3.2.1.0
+#define EPD_ENCODE_SPREAD(n) ((uint8_t)(((n) & 0x01) | (((n) & 0x02) << 1)	\
+					 | (((n) & 0x04) << 2) | (((n) & 0x08) << 3)))
+
+
+#if EPD_ENCODE_TABLES
+
+// expand a macro for 0..255 at compile time
+#define EPD_ENCODE_T4(F, n) F((n)), F((n) + 1), F((n) + 2), F((n) + 3)
+#define EPD_ENCODE_T16(F, n) EPD_ENCODE_T4(F, (n)), EPD_ENCODE_T4(F, (n) + 4),	\
+		EPD_ENCODE_T4(F, (n) + 8), EPD_ENCODE_T4(F, (n) + 12)
+#define EPD_ENCODE_T64(F, n) EPD_ENCODE_T16(F, (n)), EPD_ENCODE_T16(F, (n) + 16), \
+		EPD_ENCODE_T16(F, (n) + 32), EPD_ENCODE_T16(F, (n) + 48)
+#define EPD_ENCODE_T256(F) EPD_ENCODE_T64(F, 0), EPD_ENCODE_T64(F, 64),	\
+		EPD_ENCODE_T64(F, 128), EPD_ENCODE_T64(F, 192)
+
+static EPD_ENCODE_CONST uint8_t EPD_encode_even_table[4][256] EPD_ENCODE_PROGMEM = {
+	{EPD_ENCODE_T256(EPD_ENCODE_EVEN_0)},
+	{EPD_ENCODE_T256(EPD_ENCODE_EVEN_1)},
+	{EPD_ENCODE_T256(EPD_ENCODE_EVEN_2)},
+	{EPD_ENCODE_T256(EPD_ENCODE_EVEN_3)}
+};
+
+static EPD_ENCODE_CONST uint8_t EPD_encode_odd_table[4][256] EPD_ENCODE_PROGMEM = {
+	{EPD_ENCODE_T256(EPD_ENCODE_ODD_0)},
+	{EPD_ENCODE_T256(EPD_ENCODE_ODD_1)},
+	{EPD_ENCODE_T256(EPD_ENCODE_ODD_2)},
+	{EPD_ENCODE_T256(EPD_ENCODE_ODD_3)}
+};
+
+static EPD_ENCODE_CONST uint8_t EPD_encode_even_mask_table[256] EPD_ENCODE_PROGMEM = {
+	EPD_ENCODE_T256(EPD_ENCODE_EVEN_MASK)
+};
+
+static EPD_ENCODE_CONST uint8_t EPD_encode_spread_table[16] EPD_ENCODE_PROGMEM = {
+	EPD_ENCODE_T16(EPD_ENCODE_SPREAD, 0)
+};
+
+#endif
+
+
+// line encoders look up the table row of their stage once
+#if EPD_ENCODE_TABLES
+#define EPD_ENCODE_ROW(table, stage) ((table)[stage])
+#define EPD_ENCODE_ROW_BYTE(row, data, encode, stage) EPD_ENCODE_READ_TABLE(&(row)[data])
+#else
+#define EPD_ENCODE_ROW(table, stage) NULL
+#define EPD_ENCODE_ROW_BYTE(row, data, encode, stage) encode((data), (stage))
+#endif
+
+
+// per byte encoders
+// =================
+
+EPD_ENCODE_INLINE uint8_t EPD_encode_even(uint8_t data, int stage) {
+#if EPD_ENCODE_TABLES
+	return EPD_ENCODE_READ_TABLE(&EPD_encode_even_table[stage][data]);
+#else
+	switch (stage) {
+	case 0:
+		return EPD_ENCODE_EVEN_0(data);
+	case 1:
+		return EPD_ENCODE_EVEN_1(data);
+	case 2:
+		return EPD_ENCODE_EVEN_2(data);
+	default:
+		return EPD_ENCODE_EVEN_3(data);
+	}
+#endif
+}
+
+EPD_ENCODE_INLINE uint8_t EPD_encode_odd(uint8_t data, int stage) {
+#if EPD_ENCODE_TABLES
+	return EPD_ENCODE_READ_TABLE(&EPD_encode_odd_table[stage][data]);
+#else
+	switch (stage) {
+	case 0:
+		return EPD_ENCODE_ODD_0(data);
+	case 1:
+		return EPD_ENCODE_ODD_1(data);
+	case 2:
+		return EPD_ENCODE_ODD_2(data);
+	default:
+		return EPD_ENCODE_ODD_3(data);
+	}
+#endif
+}
+
+EPD_ENCODE_INLINE uint8_t EPD_encode_spread(uint8_t nibble) {
+#if EPD_ENCODE_TABLES
+	return EPD_ENCODE_READ_TABLE(&EPD_encode_spread_table[nibble & 0x0f]);
+#else
+	return EPD_ENCODE_SPREAD(nibble);
+#endif
+}
+
+EPD_ENCODE_INLINE uint8_t EPD_encode_even_mask(uint8_t change) {
+#if EPD_ENCODE_TABLES
+	return EPD_ENCODE_READ_TABLE(&EPD_encode_even_mask_table[change]);
+#else
+	return EPD_ENCODE_EVEN_MASK(change);
+#endif
+}
+
+EPD_ENCODE_INLINE uint8_t EPD_encode_odd_mask(uint8_t change) {
+	return EPD_ENCODE_ODD_MASK(change);
+}
+
+// replace unchanged pixels by "nothing" (0b01)
+EPD_ENCODE_INLINE uint8_t EPD_encode_apply_mask(uint8_t pixels, uint8_t mask) {
+	return (pixels & mask) | (~mask & 0x55);
+}
+
+// all pixels of one byte (two output bytes): high nibble first
+// the separate pixel pairs do not interact so the odd encoding of
+// the spread nibbles gives the same result as a 16 bit interleave
+EPD_ENCODE_INLINE uint8_t EPD_encode_all_high(uint8_t data, int stage) {
+	return EPD_encode_odd(EPD_encode_spread(data >> 4), stage);
+}
+
+EPD_ENCODE_INLINE uint8_t EPD_encode_all_low(uint8_t data, int stage) {
+	return EPD_encode_odd(EPD_encode_spread(data), stage);
+}
+
+EPD_ENCODE_INLINE uint8_t EPD_encode_all_high_mask(uint8_t change) {
+	return EPD_encode_odd_mask(EPD_encode_spread(change >> 4));
+}
+
+EPD_ENCODE_INLINE uint8_t EPD_encode_all_low_mask(uint8_t change) {
+	return EPD_encode_odd_mask(EPD_encode_spread(change));
+}
+
+
+// line encoders
+// =============
+// each writes the data bytes of one line to p and returns the new end
+// data: image line or NULL for fixed_value, change: NULL for all pixels
+// progmem: data is in program memory (AVR only, ignored elsewhere)
+//
+// the stage and the NULL checks are resolved once per line so the
+// loops are a read and a table lookup per byte; on AVR copy a progmem
+// line to SRAM (memcpy_P) first and pass progmem = false
+
+EPD_ENCODE_INLINE uint8_t *EPD_encode_fixed_line(uint8_t *p, uint8_t fixed_value, uint16_t length) {
+	for (uint16_t b = length; b > 0; --b) {
+		*p++ = fixed_value;
+	}
+	return p;
+}
+
+// even pixels in image order
+EPD_ENCODE_INLINE uint8_t *EPD_encode_even_line(uint8_t *p, const uint8_t *data, const uint8_t *change,
+						uint8_t fixed_value, bool progmem, uint16_t bytes_per_line, int stage) {
+	if (NULL == data) {
+		return EPD_encode_fixed_line(p, fixed_value, bytes_per_line);
+	}
+	const uint8_t *row = EPD_ENCODE_ROW(EPD_encode_even_table, stage);
+	(void)row;
+	if (NULL == change) {
+		for (uint16_t b = 0; b < bytes_per_line; ++b) {
+			*p++ = EPD_ENCODE_ROW_BYTE(row, EPD_ENCODE_READ_DATA(&data[b], progmem), EPD_encode_even, stage);
+		}
+	} else {
+		for (uint16_t b = 0; b < bytes_per_line; ++b) {
+			*p++ = EPD_encode_apply_mask(EPD_ENCODE_ROW_BYTE(row, EPD_ENCODE_READ_DATA(&data[b], progmem), EPD_encode_even, stage),
+						     EPD_encode_even_mask(change[b]));
+		}
+	}
+	return p;
+}
+
+// odd pixels in reverse image order
+EPD_ENCODE_INLINE uint8_t *EPD_encode_odd_line(uint8_t *p, const uint8_t *data, const uint8_t *change,
+					       uint8_t fixed_value, bool progmem, uint16_t bytes_per_line, int stage) {
+	if (NULL == data) {
+		return EPD_encode_fixed_line(p, fixed_value, bytes_per_line);
+	}
+	const uint8_t *row = EPD_ENCODE_ROW(EPD_encode_odd_table, stage);
+	(void)row;
+	if (NULL == change) {
+		for (uint16_t b = bytes_per_line; b > 0; --b) {
+			*p++ = EPD_ENCODE_ROW_BYTE(row, EPD_ENCODE_READ_DATA(&data[b - 1], progmem), EPD_encode_odd, stage);
+		}
+	} else {
+		for (uint16_t b = bytes_per_line; b > 0; --b) {
+			*p++ = EPD_encode_apply_mask(EPD_ENCODE_ROW_BYTE(row, EPD_ENCODE_READ_DATA(&data[b - 1], progmem), EPD_encode_odd, stage),
+						     EPD_encode_odd_mask(change[b - 1]));
+		}
+	}
+	return p;
+}
+
+// all pixels in reverse image order, two bytes per image byte
+EPD_ENCODE_INLINE uint8_t *EPD_encode_all_line(uint8_t *p, const uint8_t *data, const uint8_t *change,
+					       uint8_t fixed_value, bool progmem, uint16_t bytes_per_line, int stage) {
+	if (NULL == data) {
+		return EPD_encode_fixed_line(p, fixed_value, 2 * bytes_per_line);
+	}
+	const uint8_t *row = EPD_ENCODE_ROW(EPD_encode_odd_table, stage);
+	(void)row;
+	for (uint16_t b = bytes_per_line; b > 0; --b) {
+		uint8_t pixels = EPD_ENCODE_READ_DATA(&data[b - 1], progmem);
+		uint8_t high = EPD_ENCODE_ROW_BYTE(row, EPD_encode_spread(pixels >> 4), EPD_encode_odd, stage);
+		uint8_t low = EPD_ENCODE_ROW_BYTE(row, EPD_encode_spread(pixels), EPD_encode_odd, stage);
+		if (NULL != change) {
+			high = EPD_encode_apply_mask(high, EPD_encode_all_high_mask(change[b - 1]));
+			low = EPD_encode_apply_mask(low, EPD_encode_all_low_mask(change[b - 1]));
+		}
+		*p++ = high;
+		*p++ = low;
+	}
+	return p;
+}
+
+#endif
@@ -22,6 +22,8 @@
 #include <Arduino.h>
 #endif
 
+#include <stddef.h>
+#include <string.h>
 #include <SPI.h>
 
 #include "EPD_FLASH.h"
@@ -62,12 +64,24 @@ enum {
 #define EPD_FLASH_MFG 0xc2
 #define EPD_FLASH_ID 0x2014
 
+// stream read clock, the same as SPI_CLOCK_DIV4 on a 16 MHz AVR
+#if !defined(EPD_FLASH_SPI_CLOCK)
+#define EPD_FLASH_SPI_CLOCK 4000000
+#endif
+
+#if defined(SPI_HAS_TRANSACTION)
+static const SPISettings stream_settings(EPD_FLASH_SPI_CLOCK, MSBFIRST, SPI_MODE3);
+#endif
+
 
 // the default EPD_FLASH device
 EPD_FLASH_Class EPD_FLASH(9);
 
 
-EPD_FLASH_Class::EPD_FLASH_Class(uint8_t chip_select_pin) : EPD_FLASH_CS(chip_select_pin) {
+EPD_FLASH_Class::EPD_FLASH_Class(uint8_t chip_select_pin) :
+	EPD_FLASH_CS(chip_select_pin),
+	stream_open(false),
+	stream_address(0) {
 }
 
 
@@ -153,7 +167,68 @@ void EPD_FLASH_Class::read(void *buffer, uint32_t address, uint16_t length) {
 }
 
 
+void EPD_FLASH_Class::begin_stream(uint32_t address) {
+	this->wait_for_ready();
+	this->spi_teardown();
+	this->stream_open = true;
+	this->stream_address = address;
+}
+
+
+void EPD_FLASH_Class::read_next(void *buffer, uint16_t length) {
+	uint32_t address = this->stream_address;
+
+	SPI.begin();
+#if defined(SPI_HAS_TRANSACTION)
+	SPI.beginTransaction(stream_settings);
+#else
+	SPI.setBitOrder(MSBFIRST);
+	SPI.setDataMode(SPI_MODE3);
+	SPI.setClockDivider(SPI_CLOCK_DIV4);
+#endif
+
+	digitalWrite(this->EPD_FLASH_CS, LOW);
+	SPI.transfer(EPD_FLASH_FAST_READ);
+	SPI.transfer(address >> 16);
+	SPI.transfer(address >> 8);
+	SPI.transfer(address);
+	SPI.transfer(EPD_FLASH_NOP); // read dummy byte
+#if defined(SPI_HAS_TRANSACTION)
+	// clock out NOPs, the data read replaces them
+	memset(buffer, EPD_FLASH_NOP, length);
+	SPI.transfer(buffer, length);
+#else
+	uint8_t *p = (uint8_t *)buffer;
+	for (uint16_t n = length; n != 0; --n) {
+		*p++ = SPI.transfer(EPD_FLASH_NOP);
+	}
+#endif
+	digitalWrite(this->EPD_FLASH_CS, HIGH);
+
+#if defined(SPI_HAS_TRANSACTION)
+	SPI.endTransaction();
+#endif
+	SPI.end();
+
+	this->stream_address = address + length;
+}
+
+
+void EPD_FLASH_Class::end_stream(void) {
+	this->stream_open = false;
+}
+
+
+void EPD_FLASH_Class::read_stream(void *buffer, uint32_t address, uint16_t length) {
+	if (!this->stream_open || address != this->stream_address) {
+		this->begin_stream(address);
+	}
+	this->read_next(buffer, length);
+}
+
+
 void EPD_FLASH_Class::wait_for_ready(void) {
+	this->stream_open = false;  // writes and erases leave the chip busy
 	this->spi_setup();
 	while (this->is_busy()) {
 	}
@@ -238,3 +313,360 @@ void EPD_FLASH_Class::sector_erase(uint32_t address) {
 	SPI.transfer(address);
 	this->spi_teardown();
 }
+
+
+// image catalog
+// =============
+
+// header slot
+static const uint8_t catalog_magic[] = {'E', 'P', 'D', 'C', 1, EPD_FLASH_CATALOG_SLOT_SIZE};
+
+static inline uint32_t slot_address(uint8_t sector, int16_t slot) {
+	return ((uint32_t)sector << EPD_FLASH_SECTOR_SHIFT) + slot * EPD_FLASH_CATALOG_SLOT_SIZE;
+}
+
+
+bool EPD_FLASH_Class::catalog_valid(void) {
+	uint8_t header[sizeof(catalog_magic)];
+
+	this->read(header, slot_address(EPD_FLASH_CATALOG_SECTOR, 0), sizeof(header));
+	if (0 == memcmp(header, catalog_magic, sizeof(header))) {
+		return true;
+	}
+
+	// the magic is only missing while compaction copies the spare
+	// back (or the header write was cut short) and then the spare has
+	// the magic only if its copy is complete
+	this->read(header, slot_address(EPD_FLASH_CATALOG_SPARE, 0), sizeof(header));
+	if (0 == memcmp(header, catalog_magic, sizeof(header))) {
+		return this->catalog_copy(EPD_FLASH_CATALOG_SPARE, EPD_FLASH_CATALOG_SECTOR);
+	}
+	return false;
+}
+
+
+void EPD_FLASH_Class::catalog_format(void) {
+	this->write_enable();
+	this->sector_erase(slot_address(EPD_FLASH_CATALOG_SPARE, 0));
+	this->write_enable();
+	this->sector_erase(slot_address(EPD_FLASH_CATALOG_SECTOR, 0));
+	this->write_enable();
+	this->write(slot_address(EPD_FLASH_CATALOG_SECTOR, 0), catalog_magic, sizeof(catalog_magic));
+	this->write_disable();
+}
+
+
+// consecutive slots continue one read stream
+int16_t EPD_FLASH_Class::catalog_next(int16_t slot, EPD_FLASH_Entry *entry) {
+	while (++slot < EPD_FLASH_CATALOG_SLOTS) {
+		this->read_stream(entry, slot_address(EPD_FLASH_CATALOG_SECTOR, slot), sizeof(*entry));
+		if (EPD_FLASH_ENTRY_FREE == entry->state) {
+			break;
+		}
+		if (EPD_FLASH_ENTRY_VALID == entry->state) {
+			return slot;
+		}
+	}
+	this->end_stream();
+	return -1;
+}
+
+
+int16_t EPD_FLASH_Class::catalog_find(uint8_t id, EPD_FLASH_Entry *entry) {
+	for (int16_t slot = this->catalog_next(0, entry); slot > 0; slot = this->catalog_next(slot, entry)) {
+		if (id == entry->id) {
+			this->end_stream();
+			return slot;
+		}
+	}
+	return -1;
+}
+
+
+int16_t EPD_FLASH_Class::catalog_find(const char *name, EPD_FLASH_Entry *entry) {
+	for (int16_t slot = this->catalog_next(0, entry); slot > 0; slot = this->catalog_next(slot, entry)) {
+		if (0 == strncmp(name, entry->name, sizeof(entry->name))) {
+			this->end_stream();
+			return slot;
+		}
+	}
+	return -1;
+}
+
+
+int16_t EPD_FLASH_Class::catalog_allocate(EPD_FLASH_Entry *entry) {
+	uint8_t used[EPD_FLASH_SECTOR_COUNT / 8];
+	EPD_FLASH_Entry e;
+
+	if (!this->catalog_valid()) {
+		return -1;
+	}
+
+	memset(used, 0, sizeof(used));
+	for (uint8_t s = 0; s < EPD_FLASH_CATALOG_FIRST_IMAGE; ++s) {
+		used[s >> 3] |= 1 << (s & 0x07);
+	}
+
+	// collect the sectors in use; a pending entry is left from an
+	// upload that never finished so it is dropped
+	int16_t slot = 1;
+	for (; slot < EPD_FLASH_CATALOG_SLOTS; ++slot) {
+		this->read_stream(&e, slot_address(EPD_FLASH_CATALOG_SECTOR, slot), sizeof(e));
+		if (EPD_FLASH_ENTRY_FREE == e.state) {
+			break;
+		} else if (EPD_FLASH_ENTRY_PENDING == e.state) {
+			this->catalog_free(slot);
+		} else if (EPD_FLASH_ENTRY_VALID == e.state) {
+			uint16_t end = e.sector + ((e.length + EPD_FLASH_SECTOR_SIZE - 1) >> EPD_FLASH_SECTOR_SHIFT);
+			for (uint16_t s = e.sector; s < end && s < EPD_FLASH_SECTOR_COUNT; ++s) {
+				used[s >> 3] |= 1 << (s & 0x07);
+			}
+		}
+	}
+	this->end_stream();
+
+	if (slot >= EPD_FLASH_CATALOG_SLOTS) {
+		slot = this->catalog_compact();
+		if (slot < 0) {
+			return -1;
+		}
+	}
+
+	// first fit
+	uint16_t sectors = (entry->length + EPD_FLASH_SECTOR_SIZE - 1) >> EPD_FLASH_SECTOR_SHIFT;
+	uint16_t run = 0;
+	uint16_t s = EPD_FLASH_CATALOG_FIRST_IMAGE;
+	for (; s < EPD_FLASH_SECTOR_COUNT && run < sectors; ++s) {
+		run = 0 == (used[s >> 3] & (1 << (s & 0x07))) ? run + 1 : 0;
+	}
+	if (0 == sectors || run < sectors) {
+		return -1;
+	}
+
+	entry->state = EPD_FLASH_ENTRY_PENDING;
+	entry->sector = s - sectors;
+	entry->crc = 0xffff;       // programmed by commit
+	entry->reserved = 0xffff;
+	this->write_enable();
+	this->write(slot_address(EPD_FLASH_CATALOG_SECTOR, slot), entry, sizeof(*entry));
+	this->write_disable();
+	return slot;
+}
+
+
+// CRC first so a valid entry always has its CRC
+void EPD_FLASH_Class::catalog_commit(int16_t slot, uint16_t crc) {
+	uint32_t address = slot_address(EPD_FLASH_CATALOG_SECTOR, slot);
+	const uint8_t state = EPD_FLASH_ENTRY_VALID;
+
+	this->write_enable();
+	this->write(address + offsetof(EPD_FLASH_Entry, crc), &crc, sizeof(crc));
+	this->write_enable();
+	this->write(address + offsetof(EPD_FLASH_Entry, state), &state, sizeof(state));
+	this->write_disable();
+}
+
+
+void EPD_FLASH_Class::catalog_free(int16_t slot) {
+	const uint8_t state = EPD_FLASH_ENTRY_DELETED;
+
+	this->write_enable();
+	this->write(slot_address(EPD_FLASH_CATALOG_SECTOR, slot) + offsetof(EPD_FLASH_Entry, state),
+		    &state, sizeof(state));
+	this->write_disable();
+}
+
+
+// copy the valid entries, packed, to an erased sector; the header is
+// programmed last so a sector with the magic is always a complete
+// catalog and an interrupted copy is never taken for one
+bool EPD_FLASH_Class::catalog_copy(uint8_t from_sector, uint8_t to_sector) {
+	EPD_FLASH_Writer writer(*this);
+	EPD_FLASH_Entry e;
+
+	writer.begin(slot_address(to_sector, 0));
+	for (uint8_t i = 0; i < EPD_FLASH_CATALOG_SLOT_SIZE; ++i) {
+		writer.write(0xff);
+	}
+	for (int16_t slot = 1; slot < EPD_FLASH_CATALOG_SLOTS; ++slot) {
+		this->read(&e, slot_address(from_sector, slot), sizeof(e));
+		if (EPD_FLASH_ENTRY_FREE == e.state) {
+			break;
+		}
+		if (EPD_FLASH_ENTRY_VALID == e.state) {
+			writer.write(&e, sizeof(e));
+		}
+	}
+	if (!writer.end()) {
+		return false;
+	}
+
+	uint8_t header[sizeof(catalog_magic)];
+	this->write_enable();
+	this->write(slot_address(to_sector, 0), catalog_magic, sizeof(catalog_magic));
+	this->write_disable();
+	this->read(header, slot_address(to_sector, 0), sizeof(header));
+	return 0 == memcmp(header, catalog_magic, sizeof(header));
+}
+
+
+// returns the first free slot, -1 if all slots are valid entries
+int16_t EPD_FLASH_Class::catalog_compact(void) {
+	if (!this->catalog_copy(EPD_FLASH_CATALOG_SECTOR, EPD_FLASH_CATALOG_SPARE) ||
+	    !this->catalog_copy(EPD_FLASH_CATALOG_SPARE, EPD_FLASH_CATALOG_SECTOR)) {
+		return -1;
+	}
+
+	// a stale copy must not be recovered later
+	this->write_enable();
+	this->sector_erase(slot_address(EPD_FLASH_CATALOG_SPARE, 0));
+	this->write_disable();
+	EPD_FLASH_Entry e;
+	int16_t slot = 0;
+	while (slot + 1 < EPD_FLASH_CATALOG_SLOTS) {
+		this->read_stream(&e, slot_address(EPD_FLASH_CATALOG_SECTOR, ++slot), sizeof(e));
+		if (EPD_FLASH_ENTRY_FREE == e.state) {
+			this->end_stream();
+			return slot;
+		}
+	}
+	this->end_stream();
+	return -1;
+}
+
+
+EPD_FLASH_Writer::EPD_FLASH_Writer(EPD_FLASH_Class &flash) :
+	flash(flash),
+	start(0),
+	address(0),
+	used(0),
+	crc(0xffff) {
+	memset(this->erased, 0, sizeof(this->erased));
+}
+
+
+void EPD_FLASH_Writer::begin(uint32_t address) {
+	this->start = address;
+	this->address = address;
+	this->used = 0;
+	this->crc = 0xffff;
+	memset(this->erased, 0, sizeof(this->erased));
+}
+
+
+void EPD_FLASH_Writer::erase(uint32_t length) {
+	uint32_t end = this->start + length;
+	for (uint32_t a = this->start; a < end; a = (a | (EPD_FLASH_SECTOR_SIZE - 1)) + 1) {
+		this->prepare(a);
+	}
+	// starting a stream waits for the chip to be ready
+	this->flash.begin_stream(this->start);
+	this->flash.end_stream();
+}
+
+
+void EPD_FLASH_Writer::write(uint8_t data) {
+	if (0 == this->used) {
+		this->prepare(this->address);
+	}
+	this->page[this->used++] = data;
+	this->crc = crc16(this->crc, data);
+
+	// a page program must not cross a page boundary
+	if (0 == ((this->address + this->used) & (EPD_FLASH_PAGE_SIZE - 1))) {
+		this->flush();
+	}
+}
+
+
+void EPD_FLASH_Writer::write(const void *buffer, uint16_t length) {
+	for (const uint8_t *p = (const uint8_t *)buffer; length != 0; --length) {
+		this->write(*p++);
+	}
+}
+
+
+#if defined(__AVR__)
+void EPD_FLASH_Writer::write_from_progmem(PROGMEM const void *buffer, uint16_t length) {
+	for (PROGMEM const uint8_t *p = (PROGMEM const uint8_t *)buffer; length != 0; ++p, --length) {
+		this->write(pgm_read_byte_near(p));
+	}
+}
+#endif
+
+
+bool EPD_FLASH_Writer::end(void) {
+	this->flush();
+	this->flash.write_disable();
+
+	// the page buffer is free now, use it to read back
+	uint16_t check = 0xffff;
+	uint32_t length = this->address - this->start;
+	this->flash.begin_stream(this->start);
+	while (0 != length) {
+		uint16_t n = length < sizeof(this->page) ? length : sizeof(this->page);
+		this->flash.read_next(this->page, n);
+		for (uint16_t i = 0; i < n; ++i) {
+			check = crc16(check, this->page[i]);
+		}
+		length -= n;
+	}
+	this->flash.end_stream();
+
+	return check == this->crc;
+}
+
+
+uint16_t EPD_FLASH_Writer::crc16(uint16_t crc, uint8_t data) {
+	crc ^= (uint16_t)data << 8;
+	for (uint8_t i = 0; i < 8; ++i) {
+		crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+	}
+	return crc;
+}
+
+
+// called as each page is started; the first page in a sector erases
+// it unless it is already blank, and the erase then runs while the
+// page is being filled
+void EPD_FLASH_Writer::prepare(uint32_t sector_address) {
+	uint16_t sector = sector_address >> EPD_FLASH_SECTOR_SHIFT;
+	uint8_t bit = 1 << (sector & 0x07);
+	if (sector >= EPD_FLASH_SECTOR_COUNT || 0 != (this->erased[sector >> 3] & bit)) {
+		return;
+	}
+	this->erased[sector >> 3] |= bit;
+
+	// blank check, normally stops at the first byte if not blank
+	sector_address = (uint32_t)sector << EPD_FLASH_SECTOR_SHIFT;
+	bool blank = true;
+	this->flash.begin_stream(sector_address);
+	for (uint16_t i = 0; blank && i < EPD_FLASH_SECTOR_SIZE; i += sizeof(this->page)) {
+		this->flash.read_next(this->page, sizeof(this->page));
+		for (uint16_t j = 0; j < sizeof(this->page); ++j) {
+			if (0xff != this->page[j]) {
+				blank = false;
+				break;
+			}
+		}
+	}
+	this->flash.end_stream();
+
+	if (!blank) {
+		this->flash.write_enable();
+		this->flash.sector_erase(sector_address);
+	}
+}
+
+
+// program the buffered bytes, waiting only for the previous program
+// or erase to finish; this one completes in the background
+void EPD_FLASH_Writer::flush(void) {
+	if (0 == this->used) {
+		return;
+	}
+	this->flash.write_enable();
+	this->flash.write(this->address, this->page, this->used);
+	this->address += this->used;
+	this->used = 0;
+}
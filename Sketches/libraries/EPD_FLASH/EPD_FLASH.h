@@ -39,20 +39,86 @@
 #define EPD_FLASH_SECTOR_COUNT 256
 
 
+// image catalog
+// -------------
+//
+// sector 0 holds a header slot followed by 127 entry slots that are
+// filled in order; the first free (all 0xff) slot ends the list, so a
+// lookup is one sequential read of the used part of the sector
+//
+// an entry only ever has bits cleared (free -> pending -> valid ->
+// deleted) so allocate, commit and free need no erase; when the slots
+// run out the valid entries are compacted through the spare sector,
+// which holds a copy to recover from if power fails part way through;
+// a copy gets its header last so the magic marks a complete catalog
+#define EPD_FLASH_CATALOG_SECTOR 0
+#define EPD_FLASH_CATALOG_SPARE 1
+#define EPD_FLASH_CATALOG_FIRST_IMAGE 2  // first sector given to images
+#define EPD_FLASH_CATALOG_SLOT_SIZE 32
+#define EPD_FLASH_CATALOG_SLOTS (EPD_FLASH_SECTOR_SIZE / EPD_FLASH_CATALOG_SLOT_SIZE)
+#define EPD_FLASH_NAME_SIZE 16             // including the '\0'
+
+// entry states
+enum {
+	EPD_FLASH_ENTRY_FREE = 0xff,
+	EPD_FLASH_ENTRY_PENDING = 0x7f,    // allocated, data not written yet
+	EPD_FLASH_ENTRY_VALID = 0x3f,
+	EPD_FLASH_ENTRY_DELETED = 0x00
+};
+
+// image data encodings
+enum {
+	EPD_FLASH_ENCODING_RAW = 0,        // XBM bits, one line after another
+	EPD_FLASH_ENCODING_PACKBITS = 1,   // EPD_PACKBITS line packed
+	EPD_FLASH_ENCODING_STAGES = 2      // raw, then the four stage frames
+	                                   // from EPD.line_encode() (V231_G2)
+};
+
+// one catalog slot (EPD_FLASH_CATALOG_SLOT_SIZE bytes)
+typedef struct {
+	uint8_t state;
+	uint8_t id;                        // chosen by the caller
+	uint8_t sector;                    // first sector of the data
+	uint8_t encoding;
+	uint32_t length;                   // bytes of data
+	uint16_t width;                    // pixels
+	uint16_t height;                   // pixels
+	uint16_t crc;                      // CRC-16 of the data
+	uint16_t reserved;
+	char name[EPD_FLASH_NAME_SIZE];    // '\0' padded
+} EPD_FLASH_Entry;
+
+
 class EPD_FLASH_Class {
 private:
 	uint8_t EPD_FLASH_CS;
+	bool stream_open;         // chip known to be ready for reads
+	uint32_t stream_address;  // next byte of the stream
 
 	void spi_setup(void);
 	void spi_teardown(void);
 	bool is_busy(void);
 	void wait_for_ready(void);
+	bool catalog_copy(uint8_t from_sector, uint8_t to_sector);
+	int16_t catalog_compact(void);
 	EPD_FLASH_Class(const EPD_FLASH_Class &f);  // prevent copy
 
 public:
 	bool available(void);
 	void info(uint8_t *maufacturer, uint16_t *device);
 	void read(void *buffer, uint32_t address, uint16_t length);
+
+	// streaming reads: one ready check for the whole stream, then each
+	// read_next is a single FAST_READ with no extra bus set up or
+	// delays; CS is released after every read_next so the panel can use
+	// the bus in between (the flash would count its clocks otherwise)
+	void begin_stream(uint32_t address);
+	void read_next(void *buffer, uint16_t length);
+	void end_stream(void);
+
+	// EPD_reader style: continue the stream if address follows on
+	void read_stream(void *buffer, uint32_t address, uint16_t length);
+
 	void write_enable(void);
 	void write_disable(void);
 	void write(uint32_t address, const void *buffer, uint16_t length);
@@ -69,6 +135,21 @@ public:
 
 	void sector_erase(uint32_t address);
 
+	// image catalog, slot numbers are only stable until the catalog
+	// is compacted by an allocate; the find and next functions
+	// return -1 when there is no (more) match
+	bool catalog_valid(void);          // also recovers a compaction
+	void catalog_format(void);         // empty catalog, images are lost
+	int16_t catalog_next(int16_t slot, EPD_FLASH_Entry *entry);  // start with slot 0
+	int16_t catalog_find(uint8_t id, EPD_FLASH_Entry *entry);
+	int16_t catalog_find(const char *name, EPD_FLASH_Entry *entry);
+
+	// fill in id, name, encoding, length, width and height; gets free
+	// sectors and a pending slot, -1 if there is no room
+	int16_t catalog_allocate(EPD_FLASH_Entry *entry);
+	void catalog_commit(int16_t slot, uint16_t crc);  // data written
+	void catalog_free(int16_t slot);
+
 	// inline static void attachInterrupt();
 	// inline static void detachInterrupt();
 
@@ -81,4 +162,69 @@ public:
 
 extern EPD_FLASH_Class EPD_FLASH;
 
+
+// sequential page buffered programming
+//
+// bytes are collected into whole pages so there is one page program
+// per EPD_FLASH_PAGE_SIZE bytes; the program runs while the caller
+// fetches the next page and is only waited for at the next flush.
+// Each sector is erased when the first page of it is started (unless
+// it is already blank) so its erase also overlaps the data reception.
+// end() reads everything back and checks it against a CRC-16 of the
+// bytes written
+//
+// note: the whole of the starting sector is erased, so begin() should
+// normally be given a sector address
+class EPD_FLASH_Writer {
+private:
+	EPD_FLASH_Class &flash;
+	uint32_t start;         // first address written
+	uint32_t address;       // address of page[0]
+	uint8_t used;           // bytes in page
+	uint16_t crc;           // of all bytes written
+	uint8_t erased[EPD_FLASH_SECTOR_COUNT / 8];  // sectors ready to program
+	uint8_t page[EPD_FLASH_PAGE_SIZE];
+
+	void prepare(uint32_t sector_address);
+	void flush(void);
+	EPD_FLASH_Writer(const EPD_FLASH_Writer &w);  // prevent copy
+
+public:
+	void begin(uint32_t address);
+
+	// erase (or blank check) now all the sectors that length bytes from
+	// begin() will use and wait for the last erase, so the writes only
+	// wait for page programs
+	void erase(uint32_t length);
+
+	void write(uint8_t data);
+	void write(const void *buffer, uint16_t length);
+
+#if !defined(__AVR__)
+	inline void write_from_progmem(const void *buffer, uint16_t length) {
+		this->write(buffer, length);
+	}
+#else
+	void write_from_progmem(PROGMEM const void *buffer, uint16_t length);
+#endif
+
+	// flush, disable writes and verify, true if the data read back OK
+	bool end(void);
+
+	// bytes written since begin()
+	inline uint32_t count(void) const {
+		return this->address + this->used - this->start;
+	}
+
+	// CRC of the bytes written since begin(), e.g. for catalog_commit()
+	inline uint16_t written_crc(void) const {
+		return this->crc;
+	}
+
+	// CRC-16/CCITT (polynomial 0x1021, start with 0xffff)
+	static uint16_t crc16(uint16_t crc, uint8_t data);
+
+	EPD_FLASH_Writer(EPD_FLASH_Class &flash);
+};
+
 #endif
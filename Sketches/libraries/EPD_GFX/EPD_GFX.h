@@ -16,11 +16,317 @@
 #define EPD_GFX_H 1
 
 // assumes the correct EPD_Vvvv_Gg.h has already been included
+//
+// with EPD_ENABLE_EXTRA_SRAM the images are kept as full frame buffers,
+// otherwise (or if EPD_GFX_BANDED is defined) drawing is recorded in a
+// display list that is drawn again a band of lines at a time as the
+// panel reads it, see below; with EPD_GFX_SRAM defined the full frame
+// buffers are kept in an external SPI SRAM through EPD_SRAM
 
 #include <Arduino.h>
 #include <Adafruit_GFX.h>
 
 
+// area drawn on since the last display(), inclusive
+// (with a V231_G2 panel display() only updates these lines)
+struct EPD_GFX_Rectangle {
+	int16_t x0, y0, x1, y1;
+
+	void clear(void) {
+		this->x0 = this->y0 = 0x7fff;
+		this->x1 = this->y1 = -0x7fff;
+	}
+
+	bool empty(void) const {
+		return this->x0 > this->x1 || this->y0 > this->y1;
+	}
+
+	void add(int16_t ax0, int16_t ay0, int16_t ax1, int16_t ay1) {
+		if (ax0 < this->x0) {
+			this->x0 = ax0;
+		}
+		if (ay0 < this->y0) {
+			this->y0 = ay0;
+		}
+		if (ax1 > this->x1) {
+			this->x1 = ax1;
+		}
+		if (ay1 > this->y1) {
+			this->y1 = ay1;
+		}
+	}
+};
+
+
+// clip the range start .. end - 1 to low .. high - 1, false if empty
+static inline bool EPD_GFX_clip(int16_t *start, int16_t *end, int16_t low, int16_t high) {
+	if (*start < low) {
+		*start = low;
+	}
+	if (*end > high) {
+		*end = high;
+	}
+	return *start < *end;
+}
+
+// set (black) or clear the pixels x0 .. x1 of a line a byte at a time
+static inline void EPD_GFX_span(uint8_t *line, int16_t x0, int16_t x1, bool black) {
+	uint8_t *p = &line[x0 / 8];
+	uint8_t *q = &line[x1 / 8];
+	uint8_t first = 0xff << (x0 & 0x07);
+	uint8_t last = 0xff >> (7 - (x1 & 0x07));
+	if (p == q) {
+		first &= last;
+	} else {
+		memset(p + 1, black ? 0xff : 0x00, q - p - 1);
+		if (black) {
+			*q |= last;
+		} else {
+			*q &= ~last;
+		}
+	}
+	if (black) {
+		*p |= first;
+	} else {
+		*p &= ~first;
+	}
+}
+
+// set or clear one bit in count lines
+static inline void EPD_GFX_column(uint8_t *p, uint16_t bytes_per_line, int16_t count, uint8_t mask, bool black) {
+	if (black) {
+		for (; count > 0; --count, p += bytes_per_line) {
+			*p |= mask;
+		}
+	} else {
+		mask = ~mask;
+		for (; count > 0; --count, p += bytes_per_line) {
+			*p &= mask;
+		}
+	}
+}
+
+
+#if defined(EPD_GFX_SRAM)
+
+#include <EPD_SRAM.h>
+
+// frame buffers in an external SPI SRAM
+//
+// the old image (if the driver needs it) is at EPD_GFX_SRAM_ADDRESS,
+// followed by the new image; EPD_SRAM.begin() must be called first.
+// One line of the new image is kept in RAM so pixels drawn along a line
+// cost no SPI traffic until another line is drawn on, full width fills
+// go straight to the SRAM, and display() gives the driver
+// EPD_SRAM_reader so each line is read from the SRAM as it is sent
+
+#if !defined(EPD_GFX_SRAM_ADDRESS)
+#define EPD_GFX_SRAM_ADDRESS 0
+#endif
+
+class EPD_GFX : public Adafruit_GFX {
+
+private:
+	EPD_Class &EPD;
+	S5813A_Class &S5813A;
+
+	static const int pixel_width = EPD_PIXEL_WIDTH;  // must be a multiple of 8
+	static const int pixel_height = EPD_PIXEL_HEIGHT;
+	static const int bytes_per_line = pixel_width / 8;
+	static const uint32_t image_bytes = (uint32_t)bytes_per_line * (uint32_t)pixel_height;
+
+#if EPD_IMAGE_TWO_ARG
+	static const uint32_t old_address = EPD_GFX_SRAM_ADDRESS;
+	static const uint32_t new_address = EPD_GFX_SRAM_ADDRESS + image_bytes;
+#else
+	static const uint32_t new_address = EPD_GFX_SRAM_ADDRESS;
+#endif
+
+	// a line of new image, cache_y < 0 if none
+	uint8_t cache[bytes_per_line];
+	int16_t cache_y;
+	bool cache_changed;
+
+	EPD_GFX_Rectangle dirty;
+
+	EPD_GFX(EPD_Class&);  // disable copy constructor
+
+	static uint32_t line_address(int16_t y) {
+		return new_address + (uint32_t)y * bytes_per_line;
+	}
+
+	// write back the cached line if it was drawn on
+	void flush(void) {
+		if (this->cache_changed) {
+			EPD_SRAM.write(line_address(this->cache_y), this->cache, bytes_per_line);
+			this->cache_changed = false;
+		}
+	}
+
+	// forget the cached line (the SRAM has been written directly)
+	void discard(void) {
+		this->cache_y = -1;
+		this->cache_changed = false;
+	}
+
+	// a line of the new image to draw on
+	uint8_t *line(int16_t y) {
+		if (y != this->cache_y) {
+			this->flush();
+			EPD_SRAM.read(this->cache, line_address(y), bytes_per_line);
+			this->cache_y = y;
+		}
+		this->cache_changed = true;
+		return this->cache;
+	}
+
+public:
+
+	enum {
+		WHITE = 0,
+		BLACK = 1
+	};
+
+	// constructor
+	EPD_GFX(EPD_Class &epd, S5813A_Class &s5813a) :
+	Adafruit_GFX(this->pixel_width, this->pixel_height),
+		EPD(epd), S5813A(s5813a) {
+		this->discard();
+		this->dirty.clear();
+	}
+
+	void begin(void) {
+		int temperature = this->S5813A.read();
+
+		// erase display
+		this->EPD.begin();
+		this->EPD.setFactor(temperature);
+		this->EPD.clear();
+		this->EPD.end();
+
+		// clear buffers to white
+		EPD_SRAM.fill(EPD_GFX_SRAM_ADDRESS, 0, new_address + image_bytes - EPD_GFX_SRAM_ADDRESS);
+		this->discard();
+		this->dirty.clear();
+	}
+
+	void end(void){
+	}
+
+	// only the banded display list below can run out of room
+	bool overflow(void) const {
+		return false;
+	}
+
+	// set a single pixel in the new image
+	void drawPixel(int16_t x, int16_t y, uint16_t colour) {
+		if (x < 0 || x >= this->pixel_width || y < 0 || y >= this->pixel_height) {
+			return; // avoid buffer overwrite
+		}
+		this->dirty.add(x, y, x, y);
+		uint8_t *p = &this->line(y)[x / 8];
+		uint8_t mask = 0x01 << (x & 0x07);
+		if (BLACK == colour) {
+			*p |= mask;
+		} else {
+			*p &= ~mask;
+		}
+	}
+
+	void drawFastHLine(int16_t x, int16_t y, int16_t w, uint16_t colour) {
+		this->fillRect(x, y, w, 1, colour);
+	}
+
+	void drawFastVLine(int16_t x, int16_t y, int16_t h, uint16_t colour) {
+		int16_t y1 = y + h;
+		if (x < 0 || x >= pixel_width || !EPD_GFX_clip(&y, &y1, 0, pixel_height)) {
+			return;
+		}
+		this->dirty.add(x, y, x, y1 - 1);
+		for (; y < y1; ++y) {
+			EPD_GFX_column(&this->line(y)[x / 8], bytes_per_line, 1, 0x01 << (x & 0x07), BLACK == colour);
+		}
+	}
+
+	void fillRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t colour) {
+		int16_t x1 = x + w;
+		int16_t y1 = y + h;
+		if (!EPD_GFX_clip(&x, &x1, 0, pixel_width) || !EPD_GFX_clip(&y, &y1, 0, pixel_height)) {
+			return;
+		}
+		this->dirty.add(x, y, x1 - 1, y1 - 1);
+		if (0 == x && pixel_width == x1 && y1 - y > 1) {
+			// whole lines: one sequential write
+			if (this->cache_y >= y && this->cache_y < y1) {
+				this->discard();
+			}
+			EPD_SRAM.fill(line_address(y), BLACK == colour ? 0xff : 0x00, (uint32_t)(y1 - y) * bytes_per_line);
+			return;
+		}
+		for (; y < y1; ++y) {
+			EPD_GFX_span(this->line(y), x, x1 - 1, BLACK == colour);
+		}
+	}
+
+	void fillScreen(uint16_t colour) {
+		this->discard();
+		EPD_SRAM.fill(new_address, BLACK == colour ? 0xff : 0x00, image_bytes);
+		this->dirty.add(0, 0, pixel_width - 1, pixel_height - 1);
+	}
+
+	// refresh the display: change from current image to new image
+	// a V231_G2 panel only has the lines drawn on since the last
+	// display() updated (and nothing at all if there were none)
+	void display(void) {
+		this->flush();
+
+#if EPD_IMAGE_TWO_ARG && EPD_PARTIAL_AVAILABLE
+		if (this->dirty.empty()) {
+			return;
+		}
+		int16_t first_line = this->dirty.y0;
+		int16_t line_count = this->dirty.y1 - this->dirty.y0 + 1;
+#endif
+
+		int temperature = this->S5813A.read();
+
+		// erase old, display new
+		this->EPD.begin();
+		this->EPD.setFactor(temperature);
+
+#if EPD_IMAGE_ONE_ARG
+		this->EPD.frame_cb_13(new_address, EPD_SRAM_reader, EPD_inverse);
+		this->EPD.frame_stage2();
+		this->EPD.frame_cb_13(new_address, EPD_SRAM_reader, EPD_normal);
+#elif EPD_IMAGE_TWO_ARG
+#if EPD_PARTIAL_AVAILABLE
+		this->EPD.image_cb2(old_address, EPD_SRAM_reader, new_address, EPD_SRAM_reader, first_line, line_count);
+#else
+		this->EPD.frame_cb_repeat(old_address, EPD_SRAM_reader, EPD_compensate);
+		this->EPD.frame_cb_repeat(old_address, EPD_SRAM_reader, EPD_white);
+		this->EPD.frame_cb_repeat(new_address, EPD_SRAM_reader, EPD_inverse);
+		this->EPD.frame_cb_repeat(new_address, EPD_SRAM_reader, EPD_normal);
+#endif
+#else
+#error "unsupported image function"
+#endif
+		this->EPD.end();
+
+#if EPD_IMAGE_TWO_ARG
+		// copy new over to old
+#if EPD_PARTIAL_AVAILABLE
+		EPD_SRAM.copy(old_address + (uint32_t)first_line * bytes_per_line, line_address(first_line),
+			      (uint32_t)line_count * bytes_per_line);
+#else
+		EPD_SRAM.copy(old_address, new_address, image_bytes);
+#endif
+#endif
+		this->dirty.clear();
+	}
+};
+
+#elif defined(EPD_ENABLE_EXTRA_SRAM) && !defined(EPD_GFX_BANDED)
+
 class EPD_GFX : public Adafruit_GFX {
 
 private:
@@ -31,14 +337,35 @@ private:
 	// FIXME: Have to change these constants to suit panel (128 x 96, 200 x 96, 264 x 176)
 	static const int pixel_width = EPD_PIXEL_WIDTH;  // must be a multiple of 8
 	static const int pixel_height = EPD_PIXEL_HEIGHT;
+	static const int bytes_per_line = pixel_width / 8;
 
 #if EPD_IMAGE_TWO_ARG
 	uint8_t old_image[(uint32_t)(pixel_width) * (uint32_t)(pixel_height) / 8];
 #endif
 	uint8_t new_image[(uint32_t)(pixel_width) * (uint32_t)(pixel_height) / 8];
 
+	EPD_GFX_Rectangle dirty;
+
 	EPD_GFX(EPD_Class&);  // disable copy constructor
 
+#if EPD_IMAGE_TWO_ARG && EPD_PARTIAL_AVAILABLE
+	// reader address: 0 => old_image, IMAGE_NEW => new_image, plus offset
+	enum {
+		IMAGE_NEW = 0x8000
+	};
+
+	static EPD_GFX **instance(void) {
+		static EPD_GFX *gfx;
+		return &gfx;
+	}
+
+	static void reader(void *buffer, uint32_t address, uint16_t length) {
+		EPD_GFX *gfx = *instance();
+		const uint8_t *image = 0 != (address & IMAGE_NEW) ? gfx->new_image : gfx->old_image;
+		memcpy(buffer, &image[address & (IMAGE_NEW - 1)], length);
+	}
+#endif
+
 public:
 
 	enum {
@@ -50,6 +377,7 @@ public:
 	EPD_GFX(EPD_Class &epd, S5813A_Class &s5813a) :
 	Adafruit_GFX(this->pixel_width, this->pixel_height),
 		EPD(epd), S5813A(s5813a) {
+		this->dirty.clear();
 	}
 
 	void begin(void) {
@@ -66,16 +394,23 @@ public:
 		memset(this->old_image, 0, sizeof(this->old_image));
 #endif
 		memset(this->new_image, 0, sizeof(this->new_image));
+		this->dirty.clear();
 	}
 
 	void end(void){
 	}
 
+	// only the banded display list below can run out of room
+	bool overflow(void) const {
+		return false;
+	}
+
 	// set a single pixel in new_image
 	void drawPixel(int16_t x, int16_t y, uint16_t colour) {
 		if (x < 0 || x >= this->pixel_width || y < 0 || y >= this->pixel_height) {
 			return; // avoid buffer overwrite
 		}
+		this->dirty.add(x, y, x, y);
 		int bit = x & 0x07;
 		int byte = x / 8 + y * (pixel_width / 8);
 		int mask = 0x01 << bit;
@@ -86,36 +421,650 @@ public:
 		}
 	}
 
+	// whole bytes where possible instead of Adafruit_GFX's drawPixel loops
+	void drawFastHLine(int16_t x, int16_t y, int16_t w, uint16_t colour) {
+		this->fillRect(x, y, w, 1, colour);
+	}
+
+	void drawFastVLine(int16_t x, int16_t y, int16_t h, uint16_t colour) {
+		int16_t y1 = y + h;
+		if (x < 0 || x >= pixel_width || !EPD_GFX_clip(&y, &y1, 0, pixel_height)) {
+			return;
+		}
+		this->dirty.add(x, y, x, y1 - 1);
+		EPD_GFX_column(&this->new_image[x / 8 + y * bytes_per_line], bytes_per_line,
+			       y1 - y, 0x01 << (x & 0x07), BLACK == colour);
+	}
+
+	void fillRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t colour) {
+		int16_t x1 = x + w;
+		int16_t y1 = y + h;
+		if (!EPD_GFX_clip(&x, &x1, 0, pixel_width) || !EPD_GFX_clip(&y, &y1, 0, pixel_height)) {
+			return;
+		}
+		this->dirty.add(x, y, x1 - 1, y1 - 1);
+		for (uint8_t *p = &this->new_image[y * bytes_per_line]; y < y1; ++y, p += bytes_per_line) {
+			EPD_GFX_span(p, x, x1 - 1, BLACK == colour);
+		}
+	}
+
+	void fillScreen(uint16_t colour) {
+		memset(this->new_image, BLACK == colour ? 0xff : 0x00, sizeof(this->new_image));
+		this->dirty.add(0, 0, pixel_width - 1, pixel_height - 1);
+	}
+
 	// refresh the display: change from current image to new image
+	// a V231_G2 panel only has the lines drawn on since the last
+	// display() updated (and nothing at all if there were none)
 	void display(void) {
 
+#if EPD_IMAGE_TWO_ARG && EPD_PARTIAL_AVAILABLE
+		if (this->dirty.empty()) {
+			return;
+		}
+		int16_t first_line = this->dirty.y0;
+		int16_t line_count = this->dirty.y1 - this->dirty.y0 + 1;
+#endif
+
 		int temperature = this->S5813A.read();
 
 		// erase old, display new
 		this->EPD.begin();
 		this->EPD.setFactor(temperature);
 
-#if defined(EPD_ENABLE_EXTRA_SRAM)
-
 #if EPD_IMAGE_ONE_ARG
-		this->EPD.image_sram(this->image);
+		this->EPD.image_sram(this->new_image);
 #elif EPD_IMAGE_TWO_ARG
+#if EPD_PARTIAL_AVAILABLE
+		*instance() = this;
+		this->EPD.image_cb2(0, reader, IMAGE_NEW, reader, first_line, line_count);
+#else
 		this->EPD.image_sram(this->old_image, this->new_image);
+#endif
 #else
 #error "unsupported image function"
+#endif
+		this->EPD.end();
+
+#if EPD_IMAGE_TWO_ARG
+		// copy new over to old
+#if EPD_PARTIAL_AVAILABLE
+		memcpy(&this->old_image[first_line * bytes_per_line], &this->new_image[first_line * bytes_per_line],
+		       line_count * bytes_per_line);
+#else
+		memcpy(this->old_image, this->new_image, sizeof(this->old_image));
+#endif
+#endif
+		this->dirty.clear();
+	}
+};
+
+#else
+
+// banded version for small SRAM
+//
+// the drawing calls are kept in a display list (a byte of operation and
+// colour followed by 16 bit arguments); an opaque fillRect or character
+// drops anything it covers and drawing the same thing again drops the older
+// copy, so redrawing a screen each time does not keep growing the list
+//
+// display() gives the panel driver a reader that draws the list into a
+// buffer of EPD_GFX_BAND_LINES lines whenever a line outside the buffer
+// is requested, operations not touching the band are skipped
+//
+// text uses the classic built in font only
+
+// bytes for each display list (two lists for V110_G1 and V231_G2)
+#if !defined(EPD_GFX_LIST_SIZE)
+#define EPD_GFX_LIST_SIZE 512
+#endif
+
+// lines drawn at a time (one buffer per list)
+#if !defined(EPD_GFX_BAND_LINES)
+#define EPD_GFX_BAND_LINES 4
+#endif
+
+class EPD_GFX : public Adafruit_GFX {
+
+private:
+	EPD_Class &EPD;
+	S5813A_Class &S5813A;
+
+	static const int pixel_width = EPD_PIXEL_WIDTH;  // must be a multiple of 8
+	static const int pixel_height = EPD_PIXEL_HEIGHT;
+	static const int bytes_per_line = pixel_width / 8;
+
+	// the image on the panel (if the driver needs it) and the new image
+	enum {
+#if EPD_IMAGE_TWO_ARG
+		OLD,
+#endif
+		NEW,
+		IMAGES
+	};
+
+	// reader address: image << IMAGE_SHIFT | line * bytes_per_line
+	enum {
+		IMAGE_SHIFT = 15
+	};
+
+	// display list operations
+	enum {
+		OP_PIXEL,            // x, y
+		OP_HLINE,            // x, y, w
+		OP_VLINE,            // x, y, h
+		OP_FILL_RECT,        // x, y, w, h
+		OP_RECT,             // x, y, w, h
+		OP_LINE,             // x0, y0, x1, y1
+		OP_CIRCLE,           // x, y, r
+		OP_FILL_CIRCLE,      // x, y, r
+		OP_TRIANGLE,         // x0, y0, x1, y1, x2, y2
+		OP_FILL_TRIANGLE,    // x0, y0, x1, y1, x2, y2
+		OP_ROUND_RECT,       // x, y, w, h, r
+		OP_FILL_ROUND_RECT,  // x, y, w, h, r
+		OP_CHAR,             // x, y, bg << 15 | size << 8 | c
+		OP_SCREEN            // fillScreen(BLACK)
+	};
+
+	uint8_t list[IMAGES][EPD_GFX_LIST_SIZE];
+	uint16_t list_length[IMAGES];
+	bool list_overflow;
+
+	// covers everything that differs between the two lists
+	EPD_GFX_Rectangle dirty;
+
+	uint8_t band[IMAGES][EPD_GFX_BAND_LINES * bytes_per_line];
+	int16_t band_y[IMAGES];
+
+	// band being drawn, NULL while recording
+	uint8_t *clip_band;
+	int16_t clip_y;
+
+	EPD_GFX(EPD_Class&);  // disable copy constructor
+
+	static uint8_t op_args(uint8_t op) {
+		switch (op) {
+		case OP_PIXEL:
+			return 2;
+		case OP_HLINE:
+		case OP_VLINE:
+		case OP_CIRCLE:
+		case OP_FILL_CIRCLE:
+		case OP_CHAR:
+			return 3;
+		case OP_FILL_RECT:
+		case OP_RECT:
+		case OP_LINE:
+			return 4;
+		case OP_ROUND_RECT:
+		case OP_FILL_ROUND_RECT:
+			return 5;
+		case OP_TRIANGLE:
+		case OP_FILL_TRIANGLE:
+			return 6;
+		default:
+			return 0;
+		}
+	}
+
+	// area an operation can touch (inclusive)
+	static void bounds(uint8_t op, const int16_t *a, int16_t *x0, int16_t *y0, int16_t *x1, int16_t *y1) {
+		switch (op) {
+		case OP_PIXEL:
+			*x0 = *x1 = a[0];
+			*y0 = *y1 = a[1];
+			break;
+		case OP_HLINE:
+			*x0 = a[0];
+			*x1 = a[0] + a[2] - 1;
+			*y0 = *y1 = a[1];
+			break;
+		case OP_VLINE:
+			*x0 = *x1 = a[0];
+			*y0 = a[1];
+			*y1 = a[1] + a[2] - 1;
+			break;
+		case OP_FILL_RECT:
+		case OP_RECT:
+		case OP_ROUND_RECT:
+		case OP_FILL_ROUND_RECT:
+			*x0 = a[0];
+			*y0 = a[1];
+			*x1 = a[0] + a[2] - 1;
+			*y1 = a[1] + a[3] - 1;
+			break;
+		case OP_CIRCLE:
+		case OP_FILL_CIRCLE:
+			*x0 = a[0] - a[2];
+			*y0 = a[1] - a[2];
+			*x1 = a[0] + a[2];
+			*y1 = a[1] + a[2];
+			break;
+		case OP_LINE:
+		case OP_TRIANGLE:
+		case OP_FILL_TRIANGLE:
+			*x0 = *x1 = a[0];
+			*y0 = *y1 = a[1];
+			for (uint8_t i = 2; i < op_args(op); i += 2) {
+				*x0 = min(*x0, a[i]);
+				*x1 = max(*x1, a[i]);
+				*y0 = min(*y0, a[i + 1]);
+				*y1 = max(*y1, a[i + 1]);
+			}
+			break;
+		case OP_CHAR:
+		{
+			int16_t size = (a[2] >> 8) & 0x7f;
+			*x0 = a[0];
+			*y0 = a[1];
+			*x1 = a[0] + 6 * size - 1;
+			*y1 = a[1] + 8 * size - 1;
+			break;
+		}
+		default:
+			*x0 = *y0 = 0;
+			*x1 = pixel_width - 1;
+			*y1 = pixel_height - 1;
+			break;
+		}
+	}
+
+	// add an operation to the new image's display list
+	void record(uint8_t op, uint16_t colour, const int16_t *a) {
+		uint8_t *l = this->list[NEW];
+		uint16_t &length = this->list_length[NEW];
+		uint8_t code = op << 1 | (BLACK == colour ? 1 : 0);
+		uint16_t size = 1 + 2 * op_args(op);
+
+		// characters with a background colour are opaque too
+		bool opaque = OP_FILL_RECT == op ||
+			(OP_CHAR == op && (code & 0x01) != ((a[2] >> 15) & 0x01));
+		int16_t x0, y0, x1, y1;
+		bounds(op, a, &x0, &y0, &x1, &y1);
+		this->dirty.add(x0, y0, x1, y1);
+
+		for (uint16_t i = 0; i < length; ) {
+			uint8_t n = 1 + 2 * op_args(l[i] >> 1);
+			bool drop = n == size && l[i] == code && 0 == memcmp(&l[i + 1], a, size - 1);
+			if (!drop && opaque) {
+				int16_t b[6];
+				int16_t bx0, by0, bx1, by1;
+				memcpy(b, &l[i + 1], n - 1);
+				bounds(l[i] >> 1, b, &bx0, &by0, &bx1, &by1);
+				drop = bx0 >= x0 && by0 >= y0 && bx1 <= x1 && by1 <= y1;
+			}
+			if (drop) {
+				memmove(&l[i], &l[i + n], length - i - n);
+				length -= n;
+			} else {
+				i += n;
+			}
+		}
+
+		if (length + size > EPD_GFX_LIST_SIZE) {
+			this->list_overflow = true;
+			return;
+		}
+		l[length] = code;
+		memcpy(&l[length + 1], a, size - 1);
+		length += size;
+	}
+
+	void replay(uint8_t op, uint16_t colour, const int16_t *a) {
+		switch (op) {
+		case OP_PIXEL:
+			this->drawPixel(a[0], a[1], colour);
+			break;
+		case OP_HLINE:
+			this->drawFastHLine(a[0], a[1], a[2], colour);
+			break;
+		case OP_VLINE:
+			this->drawFastVLine(a[0], a[1], a[2], colour);
+			break;
+		case OP_FILL_RECT:
+			this->fillRect(a[0], a[1], a[2], a[3], colour);
+			break;
+		case OP_RECT:
+			Adafruit_GFX::drawRect(a[0], a[1], a[2], a[3], colour);
+			break;
+		case OP_LINE:
+			Adafruit_GFX::drawLine(a[0], a[1], a[2], a[3], colour);
+			break;
+		case OP_CIRCLE:
+			Adafruit_GFX::drawCircle(a[0], a[1], a[2], colour);
+			break;
+		case OP_FILL_CIRCLE:
+			Adafruit_GFX::fillCircle(a[0], a[1], a[2], colour);
+			break;
+		case OP_TRIANGLE:
+			Adafruit_GFX::drawTriangle(a[0], a[1], a[2], a[3], a[4], a[5], colour);
+			break;
+		case OP_FILL_TRIANGLE:
+			Adafruit_GFX::fillTriangle(a[0], a[1], a[2], a[3], a[4], a[5], colour);
+			break;
+		case OP_ROUND_RECT:
+			Adafruit_GFX::drawRoundRect(a[0], a[1], a[2], a[3], a[4], colour);
+			break;
+		case OP_FILL_ROUND_RECT:
+			Adafruit_GFX::fillRoundRect(a[0], a[1], a[2], a[3], a[4], colour);
+			break;
+		case OP_CHAR:
+			Adafruit_GFX::drawChar(a[0], a[1], a[2] & 0xff, colour,
+					       0 != (a[2] & 0x8000) ? BLACK : WHITE, (a[2] >> 8) & 0x7f);
+			break;
+		case OP_SCREEN:
+			this->fillScreen(BLACK);
+			break;
+		}
+	}
+
+	// draw the lines y .. y + EPD_GFX_BAND_LINES - 1 of an image
+	void render(uint8_t image, int16_t y) {
+		uint8_t *b = this->band[image];
+		memset(b, 0, sizeof(this->band[image]));
+		this->band_y[image] = y;
+		this->clip_band = b;
+		this->clip_y = y;
+
+		const uint8_t *p = this->list[image];
+		const uint8_t *end = p + this->list_length[image];
+		while (p < end) {
+			uint8_t op = *p >> 1;
+			uint16_t colour = *p & 0x01;
+			uint8_t n = op_args(op);
+			int16_t a[6];
+			memcpy(a, p + 1, 2 * n);
+			p += 1 + 2 * n;
+
+			int16_t x0, y0, x1, y1;
+			bounds(op, a, &x0, &y0, &x1, &y1);
+			if (y1 >= y && y0 < y + EPD_GFX_BAND_LINES) {
+				this->replay(op, colour, a);
+			}
+		}
+		this->clip_band = NULL;
+	}
+
+	// pixel in the band being drawn
+	void band_pixel(int16_t x, int16_t y, uint16_t colour) {
+		y -= this->clip_y;
+		if (x < 0 || x >= pixel_width || y < 0 || y >= EPD_GFX_BAND_LINES) {
+			return;
+		}
+		uint8_t *p = &this->clip_band[x / 8 + y * bytes_per_line];
+		uint8_t mask = 0x01 << (x & 0x07);
+		if (BLACK == colour) {
+			*p |= mask;
+		} else {
+			*p &= ~mask;
+		}
+	}
+
+	static EPD_GFX **instance(void) {
+		static EPD_GFX *gfx;
+		return &gfx;
+	}
+
+	// EPD_reader giving the driver one line of an image
+	static void reader(void *buffer, uint32_t address, uint16_t length) {
+		EPD_GFX *gfx = *instance();
+		uint8_t image = address >> IMAGE_SHIFT;
+		int16_t line = (address & ((1UL << IMAGE_SHIFT) - 1)) / bytes_per_line;
+		if (line < gfx->band_y[image] || line >= gfx->band_y[image] + EPD_GFX_BAND_LINES) {
+			gfx->render(image, line);
+		}
+		memcpy(buffer, &gfx->band[image][(line - gfx->band_y[image]) * bytes_per_line], length);
+	}
+
+public:
+
+	enum {
+		WHITE = 0,
+		BLACK = 1
+	};
+
+	// constructor
+	EPD_GFX(EPD_Class &epd, S5813A_Class &s5813a) :
+	Adafruit_GFX(this->pixel_width, this->pixel_height),
+		EPD(epd), S5813A(s5813a), clip_band(NULL) {
+		this->dirty.clear();
+	}
+
+	void begin(void) {
+		int temperature = this->S5813A.read();
+
+		// erase display
+		this->EPD.begin();
+		this->EPD.setFactor(temperature);
+		this->EPD.clear();
+		this->EPD.end();
+
+		// empty lists are white
+		memset(this->list_length, 0, sizeof(this->list_length));
+		this->list_overflow = false;
+		this->dirty.clear();
+	}
+
+	void end(void){
+	}
+
+	// true if drawing was lost since the last fillScreen()
+	// (increase EPD_GFX_LIST_SIZE)
+	bool overflow(void) const {
+		return this->list_overflow;
+	}
+
+	// primitives: recorded, or drawn into the band
+	void drawPixel(int16_t x, int16_t y, uint16_t colour) {
+		if (NULL != this->clip_band) {
+			this->band_pixel(x, y, colour);
+		} else {
+			int16_t a[] = {x, y};
+			this->record(OP_PIXEL, colour, a);
+		}
+	}
+
+	void drawFastHLine(int16_t x, int16_t y, int16_t w, uint16_t colour) {
+		if (NULL != this->clip_band) {
+			int16_t x1 = x + w;
+			if (y < this->clip_y || y >= this->clip_y + EPD_GFX_BAND_LINES ||
+			    !EPD_GFX_clip(&x, &x1, 0, pixel_width)) {
+				return;
+			}
+			EPD_GFX_span(&this->clip_band[(y - this->clip_y) * bytes_per_line], x, x1 - 1, BLACK == colour);
+		} else {
+			int16_t a[] = {x, y, w};
+			this->record(OP_HLINE, colour, a);
+		}
+	}
+
+	void drawFastVLine(int16_t x, int16_t y, int16_t h, uint16_t colour) {
+		if (NULL != this->clip_band) {
+			int16_t y1 = y + h;
+			if (x < 0 || x >= pixel_width ||
+			    !EPD_GFX_clip(&y, &y1, this->clip_y, this->clip_y + EPD_GFX_BAND_LINES)) {
+				return;
+			}
+			EPD_GFX_column(&this->clip_band[x / 8 + (y - this->clip_y) * bytes_per_line], bytes_per_line,
+				       y1 - y, 0x01 << (x & 0x07), BLACK == colour);
+		} else {
+			int16_t a[] = {x, y, h};
+			this->record(OP_VLINE, colour, a);
+		}
+	}
+
+	void fillRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t colour) {
+		if (NULL != this->clip_band) {
+			int16_t x1 = x + w;
+			int16_t y1 = y + h;
+			if (!EPD_GFX_clip(&x, &x1, 0, pixel_width) ||
+			    !EPD_GFX_clip(&y, &y1, this->clip_y, this->clip_y + EPD_GFX_BAND_LINES)) {
+				return;
+			}
+			uint8_t *p = &this->clip_band[(y - this->clip_y) * bytes_per_line];
+			for (; y < y1; ++y, p += bytes_per_line) {
+				EPD_GFX_span(p, x, x1 - 1, BLACK == colour);
+			}
+		} else {
+			int16_t a[] = {x, y, w, h};
+			this->record(OP_FILL_RECT, colour, a);
+		}
+	}
+
+	void fillScreen(uint16_t colour) {
+		if (NULL != this->clip_band) {
+			memset(this->clip_band, BLACK == colour ? 0xff : 0x00, sizeof(this->band[0]));
+		} else {
+			// covers everything drawn so far
+			this->list_length[NEW] = 0;
+			this->list_overflow = false;
+			this->dirty.add(0, 0, pixel_width - 1, pixel_height - 1);
+			if (BLACK == colour) {
+				int16_t none[1];
+				this->record(OP_SCREEN, colour, none);
+			}
+		}
+	}
+
+	void drawRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t colour) {
+		if (NULL != this->clip_band) {
+			Adafruit_GFX::drawRect(x, y, w, h, colour);
+		} else {
+			int16_t a[] = {x, y, w, h};
+			this->record(OP_RECT, colour, a);
+		}
+	}
+
+	void drawLine(int16_t x0, int16_t y0, int16_t x1, int16_t y1, uint16_t colour) {
+		if (NULL != this->clip_band) {
+			Adafruit_GFX::drawLine(x0, y0, x1, y1, colour);
+		} else if (x0 == x1) {
+			// straight lines take fewer list bytes as fast lines
+			this->drawFastVLine(x0, min(y0, y1), abs(y1 - y0) + 1, colour);
+		} else if (y0 == y1) {
+			this->drawFastHLine(min(x0, x1), y0, abs(x1 - x0) + 1, colour);
+		} else {
+			int16_t a[] = {x0, y0, x1, y1};
+			this->record(OP_LINE, colour, a);
+		}
+	}
+
+	// shapes are recorded whole rather than as their pixels
+	void drawCircle(int16_t x, int16_t y, int16_t r, uint16_t colour) {
+		int16_t a[] = {x, y, r};
+		this->record(OP_CIRCLE, colour, a);
+	}
+
+	void fillCircle(int16_t x, int16_t y, int16_t r, uint16_t colour) {
+		int16_t a[] = {x, y, r};
+		this->record(OP_FILL_CIRCLE, colour, a);
+	}
+
+	void drawTriangle(int16_t x0, int16_t y0, int16_t x1, int16_t y1, int16_t x2, int16_t y2, uint16_t colour) {
+		int16_t a[] = {x0, y0, x1, y1, x2, y2};
+		this->record(OP_TRIANGLE, colour, a);
+	}
+
+	void fillTriangle(int16_t x0, int16_t y0, int16_t x1, int16_t y1, int16_t x2, int16_t y2, uint16_t colour) {
+		int16_t a[] = {x0, y0, x1, y1, x2, y2};
+		this->record(OP_FILL_TRIANGLE, colour, a);
+	}
+
+	void drawRoundRect(int16_t x, int16_t y, int16_t w, int16_t h, int16_t r, uint16_t colour) {
+		int16_t a[] = {x, y, w, h, r};
+		this->record(OP_ROUND_RECT, colour, a);
+	}
+
+	void fillRoundRect(int16_t x, int16_t y, int16_t w, int16_t h, int16_t r, uint16_t colour) {
+		int16_t a[] = {x, y, w, h, r};
+		this->record(OP_FILL_ROUND_RECT, colour, a);
+	}
+
+	void drawChar(int16_t x, int16_t y, unsigned char c, uint16_t colour, uint16_t bg, uint8_t size) {
+		int16_t a[] = {x, y, (int16_t)((BLACK == bg ? 0x8000 : 0) | (size & 0x7f) << 8 | c)};
+		this->record(OP_CHAR, colour, a);
+	}
+
+	// newer Adafruit_GFX replaced textsize by textsize_x and textsize_y
+	template <class T> static auto text_size(const T *gfx, int) -> decltype(gfx->textsize_x) {
+		return gfx->textsize_x;
+	}
+
+	template <class T> static uint8_t text_size(const T *gfx, long) {
+		return gfx->textsize;
+	}
+
+	// print() support as Adafruit_GFX::write() but through drawChar above
+	size_t write(uint8_t c) {
+		uint8_t size = text_size(this, 0);
+		if ('\n' == c) {
+			this->cursor_y += size * 8;
+			this->cursor_x = 0;
+		} else if ('\r' != c) {
+			this->drawChar(this->cursor_x, this->cursor_y, c, this->textcolor, this->textbgcolor, size);
+			this->cursor_x += size * 6;
+			if (this->wrap && this->cursor_x > this->width() - size * 6) {
+				this->cursor_y += size * 8;
+				this->cursor_x = 0;
+			}
+		}
+		return 1;
+	}
+
+	// refresh the display: change from current image to new image
+	// a V231_G2 panel only has the lines drawn on since the last
+	// display() updated (and nothing at all if there were none)
+	void display(void) {
+
+#if EPD_IMAGE_TWO_ARG && EPD_PARTIAL_AVAILABLE
+		int16_t first_line = this->dirty.y0;
+		int16_t end_line = this->dirty.y1 + 1;
+		if (this->dirty.empty() || !EPD_GFX_clip(&first_line, &end_line, 0, pixel_height)) {
+			this->dirty.clear();
+			return;
+		}
 #endif
 
+		int temperature = this->S5813A.read();
+
+		// erase old, display new
+		this->EPD.begin();
+		this->EPD.setFactor(temperature);
+
+		*instance() = this;
+		for (uint8_t i = 0; i < IMAGES; ++i) {
+			this->band_y[i] = -EPD_GFX_BAND_LINES;
+		}
+		uint32_t new_address = (uint32_t)NEW << IMAGE_SHIFT;
+
+#if EPD_IMAGE_ONE_ARG
+		this->EPD.frame_cb_13(new_address, reader, EPD_inverse);
+		this->EPD.frame_stage2();
+		this->EPD.frame_cb_13(new_address, reader, EPD_normal);
+#elif EPD_IMAGE_TWO_ARG
+		uint32_t old_address = (uint32_t)OLD << IMAGE_SHIFT;
+#if EPD_PARTIAL_AVAILABLE
+		this->EPD.image_cb2(old_address, reader, new_address, reader, first_line, end_line - first_line);
 #else
-#error EPD_GFX - Needs more RAM: EPD_ENABLE_EXTRA_SRAM
+		this->EPD.frame_cb_repeat(old_address, reader, EPD_compensate);
+		this->EPD.frame_cb_repeat(old_address, reader, EPD_white);
+		this->EPD.frame_cb_repeat(new_address, reader, EPD_inverse);
+		this->EPD.frame_cb_repeat(new_address, reader, EPD_normal);
+#endif
+#else
+#error "unsupported image function"
 #endif
 		this->EPD.end();
 
 #if EPD_IMAGE_TWO_ARG
 		// copy new over to old
-		memcpy(this->old_image, this->new_image, sizeof(this->old_image));
+		memcpy(this->list[OLD], this->list[NEW], this->list_length[NEW]);
+		this->list_length[OLD] = this->list_length[NEW];
 #endif
+		this->dirty.clear();
 	}
 };
 
+#endif
 
 #endif
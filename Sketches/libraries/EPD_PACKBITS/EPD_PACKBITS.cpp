@@ -0,0 +1,166 @@
+// Copyright 2013-2015 Pervasive Displays, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at:
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+// express or implied.  See the License for the specific language
+// governing permissions and limitations under the License.
+
+
+#if defined(ENERGIA)
+#include <Energia.h>
+#else
+#include <Arduino.h>
+#endif
+
+#include <string.h>
+
+#include "EPD_PACKBITS.h"
+
+
+// the default decoder
+EPD_PACKBITS_Class EPD_PACKBITS;
+
+
+static void progmem_read(void *buffer, uint32_t address, uint16_t length);
+
+static inline uint16_t get16(const uint8_t *p) {
+	return p[0] | (p[1] << 8);
+}
+
+
+EPD_PACKBITS_Class::EPD_PACKBITS_Class(void) :
+	source(NULL),
+	address(0),
+	bytes_per_line(0),
+	lines(0),
+	total(0),
+	first_line(0) {
+}
+
+
+bool EPD_PACKBITS_Class::begin(uint32_t address, EPD_PACKBITS_source *source) {
+	uint8_t header[EPD_PACKBITS_HEADER_SIZE];
+
+	this->end();
+	source(header, address, sizeof(header));
+	if ('P' != header[0] || 'K' != header[1]) {
+		return false;
+	}
+	uint16_t bytes_per_line = get16(&header[2]);
+	if (0 == bytes_per_line || bytes_per_line > EPD_PACKBITS_MAX_LINE) {
+		return false;
+	}
+
+	this->source = source;
+	this->address = address;
+	this->bytes_per_line = bytes_per_line;
+	this->lines = get16(&header[4]);
+	this->total = get16(&header[6]);
+	this->first_line = 0xffff;  // nothing cached
+	return true;
+}
+
+
+bool EPD_PACKBITS_Class::begin_P(PROGMEM const uint8_t *image) {
+	return this->begin((uint32_t)(uintptr_t)image, progmem_read);
+}
+
+
+void EPD_PACKBITS_Class::end(void) {
+	this->source = NULL;
+	this->bytes_per_line = 0;
+	this->lines = 0;
+	this->total = 0;
+}
+
+
+bool EPD_PACKBITS_Class::read_line(void *buffer, uint16_t line, uint16_t length) {
+	if (NULL == this->source || length != this->bytes_per_line || line >= this->lines) {
+		memset(buffer, 0, length);
+		return false;
+	}
+
+	// offsets for the next few lines, one read instead of one per line
+	uint16_t i = line - this->first_line;
+	if (line < this->first_line || i >= EPD_PACKBITS_OFFSETS) {
+		uint16_t n = this->lines - line;
+		if (n > EPD_PACKBITS_OFFSETS) {
+			n = EPD_PACKBITS_OFFSETS;
+		}
+		uint8_t *p = (uint8_t *)this->offsets;
+		this->source(p, this->address + EPD_PACKBITS_HEADER_SIZE + 2 * line, 2 * (n + 1));
+		for (uint16_t j = 0; j <= n; ++j, p += 2) {
+			this->offsets[j] = get16(p);  // in place, j never overtakes p
+		}
+		this->first_line = line;
+		i = 0;
+	}
+
+	uint16_t start = this->offsets[i];
+	uint16_t end = this->offsets[i + 1];
+	if (end < start || (uint16_t)(end - start) > sizeof(this->packed) || end > this->total) {
+		memset(buffer, 0, length);
+		return false;
+	}
+	this->source(this->packed, this->address + start, end - start);
+	uint16_t n = unpack((uint8_t *)buffer, length, this->packed, end - start);
+	if (n != length) {
+		memset((uint8_t *)buffer + n, 0, length - n);
+		return false;
+	}
+	return true;
+}
+
+
+uint16_t EPD_PACKBITS_Class::unpack(uint8_t *out, uint16_t size, const uint8_t *in, uint16_t length) {
+	const uint8_t *in_end = in + length;
+	uint16_t n = 0;
+
+	while (in < in_end && n < size) {
+		int8_t c = (int8_t)*in++;
+		if (c >= 0) {
+			uint16_t count = c + 1;
+			if (count > in_end - in) {
+				count = in_end - in;
+			}
+			if (count > size - n) {
+				count = size - n;
+			}
+			memcpy(out + n, in, count);
+			in += count;
+			n += count;
+		} else if (-128 != c && in < in_end) {
+			uint16_t count = 1 - c;
+			if (count > size - n) {
+				count = size - n;
+			}
+			memset(out + n, *in++, count);
+			n += count;
+		}
+	}
+	return n;
+}
+
+
+void EPD_PACKBITS_reader(void *buffer, uint32_t address, uint16_t length) {
+	if (0 == length) {
+		return;
+	}
+	EPD_PACKBITS.read_line(buffer, address / length, length);
+}
+
+
+static void progmem_read(void *buffer, uint32_t address, uint16_t length) {
+#if defined(__AVR__)
+	memcpy_P(buffer, (PROGMEM const void *)(uintptr_t)address, length);
+#else
+	memcpy(buffer, (const void *)(uintptr_t)address, length);
+#endif
+}
@@ -0,0 +1,116 @@
+// Copyright 2013-2015 Pervasive Displays, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at:
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+// express or implied.  See the License for the specific language
+// governing permissions and limitations under the License.
+
+// PackBits compressed images, decoded one line at a time
+//
+// layout (16 bit values are little endian):
+//
+//   0  'P' 'K'
+//   2  bytes per line
+//   4  lines
+//   6  total length in bytes
+//   8  offset of each line from the start, plus one for the end
+//   .. each line packed on its own
+//
+// a line is a sequence of: n = 0..127 followed by n + 1 literal bytes,
+// or n = -127..-1 followed by one byte to repeat 1 - n times (n = -128
+// is skipped)
+//
+// use the xbm2packbits script to convert an XBM image
+//
+// to display, pass EPD_PACKBITS_reader and address 0 to any of the
+// frame_cb functions after begin() or begin_P(); every line is read
+// from its offset so no frame buffer is needed
+
+#if !defined(EPD_PACKBITS_H)
+#define EPD_PACKBITS_H 1
+
+#if defined(ENERGIA)
+#include <Energia.h>
+#else
+#include <Arduino.h>
+#endif
+
+#if defined(__AVR__)
+#include <avr/pgmspace.h>
+#else
+#ifndef PROGMEM
+#define PROGMEM
+#endif
+#endif
+
+
+// longest line supported (2.7" panel)
+#define EPD_PACKBITS_MAX_LINE (264 / 8)
+
+// worst case packed line
+#define EPD_PACKBITS_MAX_PACKED (EPD_PACKBITS_MAX_LINE + (EPD_PACKBITS_MAX_LINE + 127) / 128)
+
+// line offsets read from the source at a time
+#define EPD_PACKBITS_OFFSETS 16
+
+#define EPD_PACKBITS_HEADER_SIZE 8
+
+
+// same as EPD_reader
+typedef void EPD_PACKBITS_source(void *buffer, uint32_t address, uint16_t length);
+
+
+class EPD_PACKBITS_Class {
+private:
+	EPD_PACKBITS_source *source;
+	uint32_t address;
+	uint16_t bytes_per_line;
+	uint16_t lines;
+	uint16_t total;
+	uint16_t first_line;  // of offsets[0]
+	uint16_t offsets[EPD_PACKBITS_OFFSETS + 1];
+	uint8_t packed[EPD_PACKBITS_MAX_PACKED];
+
+	EPD_PACKBITS_Class(const EPD_PACKBITS_Class &f);  // prevent copy
+
+public:
+	// image at address of source, false if it is not a packed image
+	bool begin(uint32_t address, EPD_PACKBITS_source *source);
+
+	// image in program memory (data from xbm2packbits)
+	bool begin_P(PROGMEM const uint8_t *image);
+
+	void end(void);
+
+	// unpack one line, false (and a blank line) if it cannot be read
+	bool read_line(void *buffer, uint16_t line, uint16_t length);
+
+	inline uint16_t width_bytes(void) const {
+		return this->bytes_per_line;
+	}
+	inline uint16_t height(void) const {
+		return this->lines;
+	}
+	inline uint16_t length(void) const {
+		return this->total;
+	}
+
+	// unpack up to size bytes, returns the number of bytes produced
+	static uint16_t unpack(uint8_t *out, uint16_t size, const uint8_t *in, uint16_t length);
+
+	EPD_PACKBITS_Class(void);
+};
+
+extern EPD_PACKBITS_Class EPD_PACKBITS;
+
+// EPD_reader for the frame_cb functions: the address is line * length
+void EPD_PACKBITS_reader(void *buffer, uint32_t address, uint16_t length);
+
+#endif
@@ -28,6 +28,7 @@ const int Pin_RESET = 6;
 const int Pin_BUSY = 7;
 const int Pin_EPD_CS = 8;
 const int Pin_EPD_FLASH_CS = 9;
+const int Pin_EPD_SRAM_CS = 10;      // optional external SPI SRAM (EPD_SRAM)
 const int Pin_SW2 = 12;
 const int Pin_RED_LED = 13;
 
@@ -0,0 +1,189 @@
+// Copyright 2013-2015 Pervasive Displays, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at:
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+// express or implied.  See the License for the specific language
+// governing permissions and limitations under the License.
+
+
+#if defined(ENERGIA)
+#include <Energia.h>
+#else
+#include <Arduino.h>
+#endif
+
+#include <string.h>
+#include <SPI.h>
+
+#include "EPD_SRAM.h"
+
+
+// 23K256 / 23LC1024 command set (20 MHz max clock)
+enum {
+	EPD_SRAM_READ = 0x03,
+	EPD_SRAM_WRITE = 0x02,
+	EPD_SRAM_RDMR = 0x05,       // read mode (status) register
+	EPD_SRAM_WRMR = 0x01,       // write mode (status) register
+	EPD_SRAM_NOP = 0xff,
+
+	// mode register
+	EPD_SRAM_MODE_MASK = 0xc0,
+	EPD_SRAM_SEQUENTIAL = 0x40,
+	EPD_SRAM_HOLD_DISABLE = 0x01  // 23K256 only, reserved on 23LC1024
+};
+
+
+// same mode and clock as the panel (SPI_CLOCK_DIV2 on a 16 MHz AVR)
+#if !defined(EPD_SRAM_SPI_CLOCK)
+#define EPD_SRAM_SPI_CLOCK 8000000
+#endif
+
+#if defined(SPI_HAS_TRANSACTION)
+static const SPISettings spi_settings(EPD_SRAM_SPI_CLOCK, MSBFIRST, SPI_MODE0);
+#endif
+
+// bytes moved at a time by copy()
+#define COPY_CHUNK 32
+
+
+// the default EPD_SRAM device
+EPD_SRAM_Class EPD_SRAM(10);
+
+
+EPD_SRAM_Class::EPD_SRAM_Class(uint8_t chip_select_pin) :
+	EPD_SRAM_CS(chip_select_pin),
+	type(EPD_SRAM_23K256) {
+}
+
+
+void EPD_SRAM_Class::begin(uint8_t chip_select_pin, EPD_SRAM_type type) {
+	digitalWrite(chip_select_pin, HIGH);
+	pinMode(chip_select_pin, OUTPUT);
+	this->EPD_SRAM_CS = chip_select_pin;
+	this->type = type;
+
+	// sequential mode: reads and writes run on across pages
+	this->select();
+	SPI.transfer(EPD_SRAM_WRMR);
+	SPI.transfer(EPD_SRAM_23K256 == type
+		     ? EPD_SRAM_SEQUENTIAL | EPD_SRAM_HOLD_DISABLE
+		     : EPD_SRAM_SEQUENTIAL);
+	this->finish();
+}
+
+
+void EPD_SRAM_Class::end(void) {
+}
+
+
+// take the bus: one set up for the whole command, then CS low
+void EPD_SRAM_Class::select(void) {
+	SPI.begin();
+#if defined(SPI_HAS_TRANSACTION)
+	SPI.beginTransaction(spi_settings);
+#else
+	SPI.setBitOrder(MSBFIRST);
+	SPI.setDataMode(SPI_MODE0);
+	SPI.setClockDivider(SPI_CLOCK_DIV2);
+#endif
+	digitalWrite(this->EPD_SRAM_CS, LOW);
+}
+
+
+// start a command: CS low, command and address
+void EPD_SRAM_Class::command(uint8_t command, uint32_t address) {
+	this->select();
+	SPI.transfer(command);
+	if (EPD_SRAM_23LC1024 == this->type) {
+		SPI.transfer(address >> 16);
+	}
+	SPI.transfer(address >> 8);
+	SPI.transfer(address);
+}
+
+
+// end a command and release the bus
+void EPD_SRAM_Class::finish(void) {
+	digitalWrite(this->EPD_SRAM_CS, HIGH);
+#if defined(SPI_HAS_TRANSACTION)
+	SPI.endTransaction();
+#endif
+	SPI.end();
+}
+
+
+bool EPD_SRAM_Class::available(void) {
+	this->select();
+	SPI.transfer(EPD_SRAM_RDMR);
+	uint8_t mode = SPI.transfer(EPD_SRAM_NOP);
+	this->finish();
+
+	// a missing chip reads as all ones or all zeros
+	return EPD_SRAM_SEQUENTIAL == (mode & EPD_SRAM_MODE_MASK);
+}
+
+
+uint32_t EPD_SRAM_Class::size(void) const {
+	return EPD_SRAM_23LC1024 == this->type ? 131072UL : 32768UL;
+}
+
+
+void EPD_SRAM_Class::read(void *buffer, uint32_t address, uint16_t length) {
+	this->command(EPD_SRAM_READ, address);
+#if defined(SPI_HAS_TRANSACTION)
+	// clock out NOPs, the data read replaces them
+	memset(buffer, EPD_SRAM_NOP, length);
+	SPI.transfer(buffer, length);
+#else
+	uint8_t *p = (uint8_t *)buffer;
+	for (uint16_t n = length; n != 0; --n) {
+		*p++ = SPI.transfer(EPD_SRAM_NOP);
+	}
+#endif
+	this->finish();
+}
+
+
+void EPD_SRAM_Class::write(uint32_t address, const void *buffer, uint16_t length) {
+	this->command(EPD_SRAM_WRITE, address);
+	const uint8_t *p = (const uint8_t *)buffer;
+	for (uint16_t n = length; n != 0; --n) {
+		SPI.transfer(*p++);
+	}
+	this->finish();
+}
+
+
+void EPD_SRAM_Class::fill(uint32_t address, uint8_t value, uint32_t length) {
+	this->command(EPD_SRAM_WRITE, address);
+	for (; length != 0; --length) {
+		SPI.transfer(value);
+	}
+	this->finish();
+}
+
+
+// areas may not overlap
+void EPD_SRAM_Class::copy(uint32_t to, uint32_t from, uint32_t length) {
+	uint8_t buffer[COPY_CHUNK];
+	while (length != 0) {
+		uint16_t n = length > sizeof(buffer) ? sizeof(buffer) : length;
+		this->read(buffer, from, n);
+		this->write(to, buffer, n);
+		from += n;
+		to += n;
+		length -= n;
+	}
+}
+
+
+void EPD_SRAM_reader(void *buffer, uint32_t address, uint16_t length) {
+	EPD_SRAM.read(buffer, address, length);
+}
@@ -0,0 +1,80 @@
+// Copyright 2013-2015 Pervasive Displays, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at:
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+// express or implied.  See the License for the specific language
+// governing permissions and limitations under the License.
+
+#if !defined(EPD_SRAM_H)
+#define EPD_SRAM_H 1
+
+#if defined(ENERGIA)
+#include <Energia.h>
+#else
+#include <Arduino.h>
+#endif
+
+
+// external SPI SRAM for frame buffers
+// -----------------------------------
+//
+// the chip is put in sequential mode once by begin(), so every read or
+// write is one command and address followed by as many bytes as are
+// wanted; each access is a single SPI transaction in the same mode and
+// at the same clock as the panel, so the panel, SRAM and FLASH can take
+// turns on the bus a line at a time, and the bus is always released
+// (CS high, SPI.end()) on return
+//
+// note: these chips are 3.3 Volt parts
+
+
+// supported chips
+typedef enum {
+	EPD_SRAM_23K256,       // 32 kBytes, 16 bit address
+	EPD_SRAM_23LC1024      // 128 kBytes, 24 bit address
+} EPD_SRAM_type;
+
+
+class EPD_SRAM_Class {
+private:
+	uint8_t EPD_SRAM_CS;
+	EPD_SRAM_type type;
+
+	void select(void);
+	void command(uint8_t command, uint32_t address);
+	void finish(void);
+	EPD_SRAM_Class(const EPD_SRAM_Class &f);  // prevent copy
+
+public:
+	// the mode register reads back as sequential
+	bool available(void);
+
+	// bytes in the chip
+	uint32_t size(void) const;
+
+	void read(void *buffer, uint32_t address, uint16_t length);
+	void write(uint32_t address, const void *buffer, uint16_t length);
+	void fill(uint32_t address, uint8_t value, uint32_t length);
+	void copy(uint32_t to, uint32_t from, uint32_t length);
+
+	void begin(uint8_t chip_select_pin, EPD_SRAM_type type = EPD_SRAM_23K256);
+	void end(void);
+
+	EPD_SRAM_Class(uint8_t chip_select_pin);
+
+};
+
+extern EPD_SRAM_Class EPD_SRAM;
+
+
+// EPD_reader for frame_cb style functions, address is an SRAM address
+void EPD_SRAM_reader(void *buffer, uint32_t address, uint16_t length);
+
+#endif
@@ -0,0 +1,244 @@
+// Copyright 2013-2015 Pervasive Displays, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at:
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+// express or implied.  See the License for the specific language
+// governing permissions and limitations under the License.
+
+
+#if defined(ENERGIA)
+#include <Energia.h>
+#else
+#include <Arduino.h>
+#endif
+
+#include <string.h>
+
+#include <EPD_FLASH.h>
+#include "EPD_UPLOAD.h"
+
+
+// framing and reply bytes
+enum {
+	EPD_UPLOAD_SYNC = 0x7e,
+	EPD_UPLOAD_READY = 'R',
+	EPD_UPLOAD_ACK = 'A',
+	EPD_UPLOAD_NAK = 'N',
+	EPD_UPLOAD_DONE = 'D'
+};
+
+// read_frame results
+enum {
+	FRAME_TIMEOUT = -1,
+	FRAME_BAD = 0,
+	FRAME_GOOD = 1
+};
+
+
+// the default EPD_UPLOAD receiver
+EPD_UPLOAD_Class EPD_UPLOAD;
+
+
+EPD_UPLOAD_Class::EPD_UPLOAD_Class(void) :
+	port(NULL),
+	expected(0),
+	length(0) {
+}
+
+
+void EPD_UPLOAD_Class::begin(Stream &port) {
+	this->port = &port;
+}
+
+
+void EPD_UPLOAD_Class::end(void) {
+	this->port = NULL;
+}
+
+
+// next byte, or -1 after EPD_UPLOAD_TIMEOUT of silence
+int16_t EPD_UPLOAD_Class::read_byte(void) {
+	unsigned long start = millis();
+	while (0 == this->port->available()) {
+		if (millis() - start >= EPD_UPLOAD_TIMEOUT) {
+			return -1;
+		}
+	}
+	return this->port->read();
+}
+
+
+void EPD_UPLOAD_Class::reply(uint8_t type, uint8_t value) {
+	this->port->write(EPD_UPLOAD_SYNC);
+	this->port->write(type);
+	this->port->write(value);
+}
+
+
+// one frame into block, sets the sequence number
+int8_t EPD_UPLOAD_Class::read_frame(uint8_t *sequence) {
+	int16_t c;
+	do {
+		c = this->read_byte();
+		if (c < 0) {
+			return FRAME_TIMEOUT;
+		}
+	} while (EPD_UPLOAD_SYNC != c);
+
+	// sequence, length low, length high
+	uint8_t head[3];
+	uint16_t crc = 0xffff;
+	for (uint8_t i = 0; i < sizeof(head); ++i) {
+		if ((c = this->read_byte()) < 0) {
+			return FRAME_TIMEOUT;
+		}
+		head[i] = c;
+		crc = EPD_FLASH_Writer::crc16(crc, c);
+	}
+	*sequence = head[0];
+	this->length = head[1] | head[2] << 8;
+	if (this->length > sizeof(this->block)) {
+		return FRAME_BAD;  // lost sync
+	}
+
+	for (uint16_t i = 0; i < this->length; ++i) {
+		if ((c = this->read_byte()) < 0) {
+			return FRAME_TIMEOUT;
+		}
+		this->block[i] = c;
+		crc = EPD_FLASH_Writer::crc16(crc, c);
+	}
+
+	uint16_t check = 0;
+	for (uint8_t i = 0; i < 16; i += 8) {
+		if ((c = this->read_byte()) < 0) {
+			return FRAME_TIMEOUT;
+		}
+		check |= (uint16_t)c << i;
+	}
+	return check == crc ? FRAME_GOOD : FRAME_BAD;
+}
+
+
+// wait for the expected frame (go back N): false if the host is gone
+bool EPD_UPLOAD_Class::next_frame(void) {
+	bool nak_sent = false;
+	for (uint8_t retries = 0; retries < EPD_UPLOAD_RETRIES;) {
+		uint8_t sequence = 0;
+		int8_t result = this->read_frame(&sequence);
+		if (FRAME_GOOD == result && sequence == this->expected) {
+			return true;
+		}
+		if (FRAME_TIMEOUT == result) {
+			++retries;
+			this->reply(EPD_UPLOAD_NAK, this->expected);
+			nak_sent = true;
+		} else if (FRAME_GOOD == result &&
+			   (uint8_t)(this->expected - sequence) <= EPD_UPLOAD_WINDOW) {
+			// a resend of a frame already written: the ACK was lost
+			this->reply(EPD_UPLOAD_ACK, this->expected - 1);
+		} else if (!nak_sent) {
+			// frames following a bad one are dropped without more NAKs
+			this->reply(EPD_UPLOAD_NAK, this->expected);
+			nak_sent = true;
+		}
+	}
+	return false;
+}
+
+
+// report the result, then drop anything still arriving (a late resend)
+// so it is not taken as commands
+EPD_UPLOAD_status EPD_UPLOAD_Class::done(EPD_UPLOAD_status status) {
+	this->reply(EPD_UPLOAD_DONE, status);
+	unsigned long start = millis();
+	while (millis() - start < EPD_UPLOAD_QUIET) {
+		if (this->port->available()) {
+			this->port->read();
+			start = millis();
+		}
+	}
+	return status;
+}
+
+
+EPD_UPLOAD_status EPD_UPLOAD_Class::catalog(uint16_t width, uint16_t height, EPD_FLASH_Entry *entry) {
+	memset(entry, 0, sizeof(*entry));
+	this->expected = 0;
+	this->reply(EPD_UPLOAD_READY, EPD_UPLOAD_WINDOW);
+	this->port->write((uint8_t)(EPD_UPLOAD_BLOCK_SIZE & 0xff));
+	this->port->write((uint8_t)(EPD_UPLOAD_BLOCK_SIZE >> 8));
+
+	// header, acknowledged only once the sectors are allocated and erased
+	if (!this->next_frame()) {
+		return this->done(EPD_UPLOAD_TIMEOUT_ERROR);
+	}
+	entry->id = this->block[0];
+	entry->encoding = this->block[1];
+	entry->width = this->block[2] | this->block[3] << 8;
+	entry->height = this->block[4] | this->block[5] << 8;
+	for (uint8_t i = 0; i < 32; i += 8) {
+		entry->length |= (uint32_t)this->block[6 + i / 8] << i;
+	}
+	memcpy(entry->name, &this->block[10], sizeof(entry->name) - 1);
+
+	int16_t slot = -1;
+	if (EPD_UPLOAD_HEADER_SIZE == this->length && 0 != entry->length &&
+	    width == entry->width && height == entry->height &&
+	    entry->encoding <= EPD_FLASH_ENCODING_STAGES && EPD_FLASH.catalog_valid()) {
+		slot = EPD_FLASH.catalog_allocate(entry);
+	}
+	if (slot < 0) {
+		return this->done(EPD_UPLOAD_REJECTED);
+	}
+	// found after allocating as that may compact the catalog (the new
+	// slot is only pending so it is not found)
+	EPD_FLASH_Entry old_entry;
+	int16_t old_slot = EPD_FLASH.catalog_find(entry->id, &old_entry);
+
+	EPD_FLASH_Writer writer(EPD_FLASH);
+	writer.begin((uint32_t)entry->sector << EPD_FLASH_SECTOR_SHIFT);
+	writer.erase(entry->length);
+	this->reply(EPD_UPLOAD_ACK, this->expected++);
+	EPD_UPLOAD_status status = EPD_UPLOAD_OK;
+	uint32_t count = 0;
+	for (;;) {
+		if (!this->next_frame()) {
+			status = EPD_UPLOAD_TIMEOUT_ERROR;
+			break;
+		}
+		if (0 == this->length) {
+			break;
+		}
+		if (count < entry->length) {
+			uint32_t n = entry->length - count;
+			writer.write(this->block, n < this->length ? n : this->length);
+		}
+		count += this->length;
+		this->reply(EPD_UPLOAD_ACK, this->expected++);
+	}
+
+	bool verified = writer.end();
+	if (EPD_UPLOAD_OK == status && count != entry->length) {
+		status = EPD_UPLOAD_LENGTH_ERROR;
+	} else if (EPD_UPLOAD_OK == status && !verified) {
+		status = EPD_UPLOAD_VERIFY_FAILED;
+	}
+	if (EPD_UPLOAD_OK == status) {
+		EPD_FLASH.catalog_commit(slot, writer.written_crc());
+		entry->crc = writer.written_crc();
+		if (old_slot > 0) {
+			EPD_FLASH.catalog_free(old_slot);
+		}
+	} else {
+		EPD_FLASH.catalog_free(slot);
+	}
+	return this->done(status);
+}
@@ -0,0 +1,145 @@
+// Copyright 2013-2015 Pervasive Displays, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at:
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+// express or implied.  See the License for the specific language
+// governing permissions and limitations under the License.
+
+#if !defined(EPD_UPLOAD_H)
+#define EPD_UPLOAD_H 1
+
+#if defined(ENERGIA)
+#include <Energia.h>
+#else
+#include <Arduino.h>
+#endif
+
+#include <EPD_FLASH.h>
+
+
+// binary image upload to the FLASH catalog
+// ----------------------------------------
+//
+// the host sends frames (16 bit values are little endian):
+//
+//   0  0x7e
+//   1  sequence number, 0 for the header then 1, 2, ... (wraps)
+//   2  payload length, 0 ends the upload
+//   4  payload
+//   .. CRC-16 of bytes 1.. (EPD_FLASH_Writer::crc16, start 0xffff)
+//
+// the header payload is: id, encoding, width, height, length (32 bit)
+// and a '\0' padded name of EPD_FLASH_NAME_SIZE bytes; the data
+// frames follow with the image bytes exactly as they are stored
+//
+// the device answers with three byte records:
+//
+//   0x7e 'R' window, then the block size (16 bit), when it is ready
+//   0x7e 'A' n  all frames up to n are written
+//   0x7e 'N' n  resend from frame n
+//   0x7e 'D' s  finished with EPD_UPLOAD_status s
+//
+// the host waits for the header to be acknowledged: the sectors are
+// allocated and erased (or found blank) first, so the data frames only
+// have page programs to wait for.  It may then have up to window
+// frames not yet acknowledged, and the window is small enough for all
+// of them to fit in the serial receive buffer, so nothing is lost
+// while a payload is written into the EPD_FLASH_Writer.  A frame that
+// is bad or out of order (bytes lost on the line) is answered by one
+// NAK and everything up to the frame asked for is dropped; the NAK is
+// repeated after EPD_UPLOAD_TIMEOUT of silence.
+// Anything arriving within EPD_UPLOAD_QUIET of the DONE is dropped too,
+// so the host waits that long before sending the next command
+//
+// the epd_upload script is the host side
+
+
+// serial receive buffer of the port (the core's, unless it is a USB
+// port which has its own flow control and can be given a larger size)
+#if !defined(EPD_UPLOAD_RX_BUFFER_SIZE)
+#if defined(SERIAL_RX_BUFFER_SIZE)
+#define EPD_UPLOAD_RX_BUFFER_SIZE SERIAL_RX_BUFFER_SIZE
+#elif defined(SERIAL_BUFFER_SIZE)
+#define EPD_UPLOAD_RX_BUFFER_SIZE SERIAL_BUFFER_SIZE
+#else
+#define EPD_UPLOAD_RX_BUFFER_SIZE 64
+#endif
+#endif
+
+// sync, sequence, length and CRC
+#define EPD_UPLOAD_FRAME_OVERHEAD 6
+
+#define EPD_UPLOAD_HEADER_SIZE (10 + EPD_FLASH_NAME_SIZE)
+
+// payload bytes in one frame, a whole frame fits in the buffer
+#if !defined(EPD_UPLOAD_BLOCK_SIZE)
+#if EPD_UPLOAD_RX_BUFFER_SIZE >= 256 + EPD_UPLOAD_FRAME_OVERHEAD
+#define EPD_UPLOAD_BLOCK_SIZE 256
+#elif EPD_UPLOAD_RX_BUFFER_SIZE >= EPD_UPLOAD_HEADER_SIZE + EPD_UPLOAD_FRAME_OVERHEAD
+#define EPD_UPLOAD_BLOCK_SIZE (EPD_UPLOAD_RX_BUFFER_SIZE - EPD_UPLOAD_FRAME_OVERHEAD)
+#else
+#define EPD_UPLOAD_BLOCK_SIZE EPD_UPLOAD_HEADER_SIZE
+#endif
+#endif
+
+// frames the host may send ahead, as many as the buffer holds
+#if !defined(EPD_UPLOAD_WINDOW)
+#if EPD_UPLOAD_RX_BUFFER_SIZE >= 2 * (EPD_UPLOAD_BLOCK_SIZE + EPD_UPLOAD_FRAME_OVERHEAD)
+#define EPD_UPLOAD_WINDOW (EPD_UPLOAD_RX_BUFFER_SIZE / (EPD_UPLOAD_BLOCK_SIZE + EPD_UPLOAD_FRAME_OVERHEAD))
+#else
+#define EPD_UPLOAD_WINDOW 1
+#endif
+#endif
+
+// milliseconds of silence before a NAK and how many before giving up
+#define EPD_UPLOAD_TIMEOUT 500
+#define EPD_UPLOAD_RETRIES 10
+
+// milliseconds of silence that end an upload
+#define EPD_UPLOAD_QUIET 20
+
+typedef enum {
+	EPD_UPLOAD_OK,
+	EPD_UPLOAD_VERIFY_FAILED,   // FLASH did not read back correctly
+	EPD_UPLOAD_REJECTED,        // wrong size, no catalog or no room
+	EPD_UPLOAD_TIMEOUT_ERROR,   // host stopped sending
+	EPD_UPLOAD_LENGTH_ERROR     // data did not match the header length
+} EPD_UPLOAD_status;
+
+
+class EPD_UPLOAD_Class {
+private:
+	Stream *port;
+	uint8_t expected;           // next sequence number
+	uint16_t length;            // of the frame in block
+	uint8_t block[EPD_UPLOAD_BLOCK_SIZE];
+
+	int16_t read_byte(void);
+	int8_t read_frame(uint8_t *sequence);
+	bool next_frame(void);
+	void reply(uint8_t type, uint8_t value);
+	EPD_UPLOAD_status done(EPD_UPLOAD_status status);
+	EPD_UPLOAD_Class(const EPD_UPLOAD_Class &f);  // prevent copy
+
+public:
+	// receive one image into the catalog, replacing any image with the
+	// same id; width and height are the panel size.  The entry is
+	// filled in from the header
+	EPD_UPLOAD_status catalog(uint16_t width, uint16_t height, EPD_FLASH_Entry *entry);
+
+	void begin(Stream &port);
+	void end(void);
+
+	EPD_UPLOAD_Class(void);
+};
+
+extern EPD_UPLOAD_Class EPD_UPLOAD;
+
+#endif
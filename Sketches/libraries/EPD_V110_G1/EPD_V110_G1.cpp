@@ -32,8 +32,29 @@
 static void PWM_start(int pin);
 static void PWM_stop(int pin);
 
+// COG SPI clock, the same as SPI_CLOCK_DIV2 on a 16 MHz AVR
+#if !defined(EPD_SPI_CLOCK)
+#define EPD_SPI_CLOCK 8000000
+#endif
+
+// use SPI transactions where the core has them
+#if defined(SPI_HAS_TRANSACTION)
+#define EPD_SPI_TRANSACTION 1
+static const SPISettings spi_settings_on(EPD_SPI_CLOCK, MSBFIRST, SPI_MODE2);
+static const SPISettings spi_settings_off(EPD_SPI_CLOCK, MSBFIRST, SPI_MODE0);
+#else
+#define EPD_SPI_TRANSACTION 0
+#endif
+
+// longest line: command, border byte, 2.7" data and scan bytes, filler
+static uint8_t line_buffer[1 + 1 + 2 * (264 / 8) + 176 / 4 + 1];
+
+static inline void CS_write(uint8_t pin, uint8_t level);
 static void SPI_on(void);
 static void SPI_off(void);
+static void SPI_resume(void);
+static void SPI_pause(void);
+static void SPI_restart(void);
 static void SPI_put(uint8_t c);
 static void SPI_put_wait(uint8_t c, int busy_pin);
 static void SPI_send(uint8_t cs_pin, const uint8_t *buffer, uint16_t length);
@@ -230,7 +251,7 @@ void EPD_Class::begin(void) {
 	Delay_us(10);
 	SPI_send(this->EPD_Pin_EPD_CS, CU8(0x72, 0x24), 2);
 
-	SPI_off();
+	SPI_pause();
 }
 
 
@@ -257,7 +278,7 @@ void EPD_Class::end(void) {
 		digitalWrite(this->EPD_Pin_BORDER, HIGH);
 	}
 
-	SPI_on();
+	SPI_resume();
 
 	// latch reset turn on
 	Delay_us(10);
@@ -399,6 +420,7 @@ void EPD_Class::frame_cb(uint32_t address, EPD_reader *reader, EPD_stage stage)
 	static uint8_t buffer[264 / 8];
 	for (uint8_t line = 0; line < this->lines_per_display ; ++line) {
 		reader(buffer, address + line * this->bytes_per_line, this->bytes_per_line);
+		SPI_restart();
 		this->line(line, buffer, 0, false, stage);
 	}
 }
@@ -466,29 +488,15 @@ void EPD_Class::frame_cb_repeat(uint32_t address, EPD_reader *reader, EPD_stage
 }
 
 
+// the line is built first so the send loop only has to wait for BUSY
 void EPD_Class::line(uint16_t line, const uint8_t *data, uint8_t fixed_value, bool read_progmem, EPD_stage stage) {
 
-	SPI_on();
-
-	// charge pump voltage levels
-	Delay_us(10);
-	SPI_send(this->EPD_Pin_EPD_CS, CU8(0x70, 0x04), 2);
-	Delay_us(10);
-	SPI_send(this->EPD_Pin_EPD_CS, this->gate_source, this->gate_source_length);
-
-	// send data
-	Delay_us(10);
-	SPI_send(this->EPD_Pin_EPD_CS, CU8(0x70, 0x0a), 2);
-	Delay_us(10);
-
-	// CS low
-	digitalWrite(this->EPD_Pin_EPD_CS, LOW);
-	SPI_put_wait(0x72, this->EPD_Pin_BUSY);
+	uint8_t *p = line_buffer;
+	*p++ = 0x72;
 
 	// border byte only necessary for 1.44" EPD
 	if (EPD_1_44 == this->size) {
-		SPI_put_wait(0x00, this->EPD_Pin_BUSY);
-		//SPI_send(this->EPD_Pin_EPD_CS, CU8(0x00), 1);
+		*p++ = 0x00;
 	}
 
 	// even pixels
@@ -519,17 +527,18 @@ void EPD_Class::line(uint16_t line, const uint8_t *data, uint8_t fixed_value, bo
 				pixels = 0xaa | (pixels >> 1);
 				break;
 			}
-			SPI_put_wait(pixels, this->EPD_Pin_BUSY);
+			*p++ = pixels;
 		} else {
-			SPI_put_wait(fixed_value, this->EPD_Pin_BUSY);
-		}	}
+			*p++ = fixed_value;
+		}
+	}
 
 	// scan line
 	for (uint16_t b = 0; b < this->bytes_per_scan; ++b) {
 		if (line / 4 == b) {
-			SPI_put_wait(0xc0 >> (2 * (line & 0x03)), this->EPD_Pin_BUSY);
+			*p++ = 0xc0 >> (2 * (line & 0x03));
 		} else {
-			SPI_put_wait(0x00, this->EPD_Pin_BUSY);
+			*p++ = 0x00;
 		}
 	}
 
@@ -566,18 +575,35 @@ void EPD_Class::line(uint16_t line, const uint8_t *data, uint8_t fixed_value, bo
 			uint8_t p3 = (pixels >> 2) & 0x03;
 			uint8_t p4 = (pixels >> 0) & 0x03;
 			pixels = (p1 << 0) | (p2 << 2) | (p3 << 4) | (p4 << 6);
-			SPI_put_wait(pixels, this->EPD_Pin_BUSY);
+			*p++ = pixels;
 		} else {
-			SPI_put_wait(fixed_value, this->EPD_Pin_BUSY);
+			*p++ = fixed_value;
 		}
 	}
 
 	if (this->filler) {
-		SPI_put_wait(0x00, this->EPD_Pin_BUSY);
+		*p++ = 0x00;
 	}
 
-	// CS high
-	digitalWrite(this->EPD_Pin_EPD_CS, HIGH);
+	SPI_resume();
+
+	// charge pump voltage levels
+	Delay_us(10);
+	SPI_send(this->EPD_Pin_EPD_CS, CU8(0x70, 0x04), 2);
+	Delay_us(10);
+	SPI_send(this->EPD_Pin_EPD_CS, this->gate_source, this->gate_source_length);
+
+	// send data
+	Delay_us(10);
+	SPI_send(this->EPD_Pin_EPD_CS, CU8(0x70, 0x0a), 2);
+	Delay_us(10);
+
+	// the COG takes each byte at its own pace
+	CS_write(this->EPD_Pin_EPD_CS, LOW);
+	for (const uint8_t *q = line_buffer; q < p; ++q) {
+		SPI_put_wait(*q, this->EPD_Pin_BUSY);
+	}
+	CS_write(this->EPD_Pin_EPD_CS, HIGH);
 
 	// output data to panel
 	Delay_us(10);
@@ -585,31 +611,82 @@ void EPD_Class::line(uint16_t line, const uint8_t *data, uint8_t fixed_value, bo
 	Delay_us(10);
 	SPI_send(this->EPD_Pin_EPD_CS, CU8(0x72, 0x2f), 2);
 
-	SPI_off();
+	SPI_pause();
+}
+
+
+// CS by direct port write where the core allows it
+static inline void CS_write(uint8_t pin, uint8_t level) {
+#if defined(__AVR__)
+	volatile uint8_t *port = portOutputRegister(digitalPinToPort(pin));
+	uint8_t mask = digitalPinToBitMask(pin);
+	uint8_t sreg = SREG;
+	cli();
+	if (LOW == level) {
+		*port &= ~mask;
+	} else {
+		*port |= mask;
+	}
+	SREG = sreg;
+#else
+	digitalWrite(pin, level);
+#endif
 }
 
 
 static void SPI_on(void) {
-	SPI.end();
 	SPI.begin();
+	SPI_resume();
+}
+
+
+static void SPI_off(void) {
+	SPI_pause();
+	SPI.end();
+}
+
+
+// the bus stays begun from begin() to end(); each line and the
+// commands outside of the lines switch between these modes
+static void SPI_resume(void) {
+#if EPD_SPI_TRANSACTION
+	SPI.beginTransaction(spi_settings_on);
+#else
 	SPI.setBitOrder(MSBFIRST);
 	SPI.setDataMode(SPI_MODE2);
 	SPI.setClockDivider(SPI_CLOCK_DIV2);
+#endif
 	SPI_put(0x00);
 	SPI_put(0x00);
 	Delay_us(10);
 }
 
 
-static void SPI_off(void) {
+static void SPI_pause(void) {
+#if EPD_SPI_TRANSACTION
+	SPI.endTransaction();
+	SPI.beginTransaction(spi_settings_off);
+#else
 	// SPI.begin();
 	// SPI.setBitOrder(MSBFIRST);
 	SPI.setDataMode(SPI_MODE0);
 	// SPI.setClockDivider(SPI_CLOCK_DIV2);
+#endif
 	SPI_put(0x00);
 	SPI_put(0x00);
 	Delay_us(10);
+#if EPD_SPI_TRANSACTION
+	SPI.endTransaction();
+#endif
+}
+
+
+// a reader callback (e.g. the flash) ends the bus, which disables it
+// on cores that do not count begin and end; restart it, leaving any
+// count as it was
+static void SPI_restart(void) {
 	SPI.end();
+	SPI.begin();
 }
 
 
@@ -630,7 +707,7 @@ static void SPI_put_wait(uint8_t c, int busy_pin) {
 
 static void SPI_send(uint8_t cs_pin, const uint8_t *buffer, uint16_t length) {
 	// CS low
-	digitalWrite(cs_pin, LOW);
+	CS_write(cs_pin, LOW);
 
 	// send all data
 	for (uint16_t i = 0; i < length; ++i) {
@@ -638,7 +715,7 @@ static void SPI_send(uint8_t cs_pin, const uint8_t *buffer, uint16_t length) {
 	}
 
 	// CS high
-	digitalWrite(cs_pin, HIGH);
+	CS_write(cs_pin, HIGH);
 }
 
 
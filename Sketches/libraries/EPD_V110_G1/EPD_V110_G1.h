@@ -32,6 +32,7 @@
 #define EPD_PWM_REQUIRED      1
 #define EPD_IMAGE_ONE_ARG     0
 #define EPD_IMAGE_TWO_ARG     1
+#define EPD_ENCODED_AVAILABLE 0
 #define EPD_PARTIAL_AVAILABLE 0
 
 // display panels supported
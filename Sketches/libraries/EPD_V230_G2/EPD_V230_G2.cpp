@@ -19,6 +19,7 @@
 #include <SPI.h>
 
 #include "EPD_V230_G2.h"
+#include "EPD_DMA.h"
 
 // delays - more consistent naming
 #define Delay_ms(ms) delay(ms)
@@ -33,10 +34,48 @@
 #define BORDER_BYTE_WHITE 0xaa
 #define BORDER_BYTE_NULL  0x00
 
+// COG SPI clock, the same as SPI_CLOCK_DIV2 on a 16 MHz AVR
+#if !defined(EPD_SPI_CLOCK)
+#define EPD_SPI_CLOCK 8000000
+#endif
+
+// use SPI transactions where the core has them
+#if defined(SPI_HAS_TRANSACTION)
+#define EPD_SPI_TRANSACTION 1
+static const SPISettings spi_settings(EPD_SPI_CLOCK, MSBFIRST, SPI_MODE0);
+#else
+#define EPD_SPI_TRANSACTION 0
+#endif
+
+// send lines by DMA where the core has a backend (EPD_DMA.h)
+#if EPD_SPI_TRANSACTION && EPD_DMA_AVAILABLE
+#define EPD_LINE_DMA 1
+#else
+#define EPD_LINE_DMA 0
+#endif
+
+// longest line: command, border byte, 2.7" data and scan bytes
+#define LINE_BUFFER_SIZE (1 + 1 + 2 * (264 / 8) + 176 / 4)
+#if EPD_LINE_DMA
+// one buffer is encoded while the other is sent
+static uint8_t line_buffers[2][LINE_BUFFER_SIZE];
+static uint8_t *line_buffer = line_buffers[0];
+static bool line_sending = false;
+#else
+static uint8_t line_buffer[LINE_BUFFER_SIZE];
+#endif
+
+static inline void CS_write(uint8_t pin, uint8_t level);
 static void SPI_on(void);
 static void SPI_off(void);
+static void SPI_resume(void);
+static void SPI_pause(void);
+static void SPI_restart(void);
+static void SPI_begin_line(void);
+static void SPI_end_line(void);
 static void SPI_put(uint8_t c);
 static void SPI_send(uint8_t cs_pin, const uint8_t *buffer, uint16_t length);
+static void SPI_burst(uint8_t cs_pin, uint8_t *buffer, uint16_t length);
 static uint8_t SPI_read(uint8_t cs_pin, const uint8_t *buffer, uint16_t length);
 
 
@@ -283,7 +322,7 @@ void EPD_Class::begin(void) {
 	SPI_send(this->EPD_Pin_EPD_CS, CU8(0x70, 0x02), 2);
 	SPI_send(this->EPD_Pin_EPD_CS, CU8(0x72, 0x40), 2);
 
-	SPI_off();
+	SPI_pause();
 }
 
 
@@ -304,7 +343,7 @@ void EPD_Class::end(void) {
 		digitalWrite(this->EPD_Pin_BORDER, HIGH);
 	}
 
-	SPI_on();
+	SPI_resume();
 
 	// check DC/DC
 	SPI_send(this->EPD_Pin_EPD_CS, CU8(0x70, 0x0f), 2);
@@ -384,8 +423,9 @@ void EPD_Class::frame_fixed_timed(uint8_t fixed_value, long stage_time) {
 	do {
 		unsigned long t_start = millis();
 		for (uint8_t line = 0; line < this->lines_per_display ; ++line) {
-			this->line(this->lines_per_display - line - 1, 0, fixed_value, false);
+			this->line_queue(this->lines_per_display - line - 1, 0, fixed_value, false);
 		}
+		this->line_flush();
 		unsigned long t_end = millis();
 		if (t_end > t_start) {
 			stage_time -= t_end - t_start;
@@ -436,13 +476,14 @@ void EPD_Class::frame_fixed_13(uint8_t value, EPD_stage stage) {
 					break;
 				}
 				if (full_block && (line < (block_begin + step))) {
-					this->line(line, 0, 0x00, false, EPD_normal);
+					this->line_queue(line, 0, 0x00, false, EPD_normal);
 				} else {
-					this->line(line, 0, value, false, EPD_normal);
+					this->line_queue(line, 0, value, false, EPD_normal);
 				}
 			}
 		}
 	}
+	this->line_flush();
 }
 
 
@@ -485,13 +526,14 @@ void EPD_Class::frame_data_13(const uint8_t *image, EPD_stage stage, bool read_p
 					break;
 				}
 				if (full_block && (line < (block_begin + step))) {
-					this->line(line, 0, 0x00, false, EPD_normal);
+					this->line_queue(line, 0, 0x00, false, EPD_normal);
 				} else {
-					this->line(line, &image[line * this->bytes_per_line], 0x00, read_progmem, stage);
+					this->line_queue(line, &image[line * this->bytes_per_line], 0x00, read_progmem, stage);
 				}
 			}
 		}
 	}
+	this->line_flush();
 }
 
 
@@ -534,14 +576,17 @@ void EPD_Class::frame_cb_13(uint32_t address, EPD_reader *reader, EPD_stage stag
 					break;
 				}
 				if (full_block && (line < (block_begin + step))) {
-					this->line(line, 0, 0x00, false, EPD_normal);
+					this->line_queue(line, 0, 0x00, false, EPD_normal);
 				} else {
+					this->line_flush();  // the reader may use the bus
 					reader(buffer, address + line * this->bytes_per_line, this->bytes_per_line);
-					this->line(line, buffer, 0, false, stage);
+					SPI_restart();
+					this->line_queue(line, buffer, 0, false, stage);
 				}
 			}
 		}
 	}
+	this->line_flush();
 }
 
 
@@ -576,133 +621,229 @@ void EPD_Class::border_dummy_line(void) {
 void EPD_Class::line(uint16_t line, const uint8_t *data, uint8_t fixed_value,
 		     bool read_progmem, EPD_stage stage, uint8_t border_byte,
 		     bool set_voltage_limit) {
+	this->line_queue(line, data, fixed_value, read_progmem, stage, border_byte, set_voltage_limit);
+	this->line_flush();
+}
 
-       SPI_on();
 
-       if (set_voltage_limit) {
-	       // charge pump voltage level reduce voltage shift
-	       SPI_send(this->EPD_Pin_EPD_CS, CU8(0x70, 0x04), 2);
-	       const uint8_t b[2] = {0x72, this->voltage_level};
-	       SPI_send(this->EPD_Pin_EPD_CS, b, sizeof(b));
-       }
+// the line is built first and then sent as one SPI transaction
+// with DMA this returns once the line has been started (frame
+// functions build the next line meanwhile)
+void EPD_Class::line_queue(uint16_t line, const uint8_t *data, uint8_t fixed_value,
+			   bool read_progmem, EPD_stage stage, uint8_t border_byte,
+			   bool set_voltage_limit) {
 
-       // send data
-       SPI_send(this->EPD_Pin_EPD_CS, CU8(0x70, 0x0a), 2);
+	uint8_t *p = line_buffer;
+	*p++ = 0x72;
 
-       Delay_us(10);
+	// border byte
+	*p++ = border_byte;
 
-       // CS low
-       digitalWrite(this->EPD_Pin_EPD_CS, LOW);
-       SPI_put(0x72);
+	// odd pixels
+	for (uint16_t b = this->bytes_per_line; b > 0; --b) {
+		if (0 != data) {
+#if !defined(__AVR__)
+			uint8_t pixels = data[b - 1];
+#else
+			// AVR has multiple memory spaces
+			uint8_t pixels;
+			if (read_progmem) {
+				pixels = pgm_read_byte_near(data + b - 1);
+			} else {
+				pixels = data[b - 1];
+			}
+#endif
+			switch(stage) {
+			case EPD_inverse:      // B -> W, W -> B
+				pixels ^= 0xff;
+				break;
+			case EPD_normal:       // B -> B, W -> W
+				break;
+			}
+			pixels = 0xaa | pixels;
+			*p++ = pixels;
+		} else {
+			*p++ = fixed_value;
+		}
+	}
 
-       // border byte
-       SPI_put(border_byte);
+	// scan line
+	int scan_pos = (this->lines_per_display - line - 1) >> 2;
+	int scan_shift = (line & 0x03) << 1;
+	for (unsigned int b = 0; b < this->bytes_per_scan; ++b) {
+		if (scan_pos == (int) b) {
+			*p++ = 0x03 << scan_shift;
+		} else {
+			*p++ = 0x00;
+		}
+	}
 
-       // odd pixels
-       for (uint16_t b = this->bytes_per_line; b > 0; --b) {
-	       if (0 != data) {
+	// even pixels
+	for (uint16_t b = 0; b < this->bytes_per_line; ++b) {
+		if (0 != data) {
 #if !defined(__AVR__)
-		       uint8_t pixels = data[b - 1];
+			uint8_t pixels = data[b];
 #else
-		       // AVR has multiple memory spaces
-		       uint8_t pixels;
-		       if (read_progmem) {
-			       pixels = pgm_read_byte_near(data + b - 1);
-		       } else {
-			       pixels = data[b - 1];
-		       }
+			// AVR has multiple memory spaces
+			uint8_t pixels;
+			if (read_progmem) {
+				pixels = pgm_read_byte_near(data + b);
+			} else {
+				pixels = data[b];
+			}
 #endif
-		       switch(stage) {
-		       case EPD_inverse:      // B -> W, W -> B
-			       pixels ^= 0xff;
-			       break;
-		       case EPD_normal:       // B -> B, W -> W
-			       break;
-		       }
-		       pixels = 0xaa | pixels;
-		       SPI_put(pixels);
-	       } else {
-		       SPI_put(fixed_value);
-	       }
-       }
-
-       // scan line
-       int scan_pos = (this->lines_per_display - line - 1) >> 2;
-       int scan_shift = (line & 0x03) << 1;
-       for (unsigned int b = 0; b < this->bytes_per_scan; ++b) {
-	       if (scan_pos == (int) b) {
-		       SPI_put(0x03 << scan_shift);
-	       } else {
-		       SPI_put(0x00);
-	       }
-       }
-
-       // even pixels
-       for (uint16_t b = 0; b < this->bytes_per_line; ++b) {
-	       if (0 != data) {
-#if !defined(__AVR__)
-		       uint8_t pixels = data[b];
+			switch(stage) {
+			case EPD_inverse:      // B -> W, W -> B (Current Image)
+				pixels ^= 0xff;
+				break;
+			case EPD_normal:       // B -> B, W -> W (New Image)
+				break;
+			}
+			pixels >>= 1;
+			pixels |= 0xaa;
+
+			pixels = ((pixels & 0xc0) >> 6)
+				| ((pixels & 0x30) >> 2)
+				| ((pixels & 0x0c) << 2)
+				| ((pixels & 0x03) << 6);
+			*p++ = pixels;
+		} else {
+			*p++ = fixed_value;
+		}
+	}
+
+#if EPD_LINE_DMA
+	this->line_flush();
+#endif
+	SPI_begin_line();
+
+	if (set_voltage_limit) {
+		// charge pump voltage level reduce voltage shift
+		SPI_send(this->EPD_Pin_EPD_CS, CU8(0x70, 0x04), 2);
+		const uint8_t b[2] = {0x72, this->voltage_level};
+		SPI_send(this->EPD_Pin_EPD_CS, b, sizeof(b));
+	}
+
+	// send data
+	SPI_send(this->EPD_Pin_EPD_CS, CU8(0x70, 0x0a), 2);
+#if EPD_LINE_DMA
+	CS_write(this->EPD_Pin_EPD_CS, LOW);
+	EPD_DMA_send(line_buffer, p - line_buffer);
+	line_sending = true;
+	line_buffer = line_buffers[line_buffer == line_buffers[0] ? 1 : 0];
 #else
-		       // AVR has multiple memory spaces
-		       uint8_t pixels;
-		       if (read_progmem) {
-			       pixels = pgm_read_byte_near(data + b);
-		       } else {
-			       pixels = data[b];
-		       }
+	SPI_burst(this->EPD_Pin_EPD_CS, line_buffer, p - line_buffer);
+
+	// output data to panel
+	SPI_send(this->EPD_Pin_EPD_CS, CU8(0x70, 0x02), 2);
+	SPI_send(this->EPD_Pin_EPD_CS, CU8(0x72, 0x07), 2);
+
+	SPI_end_line();
 #endif
-		       switch(stage) {
-		       case EPD_inverse:      // B -> W, W -> B (Current Image)
-			       pixels ^= 0xff;
-			       break;
-		       case EPD_normal:       // B -> B, W -> W (New Image)
-			       break;
-		       }
-		       pixels >>= 1;
-		       pixels |= 0xaa;
-
-		       pixels = ((pixels & 0xc0) >> 6)
-			       | ((pixels & 0x30) >> 2)
-			       | ((pixels & 0x0c) << 2)
-			       | ((pixels & 0x03) << 6);
-		       SPI_put(pixels);
-	       } else {
-		       SPI_put(fixed_value);
-	       }
-       }
-
-       // CS high
-       digitalWrite(this->EPD_Pin_EPD_CS, HIGH);
-
-       // output data to panel
-       SPI_send(this->EPD_Pin_EPD_CS, CU8(0x70, 0x02), 2);
-       SPI_send(this->EPD_Pin_EPD_CS, CU8(0x72, 0x07), 2);
-
-       SPI_off();
 }
 
 
-static void SPI_on(void) {
-	SPI.end();
-	SPI.begin();
+// complete the line being sent by DMA, if any; has to be called
+// before anything else uses the bus
+void EPD_Class::line_flush(void) {
+#if EPD_LINE_DMA
+	if (line_sending) {
+		EPD_DMA_wait();
+		CS_write(this->EPD_Pin_EPD_CS, HIGH);
+
+		// output data to panel
+		SPI_send(this->EPD_Pin_EPD_CS, CU8(0x70, 0x02), 2);
+		SPI_send(this->EPD_Pin_EPD_CS, CU8(0x72, 0x07), 2);
+
+		SPI_end_line();
+		line_sending = false;
+	}
+#endif
+}
+
+
+// CS by direct port write where the core allows it
+static inline void CS_write(uint8_t pin, uint8_t level) {
+#if defined(__AVR__)
+	volatile uint8_t *port = portOutputRegister(digitalPinToPort(pin));
+	uint8_t mask = digitalPinToBitMask(pin);
+	uint8_t sreg = SREG;
+	cli();
+	if (LOW == level) {
+		*port &= ~mask;
+	} else {
+		*port |= mask;
+	}
+	SREG = sreg;
+#else
+	digitalWrite(pin, level);
+#endif
+}
+
+
+static void SPI_configure(void) {
+#if EPD_SPI_TRANSACTION
+	SPI.beginTransaction(spi_settings);
+#else
 	SPI.setBitOrder(MSBFIRST);
 	SPI.setDataMode(SPI_MODE0);
 	SPI.setClockDivider(SPI_CLOCK_DIV2);
+#endif
+}
+
+
+static void SPI_on(void) {
+	SPI.begin();
+	SPI_resume();
+}
+
+
+static void SPI_off(void) {
+	SPI_pause();
+	SPI.end();
+}
+
+
+// the bus stays begun from begin() to end(); these bracket the
+// commands sent outside of the lines
+static void SPI_resume(void) {
+	SPI_configure();
 	SPI_put(0x00);
 	SPI_put(0x00);
 	Delay_us(10);
 }
 
 
-static void SPI_off(void) {
-	// SPI.begin();
-	// SPI.setBitOrder(MSBFIRST);
-	SPI.setDataMode(SPI_MODE0);
-	// SPI.setClockDivider(SPI_CLOCK_DIV2);
+static void SPI_pause(void) {
 	SPI_put(0x00);
 	SPI_put(0x00);
 	Delay_us(10);
+#if EPD_SPI_TRANSACTION
+	SPI.endTransaction();
+#endif
+}
+
+
+// a reader callback (e.g. the flash) ends the bus, which disables it
+// on cores that do not count begin and end; restart it, leaving any
+// count as it was
+static void SPI_restart(void) {
 	SPI.end();
+	SPI.begin();
+}
+
+
+// the bus is held from begin() to end(), so only the transaction is
+// per line
+static void SPI_begin_line(void) {
+	SPI_configure();
+}
+
+
+static void SPI_end_line(void) {
+#if EPD_SPI_TRANSACTION
+	SPI.endTransaction();
+#endif
 }
 
 
@@ -713,7 +854,7 @@ static void SPI_put(uint8_t c) {
 
 static void SPI_send(uint8_t cs_pin, const uint8_t *buffer, uint16_t length) {
 	// CS low
-	digitalWrite(cs_pin, LOW);
+	CS_write(cs_pin, LOW);
 
 	// send all data
 	for (uint16_t i = 0; i < length; ++i) {
@@ -721,13 +862,27 @@ static void SPI_send(uint8_t cs_pin, const uint8_t *buffer, uint16_t length) {
 	}
 
 	// CS high
-	digitalWrite(cs_pin, HIGH);
+	CS_write(cs_pin, HIGH);
+}
+
+
+// send a whole buffer in one call, received bytes overwrite the buffer
+static void SPI_burst(uint8_t cs_pin, uint8_t *buffer, uint16_t length) {
+	CS_write(cs_pin, LOW);
+#if EPD_SPI_TRANSACTION
+	SPI.transfer(buffer, length);
+#else
+	for (uint16_t i = 0; i < length; ++i) {
+		SPI_put(buffer[i]);
+	}
+#endif
+	CS_write(cs_pin, HIGH);
 }
 
 // FIXME: What is the purpose of rbuffer?  It is set, but never used.
 static uint8_t SPI_read(uint8_t cs_pin, const uint8_t *buffer, uint16_t length) {
 	// CS low
-	digitalWrite(cs_pin, LOW);
+	CS_write(cs_pin, LOW);
 
 	uint8_t rbuffer[4];
 	uint8_t result = 0;
@@ -741,6 +896,6 @@ static uint8_t SPI_read(uint8_t cs_pin, const uint8_t *buffer, uint16_t length)
 	}
 
 	// CS high
-	digitalWrite(cs_pin, HIGH);
+	CS_write(cs_pin, HIGH);
 	return result;
 }
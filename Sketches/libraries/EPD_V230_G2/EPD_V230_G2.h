@@ -32,6 +32,7 @@
 #define EPD_PWM_REQUIRED      0
 #define EPD_IMAGE_ONE_ARG     1
 #define EPD_IMAGE_TWO_ARG     0
+#define EPD_ENCODED_AVAILABLE 0
 #define EPD_PARTIAL_AVAILABLE 0
 
 // display panels supported
@@ -115,6 +116,9 @@ private:
 	void nothing_frame(void);
 	void dummy_line(void);
 	void border_dummy_line(void);
+	void line_queue(uint16_t line, const uint8_t *data, uint8_t fixed_value,
+			bool read_progmem, EPD_stage stage = EPD_normal, uint8_t border_byte = EPD_BORDER_BYTE_NULL, bool set_voltage_limit = false);
+	void line_flush(void);
 
 public:
 	// power up and power down the EPD panel
@@ -23,6 +23,8 @@
 #include <SPI.h>
 
 #include "EPD_V231_G2.h"
+#include "EPD_ENCODE.h"
+#include "EPD_DMA.h"
 
 // delays - more consistent naming
 #define Delay_ms(ms) delay(ms)
@@ -37,10 +39,53 @@
 #define BORDER_BYTE_WHITE 0xaa
 #define BORDER_BYTE_NULL  0x00
 
+// COG SPI clock, the same as SPI_CLOCK_DIV2 on a 16 MHz AVR
+#if !defined(EPD_SPI_CLOCK)
+#define EPD_SPI_CLOCK 8000000
+#endif
+
+// use SPI transactions where the core has them (the MSP432 changes
+// clock mode between SPI_on and SPI_off so it keeps the old calls)
+#if defined(SPI_HAS_TRANSACTION) && !defined(__MSP432P401R__)
+#define EPD_SPI_TRANSACTION 1
+static const SPISettings spi_settings(EPD_SPI_CLOCK, MSBFIRST, SPI_MODE0);
+#else
+#define EPD_SPI_TRANSACTION 0
+#endif
+
+// send lines by DMA where the core has a backend (EPD_DMA.h)
+#if EPD_SPI_TRANSACTION && EPD_DMA_AVAILABLE
+#define EPD_LINE_DMA 1
+#else
+#define EPD_LINE_DMA 0
+#endif
+
+// longest line: command, border bytes, 2.7" data and scan bytes
+#if EPD_LINE_DMA
+// one buffer is encoded while the other is sent
+static uint8_t line_buffers[2][EPD_ENCODED_LINE_MAX];
+static uint8_t *line_buffer = line_buffers[0];
+static bool line_sending = false;
+#else
+static uint8_t line_buffer[EPD_ENCODED_LINE_MAX];
+#endif
+
+#if defined(__AVR__)
+// SRAM copy of a progmem image line
+static uint8_t data_buffer[264 / 8];
+#endif
+
+static inline void CS_write(uint8_t pin, uint8_t level);
 static void SPI_on(void);
 static void SPI_off(void);
+static void SPI_resume(void);
+static void SPI_pause(void);
+static void SPI_restart(void);
+static void SPI_begin_line(void);
+static void SPI_end_line(void);
 static void SPI_put(uint8_t c);
 static void SPI_send(uint8_t cs_pin, const uint8_t *buffer, uint16_t length);
+static void SPI_burst(uint8_t cs_pin, uint8_t *buffer, uint16_t length);
 static uint8_t SPI_read(uint8_t cs_pin, const uint8_t *buffer, uint16_t length);
 
 
@@ -273,7 +318,7 @@ void EPD_Class::begin(void) {
 	SPI_send(this->EPD_Pin_EPD_CS, CU8(0x70, 0x02), 2);
 	SPI_send(this->EPD_Pin_EPD_CS, CU8(0x72, 0x40), 2);
 
-	SPI_off();
+	SPI_pause();
 }
 
 
@@ -293,7 +338,7 @@ void EPD_Class::end(void) {
 		Delay_ms(200);
 	}
 
-	SPI_on();
+	SPI_resume();
 
 	// ??? - not described in datasheet
 	SPI_send(this->EPD_Pin_EPD_CS, CU8(0x70, 0x0b), 2);
@@ -384,23 +429,26 @@ int EPD_Class::temperature_to_factor_10x(int temperature) const {
 
 void EPD_Class::frame_fixed(uint8_t fixed_value, EPD_stage stage) {
 	for (uint8_t line = 0; line < this->lines_per_display ; ++line) {
-		this->line(line, 0, fixed_value, false, stage);
+		this->line_queue(line, 0, fixed_value, false, stage);
 	}
+	this->line_flush();
 }
 
 
 void EPD_Class::frame_data(PROGMEM const uint8_t *image, EPD_stage stage){
 	for (uint8_t line = 0; line < this->lines_per_display ; ++line) {
-		this->line(line, &image[line * this->bytes_per_line], 0, true, stage);
+		this->line_queue(line, &image[line * this->bytes_per_line], 0, true, stage);
 	}
+	this->line_flush();
 }
 
 
 #if defined(EPD_ENABLE_EXTRA_SRAM)
 void EPD_Class::frame_sram(const uint8_t *image, EPD_stage stage){
 	for (uint8_t line = 0; line < this->lines_per_display ; ++line) {
-		this->line(line, &image[line * this->bytes_per_line], 0, false, stage);
+		this->line_queue(line, &image[line * this->bytes_per_line], 0, false, stage);
 	}
+	this->line_flush();
 }
 #endif
 
@@ -408,9 +456,64 @@ void EPD_Class::frame_sram(const uint8_t *image, EPD_stage stage){
 void EPD_Class::frame_cb(uint32_t address, EPD_reader *reader, EPD_stage stage) {
 	static uint8_t buffer[264 / 8];
 	for (uint8_t line = 0; line < this->lines_per_display ; ++line) {
+		this->line_flush();  // the reader may use the bus
 		reader(buffer, address + line * this->bytes_per_line, this->bytes_per_line);
-		this->line(line, buffer, 0, false, stage);
+		SPI_restart();
+		this->line_queue(line, buffer, 0, false, stage);
+	}
+	this->line_flush();
+}
+
+
+// matching lines from two images, the old image for the first two
+// stages and the new one for the last two; old ^ new is the change mask
+void EPD_Class::frame_cb2(uint32_t old_address, EPD_reader *old_reader,
+			  uint32_t new_address, EPD_reader *new_reader, EPD_stage stage,
+			  uint16_t first_line, uint16_t line_count) {
+	static uint8_t old_buffer[264 / 8];
+	static uint8_t new_buffer[264 / 8];
+	bool use_old = EPD_compensate == stage || EPD_white == stage;
+
+	uint16_t end_line = this->lines_per_display;
+	if (line_count < end_line - first_line) {
+		end_line = first_line + line_count;
 	}
+	for (uint16_t line = first_line; line < end_line; ++line) {
+		uint16_t offset = line * this->bytes_per_line;
+		this->line_flush();  // the readers may use the bus
+		old_reader(old_buffer, old_address + offset, this->bytes_per_line);
+		new_reader(new_buffer, new_address + offset, this->bytes_per_line);
+		SPI_restart();
+
+		// old_buffer becomes the mask, keep the data first if it is needed
+		uint8_t any = 0;
+		for (uint16_t b = 0; b < this->bytes_per_line; ++b) {
+			uint8_t change = old_buffer[b] ^ new_buffer[b];
+			if (use_old) {
+				new_buffer[b] = old_buffer[b];
+			}
+			old_buffer[b] = change;
+			any |= change;
+		}
+		if (0 != any) {
+			this->line_queue(line, new_buffer, 0, false, stage, old_buffer);
+		}
+	}
+	this->line_flush();
+}
+
+
+// one stage of lines from line_encode(), sent exactly as read
+void EPD_Class::frame_encoded(uint32_t address, EPD_reader *reader) {
+	uint16_t size = this->encoded_line_size();
+	for (uint8_t line = 0; line < this->lines_per_display ; ++line) {
+		this->line_flush();  // the reader may use the bus
+		reader(line_buffer, address, size);
+		SPI_restart();
+		this->line_start(size);
+		address += size;
+	}
+	this->line_flush();
 }
 
 
@@ -476,128 +579,35 @@ void EPD_Class::frame_cb_repeat(uint32_t address, EPD_reader *reader, EPD_stage
 }
 
 
-// pixels on display are numbered from 1 so even is actually bits 1,3,5,...
-void EPD_Class::even_pixels(const uint8_t *data, uint8_t fixed_value, bool read_progmem, EPD_stage stage) {
-	for (uint16_t b = 0; b < this->bytes_per_line; ++b) {
-		if (0 != data) {
-#if !defined(__AVR__)
-			uint8_t pixels = data[b] & 0xaa;
-#else
-			// AVR has multiple memory spaces
-			uint8_t pixels;
-			if (read_progmem) {
-				pixels = pgm_read_byte_near(data + b) & 0xaa;
-			} else {
-				pixels = data[b] & 0xaa;
-			}
-#endif
-			switch(stage) {
-			case EPD_compensate:  // B -> W, W -> B (Current Image)
-				pixels = 0xaa | ((pixels ^ 0xaa) >> 1);
-				break;
-			case EPD_white:       // B -> N, W -> W (Current Image)
-				pixels = 0x55 + ((pixels ^ 0xaa) >> 1);
-				break;
-			case EPD_inverse:     // B -> N, W -> B (New Image)
-				pixels = 0x55 | (pixels ^ 0xaa);
-				break;
-			case EPD_normal:       // B -> B, W -> W (New Image)
-				pixels = 0xaa | (pixels >> 1);
-				break;
-			}
-			uint8_t p1 = (pixels >> 6) & 0x03;
-			uint8_t p2 = (pixels >> 4) & 0x03;
-			uint8_t p3 = (pixels >> 2) & 0x03;
-			uint8_t p4 = (pixels >> 0) & 0x03;
-			pixels = (p1 << 0) | (p2 << 2) | (p3 << 4) | (p4 << 6);
-			SPI_put(pixels);
-		} else {
-			SPI_put(fixed_value);
-		}
-	}
-}
-
-// pixels on display are numbered from 1 so odd is actually bits 0,2,4,...
-void EPD_Class::odd_pixels(const uint8_t *data, uint8_t fixed_value, bool read_progmem, EPD_stage stage) {
-	for (uint16_t b = this->bytes_per_line; b > 0; --b) {
-		if (0 != data) {
-#if !defined(__AVR__)
-			uint8_t pixels = data[b - 1] & 0x55;
-#else
-			// AVR has multiple memory spaces
-			uint8_t pixels;
-			if (read_progmem) {
-				pixels = pgm_read_byte_near(data + b- 1) & 0x55;
-			} else {
-				pixels = data[b - 1] & 0x55;
-			}
-#endif
-			switch(stage) {
-			case EPD_compensate:  // B -> W, W -> B (Current Image)
-				pixels = 0xaa | (pixels ^ 0x55);
-				break;
-			case EPD_white:       // B -> N, W -> W (Current Image)
-				pixels = 0x55 + (pixels ^ 0x55);
-				break;
-			case EPD_inverse:     // B -> N, W -> B (New Image)
-				pixels = 0x55 | ((pixels ^ 0x55) << 1);
-				break;
-			case EPD_normal:       // B -> B, W -> W (New Image)
-				pixels = 0xaa | pixels;
-				break;
-			}
-			SPI_put(pixels);
+void EPD_Class::frame_cb2_repeat(uint32_t old_address, EPD_reader *old_reader,
+				 uint32_t new_address, EPD_reader *new_reader, EPD_stage stage,
+				 uint16_t first_line, uint16_t line_count) {
+	long stage_time = this->factored_stage_time;
+	do {
+		unsigned long t_start = millis();
+		this->frame_cb2(old_address, old_reader, new_address, new_reader, stage, first_line, line_count);
+		unsigned long t_end = millis();
+		if (t_end > t_start) {
+			stage_time -= t_end - t_start;
 		} else {
-			SPI_put(fixed_value);
+			stage_time -= t_start - t_end + 1 + ULONG_MAX;
 		}
-	}
+	} while (stage_time > 0);
 }
 
-// interleave bits: (byte)76543210 -> (16 bit).7.6.5.4.3.2.1
-static inline uint16_t interleave_bits(uint16_t value) {
-	value = (value | (value << 4)) & 0x0f0f;
-	value = (value | (value << 2)) & 0x3333;
-	value = (value | (value << 1)) & 0x5555;
-	return value;
-}
 
-// pixels on display are numbered from 1
-void EPD_Class::all_pixels(const uint8_t *data, uint8_t fixed_value, bool read_progmem, EPD_stage stage) {
-	for (uint16_t b = this->bytes_per_line; b > 0; --b) {
-		if (NULL != data) {
-#if !defined(__AVR__)
-			uint8_t px = data[b - 1];
-#else
-			// AVR has multiple memory spaces
-			uint8_t px;
-			if (read_progmem) {
-				px = pgm_read_byte_near(data + b - 1);
-			} else {
-				px = data[b - 1];
-			}
-#endif
-			uint16_t pixels = interleave_bits(px);
-			switch(stage) {
-			case EPD_compensate:  // B -> W, W -> B (Current Image)
-				pixels = 0xaaaa | (pixels ^ 0x5555);
-				break;
-			case EPD_white:       // B -> N, W -> W (Current Image)
-				pixels = 0x5555 + (pixels ^ 0x5555);
-				break;
-			case EPD_inverse:     // B -> N, W -> B (New Image)
-				pixels = 0x5555 | ((pixels ^ 0x5555) << 1);
-				break;
-			case EPD_normal:       // B -> B, W -> W (New Image)
-				pixels = 0xaaaa | pixels;
-				break;
-			}
-			SPI_put(pixels >> 8);
-			SPI_put(pixels);
+void EPD_Class::frame_encoded_repeat(uint32_t address, EPD_reader *reader) {
+	long stage_time = this->factored_stage_time;
+	do {
+		unsigned long t_start = millis();
+		this->frame_encoded(address, reader);
+		unsigned long t_end = millis();
+		if (t_end > t_start) {
+			stage_time -= t_end - t_start;
 		} else {
-			SPI_put(fixed_value);
-			SPI_put(fixed_value);
+			stage_time -= t_start - t_end + 1 + ULONG_MAX;
 		}
-	}
+	} while (stage_time > 0);
 }
 
 
@@ -619,26 +629,45 @@ void EPD_Class::border_dummy_line() {
 
 
 // output one line of scan and data bytes to the display
-void EPD_Class::line(uint16_t line, const uint8_t *data, uint8_t fixed_value, bool read_progmem, EPD_stage stage) {
+// the line is built first and then sent as one SPI transaction
+// change: if not NULL only pixels with a set bit are updated
+void EPD_Class::line(uint16_t line, const uint8_t *data, uint8_t fixed_value, bool read_progmem, EPD_stage stage, const uint8_t *change) {
+	this->line_queue(line, data, fixed_value, read_progmem, stage, change);
+	this->line_flush();
+}
 
-	SPI_on();
 
-	// send data
-	Delay_us(10);
-	SPI_send(this->EPD_Pin_EPD_CS, CU8(0x70, 0x0a), 2);
-	Delay_us(10);
+// as line() but with DMA it returns once the line has been started
+// (frame functions encode the next line meanwhile)
+void EPD_Class::line_queue(uint16_t line, const uint8_t *data, uint8_t fixed_value, bool read_progmem, EPD_stage stage, const uint8_t *change) {
+	uint16_t length = this->line_encode(line_buffer, line, data, fixed_value, read_progmem, stage, change);
+	this->line_start(length);
+}
 
-	// CS low
-	digitalWrite(this->EPD_Pin_EPD_CS, LOW);
-	SPI_put(0x72);
+
+// the bytes line() sends, returns the length (encoded_line_size())
+// the pixel encoding is shared with the Linux driver (EPD_ENCODE.h)
+uint16_t EPD_Class::line_encode(uint8_t *buffer, uint16_t line, const uint8_t *data, uint8_t fixed_value, bool read_progmem, EPD_stage stage, const uint8_t *change) {
+
+#if defined(__AVR__)
+	// one bulk copy instead of a program memory read per byte
+	if (NULL != data && read_progmem) {
+		memcpy_P(data_buffer, data, this->bytes_per_line);
+		data = data_buffer;
+	}
+#endif
+	(void)read_progmem;
+
+	uint8_t *p = buffer;
+	*p++ = 0x72;
 
 	if (this->pre_border_byte) {
-		SPI_put(0x00);
+		*p++ = 0x00;
 	}
 
 	if (this->middle_scan) {
 		// data bytes
-		this->odd_pixels(data, fixed_value, read_progmem, stage);
+		p = EPD_encode_odd_line(p, data, change, fixed_value, false, this->bytes_per_line, stage);
 
 		// scan line
 		for (uint16_t b = this->bytes_per_scan; b > 0; --b) {
@@ -646,11 +675,11 @@ void EPD_Class::line(uint16_t line, const uint8_t *data, uint8_t fixed_value, bo
 			if (line / 4 == b - 1) {
 				n = 0x03 << (2 * (line & 0x03));
 			}
-			SPI_put(n);
+			*p++ = n;
 		}
 
 		// data bytes
-		this->even_pixels(data, fixed_value, read_progmem, stage);
+		p = EPD_encode_even_line(p, data, change, fixed_value, false, this->bytes_per_line, stage);
 
 	} else {
 		// even scan line, but as lines on display are numbered from 1, line: 1,3,5,...
@@ -659,11 +688,11 @@ void EPD_Class::line(uint16_t line, const uint8_t *data, uint8_t fixed_value, bo
 			if (0 != (line & 0x01) && line / 8 == b) {
 				n = 0xc0 >> (line & 0x06);
 			}
-			SPI_put(n);
+			*p++ = n;
 		}
 
 		// data bytes
-		this->all_pixels(data, fixed_value, read_progmem, stage);
+		p = EPD_encode_all_line(p, data, change, fixed_value, false, this->bytes_per_line, stage);
 
 		// odd scan line, but as lines on display are numbered from 1, line: 0,2,4,6,...
 		for (uint16_t b = this->bytes_per_scan; b > 0; --b) {
@@ -671,7 +700,7 @@ void EPD_Class::line(uint16_t line, const uint8_t *data, uint8_t fixed_value, bo
 			if (0 == (line & 0x01) && line / 8 == b - 1) {
 				n = 0x03 << (line & 0x06);
 			}
-			SPI_put(n);
+			*p++ = n;
 		}
 	}
 
@@ -681,7 +710,7 @@ void EPD_Class::line(uint16_t line, const uint8_t *data, uint8_t fixed_value, bo
 		break;
 
 	case EPD_BORDER_BYTE_ZERO:  // border byte == 0x00 requred
-		SPI_put(0x00);
+		*p++ = 0x00;
 		break;
 
 	case EPD_BORDER_BYTE_SET:   // border byte needs to be set
@@ -689,29 +718,106 @@ void EPD_Class::line(uint16_t line, const uint8_t *data, uint8_t fixed_value, bo
 		case EPD_compensate:
 		case EPD_white:
 		case EPD_inverse:
-			SPI_put(0x00);
+			*p++ = 0x00;
 			break;
 		case EPD_normal:
-			SPI_put(0xaa);
+			*p++ = 0xaa;
 			break;
 		}
 		break;
 	}
 
-       // CS high
-       digitalWrite(this->EPD_Pin_EPD_CS, HIGH);
+	return p - buffer;
+}
 
-       // output data to panel
-       SPI_send(this->EPD_Pin_EPD_CS, CU8(0x70, 0x02), 2);
-       SPI_send(this->EPD_Pin_EPD_CS, CU8(0x72, 0x07), 2);
 
-       SPI_off();
+uint16_t EPD_Class::encoded_line_size(void) const {
+	uint16_t size = 1 + 2 * this->bytes_per_line + this->bytes_per_scan;
+	if (!this->middle_scan) {
+		size += this->bytes_per_scan;
+	}
+	if (this->pre_border_byte) {
+		++size;
+	}
+	if (EPD_BORDER_BYTE_NONE != this->border_byte) {
+		++size;
+	}
+	return size;
 }
 
 
-static void SPI_on(void) {
-	SPI.end();
-	SPI.begin();
+// send line_buffer
+// with DMA the previous line is finished first, then this one is
+// started and line_buffer switched to the other buffer; line_flush()
+// has to be called before anything else uses the bus
+void EPD_Class::line_start(uint16_t length) {
+#if EPD_LINE_DMA
+	this->line_flush();
+	SPI_begin_line();
+
+	// send data
+	SPI_send(this->EPD_Pin_EPD_CS, CU8(0x70, 0x0a), 2);
+	CS_write(this->EPD_Pin_EPD_CS, LOW);
+	EPD_DMA_send(line_buffer, length);
+	line_sending = true;
+	line_buffer = line_buffers[line_buffer == line_buffers[0] ? 1 : 0];
+#else
+	SPI_begin_line();
+
+	// send data
+	SPI_send(this->EPD_Pin_EPD_CS, CU8(0x70, 0x0a), 2);
+	SPI_burst(this->EPD_Pin_EPD_CS, line_buffer, length);
+
+	// output data to panel
+	SPI_send(this->EPD_Pin_EPD_CS, CU8(0x70, 0x02), 2);
+	SPI_send(this->EPD_Pin_EPD_CS, CU8(0x72, 0x07), 2);
+
+	SPI_end_line();
+#endif
+}
+
+
+// complete the line being sent by DMA, if any
+void EPD_Class::line_flush(void) {
+#if EPD_LINE_DMA
+	if (line_sending) {
+		EPD_DMA_wait();
+		CS_write(this->EPD_Pin_EPD_CS, HIGH);
+
+		// output data to panel
+		SPI_send(this->EPD_Pin_EPD_CS, CU8(0x70, 0x02), 2);
+		SPI_send(this->EPD_Pin_EPD_CS, CU8(0x72, 0x07), 2);
+
+		SPI_end_line();
+		line_sending = false;
+	}
+#endif
+}
+
+
+// CS by direct port write where the core allows it
+static inline void CS_write(uint8_t pin, uint8_t level) {
+#if defined(__AVR__)
+	volatile uint8_t *port = portOutputRegister(digitalPinToPort(pin));
+	uint8_t mask = digitalPinToBitMask(pin);
+	uint8_t sreg = SREG;
+	cli();
+	if (LOW == level) {
+		*port &= ~mask;
+	} else {
+		*port |= mask;
+	}
+	SREG = sreg;
+#else
+	digitalWrite(pin, level);
+#endif
+}
+
+
+static void SPI_configure(void) {
+#if EPD_SPI_TRANSACTION
+	SPI.beginTransaction(spi_settings);
+#else
 	SPI.setBitOrder(MSBFIRST);
 #if defined(__MSP432P401R__)
 	SPI.setDataMode(SPI_MODE3);
@@ -720,14 +826,39 @@ static void SPI_on(void) {
 	SPI.setDataMode(SPI_MODE0);
 	SPI.setClockDivider(SPI_CLOCK_DIV2);
 #endif
+#endif
+}
+
+
+static void SPI_on(void) {
+	SPI.begin();
+	SPI_resume();
+}
+
+
+static void SPI_off(void) {
+	SPI_pause();
+	SPI.end();
+}
+
+
+// the bus stays begun from begin() to end(); these bracket the
+// commands sent outside of the lines
+static void SPI_resume(void) {
+	SPI_configure();
 	SPI_put(0x00);
 	SPI_put(0x00);
 	Delay_us(10);
-//	spi_is_on = true;
 }
 
 
-static void SPI_off(void) {
+static void SPI_pause(void) {
+#if EPD_SPI_TRANSACTION
+	SPI_put(0x00);
+	SPI_put(0x00);
+	Delay_us(10);
+	SPI.endTransaction();
+#else
 	// SPI.begin();
 	// SPI.setBitOrder(MSBFIRST);
 	SPI.setDataMode(SPI_MODE0);
@@ -735,7 +866,30 @@ static void SPI_off(void) {
 	SPI_put(0x00);
 	SPI_put(0x00);
 	Delay_us(10);
+#endif
+}
+
+
+// a reader callback (e.g. the flash) ends the bus, which disables it
+// on cores that do not count begin and end; restart it, leaving any
+// count as it was
+static void SPI_restart(void) {
 	SPI.end();
+	SPI.begin();
+}
+
+
+// the bus is held from begin() to end(), so only the transaction is
+// per line
+static void SPI_begin_line(void) {
+	SPI_configure();
+}
+
+
+static void SPI_end_line(void) {
+#if EPD_SPI_TRANSACTION
+	SPI.endTransaction();
+#endif
 }
 
 
@@ -746,7 +900,7 @@ static void SPI_put(uint8_t c) {
 
 static void SPI_send(uint8_t cs_pin, const uint8_t *buffer, uint16_t length) {
 	// CS low
-	digitalWrite(cs_pin, LOW);
+	CS_write(cs_pin, LOW);
 
 	// send all data
 	for (uint16_t i = 0; i < length; ++i) {
@@ -754,13 +908,41 @@ static void SPI_send(uint8_t cs_pin, const uint8_t *buffer, uint16_t length) {
 	}
 
 	// CS high
-	digitalWrite(cs_pin, HIGH);
+	CS_write(cs_pin, HIGH);
+}
+
+
+// send a whole buffer in one call, received bytes overwrite the buffer
+// (except on AVR where nothing is read back)
+static void SPI_burst(uint8_t cs_pin, uint8_t *buffer, uint16_t length) {
+	CS_write(cs_pin, LOW);
+#if defined(__AVR__)
+	// load the next byte while the current one is shifting out
+	if (0 != length) {
+		SPDR = *buffer++;
+		while (0 != --length) {
+			uint8_t next = *buffer++;
+			while (0 == (SPSR & _BV(SPIF))) {
+			}
+			SPDR = next;
+		}
+		while (0 == (SPSR & _BV(SPIF))) {
+		}
+	}
+#elif EPD_SPI_TRANSACTION
+	SPI.transfer(buffer, length);
+#else
+	for (uint16_t i = 0; i < length; ++i) {
+		SPI_put(buffer[i]);
+	}
+#endif
+	CS_write(cs_pin, HIGH);
 }
 
 #define DEBUG_SPI_READ 0
 static uint8_t SPI_read(uint8_t cs_pin, const uint8_t *buffer, uint16_t length) {
 	// CS low
-	digitalWrite(cs_pin, LOW);
+	CS_write(cs_pin, LOW);
 
 #if DEBUG_SPI_READ
 	uint8_t rbuffer[16];
@@ -778,7 +960,7 @@ static uint8_t SPI_read(uint8_t cs_pin, const uint8_t *buffer, uint16_t length)
 	}
 
 	// CS high
-	digitalWrite(cs_pin, HIGH);
+	CS_write(cs_pin, HIGH);
 
 #if DEBUG_SPI_READ
 	Serial.print("SPI read:");
@@ -40,7 +40,8 @@
 #define EPD_PWM_REQUIRED      0
 #define EPD_IMAGE_ONE_ARG     0
 #define EPD_IMAGE_TWO_ARG     1
-#define EPD_PARTIAL_AVAILABLE 0
+#define EPD_PARTIAL_AVAILABLE 1
+#define EPD_ENCODED_AVAILABLE 1
 
 // display panels supported
 #define EPD_1_44_SUPPORT      1
@@ -85,6 +86,9 @@ typedef enum {
 
 typedef void EPD_reader(void *buffer, uint32_t address, uint16_t length);
 
+// longest line from line_encode()
+#define EPD_ENCODED_LINE_MAX (1 + 2 + 2 * (264 / 8) + 176 / 4)
+
 class EPD_Class {
 private:
 	const uint8_t EPD_Pin_PANEL_ON;
@@ -117,6 +121,9 @@ private:
 	void nothing_frame(void);
 	void dummy_line(void);
 	void border_dummy_line(void);
+	void line_queue(uint16_t line, const uint8_t *data, uint8_t fixed_value, bool read_progmem, EPD_stage stage, const uint8_t *change = NULL);
+	void line_start(uint16_t length);
+	void line_flush(void);
 
 public:
 	// power up and power down the EPD panel
@@ -159,6 +166,26 @@ public:
 		this->frame_data_repeat(new_image, EPD_normal);
 	}
 
+	// change from old image to new image, both through readers
+	// only the changed pixels are driven and unchanged lines are skipped
+	// (first_line and line_count limit the lines read)
+	void image_cb2(uint32_t old_address, EPD_reader *old_reader,
+		       uint32_t new_address, EPD_reader *new_reader,
+		       uint16_t first_line = 0, uint16_t line_count = 0xffff) {
+		this->frame_cb2_repeat(old_address, old_reader, new_address, new_reader, EPD_compensate, first_line, line_count);
+		this->frame_cb2_repeat(old_address, old_reader, new_address, new_reader, EPD_white, first_line, line_count);
+		this->frame_cb2_repeat(old_address, old_reader, new_address, new_reader, EPD_inverse, first_line, line_count);
+		this->frame_cb2_repeat(old_address, old_reader, new_address, new_reader, EPD_normal, first_line, line_count);
+	}
+
+	// partial update: only the last two stages on the changed pixels
+	void partial_cb2(uint32_t old_address, EPD_reader *old_reader,
+			 uint32_t new_address, EPD_reader *new_reader,
+			 uint16_t first_line = 0, uint16_t line_count = 0xffff) {
+		this->frame_cb2_repeat(old_address, old_reader, new_address, new_reader, EPD_inverse, first_line, line_count);
+		this->frame_cb2_repeat(old_address, old_reader, new_address, new_reader, EPD_normal, first_line, line_count);
+	}
+
 #if defined(EPD_ENABLE_EXTRA_SRAM)
 
 	// change from old image to new image (SRAM version)
@@ -180,6 +207,9 @@ public:
 	void frame_sram(const uint8_t *new_image, EPD_stage stage);
 #endif
 	void frame_cb(uint32_t address, EPD_reader *reader, EPD_stage stage);
+	void frame_cb2(uint32_t old_address, EPD_reader *old_reader,
+		       uint32_t new_address, EPD_reader *new_reader, EPD_stage stage,
+		       uint16_t first_line = 0, uint16_t line_count = 0xffff);
 
 	// stage_time frame refresh
 	void frame_fixed_repeat(uint8_t fixed_value, EPD_stage stage);
@@ -188,18 +218,36 @@ public:
 	void frame_sram_repeat(const uint8_t *new_image, EPD_stage stage);
 #endif
 	void frame_cb_repeat(uint32_t address, EPD_reader *reader, EPD_stage stage);
+	void frame_cb2_repeat(uint32_t old_address, EPD_reader *old_reader,
+			      uint32_t new_address, EPD_reader *new_reader, EPD_stage stage,
+			      uint16_t first_line = 0, uint16_t line_count = 0xffff);
+
+	// pre-encoded stages: each frame is lines_per_display lines of
+	// encoded_line_size() bytes made by line_encode(); reader has to
+	// fill the line buffer, the bytes are sent without any conversion
+	void frame_encoded(uint32_t address, EPD_reader *reader);
+	void frame_encoded_repeat(uint32_t address, EPD_reader *reader);
 
 	// convert temperature to compensation factor
 	int temperature_to_factor_10x(int temperature) const;
 
-	// called by line()
-	void even_pixels(const uint8_t *data, uint8_t fixed_value, bool read_progmem, EPD_stage stage);
-	void odd_pixels(const uint8_t *data, uint8_t fixed_value, bool read_progmem, EPD_stage stage);
-	void all_pixels(const uint8_t *data, uint8_t fixed_value, bool read_progmem, EPD_stage stage);
-
 	// single line display - very low-level
 	// also has to handle AVR progmem
-	void line(uint16_t line, const uint8_t *data, uint8_t fixed_value, bool read_progmem, EPD_stage stage);
+	// change (not progmem) limits the update to pixels with a set bit
+	void line(uint16_t line, const uint8_t *data, uint8_t fixed_value, bool read_progmem, EPD_stage stage, const uint8_t *change = NULL);
+
+	// the bytes line() would send (to store for frame_encoded)
+	uint16_t line_encode(uint8_t *buffer, uint16_t line, const uint8_t *data, uint8_t fixed_value, bool read_progmem, EPD_stage stage, const uint8_t *change = NULL);
+	uint16_t encoded_line_size(void) const;
+	inline uint32_t encoded_frame_size(void) const {
+		return (uint32_t)this->encoded_line_size() * this->lines_per_display;
+	}
+	inline uint16_t lines(void) const {
+		return this->lines_per_display;
+	}
+	inline uint16_t line_bytes(void) const {
+		return this->bytes_per_line;
+	}
 
 	// inline static void attachInterrupt();
 	// inline static void detachInterrupt();
@@ -47,6 +47,14 @@
 #include <S5813A.h>
 #include <EPD_PINOUT.h>
 #include <Adafruit_GFX.h>
+
+// uncomment to keep the frame buffers in a 23K256 SPI SRAM
+// with its CS on Pin_EPD_SRAM_CS
+//#define EPD_GFX_SRAM 1
+
+#if defined(EPD_GFX_SRAM)
+#include <EPD_SRAM.h>
+#endif
 #include <EPD_GFX.h>
 
 
@@ -57,7 +65,7 @@
 // no futher changes below this point
 
 // current version number
-#define THERMO_VERSION "5"
+#define THERMO_VERSION "6"
 
 
 // LED anode through resistor to I/O pin
@@ -112,6 +120,10 @@ void setup() {
 	digitalWrite(Pin_BORDER, LOW);
 	digitalWrite(Pin_EPD_CS, LOW);
 	digitalWrite(Pin_EPD_FLASH_CS, HIGH);
+#if defined(EPD_GFX_SRAM)
+	pinMode(Pin_EPD_SRAM_CS, OUTPUT);
+	digitalWrite(Pin_EPD_SRAM_CS, HIGH);
+#endif
 
 	Serial.begin(9600);
 #if defined(__AVR__)
@@ -138,6 +150,15 @@ void setup() {
 		Serial.println("unsupported EPD FLASH chip");
 	}
 
+#if defined(EPD_GFX_SRAM)
+	EPD_SRAM.begin(Pin_EPD_SRAM_CS, EPD_SRAM_23K256);
+	if (EPD_SRAM.available()) {
+		Serial.println("EPD SRAM chip detected OK");
+	} else {
+		Serial.println("EPD SRAM chip not found");
+	}
+#endif
+
 	// configure temperature sensor
 	S5813A.begin(Pin_TEMPERATURE);
 
@@ -219,6 +240,9 @@ void loop() {
 
 	// update the display
 	G_EPD.display();
+	if (G_EPD.overflow()) {
+		Serial.println("display list overflow: increase EPD_GFX_LIST_SIZE");
+	}
 
 	// flash LED for a number of seconds
 	for (int x = 0; x < LOOP_DELAY_SECONDS * 10; ++x) {